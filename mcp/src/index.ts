@@ -100,17 +100,24 @@ server.registerTool(
   {
     title: "Read RTT output",
     description:
-      "Tail RTT channel 0 output captured from the running strtt session. Pass the cursor " +
-      "returned by the previous call to fetch only new data since then; omit it to read from " +
-      "the start of what's currently buffered.",
+      "Tail output of one RTT channel (default 0) captured from the running strtt session. Pass the " +
+      "cursor returned by the previous call for the same channel to fetch only new data since then; " +
+      "omit it to read from the start of what's currently buffered.",
     inputSchema: {
       cursor: z.number().int().min(0).optional().describe("Byte cursor from a previous strtt_read call"),
       maxBytes: z.number().int().positive().max(1024 * 1024).optional().describe("Max bytes to return (default 65536)"),
+      channel: z
+        .number()
+        .int()
+        .min(0)
+        .max(255)
+        .optional()
+        .describe("RTT up-buffer number, or 32 + n for SWO ITM stimulus port n (default 0)"),
     },
   },
-  async ({ cursor, maxBytes }) => {
+  async ({ cursor, maxBytes, channel }) => {
     try {
-      const result = session.read(cursor, maxBytes);
+      const result = session.read(cursor, maxBytes, channel);
       return textResult(result);
     } catch (err) {
       return errorResult(err);
@@ -121,16 +128,18 @@ server.registerTool(
 server.registerTool(
   "strtt_write",
   {
-    title: "Write to RTT channel 0",
-    description: "Send text to the device over RTT channel 0 (the down-buffer), as if typed at the strtt console.",
+    title: "Write to an RTT down-buffer",
+    description:
+      "Send text to the device over an RTT down-buffer (default 0, the one typed into at the strtt console).",
     inputSchema: {
       text: z.string().describe("Text to send"),
       newline: z.boolean().optional().describe("Append a trailing newline (default true)"),
+      channel: z.number().int().min(0).max(255).optional().describe("RTT down-buffer number (default 0)"),
     },
   },
-  async ({ text, newline }) => {
+  async ({ text, newline, channel }) => {
     try {
-      session.write(text, newline);
+      session.write(text, newline, channel);
       return textResult({ written: text.length });
     } catch (err) {
       return errorResult(err);
@@ -12,7 +12,7 @@ const START_GRACE_PERIOD_MS = 1800;
 const STOP_GRACE_PERIOD_MS = 3000;
 const EXIT_POLL_INTERVAL_MS = 50;
 
-// Ring buffer cap for RTT stdout. Trimmed from the front once exceeded.
+// Ring buffer cap per channel. Trimmed from the front once exceeded.
 const MAX_STDOUT_BYTES = 1024 * 1024;
 const MAX_STDERR_BYTES = 64 * 1024;
 
@@ -42,6 +42,26 @@ export interface ReadResult {
   truncated: boolean;
 }
 
+// strtt -framed: 16-byte little-endian header (magic "RT" 0x5452, channel u8,
+// flags u8, length u32, host time ns u64) followed by the payload. See
+// src/rtt/framing.h.
+const FRAME_MAGIC = 0x5452;
+const FRAME_HEADER_BYTES = 16;
+const FRAME_MAX_PAYLOAD = 1024 * 1024;
+
+interface ChannelBuffer {
+  buf: Buffer;
+  startOffset: number; // absolute offset of buf[0]
+}
+
+function encodeFrame(channel: number, payload: Buffer): Buffer {
+  const header = Buffer.alloc(FRAME_HEADER_BYTES);
+  header.writeUInt16LE(FRAME_MAGIC, 0);
+  header.writeUInt8(channel, 2);
+  header.writeUInt32LE(payload.length, 4);
+  return Buffer.concat([header, payload]);
+}
+
 function resolveBinaryPath(): string {
   if (process.env.STRTT_BIN) return process.env.STRTT_BIN;
 
@@ -62,6 +82,8 @@ function optionsToArgs(opts: StartOptions): string[] {
   // the caller explicitly asked for something else (including full silence).
   const verbosity = opts.verbosity ?? 0;
   args.push("-v", String(verbosity));
+  // Every channel tagged on one stdout, writes to any down-buffer on stdin.
+  args.push("-framed");
   if (opts.ramsize) args.push("-ramsize", opts.ramsize);
   if (opts.ramstart) args.push("-ramstart", opts.ramstart);
   if (opts.port !== undefined) args.push("-port", String(opts.port));
@@ -76,21 +98,21 @@ function sleep(ms: number): Promise<void> {
 }
 
 /**
- * Manages a single strtt child process: spawns it, proxies its RTT
- * channel-0 stdout into a cursor-addressable ring buffer, forwards writes
- * to its stdin, and tracks stderr/exit state for status reporting.
+ * Manages a single strtt child process: spawns it with -framed, splits the
+ * framed stdout into one cursor-addressable ring buffer per channel, sends
+ * writes to its stdin as frames for the chosen down-buffer, and tracks
+ * stderr/exit state for status reporting.
  *
- * strtt itself keeps RTT payload bytes on stdout and all diagnostics on
- * stderr (log_output defaults to stderr), so no framing/parsing is needed
- * here to separate the two.
+ * strtt keeps all diagnostics on stderr (log_output defaults to stderr), so
+ * stdout carries nothing but frames.
  */
 export class StrttSession {
   private child: ChildProcessWithoutNullStreams | null = null;
   private args: string[] = [];
   private startedAt: string | undefined;
 
-  private stdoutBuf = Buffer.alloc(0);
-  private stdoutBufStartOffset = 0; // absolute offset of stdoutBuf[0]
+  private channels = new Map<number, ChannelBuffer>();
+  private frameBuf = Buffer.alloc(0); // stdout not yet parsed into frames
 
   private stderrBuf = Buffer.alloc(0);
 
@@ -120,8 +142,8 @@ export class StrttSession {
     const bin = resolveBinaryPath();
     const args = optionsToArgs(opts);
 
-    this.stdoutBuf = Buffer.alloc(0);
-    this.stdoutBufStartOffset = 0;
+    this.channels = new Map();
+    this.frameBuf = Buffer.alloc(0);
     this.stderrBuf = Buffer.alloc(0);
     this.lastExitCode = null;
     this.lastExitSignal = null;
@@ -175,23 +197,28 @@ export class StrttSession {
     return this.status();
   }
 
-  write(text: string, newline = true): void {
+  write(text: string, newline = true, channel = 0): void {
     if (!this.child) {
       throw new Error("strtt is not running; call strtt_start first");
     }
-    this.child.stdin.write(text + (newline ? "\n" : ""));
+    this.child.stdin.write(encodeFrame(channel, Buffer.from(text + (newline ? "\n" : ""), "utf8")));
   }
 
-  read(sinceCursor = 0, maxBytes = 65536): ReadResult {
-    const truncated = sinceCursor < this.stdoutBufStartOffset;
-    const effectiveStart = Math.max(sinceCursor, this.stdoutBufStartOffset);
-    const startIndex = effectiveStart - this.stdoutBufStartOffset;
-    const endIndex = Math.min(this.stdoutBuf.length, startIndex + Math.max(0, maxBytes));
-    const slice = this.stdoutBuf.subarray(Math.max(0, startIndex), endIndex);
+  /**
+   * Channel numbers as strtt reports them: RTT up-buffers 0..31, SWO ITM
+   * stimulus port n as 32 + n.
+   */
+  read(sinceCursor = 0, maxBytes = 65536, channel = 0): ReadResult {
+    const ch = this.channels.get(channel) ?? { buf: Buffer.alloc(0), startOffset: 0 };
+    const truncated = sinceCursor < ch.startOffset;
+    const effectiveStart = Math.max(sinceCursor, ch.startOffset);
+    const startIndex = effectiveStart - ch.startOffset;
+    const endIndex = Math.min(ch.buf.length, startIndex + Math.max(0, maxBytes));
+    const slice = ch.buf.subarray(Math.max(0, startIndex), endIndex);
 
     return {
       text: slice.toString("utf8"),
-      cursor: this.stdoutBufStartOffset + endIndex,
+      cursor: ch.startOffset + endIndex,
       truncated,
     };
   }
@@ -217,11 +244,35 @@ export class StrttSession {
   }
 
   private appendStdout(chunk: Buffer): void {
-    this.stdoutBuf = Buffer.concat([this.stdoutBuf, chunk]);
-    if (this.stdoutBuf.length > MAX_STDOUT_BYTES) {
-      const trim = this.stdoutBuf.length - MAX_STDOUT_BYTES;
-      this.stdoutBuf = this.stdoutBuf.subarray(trim);
-      this.stdoutBufStartOffset += trim;
+    const buf = this.frameBuf.length ? Buffer.concat([this.frameBuf, chunk]) : chunk;
+    let at = 0;
+    while (buf.length - at >= FRAME_HEADER_BYTES) {
+      const length = buf.readUInt32LE(at + 4);
+      if (buf.readUInt16LE(at) !== FRAME_MAGIC || length > FRAME_MAX_PAYLOAD) {
+        // Out of sync; look for the next frame one byte further.
+        at++;
+        continue;
+      }
+      if (buf.length - at < FRAME_HEADER_BYTES + length) break;
+      const channel = buf.readUInt8(at + 2);
+      this.appendChannel(channel, buf.subarray(at + FRAME_HEADER_BYTES, at + FRAME_HEADER_BYTES + length));
+      at += FRAME_HEADER_BYTES + length;
+    }
+    // Copy the partial frame so the chunk it came from can be released.
+    this.frameBuf = Buffer.from(buf.subarray(at));
+  }
+
+  private appendChannel(channel: number, payload: Buffer): void {
+    let ch = this.channels.get(channel);
+    if (!ch) {
+      ch = { buf: Buffer.alloc(0), startOffset: 0 };
+      this.channels.set(channel, ch);
+    }
+    ch.buf = Buffer.concat([ch.buf, payload]);
+    if (ch.buf.length > MAX_STDOUT_BYTES) {
+      const trim = ch.buf.length - MAX_STDOUT_BYTES;
+      ch.buf = ch.buf.subarray(trim);
+      ch.startOffset += trim;
     }
   }
 
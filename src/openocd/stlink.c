@@ -95,6 +95,10 @@
 #define STLINK_WRITE_TIMEOUT 1000
 #define STLINK_READ_TIMEOUT 1000
 
+/* this many timeouts in a row and we consider the bulk pipe wedged,
+ * a wedged ST-LINK V3 never comes back without a reset */
+#define STLINK_WEDGE_TIMEOUTS 2
+
 #define STLINK_RX_EP (1 | ENDPOINT_IN)
 #define STLINK_TX_EP (2 | ENDPOINT_OUT)
 #define STLINK_TRACE_EP (3 | ENDPOINT_IN)
@@ -205,6 +209,8 @@ struct stlink_backend_s
 	int (*xfer_noerrcheck)(void *handle, const uint8_t *buf, int size);
 	/** */
 	int (*read_trace)(void *handle, const uint8_t *buf, int size);
+	/** drop the connection to the probe and get a working one back */
+	int (*reconnect)(void *handle);
 };
 
 /* TODO: make queue size dynamic */
@@ -326,6 +332,12 @@ struct stlink_usb_handle_s
 	/** reconnect is needed next time we try to query the
 	 * status */
 	bool reconnect_pending;
+	/** parameters we were opened with, needed to recover */
+	struct hl_interface_param_s param;
+	/** last interface clock set, in kHz */
+	int speed_khz;
+	/** USB transfers that timed out in a row */
+	unsigned int usb_timeouts;
 	/** queue of dap_direct operations */
 	struct dap_queue queue[MAX_QUEUE_DEPTH];
 	/** first element available in the queue */
@@ -841,11 +853,25 @@ static int stlink_usb_xfer_rw(void *handle, int cmdsize, const uint8_t *buf, int
 		++n_transfers;
 	}
 
-	return jtag_libusb_bulk_transfer_n(
+	int res = jtag_libusb_bulk_transfer_n(
 		h->usb_backend_priv.fd,
 		transfers,
 		n_transfers,
 		STLINK_WRITE_TIMEOUT);
+
+	bool timeout = false;
+	for (size_t i = 0; i < n_transfers; ++i)
+		timeout |= (transfers[i].retval == LIBUSB_ERROR_TIMEOUT);
+
+	if (timeout)
+	{
+		if (++h->usb_timeouts == STLINK_WEDGE_TIMEOUTS)
+			LOG_WARNING("USB transfers keep timing out, the probe looks wedged");
+	}
+	else if (res == ERROR_OK)
+		h->usb_timeouts = 0;
+
+	return res;
 }
 #else
 static int stlink_usb_xfer_rw(void *handle, int cmdsize, const uint8_t *buf, int size)
@@ -3599,6 +3625,7 @@ static int stlink_speed_v3(void *handle, bool is_jtag, int khz, bool query)
 static int stlink_speed(void *handle, int khz, bool query)
 {
 	struct stlink_usb_handle_s *h = handle;
+	int speed;
 
 	if (!handle)
 		return khz;
@@ -3609,21 +3636,85 @@ static int stlink_speed(void *handle, int khz, bool query)
 		return stlink_speed_swim(handle, khz, query);
 	case STLINK_MODE_DEBUG_SWD:
 		if (h->version.jtag_api == STLINK_JTAG_API_V3)
-			return stlink_speed_v3(handle, false, khz, query);
+			speed = stlink_speed_v3(handle, false, khz, query);
 		else
-			return stlink_speed_swd(handle, khz, query);
+			speed = stlink_speed_swd(handle, khz, query);
 		break;
 	case STLINK_MODE_DEBUG_JTAG:
 		if (h->version.jtag_api == STLINK_JTAG_API_V3)
-			return stlink_speed_v3(handle, true, khz, query);
+			speed = stlink_speed_v3(handle, true, khz, query);
 		else
-			return stlink_speed_jtag(handle, khz, query);
+			speed = stlink_speed_jtag(handle, khz, query);
 		break;
 	default:
-		break;
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	/* remembered so a recovery comes back at the same clock */
+	if (!query && speed > 0)
+		h->speed_khz = speed;
+
+	return speed;
+}
+
+/** */
+static int stlink_speed_map(void *handle, int *khz, unsigned int *count)
+{
+	struct stlink_usb_handle_s *h = handle;
+	struct speed_map map[STLINK_V3_MAX_FREQ_NB];
+	const struct speed_map *table = NULL;
+	unsigned int table_size = 0;
+	unsigned int i, n = 0;
+
+	assert(handle);
+	assert(khz);
+	assert(count);
+
+	bool is_jtag = (h->st_mode == STLINK_MODE_DEBUG_JTAG);
+
+	if (h->version.jtag_api == STLINK_JTAG_API_V3)
+	{
+		int res = stlink_get_com_freq(h, is_jtag, map);
+		if (res != ERROR_OK)
+		{
+			*count = 0;
+			return res;
+		}
+		table = map;
+		table_size = ARRAY_SIZE(map);
+	}
+	else if (is_jtag && (h->version.flags & STLINK_F_HAS_JTAG_SET_FREQ))
+	{
+		table = stlink_khz_to_speed_map_jtag;
+		table_size = ARRAY_SIZE(stlink_khz_to_speed_map_jtag);
+	}
+	else if (h->st_mode == STLINK_MODE_DEBUG_SWD && (h->version.flags & STLINK_F_HAS_SWD_SET_FREQ))
+	{
+		table = stlink_khz_to_speed_map_swd;
+		table_size = ARRAY_SIZE(stlink_khz_to_speed_map_swd);
+	}
+
+	for (i = 0; i < table_size && n < *count; i++)
+	{
+		if (table[i].speed)
+			khz[n++] = table[i].speed;
 	}
 
-	return ERROR_COMMAND_ARGUMENT_INVALID;
+	/* the V3 list comes straight from the probe, don't trust its order */
+	for (i = 1; i < n; i++)
+	{
+		int speed = khz[i];
+		unsigned int j = i;
+		while (j > 0 && khz[j - 1] < speed)
+		{
+			khz[j] = khz[j - 1];
+			j--;
+		}
+		khz[j] = speed;
+	}
+
+	*count = n;
+	return ERROR_OK;
 }
 
 /** */
@@ -3908,6 +3999,29 @@ static int stlink_usb_usb_open(void *handle, struct hl_interface_param_s *param)
 	return ERROR_OK;
 }
 
+/** */
+static int stlink_usb_usb_reconnect(void *handle)
+{
+	struct stlink_usb_handle_s *h = handle;
+
+	/* a port reset flushes whatever is stuck in the endpoints, libusb
+	 * restores configuration and claimed interfaces afterwards */
+	int err = libusb_reset_device(h->usb_backend_priv.fd);
+	if (err == LIBUSB_SUCCESS)
+		return ERROR_OK;
+
+	if (err != LIBUSB_ERROR_NOT_FOUND)
+		LOG_WARNING("USB reset failed (%s), reopening the probe", libusb_error_name(err));
+
+	/* the device re-enumerated, this handle is dead */
+	jtag_libusb_close(h->usb_backend_priv.fd);
+	h->usb_backend_priv.fd = NULL;
+	free(h->cmdbuf);
+	free(h->databuf);
+
+	return stlink_usb_usb_open(handle, &h->param);
+}
+
 /** */
 static int stlink_tcp_open(void *handle, struct hl_interface_param_s *param)
 {
@@ -4185,13 +4299,25 @@ static struct stlink_backend_s stlink_usb_backend = {
 	.close = stlink_usb_usb_close,
 	.xfer_noerrcheck = stlink_usb_usb_xfer_noerrcheck,
 	.read_trace = stlink_usb_usb_read_trace,
+	.reconnect = stlink_usb_usb_reconnect,
 };
 
+/** */
+static int stlink_tcp_reconnect(void *handle)
+{
+	struct stlink_usb_handle_s *h = handle;
+
+	/* the server owns the USB side, all we can do is start a fresh session */
+	stlink_tcp_close(handle);
+	return stlink_tcp_open(handle, &h->param);
+}
+
 static struct stlink_backend_s stlink_tcp_backend = {
 	.open = stlink_tcp_open,
 	.close = stlink_tcp_close,
 	.xfer_noerrcheck = stlink_tcp_xfer_noerrcheck,
 	.read_trace = stlink_tcp_read_trace,
+	.reconnect = stlink_tcp_reconnect,
 };
 
 static int stlink_open(struct hl_interface_param_s *param, enum stlink_mode mode, void **fd)
@@ -4210,6 +4336,7 @@ static int stlink_open(struct hl_interface_param_s *param, enum stlink_mode mode
 
 	h->st_mode = mode;
 	h->ap_num = param->ap_num;
+	h->param = *param;
 
 	for (unsigned i = 0; param->vid[i]; i++)
 	{
@@ -4314,6 +4441,9 @@ static int stlink_usb_hl_open(struct hl_interface_param_s *param, void **fd)
 	return stlink_open(param, stlink_get_mode(param->transport), fd);
 }
 
+static int stlink_recover(void *handle);
+static bool stlink_wedged(void *handle);
+
 static int stlink_config_trace(void *handle, bool enabled,
 							   enum tpiu_pin_protocol pin_protocol, uint32_t port_size,
 							   unsigned int *trace_freq, unsigned int traceclkin_freq,
@@ -4471,6 +4601,28 @@ static int stlink_usb_rw_misc_in(void *handle, uint32_t items, uint8_t *buffer)
 	return ERROR_OK;
 }
 
+/** */
+static int stlink_usb_read_debug_reg(void *handle, uint32_t addr, uint32_t *val)
+{
+	struct stlink_usb_handle_s *h = handle;
+
+	assert(handle);
+
+	if (h->version.jtag_api == STLINK_JTAG_API_V1)
+	{
+		/* no READDEBUGREG in API v1, a single word memory read does the same */
+		uint8_t buf[4];
+		int res = stlink_usb_read_mem(handle, addr, 4, 1, buf);
+		if (res != ERROR_OK)
+			return res;
+
+		*val = le_to_h_u32(buf);
+		return ERROR_OK;
+	}
+
+	return stlink_usb_v2_read_debug_reg(handle, addr, val);
+}
+
 /** */
 struct hl_layout_api_s stlink_usb_layout_api = {
 	/** */
@@ -4504,13 +4656,21 @@ struct hl_layout_api_s stlink_usb_layout_api = {
 	/** */
 	.write_debug_reg = stlink_usb_write_debug_reg,
 	/** */
+	.read_debug_reg = stlink_usb_read_debug_reg,
+	/** */
 	.override_target = stlink_usb_override_target,
 	/** */
 	.speed = stlink_speed,
 	/** */
+	.speed_map = stlink_speed_map,
+	/** */
 	.config_trace = stlink_config_trace,
 	/** */
 	.poll_trace = stlink_usb_trace_read,
+	/** */
+	.recover = stlink_recover,
+	/** */
+	.wedged = stlink_wedged,
 };
 
 /*****************************************************************************
@@ -4544,3 +4704,63 @@ static int stlink_usb_open_ap(void *handle, unsigned short apsel)
 	last_csw_default[apsel] = 0;
 	return ERROR_OK;
 }
+
+/*
+ * Brings a wedged probe back without restarting the process:
+ * reset (or reopen) the transport, enter the debug mode again at the clock
+ * we were running at and reopen the AP. Target is left running, nothing is
+ * reset on its side.
+ */
+static int stlink_recover(void *handle)
+{
+	struct stlink_usb_handle_s *h = handle;
+	int res;
+
+	assert(handle);
+
+	LOG_INFO("Recovering ST-LINK (%u timeouts in a row)", h->usb_timeouts);
+
+	res = h->backend->reconnect(handle);
+	if (res != ERROR_OK)
+	{
+		LOG_ERROR("Can't reconnect to the probe");
+		return res;
+	}
+
+	h->usb_timeouts = 0;
+	h->reconnect_pending = false;
+
+	res = stlink_usb_init_mode(handle, false, h->speed_khz ? h->speed_khz : h->param.initial_interface_speed);
+	if (res != ERROR_OK)
+	{
+		LOG_ERROR("Can't enter debug mode again");
+		return res;
+	}
+
+	/* the probe forgot about opened APs */
+	memset(opened_ap, 0, sizeof(opened_ap));
+	res = stlink_usb_open_ap(handle, h->ap_num);
+	if (res != ERROR_OK)
+		return res;
+
+	if (h->trace.enabled)
+	{
+		h->trace.enabled = false;
+		res = stlink_usb_trace_enable(handle);
+	}
+
+	return res;
+}
+
+/*
+ * A single timeout or failed command is worth a retry, only a probe that
+ * keeps timing out needs stlink_recover().
+ */
+static bool stlink_wedged(void *handle)
+{
+	struct stlink_usb_handle_s *h = handle;
+
+	assert(handle);
+
+	return h->usb_timeouts >= STLINK_WEDGE_TIMEOUTS;
+}
@@ -140,6 +140,15 @@ extern "C"
                          uint32_t count, const uint8_t *buffer);
         /** */
         int (*write_debug_reg)(void *handle, uint32_t addr, uint32_t val);
+        /**
+	 * Read a debug register (DHCSR, DWT, ...) in a single probe transaction
+	 *
+	 * @param handle A handle to adapter
+	 * @param addr Register address
+	 * @param val Storage for the register value
+	 * @returns ERROR_OK on success, an error code on failure.
+	 */
+        int (*read_debug_reg)(void *handle, uint32_t addr, uint32_t *val);
         /**
 	 * Read the idcode of the target connected to the adapter
 	 *
@@ -157,6 +166,16 @@ extern "C"
         int (*custom_command)(void *handle, const char *command);
         /** */
         int (*speed)(void *handle, int khz, bool query);
+        /**
+	 * List the interface clocks the adapter can be set to
+	 *
+	 * @param handle A handle to adapter
+	 * @param khz Storage for the supported clocks in kHz, fastest first
+	 * @param count In: capacity of @a khz, out: number of entries filled;
+	 * 0 if the adapter can't change its clock
+	 * @returns ERROR_OK on success, an error code on failure.
+	 */
+        int (*speed_map)(void *handle, int *khz, unsigned int *count);
         /**
 	 * Configure trace parameters for the adapter
 	 *
@@ -186,6 +205,20 @@ extern "C"
         int (*poll_trace)(void *handle, uint8_t *buf, size_t *size);
         /** */
         enum target_state (*state)(void *fd);
+        /**
+	 * Get a wedged adapter working again without closing the handle
+	 *
+	 * @param handle A handle to adapter
+	 * @returns ERROR_OK on success, an error code on failure.
+	 */
+        int (*recover)(void *handle);
+        /**
+	 * Tell whether the adapter stopped answering and needs recover()
+	 *
+	 * @param handle A handle to adapter
+	 * @returns true after enough USB timeouts in a row
+	 */
+        bool (*wedged)(void *handle);
     };
 
 #ifdef __cplusplus
@@ -0,0 +1,185 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <fstream>
+#include <sstream>
+
+// c
+#include <stdlib.h>
+#include <stdio.h>
+
+// local
+#include "attachcache.h"
+#include "stlink_errors.h"
+#include "log.h"
+
+#define ATTACH_CACHE_FILE ".strtt_attach"
+
+/**
+ * @brief Construct a new Attach Cache:: Attach Cache object
+ *
+ * @param path file the cache is loaded from and saved to
+ */
+AttachCache::AttachCache(const std::string &path)
+    : _path(path)
+{
+}
+
+/**
+ * @brief Loads the cache file. A missing file is not an error, it just
+ * means we haven't attached to anything yet.
+ *
+ * @return int
+ */
+int AttachCache::load()
+{
+    this->_boards.clear();
+
+    std::ifstream file(this->_path);
+    if (!file)
+    {
+        LOG_DEBUG("No attach cache at %s", this->_path.c_str());
+        return ERROR_OK;
+    }
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string board;
+        if (!(fields >> board) || board[0] == '#')
+            continue;
+
+        std::string pair;
+        while (fields >> pair)
+        {
+            size_t eq = pair.find('=');
+            if (eq == std::string::npos)
+                continue;
+            this->_boards[board][pair.substr(0, eq)] = pair.substr(eq + 1);
+        }
+    }
+
+    return ERROR_OK;
+}
+
+/**
+ * @brief
+ *
+ * @return int
+ */
+int AttachCache::save() const
+{
+    std::ofstream file(this->_path, std::ios::trunc);
+    if (!file)
+    {
+        LOG_WARNING("Can't write attach cache %s", this->_path.c_str());
+        return ERROR_FAIL;
+    }
+
+    for (const auto &board : this->_boards)
+    {
+        file << board.first;
+        for (const auto &value : board.second)
+        {
+            file << " " << value.first << "=" << value.second;
+        }
+        file << "\n";
+    }
+
+    return file ? ERROR_OK : ERROR_FAIL;
+}
+
+/**
+ * @brief
+ *
+ * @param board
+ * @param name
+ * @param value
+ * @return true if the board has a value stored under name
+ */
+bool AttachCache::getValue(const std::string &board, const std::string &name, uint32_t *value) const
+{
+    auto itBoard = this->_boards.find(board);
+    if (itBoard == this->_boards.end())
+        return false;
+
+    auto itValue = itBoard->second.find(name);
+    if (itValue == itBoard->second.end())
+        return false;
+
+    try
+    {
+        *value = (uint32_t)std::stoul(itValue->second, nullptr, 0);
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief
+ *
+ * @param board
+ * @param name
+ * @param value
+ */
+void AttachCache::setValue(const std::string &board, const std::string &name, uint32_t value)
+{
+    char str[16];
+    snprintf(str, sizeof(str), "0x%x", value);
+    this->_boards[board][name] = str;
+}
+
+/**
+ * @brief $HOME/.strtt_attach (%USERPROFILE% on Windows), or the working
+ * directory if neither is set.
+ *
+ * @return std::string
+ */
+std::string AttachCache::defaultPath()
+{
+#ifdef _WIN32
+    const char *home = getenv("USERPROFILE");
+#else
+    const char *home = getenv("HOME");
+#endif
+    if (!home)
+        return ATTACH_CACHE_FILE;
+
+    return std::string(home) + "/" + ATTACH_CACHE_FILE;
+}
+
+/**
+ * @brief A board is the probe (if we were told which one) plus what the
+ * target reports about itself.
+ *
+ * @param serial ST-LINK serial, may be empty
+ * @param idCode DP IDCODE
+ * @param cpuId SCB CPUID
+ * @return std::string
+ */
+std::string AttachCache::boardKey(const std::string &serial, uint32_t idCode, uint32_t cpuId)
+{
+    char str[32];
+    snprintf(str, sizeof(str), "%08x-%08x", idCode, cpuId);
+    return (serial.empty() ? std::string("any") : serial) + "-" + str;
+}
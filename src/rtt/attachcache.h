@@ -0,0 +1,54 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_ATTACHCACHE_H
+#define _PH_ATTACHCACHE_H
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+//
+// Small persistent store for things we learn about a board while attaching
+// to it (e.g. the SWD clock picked by -autospeed), so later sessions can
+// reuse them. Stored as a plain text file, one board per line:
+//
+//   <board key> name=value name=value ...
+//
+class AttachCache
+{
+private:
+    std::string _path;
+
+    // board key -> (name -> value)
+    std::map<std::string, std::map<std::string, std::string>> _boards;
+
+public:
+    AttachCache(const std::string &path = defaultPath());
+
+    int load();
+    int save() const;
+
+    bool getValue(const std::string &board, const std::string &name, uint32_t *value) const;
+    void setValue(const std::string &board, const std::string &name, uint32_t value);
+
+    static std::string defaultPath();
+    static std::string boardKey(const std::string &serial, uint32_t idCode, uint32_t cpuId);
+};
+
+#endif
@@ -0,0 +1,275 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+// c
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// local
+#include "bytering.h"
+
+/**
+ * @brief Construct a new Byte Ring:: Byte Ring object
+ *
+ * @param capacity rounded up to a power of two
+ */
+ByteRing::ByteRing(size_t capacity)
+    : _head(0), _tail(0)
+{
+    size_t size = 1;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    this->_buffer.resize(size);
+    this->_mask = size - 1;
+
+#if defined(__linux__)
+    this->_eventFd = this->_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif !defined(_WIN32)
+    // no eventfd, a pipe does the same for poll()
+    int fds[2];
+    this->_eventFd = this->_wakeFd = -1;
+    if (pipe(fds) == 0)
+    {
+        for (int fd : fds)
+        {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        this->_eventFd = fds[0];
+        this->_wakeFd = fds[1];
+    }
+#else
+    // nothing pollable next to a socket, wait() naps instead
+    this->_eventFd = this->_wakeFd = -1;
+#endif
+}
+
+/**
+ * @brief Destroy the Byte Ring:: Byte Ring object
+ */
+ByteRing::~ByteRing()
+{
+#ifndef _WIN32
+    if (this->_wakeFd != this->_eventFd)
+    {
+        close(this->_wakeFd);
+    }
+    if (this->_eventFd >= 0)
+    {
+        close(this->_eventFd);
+    }
+#endif
+}
+
+/**
+ * @brief Contiguous free space the producer may fill before commit().
+ *
+ * @param data
+ * @return size_t
+ */
+size_t ByteRing::writeSpan(uint8_t **data)
+{
+    size_t head = this->_head.load(std::memory_order_relaxed);
+    size_t free = this->_buffer.size() - (head - this->_tail.load(std::memory_order_acquire));
+    size_t index = head & this->_mask;
+
+    *data = &this->_buffer[index];
+    return std::min(free, this->_buffer.size() - index);
+}
+
+/**
+ * @brief Publishes size bytes written into writeSpan(), wakes the consumer
+ * if the ring was empty.
+ *
+ * @param size
+ */
+void ByteRing::commit(size_t size)
+{
+    if (!size)
+        return;
+
+    size_t head = this->_head.load(std::memory_order_relaxed);
+    this->_head.store(head + size); // seq_cst, pairs with the load of _head in wait()
+
+#ifndef _WIN32
+    if ((this->_tail.load() == head) && (this->_wakeFd >= 0))
+    {
+        uint64_t one = 1;
+        ssize_t ret = ::write(this->_wakeFd, &one, sizeof(one));
+        (void)ret;
+    }
+#endif
+}
+
+/**
+ * @brief Copies as much as fits.
+ *
+ * @param data
+ * @param size
+ * @return size_t bytes written
+ */
+size_t ByteRing::write(const uint8_t *data, size_t size)
+{
+    size_t head = this->_head.load(std::memory_order_relaxed);
+    size_t free = this->_buffer.size() - (head - this->_tail.load(std::memory_order_acquire));
+    size_t n = std::min(free, size);
+    size_t index = head & this->_mask;
+    size_t first = std::min(n, this->_buffer.size() - index);
+
+    // at most two copies, before and after the wrap, published at once
+    memcpy(&this->_buffer[index], data, first);
+    memcpy(&this->_buffer[0], data + first, n - first);
+
+    this->commit(n);
+    return n;
+}
+
+/**
+ * @brief Contiguous readable data, valid until consume().
+ *
+ * @param data
+ * @return size_t
+ */
+size_t ByteRing::readSpan(const uint8_t **data) const
+{
+    size_t tail = this->_tail.load(std::memory_order_relaxed);
+    size_t avail = this->_head.load(std::memory_order_acquire) - tail;
+    size_t index = tail & this->_mask;
+
+    *data = &this->_buffer[index];
+    return std::min(avail, this->_buffer.size() - index);
+}
+
+/**
+ * @brief Releases size bytes returned by readSpan().
+ *
+ * @param size
+ */
+void ByteRing::consume(size_t size)
+{
+    this->_tail.store(this->_tail.load(std::memory_order_relaxed) + size); // seq_cst, see commit()
+}
+
+/**
+ * @brief Copies out up to size bytes.
+ *
+ * @param data
+ * @param size
+ * @return size_t bytes read
+ */
+size_t ByteRing::read(uint8_t *data, size_t size)
+{
+    size_t done = 0;
+
+    for (int i = 0; (i < 2) && (done < size); i++)
+    {
+        const uint8_t *span;
+        size_t n = std::min(this->readSpan(&span), size - done);
+        if (!n)
+            break;
+
+        memcpy(data + done, span, n);
+        this->consume(n);
+        done += n;
+    }
+
+    return done;
+}
+
+/**
+ * @brief Drops everything queued so far (consumer side).
+ */
+void ByteRing::clear()
+{
+    this->_tail.store(this->_head.load());
+    this->drainEvent();
+}
+
+/**
+ * @brief Resets the eventfd counter (empties the pipe), for consumers
+ * polling eventFd() themselves.
+ */
+void ByteRing::drainEvent()
+{
+#ifndef _WIN32
+    if (this->_eventFd < 0)
+    {
+        return;
+    }
+
+    uint64_t count[8];
+    while (::read(this->_eventFd, count, sizeof(count)) == (ssize_t)sizeof(count))
+    {
+    }
+#endif
+}
+
+/**
+ * @brief Sleeps until there is data or timeoutMs passed.
+ *
+ * @param timeoutMs
+ * @return true if there is data
+ */
+bool ByteRing::wait(int timeoutMs)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+    // the eventfd may still count a wake-up for data we already took
+    while (this->empty())
+    {
+        int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (left < 0)
+        {
+            return false;
+        }
+
+#ifndef _WIN32
+        struct pollfd pfd = {this->_eventFd, POLLIN, 0};
+        if (poll(&pfd, 1, left) > 0)
+        {
+            this->drainEvent();
+        }
+        else if (left == 0)
+        {
+            break;
+        }
+#else
+        if (left == 0)
+        {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+    }
+
+    return !this->empty();
+}
@@ -0,0 +1,76 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_BYTERING_H
+#define _PH_BYTERING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <vector>
+
+//
+// Single producer / single consumer byte ring. Data is moved in spans, not
+// per byte, and the consumer side can read straight out of the ring
+// (readSpan()/consume()). The producer signals an eventfd (a pipe where
+// there is none) whenever the ring goes from empty to not empty, so the
+// consumer can sleep in poll()/epoll next to its sockets instead of spinning
+// on a timed wait. Windows has neither, eventFd() is -1 there.
+//
+class ByteRing
+{
+private:
+    std::vector<uint8_t> _buffer;
+    size_t _mask;
+
+    // free running positions, index = position & _mask
+    alignas(64) std::atomic<size_t> _head; // producer
+    alignas(64) std::atomic<size_t> _tail; // consumer
+
+    int _eventFd; // consumer polls this
+    int _wakeFd;  // producer writes this, same as _eventFd for an eventfd
+
+public:
+    ByteRing(size_t capacity);
+    ~ByteRing();
+
+    ByteRing(const ByteRing &) = delete;
+    ByteRing &operator=(const ByteRing &) = delete;
+
+    // producer
+    size_t write(const uint8_t *data, size_t size);
+    size_t writeSpan(uint8_t **data);
+    void commit(size_t size);
+
+    // consumer
+    size_t read(uint8_t *data, size_t size);
+    size_t readSpan(const uint8_t **data) const;
+    void consume(size_t size);
+    void clear();
+    bool wait(int timeoutMs);
+    void drainEvent();
+
+    size_t size() const { return _head.load() - _tail.load(); }
+    size_t capacity() const { return _buffer.size(); }
+    bool empty() const { return size() == 0; }
+
+    // readable when there is data, for poll()/epoll, -1 if not available
+    int eventFd() const { return _eventFd; }
+};
+
+#endif
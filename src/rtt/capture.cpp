@@ -0,0 +1,417 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <algorithm>
+
+// c
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+// local
+#include "capture.h"
+#include "stlink_errors.h"
+#include "log.h"
+
+/**
+ * @brief Construct a new Capture Writer:: Capture Writer object
+ */
+CaptureWriter::CaptureWriter()
+{
+    this->_block.resize(CAPTURE_BLOCK_SIZE / sizeof(uint64_t));
+    this->_used = 0;
+    this->_openedNs = 0;
+    this->_offset = 0;
+    this->_records = 0;
+    this->_bytes = 0;
+    this->_lastIndex = 0;
+}
+
+/**
+ * @brief Destroy the Capture Writer:: Capture Writer object
+ */
+CaptureWriter::~CaptureWriter()
+{
+    this->close();
+}
+
+/**
+ * @brief Creates path and writes the file header.
+ *
+ * @param path
+ * @return int ERROR_OK or ERROR_FAIL
+ */
+int CaptureWriter::open(const std::string &path)
+{
+    if (this->_writer.open(path) != ERROR_OK)
+    {
+        return ERROR_FAIL;
+    }
+
+    std::vector<uint8_t> first(CAPTURE_ALIGN, 0);
+    CAPTURE_FILE_HEADER *hdr = (CAPTURE_FILE_HEADER *)first.data();
+    memcpy(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic));
+    hdr->version = CAPTURE_VERSION;
+    hdr->align = CAPTURE_ALIGN;
+    hdr->blockSize = CAPTURE_BLOCK_SIZE;
+    hdr->startNs = captureNowNs();
+    hdr->startUnixNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    hdr->indexEvery = CAPTURE_INDEX_EVERY;
+
+    this->_writer.write(first.data(), first.size());
+    this->_path = path;
+    this->_used = 0;
+    this->_offset = CAPTURE_ALIGN;
+    this->_records = 0;
+    this->_bytes = 0;
+    this->_index.clear();
+    this->_lastIndex = 0;
+    return ERROR_OK;
+}
+
+/**
+ * @brief Appends a chunk, split over blocks if it has to be.
+ *
+ * @param channel
+ * @param data
+ * @param size
+ * @param timeNs
+ * @param seq
+ */
+void CaptureWriter::add(int channel, const uint8_t *data, size_t size, uint64_t timeNs, uint32_t seq)
+{
+    bool first = true;
+    do
+    {
+        // room for a record header and at least a few bytes
+        if (this->_used && (this->_used + sizeof(CAPTURE_RECORD) + 8 > CAPTURE_BLOCK_SIZE))
+        {
+            this->closeBlock();
+        }
+
+        if (!this->_used)
+        {
+            memset(this->header(), 0, sizeof(CAPTURE_BLOCK_HEADER));
+            this->header()->firstSeq = seq;
+            this->header()->firstNs = timeNs;
+            this->_used = sizeof(CAPTURE_BLOCK_HEADER);
+            this->_openedNs = captureNowNs();
+        }
+
+        size_t room = CAPTURE_BLOCK_SIZE - this->_used - sizeof(CAPTURE_RECORD);
+        size_t n = std::min(size, room);
+
+        // spans start with a whole chunk, a query never begins in the middle of one
+        if (first && (this->_index.empty() || (this->_records - this->_index.back().record >= CAPTURE_INDEX_EVERY)))
+        {
+            CAPTURE_INDEX_ENTRY entry = {};
+            entry.offset = this->_offset;
+            entry.position = this->_used;
+            entry.firstNs = timeNs;
+            entry.record = this->_records;
+            this->_index.push_back(entry);
+        }
+        first = false;
+
+        if ((channel >= 0) && (channel < CAPTURE_INDEX_CHANNELS))
+        {
+            this->_index.back().channelBytes[channel] += (uint32_t)n;
+        }
+
+        CAPTURE_RECORD *rec = (CAPTURE_RECORD *)(this->block() + this->_used);
+        rec->timeNs = timeNs;
+        rec->seq = seq;
+        rec->channel = (uint16_t)channel;
+        rec->flags = (n < size) ? CAPTURE_RECORD_CONTINUED : 0;
+        rec->length = (uint32_t)n;
+        rec->reserved = 0;
+
+        uint8_t *payload = (uint8_t *)(rec + 1);
+        memcpy(payload, data, n);
+        uint32_t padded = captureAlign((uint32_t)n, 8);
+        memset(payload + n, 0, padded - n);
+
+        this->_used += sizeof(CAPTURE_RECORD) + padded;
+        this->header()->records++;
+        this->header()->lastNs = timeNs;
+        this->_records++;
+        this->_bytes += n;
+
+        data += n;
+        size -= n;
+    } while (size);
+}
+
+/**
+ * @brief Writes the block out if it waited long enough.
+ *
+ * @param nowNs
+ */
+void CaptureWriter::tick(uint64_t nowNs)
+{
+    if (this->_used && (nowNs - this->_openedNs > (uint64_t)CAPTURE_FLUSH_MS * 1000000))
+    {
+        this->closeBlock();
+    }
+}
+
+/**
+ * @brief Pads the current block and hands it to the writer thread.
+ */
+void CaptureWriter::closeBlock()
+{
+    if (!this->_used)
+        return;
+
+    uint32_t size = captureAlign(this->_used, CAPTURE_ALIGN);
+    memset(this->block() + this->_used, 0, size - this->_used);
+
+    CAPTURE_BLOCK_HEADER *hdr = this->header();
+    hdr->magic = CAPTURE_BLOCK_MAGIC;
+    hdr->type = CAPTURE_BLOCK_DATA;
+    hdr->size = size;
+    hdr->used = this->_used;
+
+    this->_writer.write(this->block(), size);
+    this->_offset += size;
+    this->_used = 0;
+
+    // the last entry is still being filled
+    if (this->_index.size() > CAPTURE_INDEX_PER_BLOCK)
+    {
+        this->writeIndex(CAPTURE_INDEX_PER_BLOCK);
+    }
+}
+
+/**
+ * @brief Writes the first entries of the index as an index block, the
+ * data block buffer has to be empty.
+ *
+ * @param entries
+ */
+void CaptureWriter::writeIndex(size_t entries)
+{
+    uint32_t used = sizeof(CAPTURE_BLOCK_HEADER) + sizeof(CAPTURE_INDEX_HEADER) + entries * sizeof(CAPTURE_INDEX_ENTRY);
+    uint32_t size = captureAlign(used, CAPTURE_ALIGN);
+    memset(this->block(), 0, size);
+
+    CAPTURE_BLOCK_HEADER *hdr = this->header();
+    hdr->magic = CAPTURE_BLOCK_MAGIC;
+    hdr->type = CAPTURE_BLOCK_INDEX;
+    hdr->size = size;
+    hdr->used = used;
+    hdr->records = (uint32_t)entries;
+    hdr->firstNs = this->_index[0].firstNs;
+    hdr->lastNs = this->_index[entries - 1].firstNs;
+
+    CAPTURE_INDEX_HEADER *idx = (CAPTURE_INDEX_HEADER *)(hdr + 1);
+    idx->prevIndex = this->_lastIndex;
+    idx->entries = (uint32_t)entries;
+    memcpy(idx + 1, this->_index.data(), entries * sizeof(CAPTURE_INDEX_ENTRY));
+
+    this->_writer.write(this->block(), size);
+    this->_lastIndex = this->_offset;
+    this->_offset += size;
+    this->_index.erase(this->_index.begin(), this->_index.begin() + entries);
+}
+
+/**
+ * @brief Writes the rest of the index and points the file header at it.
+ */
+void CaptureWriter::close()
+{
+    if (this->_path.empty())
+    {
+        return;
+    }
+
+    this->closeBlock();
+    if (!this->_index.empty())
+    {
+        this->writeIndex(this->_index.size());
+    }
+    this->_writer.close();
+
+    // offsets are only right if the writer kept up
+    if (this->_lastIndex && !this->_writer.getDropped() && !this->_writer.hasFailed())
+    {
+        FILE *f = fopen(this->_path.c_str(), "r+b");
+        if (f)
+        {
+            uint64_t offset = this->_lastIndex;
+            fseek(f, offsetof(CAPTURE_FILE_HEADER, indexOffset), SEEK_SET);
+            fwrite(&offset, sizeof(offset), 1, f);
+            fclose(f);
+        }
+    }
+
+    this->_path.clear();
+}
+
+/**
+ * @brief Construct a new Capture Reader:: Capture Reader object
+ */
+CaptureReader::CaptureReader()
+{
+    this->_file = nullptr;
+    memset(&this->_header, 0, sizeof(this->_header));
+    this->_pos = 0;
+    this->_records = 0;
+}
+
+/**
+ * @brief Destroy the Capture Reader:: Capture Reader object
+ */
+CaptureReader::~CaptureReader()
+{
+    this->close();
+}
+
+/**
+ * @brief
+ *
+ * @param path
+ * @return int ERROR_OK or ERROR_FAIL
+ */
+int CaptureReader::open(const std::string &path)
+{
+    this->close();
+
+    this->_file = fopen(path.c_str(), "rb");
+    if (!this->_file)
+    {
+        LOG_ERROR("can't open %s: %s", path.c_str(), strerror(errno));
+        return ERROR_FAIL;
+    }
+
+    if ((fread(&this->_header, sizeof(this->_header), 1, this->_file) != 1) ||
+        memcmp(this->_header.magic, CAPTURE_MAGIC, sizeof(this->_header.magic)) ||
+        (this->_header.version != CAPTURE_VERSION) || !this->_header.align || (this->_header.align & (this->_header.align - 1)) ||
+        (this->_header.blockSize < sizeof(CAPTURE_BLOCK_HEADER)) || (this->_header.blockSize % this->_header.align))
+    {
+        LOG_ERROR("%s is not a strtt capture", path.c_str());
+        this->close();
+        return ERROR_FAIL;
+    }
+
+    fseek(this->_file, this->_header.align, SEEK_SET);
+    this->_block.resize(this->_header.blockSize / sizeof(uint64_t));
+    this->_pos = 0;
+    this->_records = 0;
+    return ERROR_OK;
+}
+
+/**
+ * @brief
+ */
+void CaptureReader::close()
+{
+    if (this->_file)
+    {
+        fclose(this->_file);
+        this->_file = nullptr;
+    }
+}
+
+/**
+ * @brief Loads the next block, a torn last block (strtt killed) ends the capture.
+ *
+ * @return true
+ * @return false
+ */
+bool CaptureReader::nextBlock()
+{
+    CAPTURE_BLOCK_HEADER *hdr = (CAPTURE_BLOCK_HEADER *)this->block();
+
+    while (fread(hdr, sizeof(*hdr), 1, this->_file) == 1)
+    {
+        bool valid = (hdr->magic == CAPTURE_BLOCK_MAGIC) && (hdr->size >= sizeof(*hdr)) &&
+                     (hdr->size <= this->_header.blockSize) && !(hdr->size % this->_header.align) &&
+                     (hdr->used >= sizeof(*hdr)) && (hdr->used <= hdr->size);
+        if (!valid)
+        {
+            LOG_WARNING("capture: bad block at offset %ld, stopping", ftell(this->_file) - (long)sizeof(*hdr));
+            return false;
+        }
+
+        if (fread(this->block() + sizeof(*hdr), hdr->size - sizeof(*hdr), 1, this->_file) != 1)
+        {
+            return false;
+        }
+
+        if (hdr->type != CAPTURE_BLOCK_DATA)
+        {
+            continue;
+        }
+
+        this->_pos = sizeof(*hdr);
+        this->_records = hdr->records;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Next chunk as it was recorded.
+ *
+ * @param record header of the chunk's last part, length is the whole chunk
+ * @param data
+ * @return true
+ * @return false end of capture
+ */
+bool CaptureReader::next(CAPTURE_RECORD *record, std::vector<uint8_t> *data)
+{
+    if (!this->_file)
+    {
+        return false;
+    }
+
+    data->clear();
+    while (true)
+    {
+        if (!this->_records)
+        {
+            if (!this->nextBlock())
+                return false;
+            continue;
+        }
+
+        const CAPTURE_BLOCK_HEADER *hdr = (const CAPTURE_BLOCK_HEADER *)this->block();
+        const CAPTURE_RECORD *rec = (const CAPTURE_RECORD *)(this->block() + this->_pos);
+        uint32_t end = this->_pos + sizeof(CAPTURE_RECORD) + captureAlign(rec->length, 8);
+        if ((this->_pos + sizeof(CAPTURE_RECORD) > hdr->used) || (end > hdr->used))
+        {
+            LOG_WARNING("capture: bad record, skipping the rest of the block");
+            this->_records = 0;
+            continue;
+        }
+
+        const uint8_t *payload = (const uint8_t *)(rec + 1);
+        data->insert(data->end(), payload, payload + rec->length);
+        this->_pos = end;
+        this->_records--;
+
+        if (!(rec->flags & CAPTURE_RECORD_CONTINUED))
+        {
+            *record = *rec;
+            record->length = (uint32_t)data->size();
+            return true;
+        }
+    }
+}
@@ -0,0 +1,210 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_CAPTURE_H
+#define _PH_CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "filewriter.h"
+
+//
+// -record file layout, little endian:
+//
+//   CAPTURE_FILE_HEADER, padded to CAPTURE_ALIGN
+//   block, block, ...
+//
+// A block is a CAPTURE_BLOCK_HEADER followed by records and is padded to a
+// multiple of CAPTURE_ALIGN, at most CAPTURE_BLOCK_SIZE. A record is a
+// CAPTURE_RECORD followed by its payload, padded to 8 bytes. Records never
+// cross a block, a chunk that doesn't fit is split and all but the last
+// part have CAPTURE_RECORD_CONTINUED set. So the file can be mapped and
+// walked block by block, and a block is only written once it is complete.
+//
+// Every CAPTURE_INDEX_EVERY records (rounded up to the next whole chunk)
+// start an index span. CAPTURE_INDEX_ENTRY holds where the span's first
+// record is, its time stamp and the bytes per channel in the span. Entries are written in index blocks between
+// the data blocks, each one pointing back at the previous index block, and
+// the file header is pointed at the last one when the capture is closed. A
+// capture that wasn't closed has a zero indexOffset, its index blocks are
+// still found by walking the blocks.
+//
+#define CAPTURE_MAGIC "STRTTCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_ALIGN (4096)
+#define CAPTURE_BLOCK_SIZE (64 * 1024)
+#define CAPTURE_BLOCK_MAGIC 0x4B4C4253 // "SBLK"
+#define CAPTURE_BLOCK_DATA 1
+#define CAPTURE_BLOCK_INDEX 2
+// a block that isn't full is closed after
+#define CAPTURE_FLUSH_MS (1000)
+
+#define CAPTURE_RECORD_CONTINUED 0x0001
+
+#define CAPTURE_INDEX_EVERY (4096)
+#define CAPTURE_INDEX_PER_BLOCK (128)
+// RTT up channels 0..31, SWO stimulus ports 32..63
+#define CAPTURE_INDEX_CHANNELS (64)
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t align;       // blocks start at multiples of this
+    uint32_t blockSize;   // the biggest block
+    uint32_t reserved;
+    uint64_t startNs;     // host monotonic clock at open, same clock as the records
+    uint64_t startUnixNs; // wall clock at the same time
+    uint64_t indexOffset; // last index block, 0 if the capture wasn't closed
+    uint32_t indexEvery;  // records per index span
+    uint32_t reserved2;
+} CAPTURE_FILE_HEADER;
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t size;     // whole block with padding
+    uint32_t used;     // header and records
+    uint32_t records;
+    uint32_t firstSeq;
+    uint64_t firstNs;
+    uint64_t lastNs;
+} CAPTURE_BLOCK_HEADER;
+
+typedef struct
+{
+    uint64_t timeNs;  // host monotonic clock when the data was read
+    uint32_t seq;     // RTT poll it came with
+    uint16_t channel; // RTT up channel, SWO_CHANNEL_BASE + port for ITM
+    uint16_t flags;
+    uint32_t length;  // payload
+    uint32_t reserved;
+} CAPTURE_RECORD;
+
+typedef struct
+{
+    uint64_t offset;   // block holding the span's first record
+    uint32_t position; // of the record in the block
+    uint32_t reserved;
+    uint64_t firstNs;
+    uint64_t record;   // number of the span's first record
+    uint32_t channelBytes[CAPTURE_INDEX_CHANNELS];
+} CAPTURE_INDEX_ENTRY;
+
+// index block payload: this, then the entries
+typedef struct
+{
+    uint64_t prevIndex; // previous index block, 0 for the first
+    uint32_t entries;
+    uint32_t reserved;
+} CAPTURE_INDEX_HEADER;
+
+static_assert(sizeof(CAPTURE_FILE_HEADER) == 56, "capture file header layout");
+static_assert(sizeof(CAPTURE_INDEX_ENTRY) == 288, "capture index entry layout");
+static_assert(sizeof(CAPTURE_BLOCK_HEADER) + sizeof(CAPTURE_INDEX_HEADER) + CAPTURE_INDEX_PER_BLOCK * sizeof(CAPTURE_INDEX_ENTRY) <= CAPTURE_BLOCK_SIZE,
+              "index block fits");
+static_assert(sizeof(CAPTURE_BLOCK_HEADER) == 40, "capture block header layout");
+static_assert(sizeof(CAPTURE_RECORD) == 24, "capture record layout");
+
+static inline uint64_t captureNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline uint32_t captureAlign(uint32_t size, uint32_t align)
+{
+    return (size + align - 1) & ~(align - 1);
+}
+
+//
+// Builds blocks on the caller's thread (a copy per chunk) and hands them to
+// a FileWriter, which writes them from its own thread.
+//
+class CaptureWriter
+{
+private:
+    FileWriter _writer;
+    std::string _path;
+    std::vector<uint64_t> _block; // 8 byte aligned
+    uint32_t _used;
+    uint64_t _openedNs;
+    uint64_t _offset; // where the block being built will go
+
+    uint64_t _records;
+    uint64_t _bytes;
+
+    // the last entry is the span being filled
+    std::vector<CAPTURE_INDEX_ENTRY> _index;
+    uint64_t _lastIndex;
+
+    uint8_t *block() { return (uint8_t *)_block.data(); }
+    CAPTURE_BLOCK_HEADER *header() { return (CAPTURE_BLOCK_HEADER *)_block.data(); }
+    void closeBlock();
+    void writeIndex(size_t entries);
+
+public:
+    CaptureWriter();
+    ~CaptureWriter();
+
+    int open(const std::string &path);
+    void add(int channel, const uint8_t *data, size_t size, uint64_t timeNs, uint32_t seq);
+    void tick(uint64_t nowNs);
+    void close();
+
+    uint64_t getRecords() const { return _records; }
+    uint64_t getBytes() const { return _bytes; }
+    uint64_t getDropped() const { return _writer.getDropped(); }
+};
+
+//
+// Reads a capture back block by block, chunks split over blocks come out
+// joined again.
+//
+class CaptureReader
+{
+private:
+    FILE *_file;
+    CAPTURE_FILE_HEADER _header;
+    std::vector<uint64_t> _block; // 8 byte aligned
+    uint32_t _pos;
+    uint32_t _records;
+
+    uint8_t *block() { return (uint8_t *)_block.data(); }
+    bool nextBlock();
+
+public:
+    CaptureReader();
+    ~CaptureReader();
+
+    CaptureReader(const CaptureReader &) = delete;
+    CaptureReader &operator=(const CaptureReader &) = delete;
+
+    int open(const std::string &path);
+    bool next(CAPTURE_RECORD *record, std::vector<uint8_t> *data);
+    void close();
+
+    const CAPTURE_FILE_HEADER &getHeader() const { return _header; }
+};
+
+#endif
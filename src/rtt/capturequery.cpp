@@ -0,0 +1,397 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <algorithm>
+
+// c
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// local
+#include "capturequery.h"
+#include "stlink_errors.h"
+#include "log.h"
+
+/**
+ * @brief Construct a new Capture File:: Capture File object
+ */
+CaptureFile::CaptureFile()
+{
+    this->_fd = -1;
+    this->_map = nullptr;
+    this->_size = 0;
+    this->_complete = false;
+}
+
+/**
+ * @brief Destroy the Capture File:: Capture File object
+ */
+CaptureFile::~CaptureFile()
+{
+    this->close();
+}
+
+/**
+ * @brief Maps path and loads its index.
+ *
+ * @param path
+ * @return int ERROR_OK or ERROR_FAIL
+ */
+int CaptureFile::open(const std::string &path)
+{
+    this->close();
+
+    this->_fd = ::open(path.c_str(), O_RDONLY);
+    if (this->_fd < 0)
+    {
+        LOG_ERROR("can't open %s: %s", path.c_str(), strerror(errno));
+        return ERROR_FAIL;
+    }
+
+    struct stat st;
+    if (fstat(this->_fd, &st) || (st.st_size < (off_t)sizeof(CAPTURE_FILE_HEADER)))
+    {
+        LOG_ERROR("%s is not a strtt capture", path.c_str());
+        this->close();
+        return ERROR_FAIL;
+    }
+
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, this->_fd, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG_ERROR("can't map %s: %s", path.c_str(), strerror(errno));
+        this->close();
+        return ERROR_FAIL;
+    }
+    this->_map = (const uint8_t *)map;
+    this->_size = st.st_size;
+    madvise(map, this->_size, MADV_RANDOM);
+
+    const CAPTURE_FILE_HEADER *hdr = this->header();
+    if (memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic)) || (hdr->version != CAPTURE_VERSION) || !hdr->align ||
+        (hdr->align & (hdr->align - 1)) || (hdr->blockSize < sizeof(CAPTURE_BLOCK_HEADER)) || (hdr->blockSize % hdr->align))
+    {
+        LOG_ERROR("%s is not a strtt capture", path.c_str());
+        this->close();
+        return ERROR_FAIL;
+    }
+
+    this->_complete = this->loadIndex();
+    if (!this->_complete)
+    {
+        LOG_INFO("%s wasn't closed, walking its blocks for the index", path.c_str());
+        this->scanIndex();
+    }
+
+    // a capture killed before its first index block is one span to the end
+    if (this->_index.empty())
+    {
+        CAPTURE_INDEX_ENTRY entry = {};
+        entry.offset = hdr->align;
+        entry.position = sizeof(CAPTURE_BLOCK_HEADER);
+        this->_index.push_back(entry);
+    }
+
+    return ERROR_OK;
+}
+
+/**
+ * @brief
+ */
+void CaptureFile::close()
+{
+    if (this->_map)
+    {
+        munmap((void *)this->_map, this->_size);
+        this->_map = nullptr;
+    }
+    if (this->_fd >= 0)
+    {
+        ::close(this->_fd);
+        this->_fd = -1;
+    }
+    this->_size = 0;
+    this->_index.clear();
+    this->_complete = false;
+}
+
+/**
+ * @brief The block at offset if it is a whole, sane one.
+ *
+ * @param offset
+ * @return const CAPTURE_BLOCK_HEADER* nullptr past the end or on a torn block
+ */
+const CAPTURE_BLOCK_HEADER *CaptureFile::blockAt(uint64_t offset) const
+{
+    const CAPTURE_FILE_HEADER *hdr = this->header();
+    if ((offset < hdr->align) || (offset % hdr->align) || (offset + sizeof(CAPTURE_BLOCK_HEADER) > this->_size))
+    {
+        return nullptr;
+    }
+
+    const CAPTURE_BLOCK_HEADER *blk = (const CAPTURE_BLOCK_HEADER *)(this->_map + offset);
+    if ((blk->magic != CAPTURE_BLOCK_MAGIC) || (blk->size < sizeof(*blk)) || (blk->size > hdr->blockSize) ||
+        (blk->size % hdr->align) || (blk->used < sizeof(*blk)) || (blk->used > blk->size) || (offset + blk->size > this->_size))
+    {
+        return nullptr;
+    }
+
+    return blk;
+}
+
+/**
+ * @brief Follows the index blocks back from the file header.
+ *
+ * @return true the whole chain was there
+ * @return false no index offset (capture not closed) or a broken chain
+ */
+bool CaptureFile::loadIndex()
+{
+    std::vector<uint64_t> chain;
+    uint64_t offset = this->header()->indexOffset;
+    while (offset)
+    {
+        const CAPTURE_BLOCK_HEADER *blk = this->blockAt(offset);
+        const CAPTURE_INDEX_HEADER *idx = blk ? (const CAPTURE_INDEX_HEADER *)(blk + 1) : nullptr;
+        if (!blk || (blk->type != CAPTURE_BLOCK_INDEX) ||
+            (sizeof(*blk) + sizeof(*idx) + (uint64_t)idx->entries * sizeof(CAPTURE_INDEX_ENTRY) > blk->used) ||
+            (idx->prevIndex >= offset))
+        {
+            LOG_WARNING("capture: broken index block at %lu", (unsigned long)offset);
+            return false;
+        }
+        chain.push_back(offset);
+        offset = idx->prevIndex;
+    }
+
+    if (chain.empty())
+    {
+        return false;
+    }
+
+    this->_index.clear();
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+    {
+        const CAPTURE_INDEX_HEADER *idx = (const CAPTURE_INDEX_HEADER *)(this->_map + *it + sizeof(CAPTURE_BLOCK_HEADER));
+        const CAPTURE_INDEX_ENTRY *entries = (const CAPTURE_INDEX_ENTRY *)(idx + 1);
+        this->_index.insert(this->_index.end(), entries, entries + idx->entries);
+    }
+    return true;
+}
+
+/**
+ * @brief Collects the index blocks in file order, for captures that weren't closed.
+ */
+void CaptureFile::scanIndex()
+{
+    this->_index.clear();
+
+    uint64_t offset = this->header()->align;
+    while (const CAPTURE_BLOCK_HEADER *blk = this->blockAt(offset))
+    {
+        const CAPTURE_INDEX_HEADER *idx = (const CAPTURE_INDEX_HEADER *)(blk + 1);
+        if ((blk->type == CAPTURE_BLOCK_INDEX) &&
+            (sizeof(*blk) + sizeof(*idx) + (uint64_t)idx->entries * sizeof(CAPTURE_INDEX_ENTRY) <= blk->used))
+        {
+            const CAPTURE_INDEX_ENTRY *entries = (const CAPTURE_INDEX_ENTRY *)(idx + 1);
+            this->_index.insert(this->_index.end(), entries, entries + idx->entries);
+        }
+        offset += blk->size;
+    }
+}
+
+/**
+ * @brief Hands every chunk in [fromNs, toNs] on channel (-1 for all) to fn.
+ *
+ * @param fromNs record clock, see CAPTURE_FILE_HEADER::startNs
+ * @param toNs
+ * @param channel
+ * @param fn
+ * @return uint64_t spans walked
+ */
+uint64_t CaptureFile::query(uint64_t fromNs, uint64_t toNs, int channel, const ChunkFunction &fn)
+{
+    if (!this->_map)
+    {
+        return 0;
+    }
+
+    // the span holding fromNs is the last one starting at or before it
+    auto it = std::upper_bound(this->_index.begin(), this->_index.end(), fromNs,
+                               [](uint64_t t, const CAPTURE_INDEX_ENTRY &e) { return t < e.firstNs; });
+    size_t span = (it == this->_index.begin()) ? 0 : (it - this->_index.begin()) - 1;
+
+    uint64_t walked = 0;
+    for (; (span < this->_index.size()) && (this->_index[span].firstNs <= toNs); span++)
+    {
+        // the last span of a capture that wasn't closed goes on past its byte counts
+        bool counted = this->_complete || (span + 1 < this->_index.size());
+        if (counted && (channel >= 0) && (channel < CAPTURE_INDEX_CHANNELS) && !this->_index[span].channelBytes[channel])
+        {
+            continue;
+        }
+
+        walked++;
+        if (!this->walk(span, fromNs, toNs, channel, fn))
+        {
+            break;
+        }
+    }
+
+    return walked;
+}
+
+/**
+ * @brief Walks the records of one span, the last one to the end of the file.
+ *
+ * @param span
+ * @param fromNs
+ * @param toNs
+ * @param channel
+ * @param fn
+ * @return true
+ * @return false fn asked to stop
+ */
+bool CaptureFile::walk(size_t span, uint64_t fromNs, uint64_t toNs, int channel, const ChunkFunction &fn)
+{
+    const CAPTURE_INDEX_ENTRY &entry = this->_index[span];
+    bool last = span + 1 >= this->_index.size();
+    uint64_t left = last ? 0 : this->_index[span + 1].record - entry.record;
+
+    uint64_t offset = entry.offset;
+    uint32_t pos = entry.position;
+    this->_joined.clear();
+
+    while (const CAPTURE_BLOCK_HEADER *blk = this->blockAt(offset))
+    {
+        const uint8_t *block = this->_map + offset;
+        while ((blk->type == CAPTURE_BLOCK_DATA) && (pos + sizeof(CAPTURE_RECORD) <= blk->used))
+        {
+            if (!last && !left--)
+            {
+                return true;
+            }
+
+            const CAPTURE_RECORD *rec = (const CAPTURE_RECORD *)(block + pos);
+            uint32_t end = pos + sizeof(CAPTURE_RECORD) + captureAlign(rec->length, 8);
+            if (end > blk->used)
+            {
+                LOG_WARNING("capture: bad record at %lu, skipping the rest of the block", (unsigned long)(offset + pos));
+                break;
+            }
+            pos = end;
+
+            // every part of a chunk has its channel and time
+            if (((channel >= 0) && (rec->channel != channel)) || (rec->timeNs < fromNs) || (rec->timeNs > toNs))
+            {
+                continue;
+            }
+
+            const uint8_t *payload = (const uint8_t *)(rec + 1);
+            if ((rec->flags & CAPTURE_RECORD_CONTINUED) || !this->_joined.empty())
+            {
+                this->_joined.insert(this->_joined.end(), payload, payload + rec->length);
+                if (rec->flags & CAPTURE_RECORD_CONTINUED)
+                {
+                    continue;
+                }
+
+                CAPTURE_RECORD whole = *rec;
+                whole.length = (uint32_t)this->_joined.size();
+                bool more = fn(whole, this->_joined.data());
+                this->_joined.clear();
+                if (!more)
+                {
+                    return false;
+                }
+            }
+            else if (!fn(*rec, payload))
+            {
+                return false;
+            }
+        }
+
+        offset += blk->size;
+        pos = sizeof(CAPTURE_BLOCK_HEADER);
+    }
+
+    return true;
+}
+
+/**
+ * @brief First occurrence of pattern in data. With SSE2 sixteen candidate
+ * positions are tested at once on the pattern's first and last byte, only
+ * those pass on to memcmp.
+ *
+ * @param data
+ * @param size
+ * @param pattern
+ * @param length
+ * @return const uint8_t* nullptr if not found
+ */
+const uint8_t *captureFind(const uint8_t *data, size_t size, const uint8_t *pattern, size_t length)
+{
+    if (!length)
+    {
+        return data;
+    }
+    if (length > size)
+    {
+        return nullptr;
+    }
+
+    const size_t last = size - length; // last possible start
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8((char)pattern[0]);
+    const __m128i final = _mm_set1_epi8((char)pattern[length - 1]);
+    for (; i + 15 <= last; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(data + i + length - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, final)));
+        while (mask)
+        {
+            size_t at = i + __builtin_ctz(mask);
+            if (!memcmp(data + at, pattern, length))
+            {
+                return data + at;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i <= last; i++)
+    {
+        if ((data[i] == pattern[0]) && !memcmp(data + i, pattern, length))
+        {
+            return data + i;
+        }
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,75 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_CAPTUREQUERY_H
+#define _PH_CAPTUREQUERY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "capture.h"
+
+// called for every chunk a query finds, parts already joined, false stops the query
+typedef std::function<bool(const CAPTURE_RECORD &record, const uint8_t *data)> ChunkFunction;
+
+//
+// A -record capture mapped read only. Queries go through the index: a binary
+// search on the span start times finds where a time range begins and spans
+// without a byte on the wanted channel are never touched.
+//
+class CaptureFile
+{
+private:
+    int _fd;
+    const uint8_t *_map;
+    size_t _size;
+
+    std::vector<CAPTURE_INDEX_ENTRY> _index;
+    bool _complete; // index came from a closed capture, its byte counts cover everything
+    std::vector<uint8_t> _joined;
+
+    const CAPTURE_FILE_HEADER *header() const { return (const CAPTURE_FILE_HEADER *)_map; }
+    const CAPTURE_BLOCK_HEADER *blockAt(uint64_t offset) const;
+    bool loadIndex();
+    void scanIndex();
+    bool walk(size_t span, uint64_t fromNs, uint64_t toNs, int channel, const ChunkFunction &fn);
+
+public:
+    CaptureFile();
+    ~CaptureFile();
+
+    CaptureFile(const CaptureFile &) = delete;
+    CaptureFile &operator=(const CaptureFile &) = delete;
+
+    int open(const std::string &path);
+    void close();
+
+    uint64_t query(uint64_t fromNs, uint64_t toNs, int channel, const ChunkFunction &fn);
+
+    const CAPTURE_FILE_HEADER *getHeader() const { return header(); }
+    const std::vector<CAPTURE_INDEX_ENTRY> &getIndex() const { return _index; }
+    bool isComplete() const { return _complete; }
+    size_t getSize() const { return _size; }
+};
+
+const uint8_t *captureFind(const uint8_t *data, size_t size, const uint8_t *pattern, size_t length);
+
+#endif
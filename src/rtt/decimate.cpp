@@ -0,0 +1,231 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <algorithm>
+#include <charconv>
+
+// c
+#include <string.h>
+
+// local
+#include "decimate.h"
+#include "log.h"
+
+/**
+ * @brief Column values as doubles, a plain loop per type.
+ *
+ * @param src
+ * @param rows
+ * @param dst
+ */
+template <typename T>
+static void widen(const uint8_t *src, uint32_t rows, double *dst)
+{
+    for (uint32_t r = 0; r < rows; r++)
+    {
+        T v;
+        memcpy(&v, src + r * sizeof(T), sizeof(T));
+        dst[r] = (double)v;
+    }
+}
+
+/**
+ * @brief min, max and sum of n values folded into the window's. Lanes
+ * that don't depend on each other, so the loop vectorizes without
+ * -ffast-math.
+ *
+ * @param v
+ * @param n
+ * @param mn
+ * @param mx
+ * @param sum
+ */
+static void reduce(const double *v, uint32_t n, double *mn, double *mx, double *sum)
+{
+    double lmin[DECIMATE_LANES], lmax[DECIMATE_LANES], lsum[DECIMATE_LANES];
+    for (int k = 0; k < DECIMATE_LANES; k++)
+    {
+        lmin[k] = *mn;
+        lmax[k] = *mx;
+        lsum[k] = 0;
+    }
+
+    uint32_t i = 0;
+    for (; i + DECIMATE_LANES <= n; i += DECIMATE_LANES)
+    {
+        for (int k = 0; k < DECIMATE_LANES; k++)
+        {
+            lmin[k] = (v[i + k] < lmin[k]) ? v[i + k] : lmin[k];
+            lmax[k] = (v[i + k] > lmax[k]) ? v[i + k] : lmax[k];
+            lsum[k] += v[i + k];
+        }
+    }
+    for (; i < n; i++)
+    {
+        lmin[0] = std::min(lmin[0], v[i]);
+        lmax[0] = std::max(lmax[0], v[i]);
+        lsum[0] += v[i];
+    }
+
+    for (int k = 0; k < DECIMATE_LANES; k++)
+    {
+        *mn = std::min(*mn, lmin[k]);
+        *mx = std::max(*mx, lmax[k]);
+        *sum += lsum[k];
+    }
+}
+
+/**
+ * @brief Construct a new Decimator:: Decimator object
+ *
+ * @param out where the reduced lines go
+ * @param window samples per line
+ */
+Decimator::Decimator(OutputSink *out, uint32_t window)
+    : _out(out), _window(std::max(window, 1u)), _count(0), _windows(0)
+{
+}
+
+/**
+ * @brief Sample layout, writes the header line.
+ *
+ * @param columns
+ */
+void Decimator::setColumns(const std::vector<SCOPE_COLUMN> &columns)
+{
+    this->_columns = columns;
+    this->_min.assign(columns.size(), 0);
+    this->_max.assign(columns.size(), 0);
+    this->_sum.assign(columns.size(), 0);
+    this->_first.assign(columns.size(), 0);
+    this->_count = 0;
+
+    std::string header;
+    for (size_t c = 0; c < columns.size(); c++)
+    {
+        std::string name = columns[c].type + std::to_string(columns[c].size) + "_" + std::to_string(c);
+        header += c ? "," : "";
+        header += (columns[c].type == 't') ? name : name + "_min," + name + "_max," + name + "_mean";
+    }
+    header += "\n";
+    this->_out->write((const uint8_t *)header.data(), header.size());
+}
+
+/**
+ * @brief A decoded block, lines for the windows it completes.
+ *
+ * @param scope
+ * @param rows
+ */
+void Decimator::feed(const ScopeDecoder &scope, uint32_t rows)
+{
+    this->_values.resize((size_t)rows * this->_columns.size());
+    for (size_t c = 0; c < this->_columns.size(); c++)
+    {
+        const SCOPE_COLUMN &column = this->_columns[c];
+        const uint8_t *src = scope.getColumn((int)c, rows);
+        double *dst = this->_values.data() + c * rows;
+        switch (column.type)
+        {
+        case 'i':
+            (column.size == 1) ? widen<int8_t>(src, rows, dst) : (column.size == 2) ? widen<int16_t>(src, rows, dst) : widen<int32_t>(src, rows, dst);
+            break;
+        case 'f':
+            widen<float>(src, rows, dst);
+            break;
+        default:
+            (column.size == 1) ? widen<uint8_t>(src, rows, dst) : (column.size == 2) ? widen<uint16_t>(src, rows, dst) : widen<uint32_t>(src, rows, dst);
+            break;
+        }
+    }
+
+    uint32_t r = 0;
+    while (r < rows)
+    {
+        uint32_t n = std::min(this->_window - this->_count, rows - r);
+        for (size_t c = 0; c < this->_columns.size(); c++)
+        {
+            const double *v = this->_values.data() + c * rows + r;
+            if (!this->_count)
+            {
+                this->_min[c] = v[0];
+                this->_max[c] = v[0];
+                this->_sum[c] = 0;
+                // exact, a double of a u32 time stamp
+                this->_first[c] = (uint32_t)v[0];
+            }
+            if (this->_columns[c].type != 't')
+            {
+                reduce(v, n, &this->_min[c], &this->_max[c], &this->_sum[c]);
+            }
+        }
+
+        this->_count += n;
+        r += n;
+        if (this->_count == this->_window)
+        {
+            this->emit();
+        }
+    }
+
+    this->_out->commit();
+}
+
+/**
+ * @brief The window as a line, into the sink without writing yet.
+ */
+void Decimator::emit()
+{
+    char buf[32];
+    this->_line.clear();
+    for (size_t c = 0; c < this->_columns.size(); c++)
+    {
+        if (c)
+        {
+            this->_line += ',';
+        }
+        if (this->_columns[c].type == 't')
+        {
+            this->_line.append(buf, std::to_chars(buf, buf + sizeof(buf), this->_first[c]).ptr - buf);
+            continue;
+        }
+
+        this->_line.append(buf, std::to_chars(buf, buf + sizeof(buf), this->_min[c]).ptr - buf);
+        this->_line += ',';
+        this->_line.append(buf, std::to_chars(buf, buf + sizeof(buf), this->_max[c]).ptr - buf);
+        this->_line += ',';
+        this->_line.append(buf, std::to_chars(buf, buf + sizeof(buf), this->_sum[c] / this->_count).ptr - buf);
+    }
+    this->_line += '\n';
+
+    this->_out->append((const uint8_t *)this->_line.data(), this->_line.size());
+    this->_windows++;
+    this->_count = 0;
+}
+
+/**
+ * @brief The last window, even if it isn't full.
+ */
+void Decimator::finish()
+{
+    if (this->_count)
+    {
+        this->emit();
+    }
+    this->_out->commit();
+}
@@ -0,0 +1,70 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_DECIMATE_H
+#define _PH_DECIMATE_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "outputsink.h"
+#include "scope.h"
+
+// independent accumulators per reduction, wide enough for AVX on doubles twice over
+#define DECIMATE_LANES (8)
+
+//
+// Reduces the samples of a -scope channel to one line per window of
+// samples: the first time stamp and min, max and mean of every other
+// column, as CSV. Runs on the decoded blocks, the full rate file is
+// written as before.
+//
+class Decimator
+{
+private:
+    OutputSink *_out;
+    uint32_t _window;
+    std::vector<SCOPE_COLUMN> _columns;
+
+    // one block as doubles, column by column
+    std::vector<double> _values;
+
+    // the window so far, per column
+    std::vector<double> _min;
+    std::vector<double> _max;
+    std::vector<double> _sum;
+    std::vector<uint32_t> _first; // time stamp columns
+    uint32_t _count;
+
+    uint64_t _windows;
+    std::string _line;
+
+    void emit();
+
+public:
+    Decimator(OutputSink *out, uint32_t window);
+
+    void setColumns(const std::vector<SCOPE_COLUMN> &columns);
+    void feed(const ScopeDecoder &scope, uint32_t rows);
+    void finish();
+
+    uint64_t getWindows() const { return _windows; }
+};
+
+#endif
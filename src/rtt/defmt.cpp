@@ -0,0 +1,486 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <algorithm>
+#include <chrono>
+
+// c
+#include <string.h>
+#include <stdio.h>
+
+// local
+#include "defmt.h"
+#include "elfsymbols.h"
+#include "stlink_errors.h"
+#include "log.h"
+
+/**
+ * @brief Splits a printf format into literal text and conversions, each
+ * with what it takes from the wire. A conversion we can't take from the
+ * wire (e.g. * width) stays literal text.
+ *
+ * @param s
+ * @param len
+ * @param pieces
+ */
+static void parseFormat(const char *s, size_t len, std::vector<DEFMT_PIECE> *pieces)
+{
+    std::string text;
+    size_t i = 0;
+    while (i < len)
+    {
+        if ((s[i] != '%') || (i + 1 >= len))
+        {
+            text += s[i++];
+            continue;
+        }
+        if (s[i + 1] == '%')
+        {
+            text += '%';
+            i += 2;
+            continue;
+        }
+
+        // flags, width, precision as given
+        std::string spec = "%";
+        size_t j = i + 1;
+        while ((j < len) && strchr("-+ #0", s[j]))
+            spec += s[j++];
+        while ((j < len) && (s[j] >= '0') && (s[j] <= '9'))
+            spec += s[j++];
+        if ((j < len) && (s[j] == '.'))
+        {
+            spec += s[j++];
+            while ((j < len) && (s[j] >= '0') && (s[j] <= '9'))
+                spec += s[j++];
+        }
+
+        int h = 0, l = 0;
+        while ((j < len) && strchr("hlzjt", s[j]))
+        {
+            h += s[j] == 'h';
+            l += s[j] == 'l';
+            j++;
+        }
+
+        DEFMT_PIECE piece;
+        piece.size = (h >= 2) ? 1 : h ? 2 : (l >= 2) ? 8 : 4;
+        char conv = (j < len) ? s[j] : 0;
+        switch (conv)
+        {
+        case 'd':
+        case 'i':
+            piece.type = DEFMT_ARG_INT;
+            spec += "ll";
+            spec += conv;
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            piece.type = DEFMT_ARG_UINT;
+            spec += "ll";
+            spec += conv;
+            break;
+        case 'p':
+            piece.type = DEFMT_ARG_UINT;
+            piece.size = 4;
+            spec = "0x%08llx";
+            break;
+        case 'c':
+            piece.type = DEFMT_ARG_CHAR;
+            piece.size = 1;
+            spec += 'c';
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            piece.type = DEFMT_ARG_FLOAT;
+            piece.size = l ? 8 : 4;
+            spec += conv;
+            break;
+        case 's':
+            piece.type = DEFMT_ARG_STRING;
+            piece.size = 1;
+            spec += 's';
+            break;
+        default:
+            text.append(s + i, std::min(j + 1, len) - i);
+            i = j + 1;
+            continue;
+        }
+
+        piece.text = std::move(text);
+        piece.spec = std::move(spec);
+        pieces->push_back(std::move(piece));
+        text.clear();
+        i = j + 1;
+    }
+
+    DEFMT_PIECE tail;
+    tail.text = std::move(text);
+    tail.type = DEFMT_ARG_NONE;
+    tail.size = 0;
+    pieces->push_back(std::move(tail));
+}
+
+/**
+ * @brief Construct a new Defmt Decoder:: Defmt Decoder object
+ */
+DefmtDecoder::DefmtDecoder()
+{
+    this->_used = 0;
+    this->_skipping = false;
+    memset(&this->_stats, 0, sizeof(this->_stats));
+}
+
+/**
+ * @brief Format strings from DEFMT_SECTION of the firmware.
+ *
+ * @param elfPath
+ * @return int ERROR_OK, ERROR_FAIL if the file or the section is missing
+ */
+int DefmtDecoder::load(const std::string &elfPath)
+{
+    ElfSymbols elf;
+    if (elf.load(elfPath) != ERROR_OK)
+    {
+        return ERROR_FAIL;
+    }
+
+    const uint8_t *data;
+    uint32_t size, addr;
+    if (!elf.getSection(DEFMT_SECTION, &data, &size, &addr))
+    {
+        LOG_ERROR("no %s section in %s", DEFMT_SECTION, elfPath.c_str());
+        return ERROR_FAIL;
+    }
+
+    return this->loadTable(data, size);
+}
+
+/**
+ * @brief Indexes every string of the section by its offset, parsed once
+ * here so messages only have to be filled in.
+ *
+ * @param data section content, 0 terminated strings, 0 padding between them
+ * @param size
+ * @return int
+ */
+int DefmtDecoder::loadTable(const uint8_t *data, uint32_t size)
+{
+    uint32_t offset = 0;
+    while (offset < size)
+    {
+        const char *s = (const char *)data + offset;
+        size_t len = strnlen(s, size - offset);
+        if (len)
+        {
+            std::vector<DEFMT_PIECE> pieces;
+            parseFormat(s, len, &pieces);
+            this->_formats[offset] = std::move(pieces);
+        }
+        offset += len + 1;
+    }
+
+    LOG_INFO("defmt: %d format strings", (int)this->_formats.size());
+    return ERROR_OK;
+}
+
+/**
+ * @brief Channel data as it comes, any split. Text of the messages it
+ * completes is appended to out, a line each.
+ *
+ * @param data
+ * @param size
+ * @param out
+ */
+void DefmtDecoder::feed(const uint8_t *data, size_t size, std::string *out)
+{
+    this->_stats.bytesIn += size;
+
+    while (size)
+    {
+        const uint8_t *end = (const uint8_t *)memchr(data, 0, size);
+        size_t n = end ? end - data : size;
+
+        if (!this->_skipping)
+        {
+            if (this->_used + n > sizeof(this->_frame))
+            {
+                // lost the end of a message or it is too long, wait for the next one
+                this->_skipping = true;
+                this->_stats.bad++;
+            }
+            else
+            {
+                memcpy(this->_frame + this->_used, data, n);
+                this->_used += n;
+            }
+        }
+
+        if (end)
+        {
+            if (!this->_skipping && this->_used)
+            {
+                this->message(this->_used, out);
+            }
+            this->_used = 0;
+            this->_skipping = false;
+            n++;
+        }
+
+        data += n;
+        size -= n;
+    }
+}
+
+/**
+ * @brief COBS decodes the collected message in place and formats it.
+ *
+ * @param size
+ * @param out
+ */
+void DefmtDecoder::message(size_t size, std::string *out)
+{
+    uint8_t *f = this->_frame;
+    size_t in = 0, len = 0;
+    while (in < size)
+    {
+        uint8_t code = f[in++];
+        if (in + code - 1 > size)
+        {
+            this->_stats.bad++;
+            return;
+        }
+        for (int k = 1; k < code; k++)
+        {
+            f[len++] = f[in++];
+        }
+        if ((code < 0xff) && (in < size))
+        {
+            f[len++] = 0;
+        }
+    }
+
+    if (len < 2)
+    {
+        this->_stats.bad++;
+        return;
+    }
+
+    uint32_t id = f[0] | (f[1] << 8);
+    auto it = this->_formats.find(id);
+    if (it == this->_formats.end())
+    {
+        this->_stats.unknown++;
+        return;
+    }
+
+    size_t before = out->size();
+    if (!this->format(it->second, f + 2, len - 2, out))
+    {
+        out->resize(before);
+        this->_stats.bad++;
+        return;
+    }
+
+    if (out->size() == before || (out->back() != '\n'))
+    {
+        out->push_back('\n');
+    }
+    this->_stats.messages++;
+    this->_stats.bytesOut += out->size() - before;
+}
+
+/**
+ * @brief
+ *
+ * @param pieces
+ * @param args
+ * @param size
+ * @param out
+ * @return true if the arguments were exactly what the format asks for
+ */
+bool DefmtDecoder::format(const std::vector<DEFMT_PIECE> &pieces, const uint8_t *args, size_t size, std::string *out)
+{
+    char buf[512];
+    for (const DEFMT_PIECE &piece : pieces)
+    {
+        out->append(piece.text);
+        if (piece.type == DEFMT_ARG_NONE)
+        {
+            continue;
+        }
+
+        if (piece.size > size)
+        {
+            return false;
+        }
+
+        int n = 0;
+        switch (piece.type)
+        {
+        case DEFMT_ARG_INT:
+        case DEFMT_ARG_UINT:
+        {
+            uint64_t u = 0;
+            memcpy(&u, args, piece.size);
+            if ((piece.type == DEFMT_ARG_INT) && (piece.size < 8) && (u >> (piece.size * 8 - 1)))
+            {
+                // sign extend
+                u |= ~0ULL << (piece.size * 8);
+            }
+            n = snprintf(buf, sizeof(buf), piece.spec.c_str(), (unsigned long long)u);
+            break;
+        }
+        case DEFMT_ARG_CHAR:
+            n = snprintf(buf, sizeof(buf), piece.spec.c_str(), (int)args[0]);
+            break;
+        case DEFMT_ARG_FLOAT:
+        {
+            double d;
+            if (piece.size == 8)
+            {
+                memcpy(&d, args, 8);
+            }
+            else
+            {
+                float f;
+                memcpy(&f, args, 4);
+                d = f;
+            }
+            n = snprintf(buf, sizeof(buf), piece.spec.c_str(), d);
+            break;
+        }
+        case DEFMT_ARG_STRING:
+        {
+            size_t strLen = args[0];
+            if (1 + strLen > size)
+            {
+                return false;
+            }
+            std::string str((const char *)args + 1, strLen);
+            n = snprintf(buf, sizeof(buf), piece.spec.c_str(), str.c_str());
+            args += strLen;
+            size -= strLen;
+            break;
+        }
+        default:
+            break;
+        }
+
+        if (n > 0)
+        {
+            out->append(buf, std::min((size_t)n, sizeof(buf) - 1));
+        }
+        args += piece.size;
+        size -= piece.size;
+    }
+
+    return size == 0;
+}
+
+/**
+ * @brief Construct a new Defmt Log:: Defmt Log object, the worker starts
+ * right away.
+ *
+ * @param decoder
+ */
+DefmtLog::DefmtLog(DefmtDecoder *decoder)
+    : _decoder(decoder), _stop(false)
+{
+    this->_th = std::thread(&DefmtLog::run, this);
+}
+
+/**
+ * @brief Destroy the Defmt Log:: Defmt Log object
+ */
+DefmtLog::~DefmtLog()
+{
+    this->stop();
+}
+
+/**
+ * @brief Decodes what was pushed so far and ends the worker, the decoder
+ * stats are final after this.
+ */
+void DefmtLog::stop()
+{
+    this->_stop = true;
+    if (this->_th.joinable())
+    {
+        this->_th.join();
+    }
+}
+
+/**
+ * @brief Channel data for the worker, from the main thread.
+ *
+ * @param data
+ * @param size
+ */
+void DefmtLog::push(const uint8_t *data, size_t size)
+{
+    this->_in.enqueue(std::vector<uint8_t>(data, data + size));
+}
+
+/**
+ * @brief Text decoded meanwhile, to be called from the main thread.
+ *
+ * @param text
+ * @return true if there was some
+ */
+bool DefmtLog::getText(std::string *text)
+{
+    return this->_out.try_dequeue(*text);
+}
+
+/**
+ * @brief
+ */
+void DefmtLog::run()
+{
+    std::vector<uint8_t> chunk;
+    std::string text;
+
+    for (;;)
+    {
+        bool stopping = this->_stop;
+        if (!this->_in.wait_dequeue_timed(chunk, std::chrono::milliseconds(stopping ? 0 : DEFMT_WAIT_MS)))
+        {
+            if (stopping)
+            {
+                break;
+            }
+            continue;
+        }
+
+        text.clear();
+        this->_decoder->feed(chunk.data(), chunk.size(), &text);
+        if (text.size())
+        {
+            this->_out.enqueue(std::move(text));
+        }
+    }
+}
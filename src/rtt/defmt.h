@@ -0,0 +1,132 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_DEFMT_H
+#define _PH_DEFMT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "blockingconcurrentqueue.h"
+#include "concurrentqueue.h"
+
+// format strings, e.g. linked as .strtt_fmt 0 (INFO) : { KEEP(*(.strtt_fmt)) }
+#define DEFMT_SECTION ".strtt_fmt"
+#define DEFMT_CHANNEL_NAME "defmt"
+// longest message after COBS decoding, longer ones are dropped
+#define DEFMT_MAX_FRAME (1024)
+// the worker checks for stop this often
+#define DEFMT_WAIT_MS (100)
+
+typedef enum
+{
+    DEFMT_ARG_NONE, // text only, the tail of a format
+    DEFMT_ARG_INT,
+    DEFMT_ARG_UINT,
+    DEFMT_ARG_CHAR,
+    DEFMT_ARG_FLOAT,
+    DEFMT_ARG_STRING,
+} DEFMT_ARG;
+
+typedef struct
+{
+    std::string text; // literal text before the argument
+    std::string spec; // host printf conversion for it
+    DEFMT_ARG type;
+    uint8_t size; // bytes on the wire, strings have a 1 byte length instead
+} DEFMT_PIECE;
+
+typedef struct
+{
+    uint64_t messages;
+    uint64_t bytesIn;  // encoded, as the target sent them
+    uint64_t bytesOut; // formatted text
+    uint64_t bad;      // COBS errors, too long, arguments not matching
+    uint64_t unknown;  // ids that are no format string
+} DEFMT_STATS;
+
+//
+// Deferred formatting: the target logs the id of a format string (its
+// offset in DEFMT_SECTION of the firmware ELF) and the raw arguments,
+// strtt formats them. A message on the channel is COBS encoded and ends
+// with a 0 byte, so after lost bytes decoding picks up again at the next
+// message:
+//
+//   id (uint16) | arguments, little endian, in format order
+//
+// hh, h, no and ll length give 1, 2, 4 and 8 byte integers (l is 4, as
+// long on Cortex-M), floats are 4 bytes and 8 with l, %c 1 byte, %p 4,
+// %s a length byte and the characters. Every message is one line.
+//
+class DefmtDecoder
+{
+private:
+    std::unordered_map<uint32_t, std::vector<DEFMT_PIECE>> _formats;
+
+    uint8_t _frame[DEFMT_MAX_FRAME + DEFMT_MAX_FRAME / 254 + 2];
+    size_t _used;
+    bool _skipping;
+    DEFMT_STATS _stats;
+
+    void message(size_t size, std::string *out);
+    bool format(const std::vector<DEFMT_PIECE> &pieces, const uint8_t *args, size_t size, std::string *out);
+
+public:
+    DefmtDecoder();
+
+    int load(const std::string &elfPath);
+    int loadTable(const uint8_t *data, uint32_t size);
+
+    void feed(const uint8_t *data, size_t size, std::string *out);
+
+    size_t getFormatCount() const { return _formats.size(); }
+    const DEFMT_STATS &getStats() const { return _stats; }
+};
+
+//
+// Runs a decoder on its own thread, the main loop hands it the channel
+// data and takes the text back.
+//
+class DefmtLog
+{
+private:
+    DefmtDecoder *_decoder;
+
+    moodycamel::BlockingConcurrentQueue<std::vector<uint8_t>> _in;
+    moodycamel::ConcurrentQueue<std::string> _out;
+
+    std::thread _th;
+    std::atomic_bool _stop;
+
+    void run();
+
+public:
+    DefmtLog(DefmtDecoder *decoder);
+    ~DefmtLog();
+
+    void stop();
+    void push(const uint8_t *data, size_t size);
+    bool getText(std::string *text);
+};
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+// c
+#include <string.h>
+
+// local
+#include "elfsymbols.h"
+#include "stlink_errors.h"
+#include "log.h"
+
+// only what we need from the ELF32 spec, <elf.h> isn't available everywhere
+
+#define EI_CLASS 4
+#define EI_DATA 5
+#define ELFCLASS32 1
+#define ELFDATA2LSB 1
+
+#define SHT_SYMTAB 2
+#define STT_FUNC 2
+#define ELF32_ST_TYPE(info) ((info)&0xF)
+
+typedef struct
+{
+    uint8_t e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint32_t e_entry;
+    uint32_t e_phoff;
+    uint32_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} ELF32_EHDR;
+
+typedef struct
+{
+    uint32_t sh_name;
+    uint32_t sh_type;
+    uint32_t sh_flags;
+    uint32_t sh_addr;
+    uint32_t sh_offset;
+    uint32_t sh_size;
+    uint32_t sh_link;
+    uint32_t sh_info;
+    uint32_t sh_addralign;
+    uint32_t sh_entsize;
+} ELF32_SHDR;
+
+typedef struct
+{
+    uint32_t st_name;
+    uint32_t st_value;
+    uint32_t st_size;
+    uint8_t st_info;
+    uint8_t st_other;
+    uint16_t st_shndx;
+} ELF32_SYM;
+
+/**
+ * @brief Reads the ELF file and builds the address index of its function
+ * symbols.
+ *
+ * @param path
+ * @return int
+ */
+int ElfSymbols::load(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        LOG_ERROR("Can't open %s", path.c_str());
+        return ERROR_FAIL;
+    }
+
+    this->_file.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    this->_symbols.clear();
+
+    ELF32_EHDR ehdr;
+    if ((this->_file.size() < sizeof(ehdr)) || (memcmp(this->_file.data(), "\177ELF", 4) != 0))
+    {
+        LOG_ERROR("%s is not an ELF file", path.c_str());
+        return ERROR_FAIL;
+    }
+
+    memcpy(&ehdr, this->_file.data(), sizeof(ehdr));
+    if ((ehdr.e_ident[EI_CLASS] != ELFCLASS32) || (ehdr.e_ident[EI_DATA] != ELFDATA2LSB))
+    {
+        LOG_ERROR("%s is not a 32 bit little endian ELF file", path.c_str());
+        return ERROR_FAIL;
+    }
+
+    if ((ehdr.e_shentsize != sizeof(ELF32_SHDR)) || ((uint64_t)ehdr.e_shoff + (uint64_t)ehdr.e_shnum * sizeof(ELF32_SHDR) > this->_file.size()))
+    {
+        LOG_ERROR("%s: broken section header table", path.c_str());
+        return ERROR_FAIL;
+    }
+
+    const ELF32_SHDR *shdr = (const ELF32_SHDR *)(this->_file.data() + ehdr.e_shoff);
+    for (uint16_t i = 0; i < ehdr.e_shnum; i++)
+    {
+        if ((shdr[i].sh_type != SHT_SYMTAB) || (shdr[i].sh_link >= ehdr.e_shnum))
+            continue;
+
+        const ELF32_SHDR &strtab = shdr[shdr[i].sh_link];
+        if (((uint64_t)shdr[i].sh_offset + shdr[i].sh_size > this->_file.size()) ||
+            ((uint64_t)strtab.sh_offset + strtab.sh_size > this->_file.size()))
+            continue;
+
+        const char *names = (const char *)this->_file.data() + strtab.sh_offset;
+        uint32_t count = shdr[i].sh_size / sizeof(ELF32_SYM);
+
+        for (uint32_t n = 0; n < count; n++)
+        {
+            ELF32_SYM sym;
+            memcpy(&sym, this->_file.data() + shdr[i].sh_offset + n * sizeof(ELF32_SYM), sizeof(sym));
+
+            if ((ELF32_ST_TYPE(sym.st_info) != STT_FUNC) || (sym.st_name >= strtab.sh_size))
+                continue;
+
+            // thumb bit
+            ELF_SYMBOL symbol;
+            symbol.addr = sym.st_value & ~1u;
+            symbol.size = sym.st_size;
+            symbol.name = std::string(names + sym.st_name, strnlen(names + sym.st_name, strtab.sh_size - sym.st_name));
+            this->_symbols.push_back(std::move(symbol));
+        }
+    }
+
+    std::sort(this->_symbols.begin(), this->_symbols.end(),
+              [](const ELF_SYMBOL &a, const ELF_SYMBOL &b)
+              { return a.addr < b.addr; });
+
+    LOG_INFO("%s: %d function symbols", path.c_str(), (int)this->_symbols.size());
+    return ERROR_OK;
+}
+
+/**
+ * @brief Function the PC belongs to. Symbols without a size cover
+ * everything up to the next one.
+ *
+ * @param pc
+ * @return const ELF_SYMBOL* nullptr if it isn't in any
+ */
+const ELF_SYMBOL *ElfSymbols::lookup(uint32_t pc) const
+{
+    auto it = std::upper_bound(this->_symbols.begin(), this->_symbols.end(), pc,
+                               [](uint32_t value, const ELF_SYMBOL &symbol)
+                               { return value < symbol.addr; });
+
+    if (it == this->_symbols.begin())
+        return nullptr;
+
+    const ELF_SYMBOL &symbol = *--it;
+    if (symbol.size && (pc >= symbol.addr + symbol.size))
+        return nullptr;
+
+    return &symbol;
+}
+
+/**
+ * @brief Content of a section, by name.
+ *
+ * @param name
+ * @param data
+ * @param size
+ * @param addr load address
+ * @return true if found
+ */
+bool ElfSymbols::getSection(const std::string &name, const uint8_t **data, uint32_t *size, uint32_t *addr) const
+{
+    if (this->_file.size() < sizeof(ELF32_EHDR))
+        return false;
+
+    ELF32_EHDR ehdr;
+    memcpy(&ehdr, this->_file.data(), sizeof(ehdr));
+    if ((ehdr.e_shstrndx >= ehdr.e_shnum) || ((uint64_t)ehdr.e_shoff + (uint64_t)ehdr.e_shnum * sizeof(ELF32_SHDR) > this->_file.size()))
+        return false;
+
+    const ELF32_SHDR *shdr = (const ELF32_SHDR *)(this->_file.data() + ehdr.e_shoff);
+    const ELF32_SHDR &shstrtab = shdr[ehdr.e_shstrndx];
+    if ((uint64_t)shstrtab.sh_offset + shstrtab.sh_size > this->_file.size())
+        return false;
+
+    for (uint16_t i = 0; i < ehdr.e_shnum; i++)
+    {
+        if ((shdr[i].sh_name >= shstrtab.sh_size) || ((uint64_t)shdr[i].sh_offset + shdr[i].sh_size > this->_file.size()))
+            continue;
+
+        const char *sectionName = (const char *)this->_file.data() + shstrtab.sh_offset + shdr[i].sh_name;
+        if (name == sectionName)
+        {
+            *data = this->_file.data() + shdr[i].sh_offset;
+            *size = shdr[i].sh_size;
+            *addr = shdr[i].sh_addr;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,53 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_ELFSYMBOLS_H
+#define _PH_ELFSYMBOLS_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+typedef struct
+{
+    uint32_t addr;
+    uint32_t size;
+    std::string name;
+} ELF_SYMBOL;
+
+//
+// Function symbols of a 32 bit little endian (Cortex-M) firmware ELF,
+// sorted by address for lookup by PC. Sections stay available for other
+// consumers of the file (e.g. format string tables).
+//
+class ElfSymbols
+{
+private:
+    std::vector<uint8_t> _file;
+    std::vector<ELF_SYMBOL> _symbols;
+
+public:
+    int load(const std::string &path);
+
+    const ELF_SYMBOL *lookup(uint32_t pc) const;
+    bool getSection(const std::string &name, const uint8_t **data, uint32_t *size, uint32_t *addr) const;
+
+    const std::vector<ELF_SYMBOL> &getSymbols() const { return _symbols; }
+};
+
+#endif
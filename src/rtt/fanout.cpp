@@ -0,0 +1,620 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <algorithm>
+#include <iterator>
+
+// c
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// local
+#include "fanout.h"
+#include "stlink_errors.h"
+#include "log.h"
+
+// epoll data for the listening sockets (tag | channel), subscribers use their fd
+#define FANOUT_TAG_EVENT (-1)
+#define FANOUT_TAG_LIVE (1ull << 32)
+#define FANOUT_TAG_HISTORY (2ull << 32)
+#define FANOUT_TAG_TCP (4ull << 32)
+
+/**
+ * @brief Construct a new Fan Out:: Fan Out object
+ */
+FanOut::FanOut()
+{
+    memset(this->_byIndex, 0, sizeof(this->_byIndex));
+    this->_scratch.resize(FANOUT_SEND_MAX);
+    this->_signaled = false;
+    this->_stop = false;
+
+    this->_epoll = epoll_create1(EPOLL_CLOEXEC);
+    this->_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((this->_epoll < 0) || (this->_eventFd < 0))
+    {
+        LOG_ERROR("fanout: %s", strerror(errno));
+    }
+    else
+    {
+        this->watch(this->_eventFd, (uint64_t)(int64_t)FANOUT_TAG_EVENT);
+    }
+}
+
+/**
+ * @brief Destroy the Fan Out:: Fan Out object
+ */
+FanOut::~FanOut()
+{
+    this->close();
+}
+
+/**
+ * @brief The channel's ring, made on first use.
+ *
+ * @param index
+ * @return FanOut::CHANNEL*
+ */
+FanOut::CHANNEL *FanOut::channel(int index)
+{
+    if (!this->_byIndex[index])
+    {
+        std::unique_ptr<CHANNEL> ch(new CHANNEL());
+        ch->channel = index;
+        ch->liveFd = -1;
+        ch->historyFd = -1;
+        ch->tcpFd = -1;
+        ch->ring.resize(FANOUT_RING_SIZE);
+        ch->head = 0;
+        ch->reserved = 0;
+        ch->stats = {};
+        ch->stats.channel = index;
+        this->_byIndex[index] = ch.get();
+        this->_channels.push_back(std::move(ch));
+    }
+    return this->_byIndex[index];
+}
+
+/**
+ * @brief
+ *
+ * @param fd
+ * @param tag
+ */
+void FanOut::watch(int fd, uint64_t tag)
+{
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = tag;
+    epoll_ctl(this->_epoll, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/**
+ * @brief Creates a listening Unix socket, replacing a stale one.
+ *
+ * @param path
+ * @return int fd or -1
+ */
+int FanOut::listenUnix(const std::string &path)
+{
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        LOG_ERROR("fanout: socket path too long: %s", path.c_str());
+        return -1;
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        LOG_ERROR("fanout: can't create socket: %s", strerror(errno));
+        return -1;
+    }
+
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || ::listen(fd, 8))
+    {
+        LOG_ERROR("fanout: can't listen on %s: %s", path.c_str(), strerror(errno));
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * @brief Listens on path.N and path.N.history for every channel.
+ *
+ * @param path
+ * @param channels
+ * @return int ERROR_OK or ERROR_FAIL
+ */
+int FanOut::serveUnix(const std::string &path, const std::vector<int> &channels)
+{
+    if (this->_epoll < 0)
+    {
+        return ERROR_FAIL;
+    }
+
+    for (int index : channels)
+    {
+        if ((index < 0) || (index >= FANOUT_CHANNELS) || (this->hasChannel(index) && (this->_byIndex[index]->liveFd >= 0)))
+        {
+            continue;
+        }
+
+        CHANNEL *ch = this->channel(index);
+        ch->path = path + "." + std::to_string(index);
+        ch->liveFd = this->listenUnix(ch->path);
+        ch->historyFd = this->listenUnix(ch->path + ".history");
+        if ((ch->liveFd < 0) || (ch->historyFd < 0))
+        {
+            return ERROR_FAIL;
+        }
+
+        this->watch(ch->liveFd, FANOUT_TAG_LIVE | index);
+        this->watch(ch->historyFd, FANOUT_TAG_HISTORY | index);
+        LOG_INFO("fanout: channel %d on %s", index, ch->path.c_str());
+    }
+
+    return ERROR_OK;
+}
+
+/**
+ * @brief Listens on TCP port basePort + N for every channel, clients can also write to the channel.
+ *
+ * @param basePort
+ * @param channels
+ * @return int ERROR_OK or ERROR_FAIL
+ */
+int FanOut::serveTcp(int basePort, const std::vector<int> &channels)
+{
+    if (this->_epoll < 0)
+    {
+        return ERROR_FAIL;
+    }
+
+    for (int index : channels)
+    {
+        if ((index < 0) || (index >= FANOUT_CHANNELS) || (this->hasChannel(index) && (this->_byIndex[index]->tcpFd >= 0)))
+        {
+            continue;
+        }
+
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            LOG_ERROR("fanout: can't create socket: %s", strerror(errno));
+            return ERROR_FAIL;
+        }
+
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(basePort + index);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || ::listen(fd, 8))
+        {
+            LOG_ERROR("fanout: can't listen on port %d: %s", basePort + index, strerror(errno));
+            ::close(fd);
+            return ERROR_FAIL;
+        }
+
+        CHANNEL *ch = this->channel(index);
+        ch->tcpFd = fd;
+        ch->input = std::make_unique<ByteRing>(FANOUT_INPUT_SIZE);
+
+        this->watch(fd, FANOUT_TAG_TCP | index);
+        LOG_INFO("fanout: channel %d on port %d", index, basePort + index);
+    }
+
+    return ERROR_OK;
+}
+
+/**
+ * @brief Starts the server thread, after the serve*() calls.
+ */
+void FanOut::start()
+{
+    if ((this->_epoll >= 0) && !this->_th.joinable())
+    {
+        this->_stop = false;
+        this->_th = std::thread(&FanOut::run, this);
+    }
+}
+
+/**
+ * @brief Copies a chunk into the channel's ring, called on the probe thread.
+ *
+ * @param channel
+ * @param data
+ * @param size
+ */
+void FanOut::publish(int channel, const uint8_t *data, size_t size)
+{
+    if (!this->hasChannel(channel) || !size)
+    {
+        return;
+    }
+
+    CHANNEL *ch = this->_byIndex[channel];
+    uint64_t head = ch->head.load(std::memory_order_relaxed);
+
+    // only the newest ring full can be kept anyway
+    if (size > ch->ring.size())
+    {
+        head += size - ch->ring.size();
+        data += size - ch->ring.size();
+        size = ch->ring.size();
+    }
+
+    // subscribers copying out what we are about to overwrite see this and retry
+    ch->reserved.store(head + size, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    size_t pos = head & (ch->ring.size() - 1);
+    size_t first = std::min(size, ch->ring.size() - pos);
+    memcpy(ch->ring.data() + pos, data, first);
+    memcpy(ch->ring.data(), data + first, size - first);
+    ch->head.store(head + size, std::memory_order_release);
+
+    // one wake up until the server thread looked
+    if (!this->_signaled.exchange(true))
+    {
+        uint64_t one = 1;
+        if (write(this->_eventFd, &one, sizeof(one)) < 0)
+        {
+            LOG_DEBUG("fanout: eventfd: %s", strerror(errno));
+        }
+    }
+}
+
+/**
+ * @brief
+ *
+ * @param listenFd
+ * @param channel
+ * @param history start with what the ring holds
+ * @param tcp what the subscriber sends goes to the target
+ */
+void FanOut::accept(int listenFd, CHANNEL *channel, bool history, bool tcp)
+{
+    int fd;
+    while ((fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        if (tcp)
+        {
+            // typed lines go out right away
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        uint64_t head = channel->head.load(std::memory_order_acquire);
+        uint64_t cursor = head;
+        if (history)
+        {
+            // keep clear of the part the probe thread may be writing right now
+            uint64_t keep = channel->ring.size() - FANOUT_SEND_MAX;
+            cursor = (head > keep) ? head - keep : 0;
+        }
+
+        this->_subscribers[fd] = {channel, cursor, tcp};
+        channel->stats.subscribers++;
+        LOG_INFO("fanout: subscriber on channel %d%s", channel->channel, history ? " with history" : "");
+
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = (uint64_t)fd;
+        epoll_ctl(this->_epoll, EPOLL_CTL_ADD, fd, &ev);
+
+        this->pump(fd, &this->_subscribers[fd]);
+    }
+}
+
+/**
+ * @brief Sends a subscriber what it hasn't got yet, until its socket is full.
+ *
+ * @param fd
+ * @param sub
+ */
+void FanOut::pump(int fd, SUBSCRIBER *sub)
+{
+    CHANNEL *ch = sub->channel;
+    const size_t size = ch->ring.size();
+
+    for (;;)
+    {
+        uint64_t head = ch->head.load(std::memory_order_acquire);
+        if (head == sub->cursor)
+        {
+            return;
+        }
+
+        if (ch->reserved.load(std::memory_order_relaxed) - sub->cursor > size)
+        {
+            LOG_WARNING("fanout: subscriber on channel %d fell a ring behind, dropped", ch->channel);
+            ch->stats.dropped++;
+            this->drop(fd);
+            return;
+        }
+
+        // copy out, then make sure the probe thread didn't write over it meanwhile
+        size_t pos = sub->cursor & (size - 1);
+        size_t n = std::min({(size_t)(head - sub->cursor), size - pos, this->_scratch.size()});
+        memcpy(this->_scratch.data(), ch->ring.data() + pos, n);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (ch->reserved.load(std::memory_order_relaxed) - sub->cursor > size)
+        {
+            continue;
+        }
+
+        ssize_t sent = send(fd, this->_scratch.data(), n, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN)
+            {
+                // gone
+                this->drop(fd);
+            }
+            // EPOLLOUT (edge triggered) brings us back
+            return;
+        }
+        sub->cursor += sent;
+    }
+}
+
+/**
+ * @brief Reads what the subscriber sent, TCP clients into the channel's
+ * input ring, everything else is thrown away.
+ *
+ * @param fd
+ * @param sub
+ * @return true
+ * @return false the subscriber hung up or failed and was dropped
+ */
+bool FanOut::receive(int fd, SUBSCRIBER *sub)
+{
+    ByteRing *input = sub->tcp ? sub->channel->input.get() : nullptr;
+    uint8_t buf[1024];
+
+    for (;;)
+    {
+        ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+        {
+            return true;
+        }
+        // end of file, or the connection broke (ECONNRESET)
+        if (n <= 0)
+        {
+            this->drop(fd);
+            return false;
+        }
+
+        if (input)
+        {
+            // the target reads its down-buffer slowly, no point keeping more than the ring
+            size_t taken = input->write(buf, n);
+            sub->channel->stats.input += taken;
+            sub->channel->stats.inputLost += n - taken;
+        }
+    }
+}
+
+/**
+ * @brief Takes what TCP clients sent to the channel, called on the probe thread.
+ *
+ * @param channel
+ * @param data appended to
+ * @return size_t bytes taken
+ */
+size_t FanOut::getInput(int channel, std::vector<uint8_t> *data)
+{
+    if (!this->hasInput(channel))
+    {
+        return 0;
+    }
+
+    ByteRing *input = this->_byIndex[channel]->input.get();
+    size_t size = input->size();
+    if (size)
+    {
+        size_t at = data->size();
+        data->resize(at + size);
+        size = input->read(data->data() + at, size);
+        data->resize(at + size);
+    }
+    return size;
+}
+
+/**
+ * @brief
+ *
+ * @param fd
+ */
+void FanOut::drop(int fd)
+{
+    epoll_ctl(this->_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    this->_subscribers.erase(fd);
+}
+
+/**
+ * @brief Server thread.
+ */
+void FanOut::run()
+{
+    struct epoll_event events[32];
+
+    while (!this->_stop)
+    {
+        int nev = epoll_wait(this->_epoll, events, 32, FANOUT_POLL_MS);
+        if (nev < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            LOG_ERROR("fanout: epoll: %s", strerror(errno));
+            break;
+        }
+
+        bool published = false;
+        for (int i = 0; i < nev; i++)
+        {
+            uint64_t tag = events[i].data.u64;
+            if (tag == (uint64_t)(int64_t)FANOUT_TAG_EVENT)
+            {
+                uint64_t count;
+                if (read(this->_eventFd, &count, sizeof(count)) < 0)
+                {
+                    LOG_DEBUG("fanout: eventfd: %s", strerror(errno));
+                }
+                published = true;
+            }
+            else if (tag & (FANOUT_TAG_LIVE | FANOUT_TAG_HISTORY | FANOUT_TAG_TCP))
+            {
+                CHANNEL *ch = this->_byIndex[tag & 0xFFFFFFFF];
+                if (tag & FANOUT_TAG_TCP)
+                    this->accept(ch->tcpFd, ch, false, true);
+                else if (tag & FANOUT_TAG_HISTORY)
+                    this->accept(ch->historyFd, ch, true, false);
+                else
+                    this->accept(ch->liveFd, ch, false, false);
+            }
+            else
+            {
+                int fd = (int)tag;
+                auto it = this->_subscribers.find(fd);
+                if (it == this->_subscribers.end())
+                {
+                    continue;
+                }
+
+                if ((events[i].events & EPOLLIN) && !this->receive(fd, &it->second))
+                {
+                    continue;
+                }
+                if (events[i].events & (EPOLLHUP | EPOLLERR))
+                {
+                    this->drop(fd);
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT)
+                {
+                    this->pump(fd, &it->second);
+                }
+            }
+        }
+
+        if (published)
+        {
+            // clear before looking, a publish from now on wakes us again
+            this->_signaled = false;
+            for (auto it = this->_subscribers.begin(); it != this->_subscribers.end();)
+            {
+                // pump() may drop the subscriber
+                auto next = std::next(it);
+                this->pump(it->first, &it->second);
+                it = next;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Stops the server, disconnects everybody and removes the sockets.
+ */
+void FanOut::close()
+{
+    this->_stop = true;
+    if (this->_th.joinable())
+    {
+        this->_th.join();
+    }
+
+    while (!this->_subscribers.empty())
+    {
+        this->drop(this->_subscribers.begin()->first);
+    }
+
+    for (auto &ch : this->_channels)
+    {
+        if (ch->liveFd >= 0)
+        {
+            ::close(ch->liveFd);
+            unlink(ch->path.c_str());
+            ch->liveFd = -1;
+        }
+        if (ch->historyFd >= 0)
+        {
+            ::close(ch->historyFd);
+            unlink((ch->path + ".history").c_str());
+            ch->historyFd = -1;
+        }
+        if (ch->tcpFd >= 0)
+        {
+            ::close(ch->tcpFd);
+            ch->tcpFd = -1;
+        }
+        this->_byIndex[ch->channel] = nullptr;
+    }
+
+    if (this->_eventFd >= 0)
+    {
+        ::close(this->_eventFd);
+        this->_eventFd = -1;
+    }
+    if (this->_epoll >= 0)
+    {
+        ::close(this->_epoll);
+        this->_epoll = -1;
+    }
+}
+
+/**
+ * @brief Per channel counters, call after close() for final numbers.
+ *
+ * @return std::vector<FANOUT_STATS>
+ */
+std::vector<FANOUT_STATS> FanOut::getStats() const
+{
+    std::vector<FANOUT_STATS> stats;
+    for (const auto &ch : this->_channels)
+    {
+        FANOUT_STATS s = ch->stats;
+        s.bytes = ch->head.load();
+        stats.push_back(s);
+    }
+    return stats;
+}
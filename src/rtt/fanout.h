@@ -0,0 +1,128 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_FANOUT_H
+#define _PH_FANOUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bytering.h"
+
+// channels 0..31 RTT, 32..63 SWO
+#define FANOUT_CHANNELS (64)
+// per channel, also the history a path.N.history subscriber starts with
+#define FANOUT_RING_SIZE (4 * 1024 * 1024)
+// most a subscriber is sent at once
+#define FANOUT_SEND_MAX (64 * 1024)
+// the server thread looks at the stop flag this often
+#define FANOUT_POLL_MS (100)
+// per channel, TCP clients -> target down-buffer
+#define FANOUT_INPUT_SIZE (16 * 1024)
+
+typedef struct
+{
+    int channel;
+    uint64_t bytes;       // published
+    uint32_t subscribers; // connected so far
+    uint32_t dropped;     // fell a whole ring behind and were disconnected
+    uint64_t input;       // received from TCP clients
+    uint64_t inputLost;   // didn't fit the input ring
+} FANOUT_STATS;
+
+//
+// Serves RTT/SWO channels to any number of subscribers, over Unix domain
+// sockets path.N (-fanout) and TCP ports base+N (-rttport), all from one
+// epoll loop on one thread. The probe thread only copies a chunk into the
+// channel's ring and never waits for anybody. Every subscriber has its own
+// read position in the shared ring, so what it may have pending is bounded
+// by the ring; one that falls a whole ring behind is disconnected and
+// counted. Connecting to path.N.history starts with what the ring still
+// holds. What TCP clients send is queued for the channel's down-buffer,
+// see getInput().
+//
+class FanOut
+{
+private:
+    typedef struct
+    {
+        int channel;
+        std::string path;
+        int liveFd;
+        int historyFd;
+        int tcpFd;
+        std::vector<uint8_t> ring;
+        std::atomic<uint64_t> head;     // bytes ever published
+        std::atomic<uint64_t> reserved; // head once the chunk being copied in is done
+        std::unique_ptr<ByteRing> input; // TCP only
+        FANOUT_STATS stats;
+    } CHANNEL;
+
+    typedef struct
+    {
+        CHANNEL *channel;
+        uint64_t cursor;
+        bool tcp;
+    } SUBSCRIBER;
+
+    std::vector<std::unique_ptr<CHANNEL>> _channels;
+    CHANNEL *_byIndex[FANOUT_CHANNELS];
+    std::map<int, SUBSCRIBER> _subscribers;
+    std::vector<uint8_t> _scratch;
+
+    int _epoll;
+    int _eventFd;
+    std::atomic_bool _signaled;
+    std::atomic_bool _stop;
+    std::thread _th;
+
+    CHANNEL *channel(int index);
+    int listenUnix(const std::string &path);
+    void watch(int fd, uint64_t tag);
+    void run();
+    void accept(int listenFd, CHANNEL *channel, bool history, bool tcp);
+    void pump(int fd, SUBSCRIBER *sub);
+    bool receive(int fd, SUBSCRIBER *sub);
+    void drop(int fd);
+
+public:
+    FanOut();
+    ~FanOut();
+
+    FanOut(const FanOut &) = delete;
+    FanOut &operator=(const FanOut &) = delete;
+
+    int serveUnix(const std::string &path, const std::vector<int> &channels);
+    int serveTcp(int basePort, const std::vector<int> &channels);
+    void start();
+    void publish(int channel, const uint8_t *data, size_t size);
+    size_t getInput(int channel, std::vector<uint8_t> *data);
+    void close();
+
+    bool hasChannel(int channel) const { return (channel >= 0) && (channel < FANOUT_CHANNELS) && _byIndex[channel]; }
+    bool hasInput(int channel) const { return hasChannel(channel) && _byIndex[channel]->input; }
+    std::vector<FANOUT_STATS> getStats() const;
+};
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <chrono>
+
+// c
+#include <errno.h>
+#include <string.h>
+
+// local
+#include "filewriter.h"
+#include "stlink_errors.h"
+#include "log.h"
+
+/**
+ * @brief Construct a new File Writer:: File Writer object
+ */
+FileWriter::FileWriter()
+    : _written(0), _dropped(0), _failed(false)
+{
+    this->_file = nullptr;
+    this->_fileIndex = 0;
+    this->_nextIndex = 0;
+    this->_stop = false;
+}
+
+/**
+ * @brief Destroy the File Writer:: File Writer object, writes what is left
+ */
+FileWriter::~FileWriter()
+{
+    this->close();
+}
+
+/**
+ * @brief Creates (truncates) path and starts the writer thread.
+ *
+ * @param path
+ * @return int ERROR_OK or ERROR_FAIL
+ */
+int FileWriter::open(const std::string &path)
+{
+    this->close();
+
+    this->_path = path;
+    this->_fileIndex = -1;
+    this->_nextIndex = 0;
+    this->_pending.clear();
+    this->_cuts.clear();
+    this->_failed = false;
+    this->_stop = false;
+
+    if (!this->openNext())
+    {
+        return ERROR_FAIL;
+    }
+
+    this->_th = std::thread(&FileWriter::run, this);
+    return ERROR_OK;
+}
+
+/**
+ * @brief name.ext, name.1.ext, name.2.ext ...
+ *
+ * @param index
+ * @return std::string
+ */
+std::string FileWriter::fileName(int index) const
+{
+    if (!index)
+    {
+        return this->_path;
+    }
+
+    size_t dot = this->_path.find_last_of('.');
+    size_t slash = this->_path.find_last_of("/\\");
+    if ((dot == std::string::npos) || ((slash != std::string::npos) && (dot < slash)))
+    {
+        return this->_path + "." + std::to_string(index);
+    }
+
+    return this->_path.substr(0, dot) + "." + std::to_string(index) + this->_path.substr(dot);
+}
+
+/**
+ * @brief Closes the current file and opens the next one.
+ *
+ * @return true
+ * @return false
+ */
+bool FileWriter::openNext()
+{
+    if (this->_file)
+    {
+        fclose(this->_file);
+        this->_file = nullptr;
+    }
+
+    std::string name = this->fileName(++this->_fileIndex);
+    this->_file = fopen(name.c_str(), "wb");
+    if (!this->_file)
+    {
+        LOG_ERROR("can't create %s: %s", name.c_str(), strerror(errno));
+        this->_failed = true;
+        return false;
+    }
+
+    // we hand over big blocks anyway
+    setvbuf(this->_file, nullptr, _IONBF, 0);
+    return true;
+}
+
+/**
+ * @brief Queues data for the writer thread, never blocks on the disk.
+ *
+ * @param data
+ * @param size
+ */
+void FileWriter::write(const uint8_t *data, size_t size)
+{
+    if (!size)
+        return;
+
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        if (!this->_th.joinable() || this->_failed || (this->_pending.size() + size > FILEWRITER_MAX_PENDING))
+        {
+            this->_dropped += size;
+            return;
+        }
+
+        this->_pending.insert(this->_pending.end(), data, data + size);
+        wake = this->_pending.size() >= FILEWRITER_CHUNK;
+    }
+
+    if (wake)
+    {
+        this->_cv.notify_one();
+    }
+}
+
+/**
+ * @brief What is written from now on goes to the next file. The writer
+ * thread opens it once it got everything written before.
+ *
+ * @return std::string name of the next file
+ */
+std::string FileWriter::rotate()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_cuts.push_back(this->_pending.size());
+    }
+
+    return this->fileName(++this->_nextIndex);
+}
+
+/**
+ * @brief Writes everything still queued and stops the thread.
+ */
+void FileWriter::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_stop = true;
+    }
+    this->_cv.notify_one();
+
+    if (this->_th.joinable())
+    {
+        this->_th.join();
+    }
+
+    if (this->_file)
+    {
+        fclose(this->_file);
+        this->_file = nullptr;
+    }
+}
+
+/**
+ * @brief Writer thread, swaps the pending buffer out and writes it in one go.
+ */
+void FileWriter::run()
+{
+    std::vector<uint8_t> block;
+    std::vector<size_t> cuts;
+    block.reserve(FILEWRITER_CHUNK);
+
+    while (true)
+    {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lock(this->_mutex);
+            this->_cv.wait_for(lock, std::chrono::milliseconds(FILEWRITER_FLUSH_MS),
+                               [this]() { return this->_stop || (this->_pending.size() >= FILEWRITER_CHUNK); });
+            block.swap(this->_pending);
+            cuts.swap(this->_cuts);
+            stop = this->_stop;
+        }
+
+        // up to the first cut, next file, up to the next cut ...
+        size_t done = 0;
+        size_t cut = 0;
+        while (!this->_failed && ((done < block.size()) || (cut < cuts.size())))
+        {
+            if ((cut < cuts.size()) && (cuts[cut] == done))
+            {
+                cut++;
+                if (!this->openNext())
+                    break;
+                continue;
+            }
+
+            size_t n = ((cut < cuts.size()) ? cuts[cut] : block.size()) - done;
+            if (fwrite(block.data() + done, 1, n, this->_file) != n)
+            {
+                LOG_ERROR("write to %s failed: %s", this->fileName(this->_fileIndex).c_str(), strerror(errno));
+                this->_failed = true;
+                break;
+            }
+
+            done += n;
+            this->_written += n;
+        }
+        cuts.clear();
+
+        if (done < block.size())
+        {
+            this->_dropped += block.size() - done;
+        }
+        block.clear();
+
+        if (stop)
+        {
+            break;
+        }
+    }
+}
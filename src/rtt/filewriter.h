@@ -0,0 +1,86 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_FILEWRITER_H
+#define _PH_FILEWRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// hand over to the writer thread at this size
+#define FILEWRITER_CHUNK (1024 * 1024)
+// or at the latest after
+#define FILEWRITER_FLUSH_MS (1000)
+// drop data rather than grow without limit when the disk can't keep up
+#define FILEWRITER_MAX_PENDING (64 * 1024 * 1024)
+
+//
+// Appends to a file from a background thread. write() only copies into
+// memory, the thread writes in large sequential blocks. rotate() continues
+// in name.1.ext, name.2.ext, ... right after the data written so far, so
+// the caller decides where a file ends.
+//
+class FileWriter
+{
+private:
+    std::string _path;
+
+    FILE *_file;
+    int _fileIndex; // writer thread
+    int _nextIndex; // caller
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::vector<uint8_t> _pending;
+    std::vector<size_t> _cuts; // offsets in _pending where the next file begins
+    bool _stop;
+
+    std::atomic<uint64_t> _written;
+    std::atomic<uint64_t> _dropped;
+    std::atomic_bool _failed;
+
+    std::thread _th;
+
+    void run();
+    bool openNext();
+    std::string fileName(int index) const;
+
+public:
+    FileWriter();
+    ~FileWriter();
+
+    FileWriter(const FileWriter &) = delete;
+    FileWriter &operator=(const FileWriter &) = delete;
+
+    int open(const std::string &path);
+    void write(const uint8_t *data, size_t size);
+    std::string rotate();
+    void close();
+
+    uint64_t getWritten() const { return _written; }
+    uint64_t getDropped() const { return _dropped; }
+    bool hasFailed() const { return _failed; }
+};
+
+#endif
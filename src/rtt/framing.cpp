@@ -0,0 +1,240 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <algorithm>
+#include <thread>
+
+// c
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// local
+#include "framing.h"
+#include "log.h"
+
+/**
+ * @brief Construct a new Frame Parser:: Frame Parser object
+ */
+FrameParser::FrameParser()
+{
+    this->_used = 0;
+    this->_skipped = 0;
+}
+
+/**
+ * @brief Hands every frame completed by data to fn. Frames that arrived
+ * whole are passed straight from data, only a split frame is collected.
+ *
+ * @param data
+ * @param size
+ * @param fn
+ */
+void FrameParser::feed(const uint8_t *data, size_t size, const FrameFunction &fn)
+{
+    while (size)
+    {
+        if (this->_used == 0)
+        {
+            // whole frames straight from data
+            if (size >= sizeof(FRAME_HEADER))
+            {
+                FRAME_HEADER header;
+                memcpy(&header, data, sizeof(header));
+                if ((header.magic != FRAME_MAGIC) || (header.length > FRAME_MAX_PAYLOAD))
+                {
+                    data++;
+                    size--;
+                    this->_skipped++;
+                    continue;
+                }
+                if (size >= sizeof(FRAME_HEADER) + header.length)
+                {
+                    fn(header, data + sizeof(FRAME_HEADER));
+                    data += sizeof(FRAME_HEADER) + header.length;
+                    size -= sizeof(FRAME_HEADER) + header.length;
+                    continue;
+                }
+            }
+
+            // the start of a frame, keep it
+            if (this->_buffer.size() < size)
+            {
+                this->_buffer.resize(size);
+            }
+            memcpy(this->_buffer.data(), data, size);
+            this->_used = size;
+            break;
+        }
+
+        // finish the frame started in an earlier piece
+        size_t want = sizeof(FRAME_HEADER);
+        if (this->_used >= sizeof(FRAME_HEADER))
+        {
+            want += ((const FRAME_HEADER *)this->_buffer.data())->length;
+        }
+
+        size_t n = std::min(want - this->_used, size);
+        if (this->_buffer.size() < this->_used + n)
+        {
+            this->_buffer.resize(this->_used + n);
+        }
+        memcpy(this->_buffer.data() + this->_used, data, n);
+        this->_used += n;
+        data += n;
+        size -= n;
+
+        if (this->_used < want)
+        {
+            break;
+        }
+
+        FRAME_HEADER header;
+        memcpy(&header, this->_buffer.data(), sizeof(header));
+        if (want == sizeof(FRAME_HEADER))
+        {
+            if ((header.magic != FRAME_MAGIC) || (header.length > FRAME_MAX_PAYLOAD))
+            {
+                // not a frame after all, look again one byte further
+                std::vector<uint8_t> rest(this->_buffer.begin() + 1, this->_buffer.begin() + this->_used);
+                this->_used = 0;
+                this->_skipped++;
+                this->feed(rest.data(), rest.size(), fn);
+                continue;
+            }
+            if (header.length)
+            {
+                continue;
+            }
+        }
+
+        this->_used = 0;
+        fn(header, this->_buffer.data() + sizeof(FRAME_HEADER));
+    }
+}
+
+/**
+ * @brief Header and payload into the sink as one piece.
+ *
+ * @param out
+ * @param channel
+ * @param data
+ * @param size
+ * @param timeNs
+ */
+void frameWrite(OutputSink *out, int channel, const uint8_t *data, size_t size, uint64_t timeNs)
+{
+    FRAME_HEADER header;
+    header.magic = FRAME_MAGIC;
+    header.channel = (uint8_t)channel;
+    header.flags = 0;
+    header.length = (uint32_t)size;
+    header.timeNs = timeNs;
+
+    out->append((const uint8_t *)&header, sizeof(header));
+    out->append(data, size);
+    out->commit();
+}
+
+/**
+ * @brief Construct a new Framed Input:: Framed Input object
+ */
+FramedInput::FramedInput()
+{
+    this->_shared = std::make_shared<SHARED>();
+    this->_shared->eof = false;
+    this->_shared->skipped = 0;
+}
+
+/**
+ * @brief Starts reading fd, the thread ends at end of file.
+ *
+ * @param fd
+ */
+void FramedInput::start(int fd)
+{
+    std::shared_ptr<SHARED> shared = this->_shared;
+    std::thread([shared, fd]() {
+        FrameParser parser;
+        std::vector<uint8_t> buf(64 * 1024);
+        for (;;)
+        {
+#ifdef _WIN32
+            int n = _read(fd, buf.data(), (unsigned int)buf.size());
+#else
+            ssize_t n = read(fd, buf.data(), buf.size());
+#endif
+            if (n <= 0)
+            {
+                break;
+            }
+
+            std::unique_lock<std::mutex> lock(shared->mutex);
+            parser.feed(buf.data(), n, [&](const FRAME_HEADER &header, const uint8_t *payload) {
+                if (shared->pending.size() <= header.channel)
+                {
+                    shared->pending.resize(header.channel + 1);
+                }
+                std::vector<uint8_t> &pending = shared->pending[header.channel];
+                pending.insert(pending.end(), payload, payload + header.length);
+            });
+            if (parser.getSkipped() != shared->skipped)
+            {
+                LOG_WARNING("framed input: out of sync, %llu bytes skipped", (unsigned long long)parser.getSkipped());
+                shared->skipped = parser.getSkipped();
+            }
+
+            // leave the rest in the pipe until the main loop caught up
+            shared->taken.wait(lock, [&]() {
+                return std::all_of(shared->pending.begin(), shared->pending.end(),
+                                   [](const std::vector<uint8_t> &p) { return p.size() <= FRAMED_INPUT_MAX; });
+            });
+        }
+        shared->eof = true;
+    }).detach();
+}
+
+/**
+ * @brief Hands over what arrived since the last call, per channel, to the
+ * channels of pending that are empty. A channel still holding data gets
+ * nothing new, so neither side grows much past FRAMED_INPUT_MAX.
+ *
+ * @param pending
+ */
+void FramedInput::take(std::vector<std::vector<uint8_t>> *pending)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->_shared->mutex);
+        std::vector<std::vector<uint8_t>> &arrived = this->_shared->pending;
+        if (pending->size() < arrived.size())
+        {
+            pending->resize(arrived.size());
+        }
+        for (size_t i = 0; i < arrived.size(); i++)
+        {
+            if (arrived[i].size() && (*pending)[i].empty())
+            {
+                (*pending)[i].swap(arrived[i]);
+            }
+        }
+    }
+    this->_shared->taken.notify_one();
+}
@@ -0,0 +1,110 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_FRAMING_H
+#define _PH_FRAMING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "outputsink.h"
+
+//
+// -framed stdout/stdin, little endian: FRAME_HEADER then length payload
+// bytes, nothing in between. Out of strtt a frame is one chunk of an up
+// channel (RTT 0..31, SWO stimulus port n as 32 + n) with the host time it
+// was read at, steady clock ns like -record. Into strtt a frame is data for
+// down-buffer channel, its time is ignored. A reader that loses sync looks
+// for the next FRAME_MAGIC.
+//
+#define FRAME_MAGIC 0x5452 // "RT"
+// a bigger length means we are out of sync
+#define FRAME_MAX_PAYLOAD (1024 * 1024)
+// per channel, FramedInput stops reading stdin while a channel holds more
+#define FRAMED_INPUT_MAX (64 * 1024)
+
+typedef struct
+{
+    uint16_t magic;
+    uint8_t channel;
+    uint8_t flags; // 0
+    uint32_t length;
+    uint64_t timeNs;
+} FRAME_HEADER;
+
+static_assert(sizeof(FRAME_HEADER) == 16, "frame header layout");
+
+// called for every whole frame
+typedef std::function<void(const FRAME_HEADER &header, const uint8_t *payload)> FrameFunction;
+
+//
+// Cuts a byte stream back into frames, whatever pieces it arrives in.
+//
+class FrameParser
+{
+private:
+    std::vector<uint8_t> _buffer;
+    size_t _used;
+    uint64_t _skipped;
+
+public:
+    FrameParser();
+
+    void feed(const uint8_t *data, size_t size, const FrameFunction &fn);
+
+    // bytes thrown away looking for a frame start
+    uint64_t getSkipped() const { return _skipped; }
+};
+
+void frameWrite(OutputSink *out, int channel, const uint8_t *data, size_t size, uint64_t timeNs);
+
+//
+// Reads frames from stdin on its own thread, blocking reads work the same
+// on pipes everywhere. The main loop takes what arrived per channel, a
+// channel the target doesn't drain holds stdin back instead of piling up.
+//
+class FramedInput
+{
+private:
+    typedef struct
+    {
+        std::mutex mutex;
+        std::condition_variable taken;             // take() made room
+        std::vector<std::vector<uint8_t>> pending; // per channel
+        std::atomic_bool eof;
+        uint64_t skipped;
+    } SHARED;
+
+    // the reader thread may outlive us, blocked in read()
+    std::shared_ptr<SHARED> _shared;
+
+public:
+    FramedInput();
+
+    void start(int fd);
+    void take(std::vector<std::vector<uint8_t>> *pending);
+    bool atEnd() const { return _shared->eof; }
+};
+
+#endif
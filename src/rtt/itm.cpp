@@ -0,0 +1,128 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// local
+#include "itm.h"
+
+#define ITM_OVERFLOW (0x70)
+
+/**
+ * @brief Construct a new Itm Decoder:: Itm Decoder object
+ */
+ItmDecoder::ItmDecoder()
+    : _ports(ITM_STIMULUS_PORTS)
+{
+}
+
+/**
+ * @brief Decodes a chunk of SWO data, the handler is called once per
+ * stimulus port that received something in it.
+ *
+ * @param data
+ * @param size
+ */
+void ItmDecoder::feed(const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        uint8_t byte = data[i];
+
+        switch (this->_state)
+        {
+        case State::Header:
+            if (byte == 0)
+            {
+                // sync packet, or idle
+                this->_zeros++;
+                break;
+            }
+
+            if ((byte == 0x80) && (this->_zeros >= 5))
+            {
+                // end of sync packet
+                this->_zeros = 0;
+                break;
+            }
+
+            this->_zeros = 0;
+
+            if (byte == ITM_OVERFLOW)
+            {
+                this->_overflows++;
+                break;
+            }
+
+            if (byte & 0x03)
+            {
+                // source packet, 1, 2 or 4 bytes of payload
+                static const int payload[] = {0, 1, 2, 4};
+                this->_software = (byte & 0x04) == 0;
+                this->_port = byte >> 3;
+                this->_remaining = payload[byte & 0x03];
+                this->_size = this->_remaining;
+                this->_value = 0;
+                this->_state = State::Payload;
+            }
+            else if (byte & 0x80)
+            {
+                // timestamp, extension, global timestamp - skip until the last byte
+                this->_state = State::Continued;
+            }
+            break;
+
+        case State::Payload:
+            if (this->_software)
+            {
+                this->_ports[this->_port].push_back(byte);
+            }
+            else
+            {
+                // little endian
+                this->_value |= (uint32_t)byte << (8 * (this->_size - this->_remaining));
+            }
+
+            if (--this->_remaining == 0)
+            {
+                if (!this->_software && this->_hwHandler)
+                {
+                    this->_hwHandler(this->_port, this->_value, this->_size);
+                }
+                this->_state = State::Header;
+            }
+            break;
+
+        case State::Continued:
+            if (!(byte & 0x80))
+            {
+                this->_state = State::Header;
+            }
+            break;
+        }
+    }
+
+    for (int port = 0; port < ITM_STIMULUS_PORTS; port++)
+    {
+        if (this->_ports[port].size())
+        {
+            if (this->_handler)
+            {
+                this->_handler(port, &this->_ports[port]);
+            }
+            this->_ports[port].clear();
+        }
+    }
+}
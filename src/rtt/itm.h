@@ -0,0 +1,114 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_ITM_H
+#define _PH_ITM_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#define ITM_STIMULUS_PORTS (32)
+
+// ITM/DWT registers
+#define DEMCR_ADDR (0xE000EDFC)
+#define DEMCR_TRCENA (1 << 24)
+
+#define ITM_TER_ADDR (0xE0000E00)
+#define ITM_TPR_ADDR (0xE0000E40)
+#define ITM_TCR_ADDR (0xE0000E80)
+#define ITM_LAR_ADDR (0xE0000FB0)
+#define ITM_LAR_KEY (0xC5ACCE55)
+#define ITM_TCR_ITMENA (1 << 0)
+#define ITM_TCR_SYNCENA (1 << 2)
+#define ITM_TCR_TXENA (1 << 3)
+#define ITM_TCR_TRACEBUSID(id) ((id) << 16)
+
+// TPIU registers
+#define TPIU_CSPSR_ADDR (0xE0040004)
+#define TPIU_ACPR_ADDR (0xE0040010)
+#define TPIU_SPPR_ADDR (0xE00400F0)
+#define TPIU_FFCR_ADDR (0xE0040304)
+#define TPIU_FFCR_TRIGIN (1 << 8)
+
+// DWT registers
+#define DWT_CTRL_ADDR (0xE0001000)
+#define DWT_CTRL_CYCCNTENA (1 << 0)
+#define DWT_CTRL_POSTPRESET(n) ((n) << 1)
+#define DWT_CTRL_POSTPRESET_MASK (0xF << 1)
+#define DWT_CTRL_POSTINIT_MASK (0xF << 5)
+#define DWT_CTRL_CYCTAP (1 << 9)
+#define DWT_CTRL_PCSAMPLENA (1 << 12)
+#define DWT_PCSR_ADDR (0xE000101C)
+
+// DWT hardware source packet ids
+#define ITM_DWT_PC_SAMPLE (2)
+
+// STM32 DBGMCU_CR, routes TRACESWO to its pin
+#define DBGMCU_CR_ADDR (0xE0042004)
+#define DBGMCU_CR_TRACE_IOEN (1 << 5)
+
+// stimulus port, data of one packet
+typedef std::function<void(const int, const std::vector<uint8_t> *)> ItmPortHandler;
+// DWT packet id, payload, payload size
+typedef std::function<void(const int, const uint32_t, const int)> ItmHardwareHandler;
+
+//
+// Streaming decoder for the ITM packet protocol as it comes out of SWO.
+// Software source packets (ITM stimulus ports) are collected per port,
+// hardware source packets (DWT, e.g. PC samples) are passed on one by one,
+// everything else (sync, overflow, timestamps, extension) is skipped. Packets may be split across feed() calls.
+//
+class ItmDecoder
+{
+private:
+    enum class State
+    {
+        Header,
+        Payload,   // source packet payload
+        Continued, // protocol packet continuation bytes
+    };
+
+    State _state = State::Header;
+    bool _software = false;
+    int _port = 0;
+    int _remaining = 0;
+    int _zeros = 0; // sync packet is 47 zero bits and a one
+    int _size = 0;
+    uint32_t _value = 0;
+
+    std::atomic<uint32_t> _overflows{0};
+
+    // bytes of the current feed() call, per port
+    std::vector<std::vector<uint8_t>> _ports;
+
+    ItmPortHandler _handler;
+    ItmHardwareHandler _hwHandler;
+
+public:
+    ItmDecoder();
+
+    void setHandler(ItmPortHandler handler) { _handler = handler; }
+    void setHardwareHandler(ItmHardwareHandler handler) { _hwHandler = handler; }
+    void feed(const uint8_t *data, size_t size);
+
+    uint32_t getOverflows() const { return _overflows; }
+};
+
+#endif
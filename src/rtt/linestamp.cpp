@@ -0,0 +1,150 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <algorithm>
+
+// c
+#include <stdio.h>
+#include <string.h>
+
+// local
+#include "linestamp.h"
+
+/**
+ * @brief Construct a new Line Stamper:: Line Stamper object
+ *
+ * @param out
+ */
+LineStamper::LineStamper(OutputSink *out)
+{
+    this->_out = out;
+    this->_baseNs = 0;
+    memset(this->_lines, 0, sizeof(this->_lines));
+    this->_carry.resize(LINESTAMP_CHANNELS * LINESTAMP_MAX_LINE);
+    this->_lineCount = 0;
+}
+
+/**
+ * @brief Destroy the Line Stamper:: Line Stamper object
+ */
+LineStamper::~LineStamper()
+{
+    this->finish();
+}
+
+/**
+ * @brief "[   12.345678 0] "
+ *
+ * @param channel
+ * @param timeNs
+ */
+void LineStamper::prefix(int channel, uint64_t timeNs)
+{
+    uint64_t us = (timeNs - this->_baseNs) / 1000;
+    char text[48];
+    int n = snprintf(text, sizeof(text), "[%5llu.%06u %d] ", (unsigned long long)(us / 1000000), (unsigned)(us % 1000000), channel);
+    this->_out->append((const uint8_t *)text, n);
+}
+
+/**
+ * @brief Prints the lines completed by data, keeps the unfinished rest.
+ *
+ * @param channel
+ * @param data
+ * @param size
+ * @param timeNs host time the fragment was read at
+ */
+void LineStamper::feed(int channel, const uint8_t *data, size_t size, uint64_t timeNs)
+{
+    if ((channel < 0) || (channel >= LINESTAMP_CHANNELS) || !size)
+    {
+        return;
+    }
+
+    if (!this->_baseNs)
+    {
+        this->_baseNs = timeNs;
+    }
+
+    LINE &line = this->_lines[channel];
+    uint8_t *carry = this->_carry.data() + channel * LINESTAMP_MAX_LINE;
+    const uint8_t *end = data + size;
+
+    while (data < end)
+    {
+        const uint8_t *nl = (const uint8_t *)memchr(data, '\n', end - data);
+        if (!nl)
+        {
+            // unfinished, wait for the rest; a full carry goes out as a line
+            size_t rest = end - data;
+            while (rest)
+            {
+                if (!line.used)
+                {
+                    line.startNs = timeNs;
+                }
+
+                size_t n = std::min(rest, (size_t)(LINESTAMP_MAX_LINE - line.used));
+                memcpy(carry + line.used, data, n);
+                line.used += (uint32_t)n;
+                data += n;
+                rest -= n;
+
+                if (line.used == LINESTAMP_MAX_LINE)
+                {
+                    this->prefix(channel, line.startNs);
+                    this->_out->append(carry, line.used);
+                    this->_out->append((const uint8_t *)"\n", 1);
+                    this->_lineCount++;
+                    line.used = 0;
+                }
+            }
+            break;
+        }
+
+        // the line started with the carry, or right here
+        this->prefix(channel, line.used ? line.startNs : timeNs);
+        this->_out->append(carry, line.used);
+        this->_out->append(data, nl + 1 - data);
+        this->_lineCount++;
+        line.used = 0;
+        data = nl + 1;
+    }
+
+    this->_out->commit();
+}
+
+/**
+ * @brief Prints what is left of unfinished lines, at exit.
+ */
+void LineStamper::finish()
+{
+    for (int channel = 0; channel < LINESTAMP_CHANNELS; channel++)
+    {
+        LINE &line = this->_lines[channel];
+        if (line.used)
+        {
+            this->prefix(channel, line.startNs);
+            this->_out->append(this->_carry.data() + channel * LINESTAMP_MAX_LINE, line.used);
+            this->_out->append((const uint8_t *)"\n", 1);
+            this->_lineCount++;
+            line.used = 0;
+        }
+    }
+    this->_out->commit();
+}
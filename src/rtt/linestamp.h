@@ -0,0 +1,71 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_LINESTAMP_H
+#define _PH_LINESTAMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "outputsink.h"
+
+#define LINESTAMP_CHANNELS (64)
+// a longer line is cut, the rest goes out as a line of its own
+#define LINESTAMP_MAX_LINE (1024)
+
+//
+// Prefixes every line of a terminal channel with the host time it started
+// at and the channel number (-ts). RTT hands over arbitrary fragments, so
+// the unfinished end of a line is kept per channel until its new line
+// arrives. Lines are found with memchr and handed to the OutputSink in
+// whole spans, nothing is allocated per line. Lines of different channels
+// never mix.
+//
+class LineStamper
+{
+private:
+    typedef struct
+    {
+        uint32_t used;
+        uint64_t startNs;
+    } LINE;
+
+    OutputSink *_out;
+    uint64_t _baseNs; // time 0, the first data seen
+    LINE _lines[LINESTAMP_CHANNELS];
+    std::vector<uint8_t> _carry; // LINESTAMP_MAX_LINE per channel
+
+    uint64_t _lineCount;
+
+    void prefix(int channel, uint64_t timeNs);
+
+public:
+    LineStamper(OutputSink *out);
+    ~LineStamper();
+
+    LineStamper(const LineStamper &) = delete;
+    LineStamper &operator=(const LineStamper &) = delete;
+
+    void feed(int channel, const uint8_t *data, size_t size, uint64_t timeNs);
+    void finish();
+
+    uint64_t getLines() const { return _lineCount; }
+};
+
+#endif
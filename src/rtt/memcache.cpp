@@ -0,0 +1,136 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <algorithm>
+
+// c
+#include <string.h>
+
+// local
+#include "memcache.h"
+#include "stlink.h"
+#include "stlink_errors.h"
+#include "log.h"
+
+/**
+ * @brief Construct a new Mem Cache:: Mem Cache object, the code region is
+ * cacheable from the start
+ */
+MemCache::MemCache()
+{
+    this->addCacheable(MEMCACHE_CODE_START, MEMCACHE_CODE_SIZE);
+}
+
+/**
+ * @brief Marks memory that doesn't change while we are attached.
+ *
+ * @param addr
+ * @param size
+ */
+void MemCache::addCacheable(uint32_t addr, uint32_t size)
+{
+    this->_ranges.push_back(std::make_pair(addr, size));
+}
+
+/**
+ * @brief Range the whole [addr, addr + count) lies in, nullptr if it's not
+ * cacheable.
+ */
+const std::pair<uint32_t, uint32_t> *MemCache::findRange(uint32_t addr, uint32_t count) const
+{
+    for (const auto &range : this->_ranges)
+    {
+        if ((addr >= range.first) && ((uint64_t)addr + count <= (uint64_t)range.first + range.second))
+            return &range;
+    }
+
+    return nullptr;
+}
+
+/**
+ * @brief Drop everything, next reads go to the probe again.
+ */
+void MemCache::invalidate()
+{
+    if (this->_pages.size())
+    {
+        LOG_DEBUG("Memory cache invalidated (%d pages)", (int)this->_pages.size());
+    }
+
+    this->_pages.clear();
+}
+
+/**
+ * @brief Drop-in for read_mem(handle, addr, -1, count, buffer).
+ *
+ * @param addr
+ * @param count
+ * @param buffer
+ * @return int
+ */
+int MemCache::read(uint32_t addr, uint32_t count, uint8_t *buffer)
+{
+    const std::pair<uint32_t, uint32_t> *range = this->findRange(addr, count);
+    if (!range)
+    {
+        this->_stats.bypassed++;
+        return stlink_usb_layout_api.read_mem(this->_handle, addr, -1, count, buffer);
+    }
+
+    while (count)
+    {
+        uint32_t page = addr & ~(uint32_t)(MEMCACHE_PAGE_SIZE - 1);
+        uint32_t offset = addr - page;
+        uint32_t chunk = std::min(count, (uint32_t)MEMCACHE_PAGE_SIZE - offset);
+
+        auto it = this->_pages.find(page);
+        if (it != this->_pages.end())
+        {
+            this->_stats.hits++;
+        }
+        else
+        {
+            if (this->_pages.size() >= MEMCACHE_MAX_PAGES)
+            {
+                this->_pages.clear();
+            }
+
+            // never read past the cacheable range, what's behind it may have side effects
+            uint32_t from = std::max(page, range->first);
+            uint64_t to = std::min((uint64_t)page + MEMCACHE_PAGE_SIZE, (uint64_t)range->first + range->second);
+
+            std::vector<uint8_t> content(MEMCACHE_PAGE_SIZE);
+            int ret = stlink_usb_layout_api.read_mem(this->_handle, from, -1, (uint32_t)(to - from), &content[from - page]);
+            if (ret != ERROR_OK)
+            {
+                return ret;
+            }
+
+            this->_stats.misses++;
+            it = this->_pages.emplace(page, std::move(content)).first;
+        }
+
+        memcpy(buffer, &it->second[offset], chunk);
+
+        buffer += chunk;
+        addr += chunk;
+        count -= chunk;
+    }
+
+    return ERROR_OK;
+}
@@ -0,0 +1,77 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_MEMCACHE_H
+#define _PH_MEMCACHE_H
+
+#include <stdint.h>
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define MEMCACHE_PAGE_SIZE (256)
+// 16KB, when full we simply start over
+#define MEMCACHE_MAX_PAGES (64)
+
+// Cortex-M code region, flash/ROM on most parts
+#define MEMCACHE_CODE_START (0x00000000)
+#define MEMCACHE_CODE_SIZE (0x20000000)
+
+typedef struct
+{
+    uint64_t hits;     // pages served from host memory
+    uint64_t misses;   // pages fetched from the probe
+    uint64_t bypassed; // reads of volatile memory passed straight through
+} MEMCACHE_STATS;
+
+//
+// Page cache between StRtt and hl_layout_api_s::read_mem. Only reads that
+// fall completely into a range registered with addCacheable() (by default
+// the code region, where RTT channel names live) are served from host
+// memory, anything else (RAM, RTT ring offsets) always goes to the probe.
+// Contents stay valid until invalidate(), which has to be called whenever
+// the target may have been reflashed (reset, reattach).
+//
+class MemCache
+{
+private:
+    void *_handle = nullptr;
+
+    // start, size
+    std::vector<std::pair<uint32_t, uint32_t>> _ranges;
+
+    // page address -> content
+    std::unordered_map<uint32_t, std::vector<uint8_t>> _pages;
+
+    MEMCACHE_STATS _stats = {0};
+
+    const std::pair<uint32_t, uint32_t> *findRange(uint32_t addr, uint32_t count) const;
+
+public:
+    MemCache();
+
+    void setHandle(void *handle) { _handle = handle; }
+    void addCacheable(uint32_t addr, uint32_t size);
+
+    int read(uint32_t addr, uint32_t count, uint8_t *buffer);
+    void invalidate();
+
+    const MEMCACHE_STATS &getStats() const { return _stats; }
+};
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <algorithm>
+#include <chrono>
+
+// c
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// local
+#include "outputsink.h"
+#include "log.h"
+
+static uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Construct a new Output Sink:: Output Sink object
+ *
+ * @param fd
+ * @param flushMs 0 writes every commit()
+ */
+OutputSink::OutputSink(int fd, uint32_t flushMs)
+{
+    this->_fd = fd;
+    this->_flushMs = flushMs;
+    this->_buffer.resize(OUTPUTSINK_BUFFER_SIZE);
+    this->_used = 0;
+    this->_oldestNs = 0;
+    this->_writes = 0;
+    this->_bytes = 0;
+
+#ifdef F_SETPIPE_SZ
+    struct stat st;
+    if (!fstat(fd, &st) && S_ISFIFO(st.st_mode) && (fcntl(fd, F_GETPIPE_SZ) < OUTPUTSINK_PIPE_SIZE))
+    {
+        if (fcntl(fd, F_SETPIPE_SZ, OUTPUTSINK_PIPE_SIZE) < 0)
+        {
+            LOG_DEBUG("output: pipe size stays at %d", fcntl(fd, F_GETPIPE_SZ));
+        }
+    }
+#endif
+}
+
+/**
+ * @brief Destroy the Output Sink:: Output Sink object
+ */
+OutputSink::~OutputSink()
+{
+    this->flush();
+}
+
+/**
+ * @brief Collects data, a commit() or tick() writes it.
+ *
+ * @param data
+ * @param size
+ */
+void OutputSink::append(const uint8_t *data, size_t size)
+{
+    if (!size)
+    {
+        return;
+    }
+
+    if (this->_used + size > this->_buffer.size())
+    {
+        this->flushWith(data, size);
+        return;
+    }
+
+    if (!this->_used)
+    {
+        this->_oldestNs = nowNs();
+    }
+    memcpy(this->_buffer.data() + this->_used, data, size);
+    this->_used += size;
+}
+
+/**
+ * @brief End of a chunk, written now without a flush deadline.
+ */
+void OutputSink::commit()
+{
+    if (!this->_flushMs)
+    {
+        this->flush();
+    }
+}
+
+/**
+ * @brief A whole chunk, with no deadline and nothing waiting it goes out
+ * straight from the caller's buffer.
+ *
+ * @param data
+ * @param size
+ */
+void OutputSink::write(const uint8_t *data, size_t size)
+{
+    if (!this->_flushMs && !this->_used)
+    {
+        this->flushWith(data, size);
+        return;
+    }
+
+    this->append(data, size);
+    this->commit();
+}
+
+/**
+ * @brief Writes what waited longer than the deadline.
+ *
+ * @param nowNs steady clock
+ */
+void OutputSink::tick(uint64_t nowNs)
+{
+    if (this->_used && (nowNs - this->_oldestNs >= (uint64_t)this->_flushMs * 1000000))
+    {
+        this->flush();
+    }
+}
+
+/**
+ * @brief
+ */
+void OutputSink::flush()
+{
+    this->flushWith(nullptr, 0);
+}
+
+/**
+ * @brief Writes the buffer followed by data, retrying partial writes.
+ *
+ * @param data
+ * @param size
+ */
+void OutputSink::flushWith(const uint8_t *data, size_t size)
+{
+    const uint8_t *part[2] = {this->_buffer.data(), data};
+    size_t left[2] = {this->_used, size};
+    this->_used = 0;
+
+    while (left[0] || left[1])
+    {
+#ifdef _WIN32
+        int i = left[0] ? 0 : 1;
+        int n = _write(this->_fd, part[i], (unsigned int)std::min(left[i], (size_t)INT32_MAX));
+        if (n < 0)
+        {
+            return;
+        }
+#else
+        struct iovec iov[2];
+        int count = 0;
+        for (int i = 0; i < 2; i++)
+        {
+            if (left[i])
+            {
+                iov[count].iov_base = (void *)part[i];
+                iov[count].iov_len = left[i];
+                count++;
+            }
+        }
+
+        ssize_t n = writev(this->_fd, iov, count);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN)
+            {
+                // non blocking stdout, wait until the reader took some
+                struct pollfd pfd = {this->_fd, POLLOUT, 0};
+                poll(&pfd, 1, 100);
+                continue;
+            }
+            // reader gone (EPIPE) or disk full, nothing to do about it here
+            return;
+        }
+#endif
+        this->_writes++;
+        this->_bytes += n;
+
+        for (int i = 0; (i < 2) && n; i++)
+        {
+            size_t taken = std::min(left[i], (size_t)n);
+            part[i] += taken;
+            left[i] -= taken;
+            n -= taken;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_OUTPUTSINK_H
+#define _PH_OUTPUTSINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+// collected output goes out at this size at the latest
+#define OUTPUTSINK_BUFFER_SIZE (256 * 1024)
+// asked for when stdout is a pipe, so a slow reader doesn't stall polling right away
+#define OUTPUTSINK_PIPE_SIZE (1024 * 1024)
+
+//
+// Terminal output to a file descriptor (stdout). Data is collected and
+// written with as few system calls as possible: every commit() when the
+// flush deadline is 0, otherwise once the oldest byte waited -flushms or
+// the buffer is full. A chunk that doesn't fit goes out together with the
+// buffer in one writev(), without being copied.
+//
+class OutputSink
+{
+private:
+    int _fd;
+    uint32_t _flushMs;
+    std::vector<uint8_t> _buffer;
+    size_t _used;
+    uint64_t _oldestNs;
+
+    uint64_t _writes;
+    uint64_t _bytes;
+
+    void flushWith(const uint8_t *data, size_t size);
+
+public:
+    OutputSink(int fd, uint32_t flushMs = 0);
+    ~OutputSink();
+
+    OutputSink(const OutputSink &) = delete;
+    OutputSink &operator=(const OutputSink &) = delete;
+
+    void append(const uint8_t *data, size_t size);
+    void commit();
+    void write(const uint8_t *data, size_t size);
+    void tick(uint64_t nowNs);
+    void flush();
+
+    uint64_t getWrites() const { return _writes; }
+    uint64_t getBytes() const { return _bytes; }
+};
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <string>
+
+// c
+#include <stdio.h>
+#include <string.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// local
+#include "pollstats.h"
+#include "log.h"
+
+/**
+ * @brief Construct a new Histogram:: Histogram object
+ */
+Histogram::Histogram()
+{
+    this->reset();
+}
+
+/**
+ * @brief Values below HISTOGRAM_SUBS have a bucket each, above the top
+ * HISTOGRAM_SUB_BITS after the leading one pick the bucket within the
+ * power of two.
+ *
+ * @param value
+ * @return int
+ */
+int Histogram::bucket(uint64_t value)
+{
+    if (value < HISTOGRAM_SUBS)
+    {
+        return (int)value;
+    }
+
+#ifdef _MSC_VER
+    unsigned long msb;
+    _BitScanReverse64(&msb, value);
+#else
+    int msb = 63 - __builtin_clzll(value);
+#endif
+    int shift = (int)msb - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUBS + (int)(value >> shift) - HISTOGRAM_SUBS;
+}
+
+/**
+ * @brief Largest value that goes into the bucket.
+ *
+ * @param bucket
+ * @return uint64_t
+ */
+uint64_t Histogram::upperBound(int bucket)
+{
+    if (bucket < HISTOGRAM_SUBS)
+    {
+        return bucket;
+    }
+
+    int shift = bucket / HISTOGRAM_SUBS - 1;
+    uint64_t mantissa = bucket % HISTOGRAM_SUBS + HISTOGRAM_SUBS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+/**
+ * @brief
+ *
+ * @param value
+ */
+void Histogram::add(uint64_t value)
+{
+    this->_buckets[bucket(value)]++;
+    this->_count++;
+    if (value > this->_max)
+    {
+        this->_max = value;
+    }
+}
+
+/**
+ * @brief
+ */
+void Histogram::reset()
+{
+    memset(this->_buckets, 0, sizeof(this->_buckets));
+    this->_count = 0;
+    this->_max = 0;
+}
+
+/**
+ * @brief
+ *
+ * @param p 0..100
+ * @return uint64_t upper bound of the bucket holding it, never above the maximum
+ */
+uint64_t Histogram::percentile(double p) const
+{
+    if (!this->_count)
+    {
+        return 0;
+    }
+
+    // rank of the value, 1 based
+    uint64_t rank = (uint64_t)(p / 100.0 * this->_count + 0.5);
+    rank = rank ? rank : 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += this->_buckets[i];
+        if (seen >= rank)
+        {
+            uint64_t bound = upperBound(i);
+            return (bound < this->_max) ? bound : this->_max;
+        }
+    }
+
+    return this->_max;
+}
+
+/**
+ * @brief ns as the shortest readable duration
+ *
+ * @param ns
+ * @return std::string
+ */
+static std::string formatNs(uint64_t ns)
+{
+    char buf[32];
+    if (ns < 1000)
+        snprintf(buf, sizeof(buf), "%uns", (unsigned)ns);
+    else if (ns < 1000000)
+        snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+    else if (ns < 1000000000)
+        snprintf(buf, sizeof(buf), "%.2fms", ns / 1e6);
+    else
+        snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9);
+    return buf;
+}
+
+/**
+ * @brief Construct a new Poll Stats:: Poll Stats object
+ */
+PollStats::PollStats()
+{
+    this->reset();
+}
+
+/**
+ * @brief
+ *
+ * @param channel
+ * @param bytes
+ */
+void PollStats::addBytes(int channel, size_t bytes)
+{
+    if ((channel >= 0) && (channel < POLLSTATS_CHANNELS))
+    {
+        this->_channelBytes[channel] += bytes;
+    }
+}
+
+/**
+ * @brief A main loop cycle is over, with the transactions it took.
+ *
+ * @param cycleNs
+ */
+void PollStats::endCycle(uint64_t cycleNs)
+{
+    this->_histograms[POLLSTAT_CYCLE].add(cycleNs);
+    this->_histograms[POLLSTAT_USB].add(this->_cycleTransactions);
+    this->_cycleTransactions = 0;
+}
+
+/**
+ * @brief
+ */
+void PollStats::reset()
+{
+    for (Histogram &histogram : this->_histograms)
+    {
+        histogram.reset();
+    }
+    memset(this->_channelBytes, 0, sizeof(this->_channelBytes));
+    this->_cycleTransactions = 0;
+    this->_since = std::chrono::steady_clock::now();
+}
+
+/**
+ * @brief A line per histogram and one for the channels, then starts over.
+ */
+void PollStats::report()
+{
+    static const char *names[POLLSTAT_COUNT] = {"cycle", "desc", "data", "write", "usb"};
+
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->_since).count();
+    const Histogram &cycles = this->_histograms[POLLSTAT_CYCLE];
+    LOG_USER("Poll stats, %.1f s, %llu cycles (%.0f/s)", secs, (unsigned long long)cycles.getCount(), secs > 0 ? cycles.getCount() / secs : 0.0);
+
+    for (int i = 0; i < POLLSTAT_COUNT; i++)
+    {
+        const Histogram &h = this->_histograms[i];
+        if (!h.getCount())
+        {
+            continue;
+        }
+
+        if (i == POLLSTAT_USB)
+        {
+            LOG_USER("  %-5s p50 %-8llu p99 %-8llu max %-8llu transactions per cycle", names[i], (unsigned long long)h.percentile(50),
+                     (unsigned long long)h.percentile(99), (unsigned long long)h.getMax());
+        }
+        else
+        {
+            LOG_USER("  %-5s p50 %-8s p99 %-8s max %-8s %llu", names[i], formatNs(h.percentile(50)).c_str(), formatNs(h.percentile(99)).c_str(),
+                     formatNs(h.getMax()).c_str(), (unsigned long long)h.getCount());
+        }
+    }
+
+    std::string channels;
+    for (int c = 0; c < POLLSTATS_CHANNELS; c++)
+    {
+        if (this->_channelBytes[c])
+        {
+            char buf[48];
+            snprintf(buf, sizeof(buf), " %d: %.1f KB/s", c, secs > 0 ? this->_channelBytes[c] / secs / 1024 : 0.0);
+            channels += buf;
+        }
+    }
+    if (!channels.empty())
+    {
+        LOG_USER("  channels%s", channels.c_str());
+    }
+
+    this->reset();
+}
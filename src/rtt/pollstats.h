@@ -0,0 +1,117 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_POLLSTATS_H
+#define _PH_POLLSTATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <chrono>
+
+// 8 buckets per power of two, values within 12.5 %
+#define HISTOGRAM_SUB_BITS (3)
+#define HISTOGRAM_SUBS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUBS)
+
+// RTT up channels 0..31, SWO stimulus ports 32..63
+#define POLLSTATS_CHANNELS (64)
+
+typedef enum
+{
+    POLLSTAT_CYCLE, // main loop, ns
+    POLLSTAT_DESC,  // control block read, ns
+    POLLSTAT_DATA,  // bulk read of the up buffers, ns
+    POLLSTAT_WRITE, // writeRtt(), ns
+    POLLSTAT_USB,   // probe transactions per cycle
+    POLLSTAT_COUNT,
+} POLLSTAT;
+
+//
+// Log bucketed histogram, fixed size, add() is a few instructions. The
+// exact maximum is kept aside.
+//
+class Histogram
+{
+private:
+    uint32_t _buckets[HISTOGRAM_BUCKETS];
+    uint64_t _count;
+    uint64_t _max;
+
+public:
+    Histogram();
+
+    static int bucket(uint64_t value);
+    static uint64_t upperBound(int bucket);
+
+    void add(uint64_t value);
+    void reset();
+
+    uint64_t percentile(double p) const;
+    uint64_t getCount() const { return _count; }
+    uint64_t getMax() const { return _max; }
+};
+
+//
+// Poll loop instrumentation (-t): how long cycles, control block reads,
+// bulk reads and writes take, how many probe transactions a cycle costs
+// and the bytes per channel. report() prints it all since the last report.
+//
+class PollStats
+{
+private:
+    Histogram _histograms[POLLSTAT_COUNT];
+    uint64_t _channelBytes[POLLSTATS_CHANNELS];
+    uint32_t _cycleTransactions;
+    std::chrono::steady_clock::time_point _since;
+
+public:
+    PollStats();
+
+    void add(POLLSTAT which, uint64_t value) { _histograms[which].add(value); }
+    void addTransactions(uint32_t transactions) { _cycleTransactions += transactions; }
+    void addBytes(int channel, size_t bytes);
+    void endCycle(uint64_t cycleNs);
+
+    void report();
+    void reset();
+
+    const Histogram &getHistogram(POLLSTAT which) const { return _histograms[which]; }
+    uint64_t getChannelBytes(int channel) const { return _channelBytes[channel]; }
+};
+
+//
+// Adds the time from construction to destruction, for functions with
+// many returns.
+//
+class PollTimer
+{
+private:
+    PollStats *_stats;
+    POLLSTAT _which;
+    std::chrono::steady_clock::time_point _start;
+
+public:
+    PollTimer(PollStats *stats, POLLSTAT which)
+        : _stats(stats), _which(which), _start(std::chrono::steady_clock::now()) {}
+    ~PollTimer()
+    {
+        _stats->add(_which, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count());
+    }
+};
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <algorithm>
+#include <map>
+
+// c
+#include <stdio.h>
+
+// local
+#include "profiler.h"
+#include "log.h"
+
+/**
+ * @brief Construct a new Profiler:: Profiler object
+ *
+ * @param symbols function symbols of the firmware running on the target
+ */
+Profiler::Profiler(const ElfSymbols &symbols)
+    : _symbols(symbols)
+{
+}
+
+/**
+ * @brief
+ *
+ * @param pc
+ */
+void Profiler::addSample(uint32_t pc)
+{
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    this->_pcs[pc]++;
+    this->_samples++;
+}
+
+/**
+ * @brief Adds a batch, one lock for all of them.
+ *
+ * @param pcs
+ * @param sleeps samples without PC, taken while the core was sleeping
+ */
+void Profiler::addSamples(const std::vector<uint32_t> &pcs, uint64_t sleeps)
+{
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    for (uint32_t pc : pcs)
+    {
+        this->_pcs[pc]++;
+    }
+    this->_samples += pcs.size() + sleeps;
+    this->_sleeps += sleeps;
+}
+
+/**
+ * @brief Samples per function, PCs outside of any function are reported
+ * by address.
+ *
+ * @param count how many functions
+ * @param samples all samples so far
+ * @param sleeps samples taken while the core was sleeping
+ * @return std::vector<std::pair<std::string, uint64_t>>
+ */
+std::vector<std::pair<std::string, uint64_t>> Profiler::getTop(size_t count, uint64_t *samples, uint64_t *sleeps)
+{
+    std::map<std::string, uint64_t> functions;
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        for (const auto &pc : this->_pcs)
+        {
+            const ELF_SYMBOL *symbol = this->_symbols.lookup(pc.first);
+            if (symbol)
+            {
+                functions[symbol->name] += pc.second;
+            }
+            else
+            {
+                char addr[16];
+                snprintf(addr, sizeof(addr), "0x%08x", pc.first);
+                functions[addr] += pc.second;
+            }
+        }
+
+        *samples = this->_samples;
+        *sleeps = this->_sleeps;
+    }
+
+    std::vector<std::pair<std::string, uint64_t>> top(functions.begin(), functions.end());
+    std::sort(top.begin(), top.end(),
+              [](const std::pair<std::string, uint64_t> &a, const std::pair<std::string, uint64_t> &b)
+              { return a.second > b.second; });
+
+    if (top.size() > count)
+    {
+        top.resize(count);
+    }
+
+    return top;
+}
+
+/**
+ * @brief Prints the hottest functions.
+ *
+ * @param count
+ */
+void Profiler::report(size_t count)
+{
+    uint64_t samples, sleeps;
+    auto top = this->getTop(count, &samples, &sleeps);
+    if (!samples)
+    {
+        LOG_USER("Profile: no samples");
+        return;
+    }
+
+    LOG_USER("Profile: %llu samples, %.1f%% sleeping", (unsigned long long)samples, 100.0 * sleeps / samples);
+    for (const auto &function : top)
+    {
+        LOG_USER("%6.2f%% %10llu  %s", 100.0 * function.second / samples, (unsigned long long)function.second, function.first.c_str());
+    }
+}
+
+/**
+ * @brief
+ */
+void Profiler::reset()
+{
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    this->_pcs.clear();
+    this->_samples = 0;
+    this->_sleeps = 0;
+}
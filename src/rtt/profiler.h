@@ -0,0 +1,61 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_PROFILER_H
+#define _PH_PROFILER_H
+
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "elfsymbols.h"
+
+// functions listed by report()
+#define PROFILER_TOP (10)
+
+//
+// Flat statistical profile: PC samples are counted per address as they come
+// in (cheap enough for the full SWO rate), they're attributed to functions
+// only when a report is made. Samples may be added from another thread.
+//
+class Profiler
+{
+private:
+    const ElfSymbols &_symbols;
+
+    std::mutex _mutex;
+    std::unordered_map<uint32_t, uint64_t> _pcs;
+    uint64_t _samples = 0;
+    uint64_t _sleeps = 0; // sampled while the core was sleeping (WFI/WFE)
+
+public:
+    Profiler(const ElfSymbols &symbols);
+
+    void addSample(uint32_t pc);
+    void addSamples(const std::vector<uint32_t> &pcs, uint64_t sleeps);
+
+    // function name, samples; most hit first
+    std::vector<std::pair<std::string, uint64_t>> getTop(size_t count, uint64_t *samples, uint64_t *sleeps);
+    void report(size_t count = PROFILER_TOP);
+    void reset();
+};
+
+#endif
@@ -0,0 +1,331 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <algorithm>
+#include <charconv>
+
+// c
+#include <ctype.h>
+#include <string.h>
+
+// local
+#include "scope.h"
+#include "stlink_errors.h"
+#include "log.h"
+
+/**
+ * @brief Case-insensitive compare of the first n characters, strncasecmp()
+ * isn't there with MSVC.
+ *
+ * @param a at least n characters or a shorter NUL terminated string
+ * @param b n characters
+ * @param n
+ * @return true if equal
+ */
+static bool equalNoCase(const char *a, const char *b, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Construct a new Scope Decoder:: Scope Decoder object
+ */
+ScopeDecoder::ScopeDecoder()
+{
+    this->_sampleSize = 0;
+    this->_carryUsed = 0;
+    this->_csv = false;
+    this->_samples = 0;
+}
+
+/**
+ * @brief Channel names J-Scope picks up, "JScope_t4i4" and the spelling
+ * in SEGGER_RTT.h, "J-Scope_t4i4".
+ *
+ * @param name
+ * @return true
+ */
+bool ScopeDecoder::isScopeName(const std::string &name)
+{
+    return equalNoCase(name.c_str(), "JScope_", 7) || equalNoCase(name.c_str(), "J-Scope_", 8);
+}
+
+/**
+ * @brief Sample layout from a channel name or just its type string.
+ *
+ * @param types e.g. "JScope_t4i4" or "t4i4"
+ * @param columns
+ * @return true if every type is known
+ */
+bool ScopeDecoder::parseTypes(const std::string &types, std::vector<SCOPE_COLUMN> *columns)
+{
+    size_t at = isScopeName(types) ? types.find('_') + 1 : 0;
+    uint32_t offset = 0;
+
+    columns->clear();
+    while (at < types.size())
+    {
+        SCOPE_COLUMN column;
+        column.type = (char)tolower(types[at++]);
+        column.size = 1;
+        if (column.type != 'b')
+        {
+            if (at >= types.size())
+            {
+                return false;
+            }
+            column.size = (uint8_t)(types[at++] - '0');
+        }
+
+        bool known = (column.type == 'b') ||
+                     (((column.type == 'i') || (column.type == 'u')) && ((column.size == 1) || (column.size == 2) || (column.size == 4))) ||
+                     (((column.type == 'f') || (column.type == 't')) && (column.size == 4));
+        if (!known || (columns->size() == SCOPE_MAX_COLUMNS))
+        {
+            return false;
+        }
+
+        column.offset = offset;
+        offset += column.size;
+        columns->push_back(column);
+    }
+
+    return !columns->empty();
+}
+
+/**
+ * @brief
+ *
+ * @param path CSV if it ends with .csv, binary columns otherwise
+ * @param types channel name or type string
+ * @return int ERROR_OK, ERROR_FAIL for an unknown layout or a file we can't write
+ */
+int ScopeDecoder::open(const std::string &path, const std::string &types)
+{
+    if (!parseTypes(types, &this->_columns))
+    {
+        LOG_ERROR("%s is no J-Scope sample layout", types.c_str());
+        return ERROR_FAIL;
+    }
+
+    this->_types.clear();
+    this->_sampleSize = 0;
+    for (const SCOPE_COLUMN &column : this->_columns)
+    {
+        this->_types += column.type;
+        if (column.type != 'b')
+        {
+            this->_types += (char)('0' + column.size);
+        }
+        this->_sampleSize += column.size;
+    }
+
+    if (this->_file.open(path) != ERROR_OK)
+    {
+        return ERROR_FAIL;
+    }
+
+    this->_csv = (path.size() > 4) && equalNoCase(path.c_str() + path.size() - 4, ".csv", 4);
+    if (this->_csv)
+    {
+        std::string header;
+        for (size_t c = 0; c < this->_columns.size(); c++)
+        {
+            header += c ? "," : "";
+            header += this->_columns[c].type;
+            header += std::to_string(this->_columns[c].size) + "_" + std::to_string(c);
+        }
+        header += "\n";
+        this->_file.write((const uint8_t *)header.data(), header.size());
+    }
+    else
+    {
+        SCOPE_FILE_HEADER header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SCOPE_MAGIC, sizeof(header.magic));
+        header.version = SCOPE_VERSION;
+        header.columns = (uint32_t)this->_columns.size();
+        memcpy(header.types, this->_types.data(), std::min(this->_types.size(), sizeof(header.types)));
+        this->_file.write((const uint8_t *)&header, sizeof(header));
+    }
+
+    LOG_INFO("scope: %s, %u byte samples to %s", this->_types.c_str(), this->_sampleSize, path.c_str());
+    return ERROR_OK;
+}
+
+/**
+ * @brief Channel data as it comes, samples may be split between chunks.
+ *
+ * @param data
+ * @param size
+ */
+void ScopeDecoder::feed(const uint8_t *data, size_t size)
+{
+    while (size && this->_sampleSize)
+    {
+        // finish the sample the last chunk started
+        if (this->_carryUsed)
+        {
+            size_t n = std::min((size_t)(this->_sampleSize - this->_carryUsed), size);
+            memcpy(this->_carry + this->_carryUsed, data, n);
+            this->_carryUsed += (uint32_t)n;
+            data += n;
+            size -= n;
+
+            if (this->_carryUsed == this->_sampleSize)
+            {
+                this->decode(this->_carry, 1);
+                this->_carryUsed = 0;
+            }
+            continue;
+        }
+
+        uint32_t rows = (uint32_t)std::min(size / this->_sampleSize, (size_t)SCOPE_BLOCK_ROWS);
+        if (!rows)
+        {
+            memcpy(this->_carry, data, size);
+            this->_carryUsed = (uint32_t)size;
+            break;
+        }
+
+        this->decode(data, rows);
+        data += rows * this->_sampleSize;
+        size -= rows * this->_sampleSize;
+    }
+}
+
+/**
+ * @brief Turns rows samples into columns and writes them as a block.
+ *
+ * @param data
+ * @param rows
+ */
+void ScopeDecoder::decode(const uint8_t *data, uint32_t rows)
+{
+    const uint32_t stride = this->_sampleSize;
+    this->_block.resize((size_t)stride * rows);
+
+    // fixed size copies, one loop per column the compiler can unroll
+    for (const SCOPE_COLUMN &column : this->_columns)
+    {
+        const uint8_t *src = data + column.offset;
+        uint8_t *dst = this->_block.data() + (size_t)column.offset * rows;
+        switch (column.size)
+        {
+        case 1:
+            for (uint32_t r = 0; r < rows; r++)
+                dst[r] = src[r * stride];
+            break;
+        case 2:
+            for (uint32_t r = 0; r < rows; r++)
+                memcpy(dst + r * 2, src + r * stride, 2);
+            break;
+        default:
+            for (uint32_t r = 0; r < rows; r++)
+                memcpy(dst + r * 4, src + r * stride, 4);
+            break;
+        }
+    }
+
+    if (this->_csv)
+    {
+        this->writeCsv(rows);
+    }
+    else
+    {
+        SCOPE_BLOCK_HEADER header = {rows, 0};
+        this->_file.write((const uint8_t *)&header, sizeof(header));
+        this->_file.write(this->_block.data(), this->_block.size());
+    }
+
+    if (this->_onBlock)
+    {
+        this->_onBlock(rows);
+    }
+    this->_samples += rows;
+}
+
+/**
+ * @brief A line per sample from the columns of the block.
+ *
+ * @param rows
+ */
+void ScopeDecoder::writeCsv(uint32_t rows)
+{
+    // longest value: a float, up to 15 characters, and the separator
+    this->_text.resize((size_t)rows * this->_columns.size() * 16);
+    char *p = &this->_text[0];
+    char *end = p + this->_text.size();
+
+    for (uint32_t r = 0; r < rows; r++)
+    {
+        for (size_t c = 0; c < this->_columns.size(); c++)
+        {
+            const SCOPE_COLUMN &column = this->_columns[c];
+            const uint8_t *v = this->getColumn((int)c, rows) + r * column.size;
+            if (c)
+            {
+                *p++ = ',';
+            }
+
+            switch (column.type)
+            {
+            case 'f':
+            {
+                float f;
+                memcpy(&f, v, 4);
+                p = std::to_chars(p, end, f).ptr;
+                break;
+            }
+            case 'i':
+            {
+                int32_t i = (column.size == 1) ? (int8_t)v[0] : (column.size == 2) ? (int16_t)(v[0] | (v[1] << 8)) : (int32_t)(v[0] | (v[1] << 8) | (v[2] << 16) | ((uint32_t)v[3] << 24));
+                p = std::to_chars(p, end, i).ptr;
+                break;
+            }
+            default:
+            {
+                uint32_t u = (column.size == 1) ? v[0] : (column.size == 2) ? (uint32_t)(v[0] | (v[1] << 8)) : (uint32_t)(v[0] | (v[1] << 8) | (v[2] << 16) | ((uint32_t)v[3] << 24));
+                p = std::to_chars(p, end, u).ptr;
+                break;
+            }
+            }
+        }
+        *p++ = '\n';
+    }
+
+    this->_file.write((const uint8_t *)this->_text.data(), p - this->_text.data());
+}
+
+/**
+ * @brief
+ */
+void ScopeDecoder::close()
+{
+    if (this->_carryUsed)
+    {
+        LOG_WARNING("scope: last sample incomplete, %u of %u bytes", this->_carryUsed, this->_sampleSize);
+        this->_carryUsed = 0;
+    }
+    this->_file.close();
+}
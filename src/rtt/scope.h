@@ -0,0 +1,123 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_SCOPE_H
+#define _PH_SCOPE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "filewriter.h"
+
+//
+// J-Scope sample channels: the channel name is "JScope_" and the sample
+// layout, e.g. "JScope_t4i4f4", and the target writes packed little endian
+// samples. b is a 1 byte bool, i1 i2 i4 and u1 u2 u4 integers, f4 a float,
+// t4 a time stamp in us.
+//
+// -scope file.csv writes a header line with the columns and a line per
+// sample. Any other name gets the binary columnar layout, little endian:
+//
+//   SCOPE_FILE_HEADER
+//   SCOPE_BLOCK_HEADER, column 0 values, column 1 values, ...
+//   SCOPE_BLOCK_HEADER, ...
+//
+// Each column of a block holds rows values of the column's size, so a
+// reader can map one column of a block as an array of its type.
+//
+#define SCOPE_MAGIC "STRTTSCP"
+#define SCOPE_VERSION 1
+#define SCOPE_MAX_COLUMNS (16)
+// a block of the binary file holds at most
+#define SCOPE_BLOCK_ROWS (4096)
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t columns;
+    char types[SCOPE_MAX_COLUMNS * 2]; // as in the channel name, e.g. "t4i4", 0 padded
+} SCOPE_FILE_HEADER;
+
+typedef struct
+{
+    uint32_t rows;
+    uint32_t reserved;
+} SCOPE_BLOCK_HEADER;
+
+typedef struct
+{
+    char type; // b i u f t
+    uint8_t size;
+    uint32_t offset; // in the sample
+} SCOPE_COLUMN;
+
+// called with every decoded block, its columns are valid during the call
+typedef std::function<void(uint32_t rows)> ScopeBlockFunction;
+
+//
+// Cuts a sample channel into samples, whatever size the chunks come in,
+// and writes them as columns.
+//
+class ScopeDecoder
+{
+private:
+    std::vector<SCOPE_COLUMN> _columns;
+    std::string _types;
+    uint32_t _sampleSize;
+
+    // the start of a sample the last chunk ended with
+    uint8_t _carry[SCOPE_MAX_COLUMNS * 4];
+    uint32_t _carryUsed;
+
+    bool _csv;
+    FileWriter _file;
+    // one block, column by column
+    std::vector<uint8_t> _block;
+    std::string _text;
+    uint64_t _samples;
+    ScopeBlockFunction _onBlock;
+
+    void decode(const uint8_t *data, uint32_t rows);
+    void writeCsv(uint32_t rows);
+
+public:
+    ScopeDecoder();
+
+    static bool isScopeName(const std::string &name);
+    static bool parseTypes(const std::string &types, std::vector<SCOPE_COLUMN> *columns);
+
+    int open(const std::string &path, const std::string &types);
+    void feed(const uint8_t *data, size_t size);
+    void close();
+
+    void setBlockHandler(ScopeBlockFunction onBlock) { _onBlock = onBlock; }
+
+    const std::vector<SCOPE_COLUMN> &getColumns() const { return _columns; }
+    // column c of the last block, rows values of its size
+    const uint8_t *getColumn(int c, uint32_t rows) const { return _block.data() + _columns[c].offset * rows; }
+
+    uint64_t getSamples() const { return _samples; }
+    uint64_t getWritten() const { return _file.getWritten(); }
+    uint64_t getDropped() const { return _file.getDropped(); }
+};
+
+#endif
@@ -19,6 +19,7 @@
 #include <chrono>
 #include <algorithm>
 #include <list>
+#include <cmath>
 
 // c
 #include <string.h>
@@ -26,11 +27,11 @@
 // local
 #include "strtt.h"
 #include "log.h"
+#include "itm.h"
 
 #define MAX_STR_LENGTH 64
 
-#define START_TS auto __start_ts = std::chrono::high_resolution_clock::now()
-#define STOP_TS this->_duration = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - __start_ts).count()
+#define PROBE_LOCK std::lock_guard<std::recursive_mutex> __probe_lock(this->_probeMutex)
 
 /**
  * @brief Construct a new St Rtt:: St Rtt object
@@ -99,9 +100,187 @@ void StRtt::init()
  */
 int StRtt::open(bool use_tcp = false, uint16_t port_tcp)
 {
+    PROBE_LOCK;
     this->_param.use_stlink_tcp = use_tcp;
     this->_param.stlink_tcp_port = port_tcp;
-    return stlink_usb_layout_api.open(&this->_param, &this->_handle);
+    int ret = stlink_usb_layout_api.open(&this->_param, &this->_handle);
+    this->_cache.setHandle(this->_handle);
+    return ret;
+}
+
+/**
+ * @brief Sets a bit mask in a 32 bit target register.
+ */
+static int setRegBits(void *handle, uint32_t addr, uint32_t bits)
+{
+    uint8_t buffer[4];
+    int ret = stlink_usb_layout_api.read_mem(handle, addr, 4, 1, buffer);
+    if (ret != ERROR_OK)
+    {
+        return ret;
+    }
+
+    uint32_t value;
+    memcpy(&value, buffer, sizeof(value));
+    return stlink_usb_layout_api.write_debug_reg(handle, addr, value | bits);
+}
+
+/**
+ * @brief Starts SWO capture: asynchronous NRZ at the probe's fastest rate
+ * (unless *swoHz is set), TPIU prescaler to match and all ITM stimulus
+ * ports enabled. The target firmware doesn't have to set anything up.
+ *
+ * @param cpuHz core clock, TRACECLKIN of the TPIU
+ * @param swoHz in: wanted SWO rate, 0 = fastest, out: rate in use
+ * @return int
+ */
+int StRtt::enableSwo(uint32_t cpuHz, uint32_t *swoHz)
+{
+    PROBE_LOCK;
+
+    unsigned int traceHz = *swoHz;
+    uint16_t prescaler;
+    int ret = stlink_usb_layout_api.config_trace(this->_handle, true, TPIU_PIN_PROTOCOL_ASYNC_UART, 1, &traceHz, cpuHz, &prescaler);
+    if (ret != ERROR_OK)
+    {
+        return ret;
+    }
+
+    const struct
+    {
+        uint32_t addr;
+        uint32_t value;
+    } regs[] = {
+        {TPIU_CSPSR_ADDR, 1}, // 1 bit port
+        {TPIU_ACPR_ADDR, (uint32_t)prescaler - 1},
+        {TPIU_SPPR_ADDR, TPIU_PIN_PROTOCOL_ASYNC_UART},
+        {TPIU_FFCR_ADDR, TPIU_FFCR_TRIGIN}, // formatter off, ITM only
+        {ITM_LAR_ADDR, ITM_LAR_KEY},
+        {ITM_TCR_ADDR, ITM_TCR_ITMENA | ITM_TCR_SYNCENA | ITM_TCR_TXENA | ITM_TCR_TRACEBUSID(1)},
+        {ITM_TPR_ADDR, 0}, // unprivileged code may write too
+        {ITM_TER_ADDR, 0xFFFFFFFF},
+    };
+
+    ret = setRegBits(this->_handle, DEMCR_ADDR, DEMCR_TRCENA);
+    if (ret == ERROR_OK)
+    {
+        ret = setRegBits(this->_handle, DBGMCU_CR_ADDR, DBGMCU_CR_TRACE_IOEN);
+    }
+
+    for (size_t i = 0; (i < sizeof(regs) / sizeof(regs[0])) && (ret == ERROR_OK); i++)
+    {
+        ret = stlink_usb_layout_api.write_debug_reg(this->_handle, regs[i].addr, regs[i].value);
+    }
+
+    if (ret != ERROR_OK)
+    {
+        LOG_ERROR("Failed to set up TPIU/ITM for SWO (%d)", ret);
+        stlink_usb_layout_api.config_trace(this->_handle, false, TPIU_PIN_PROTOCOL_ASYNC_UART, 1, &traceHz, cpuHz, &prescaler);
+        return ret;
+    }
+
+    LOG_INFO("SWO: %u Hz (core %u Hz / %u)", traceHz, cpuHz, prescaler);
+    *swoHz = traceHz;
+    return ERROR_OK;
+}
+
+/**
+ * @brief Has the DWT send periodic PC samples over SWO (SWO must be enabled
+ * already). The rate is picked so the samples (5 bytes each) take about
+ * half of the SWO bandwidth, the rest is left to ITM.
+ *
+ * @param cpuHz
+ * @param swoHz
+ * @param sampleHz samples per second we'll get
+ * @return int
+ */
+int StRtt::enablePcSampling(uint32_t cpuHz, uint32_t swoHz, uint32_t *sampleHz)
+{
+    PROBE_LOCK;
+
+    // NRZ: 10 bits per byte, 5 bytes per sample, half the bandwidth
+    uint32_t maxRate = swoHz / 10 / 5 / 2;
+    uint64_t interval = maxRate ? ((uint64_t)cpuHz + maxRate - 1) / maxRate : UINT32_MAX;
+
+    // CYCCNT tap at bit 6 or bit 10, POSTCNT reload 0..15
+    uint32_t tap = (interval > 64 * 16) ? 1024 : 64;
+    uint64_t steps = (interval + tap - 1) / tap;
+    uint32_t postPreset = (uint32_t)std::min<uint64_t>(std::max<uint64_t>(steps, 1), 16) - 1;
+
+    uint8_t buffer[4];
+    int ret = stlink_usb_layout_api.read_mem(this->_handle, DWT_CTRL_ADDR, 4, 1, buffer);
+    if (ret != ERROR_OK)
+    {
+        return ret;
+    }
+
+    uint32_t ctrl;
+    memcpy(&ctrl, buffer, sizeof(ctrl));
+    ctrl &= ~(DWT_CTRL_POSTPRESET_MASK | DWT_CTRL_POSTINIT_MASK | DWT_CTRL_CYCTAP);
+    ctrl |= DWT_CTRL_CYCCNTENA | DWT_CTRL_PCSAMPLENA | DWT_CTRL_POSTPRESET(postPreset);
+    if (tap == 1024)
+        ctrl |= DWT_CTRL_CYCTAP;
+
+    ret = stlink_usb_layout_api.write_debug_reg(this->_handle, DWT_CTRL_ADDR, ctrl);
+    if (ret != ERROR_OK)
+    {
+        return ret;
+    }
+
+    *sampleHz = cpuHz / (tap * (postPreset + 1));
+    LOG_INFO("PC sampling every %u cycles, %u samples/s", tap * (postPreset + 1), *sampleHz);
+    return ERROR_OK;
+}
+
+/**
+ * @brief Takes whatever the probe has buffered from SWO.
+ *
+ * @param buffer
+ * @param size in: buffer size, out: bytes received
+ * @return int
+ */
+int StRtt::pollSwo(uint8_t *buffer, size_t *size)
+{
+    PROBE_LOCK;
+    return stlink_usb_layout_api.poll_trace(this->_handle, buffer, size);
+}
+
+/**
+ * @brief
+ *
+ * @return int
+ */
+int StRtt::disableSwo()
+{
+    PROBE_LOCK;
+
+    // stop PC sampling, if it was on
+    uint8_t buffer[4];
+    if (stlink_usb_layout_api.read_mem(this->_handle, DWT_CTRL_ADDR, 4, 1, buffer) == ERROR_OK)
+    {
+        uint32_t ctrl;
+        memcpy(&ctrl, buffer, sizeof(ctrl));
+        if (ctrl & DWT_CTRL_PCSAMPLENA)
+        {
+            stlink_usb_layout_api.write_debug_reg(this->_handle, DWT_CTRL_ADDR, ctrl & ~DWT_CTRL_PCSAMPLENA);
+        }
+    }
+
+    return stlink_usb_layout_api.config_trace(this->_handle, false, TPIU_PIN_PROTOCOL_ASYNC_UART, 1, nullptr, 0, nullptr);
+}
+
+/**
+ * @brief Reads target memory, through the cache if the range is cacheable.
+ *
+ * @param addr
+ * @param count
+ * @param buffer
+ * @return int
+ */
+int StRtt::readMem(uint32_t addr, uint32_t count, uint8_t *buffer)
+{
+    PROBE_LOCK;
+    return this->_cache.read(addr, count, buffer);
 }
 
 /**
@@ -111,6 +290,7 @@ int StRtt::open(bool use_tcp = false, uint16_t port_tcp)
  */
 int StRtt::close()
 {
+    PROBE_LOCK;
     return stlink_usb_layout_api.close(this->_handle);
 }
 
@@ -122,17 +302,245 @@ int StRtt::close()
  */
 int StRtt::getIdCode(uint32_t *pIdCode)
 {
-    START_TS;
+    PROBE_LOCK;
 
     int ret;
 
     ret = stlink_usb_layout_api.idcode(this->_handle, pIdCode);
 
-    STOP_TS;
+    return ret;
+}
+
+/**
+ * @brief
+ *
+ * @param pCpuId
+ * @return int
+ */
+int StRtt::getCpuId(uint32_t *pCpuId)
+{
+    PROBE_LOCK;
+
+    uint8_t buffer[4];
+    int ret = stlink_usb_layout_api.read_mem(this->_handle, CPUID_ADDR, 4, 1, buffer);
+    if (ret == ERROR_OK)
+    {
+        memcpy(pCpuId, buffer, sizeof(*pCpuId));
+    }
 
     return ret;
 }
 
+/**
+ * @brief
+ *
+ * @param khz requested interface clock
+ * @param actualKhz clock the probe actually settled on (optional)
+ * @return int
+ */
+int StRtt::setSpeed(int khz, int *actualKhz)
+{
+    PROBE_LOCK;
+    int actual = stlink_usb_layout_api.speed(this->_handle, khz, false);
+    if (actual < 0)
+    {
+        return actual;
+    }
+
+    this->_speedKhz = khz;
+
+    if (actualKhz)
+    {
+        *actualKhz = actual;
+    }
+
+    LOG_DEBUG("Interface clock set to %d kHz", actual);
+    return ERROR_OK;
+}
+
+/**
+ * @brief Finds a RAM window we may scribble on without the target noticing:
+ * the free part of down-buffer 0, right after WrOff. The target only ever
+ * reads RdOff..WrOff of a down-buffer, so anything past WrOff is ours until
+ * we move WrOff.
+ *
+ * warning: it is valid after findRtt()
+ *
+ * @param addr
+ * @param size
+ * @return int
+ */
+int StRtt::getScratchWindow(uint32_t *addr, uint32_t *size)
+{
+    if (!this->_rtt_info.pRttDescription)
+    {
+        return ERROR_FAIL;
+    }
+
+    const SEGGER_RTT_BUFFER &ring = this->_rtt_info.pRttDescription->buffDesc[this->_rtt_info.pRttDescription->MaxNumUpBuffers];
+    if ((ring.SizeOfBuffer == 0) || (ring.WrOff >= ring.SizeOfBuffer) || (ring.RdOff >= ring.SizeOfBuffer))
+    {
+        return ERROR_FAIL;
+    }
+
+    // contiguous free space starting at WrOff, one byte is always kept free
+    uint32_t end = (ring.RdOff > ring.WrOff) ? ring.RdOff - 1 : ring.SizeOfBuffer - (ring.RdOff == 0 ? 1 : 0);
+    uint32_t start = ring.pBuffer + ring.WrOff;
+
+    // keep it word aligned, this is what we want to measure
+    uint32_t alignedStart = (start + 3) & ~3u;
+    uint32_t alignedEnd = (ring.pBuffer + end) & ~3u;
+    if (alignedEnd <= alignedStart)
+    {
+        return ERROR_FAIL;
+    }
+
+    *addr = alignedStart;
+    *size = alignedEnd - alignedStart;
+    return ERROR_OK;
+}
+
+/**
+ * @brief Walks the probe's clock table from the top down. At every clock
+ * it writes a pattern to the scratch window, reads it back and compares,
+ * and also times a bulk read of the RAM window we scan for RTT. The first
+ * (fastest) clock that gets through without a single error is kept. If
+ * none does, the probe goes back to the clock it started at. The scratch
+ * window gets its original content back at the end, at a clock that
+ * passed (or the starting one, which the original read already used).
+ *
+ * @param scratchAddr RAM the pattern test may overwrite
+ * @param scratchSize
+ * @param khz selected clock
+ * @return int
+ */
+int StRtt::autoSpeed(uint32_t scratchAddr, uint32_t scratchSize, int *khz)
+{
+    PROBE_LOCK;
+
+    int speeds[AUTOSPEED_MAX_STEPS];
+    unsigned int count = AUTOSPEED_MAX_STEPS;
+    int ret = stlink_usb_layout_api.speed_map(this->_handle, speeds, &count);
+    if (ret != ERROR_OK)
+    {
+        return ret;
+    }
+
+    if (count == 0)
+    {
+        LOG_WARNING("Probe can't change the interface clock, nothing to tune");
+        return ERROR_FAIL;
+    }
+
+    int startKhz = this->_speedKhz;
+
+    std::vector<uint8_t> original(scratchSize);
+    ret = stlink_usb_layout_api.read_mem(this->_handle, scratchAddr, -1, scratchSize, original.data());
+    if (ret != ERROR_OK)
+    {
+        return ret;
+    }
+
+    std::vector<uint8_t> pattern(scratchSize);
+    std::vector<uint8_t> readBack(scratchSize);
+    std::vector<uint8_t> bulk(this->_memory.size());
+
+    int chosen = 0;
+    for (unsigned int step = 0; (step < count) && !chosen; step++)
+    {
+        int actual = speeds[step];
+        ret = this->setSpeed(speeds[step], &actual);
+        if (ret != ERROR_OK)
+        {
+            LOG_WARNING("Can't set %d kHz (%d)", speeds[step], ret);
+            continue;
+        }
+
+        unsigned int errors = 0;
+        uint64_t bytes = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (uint32_t round = 0; round < AUTOSPEED_ROUNDS; round++)
+        {
+            // xorshift32, different for every clock and round
+            uint32_t x = 0x9E3779B9u * (round + 1) ^ (uint32_t)actual;
+            for (uint8_t &b : pattern)
+            {
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                b = (uint8_t)x;
+            }
+
+            if (stlink_usb_layout_api.write_mem(this->_handle, scratchAddr, -1, scratchSize, pattern.data()) != ERROR_OK)
+            {
+                errors++;
+                continue;
+            }
+
+            if (stlink_usb_layout_api.read_mem(this->_handle, scratchAddr, -1, scratchSize, readBack.data()) != ERROR_OK)
+            {
+                errors++;
+                continue;
+            }
+
+            for (uint32_t i = 0; i < scratchSize; i++)
+            {
+                errors += (pattern[i] != readBack[i]);
+            }
+            bytes += 2 * scratchSize;
+
+            // RAM window is known once findRtt() ran
+            if (bulk.empty())
+            {
+                continue;
+            }
+
+            if (stlink_usb_layout_api.read_mem(this->_handle, ramStart, -1, (uint32_t)bulk.size(), bulk.data()) != ERROR_OK)
+            {
+                errors++;
+                continue;
+            }
+            bytes += bulk.size();
+        }
+
+        double us = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+        LOG_USER("autospeed: %5d kHz %8.3f MB/s %u errors", actual, us > 0 ? bytes / us : 0.0, errors);
+
+        if (!errors)
+        {
+            chosen = actual;
+        }
+    }
+
+    if (!chosen)
+    {
+        LOG_ERROR("No clock passed the read-back test, going back to %d kHz", startKhz);
+        if (this->setSpeed(startKhz) != ERROR_OK)
+        {
+            LOG_ERROR("Can't set %d kHz, scratch window at 0x%08x not restored", startKhz, scratchAddr);
+            return ERROR_FAIL;
+        }
+    }
+
+    // give the target its memory back
+    ret = stlink_usb_layout_api.write_mem(this->_handle, scratchAddr, -1, scratchSize, original.data());
+
+    if (!chosen)
+    {
+        return ERROR_FAIL;
+    }
+
+    if (ret != ERROR_OK)
+    {
+        return ret;
+    }
+
+    *khz = chosen;
+
+    return ERROR_OK;
+}
+
 /**
  * @brief
  *
@@ -142,14 +550,16 @@ int StRtt::getIdCode(uint32_t *pIdCode)
  */
 int StRtt::findRtt(uint32_t ramKbytes)
 {
-    START_TS;
+    PROBE_LOCK;
+
+    // fresh attach, flash may have changed since we last looked
+    this->_cache.invalidate();
 
     // read the whole RAM ---------------------------------------------------------------
     this->_memory.resize(ramKbytes * 1024);
     int ret = stlink_usb_layout_api.read_mem(this->_handle, ramStart, -1, ramKbytes * 0x400, this->_memory.data());
     if (ret != ERROR_OK)
     {
-        STOP_TS;
         return ret;
     }
 
@@ -174,7 +584,6 @@ int StRtt::findRtt(uint32_t ramKbytes)
     if (this->_rtt_info.offset == 0)
     {
         LOG_ERROR("RTT not found");
-        STOP_TS;
         return -1;
     }
 
@@ -183,7 +592,6 @@ int StRtt::findRtt(uint32_t ramKbytes)
         LOG_ERROR("Max number of UP buffers: %d and DOWN buffers: %d",
                   this->_rtt_info.pRttDescription->MaxNumUpBuffers,
                   this->_rtt_info.pRttDescription->MaxNumDownBuffers);
-        STOP_TS;
         return -1;
     }
 
@@ -191,7 +599,6 @@ int StRtt::findRtt(uint32_t ramKbytes)
               this->_rtt_info.pRttDescription->MaxNumUpBuffers,
               this->_rtt_info.pRttDescription->MaxNumDownBuffers);
 
-    STOP_TS;
     return ERROR_OK;
 }
 
@@ -202,7 +609,7 @@ int StRtt::findRtt(uint32_t ramKbytes)
  */
 int StRtt::getRttDesc()
 {
-    START_TS;
+    PROBE_LOCK;
 
     // TODO: sanity checks (pointers)
     unsigned int size = this->_rtt_info.pRttDescription->MaxNumUpBuffers + this->_rtt_info.pRttDescription->MaxNumDownBuffers;
@@ -213,10 +620,15 @@ int StRtt::getRttDesc()
         char strChannelName[MAX_STR_LENGTH];
         if (this->_rtt_info.pRttDescription->buffDesc[i].sName)
         {
-            // we have to read it from flash
-            stlink_usb_layout_api.read_mem(this->_handle, this->_rtt_info.pRttDescription->buffDesc[i].sName, -1, MAX_STR_LENGTH, (uint8_t *)strChannelName);
-            _rtt_info_names[i] = std::string(strChannelName);
-            LOG_INFO("%d. Channel name: %s\tsize: %d\tmode: %d", (int)i, strChannelName,
+            // we have to read it from flash, names of all channels usually share a cache page
+            int ret = this->readMem(this->_rtt_info.pRttDescription->buffDesc[i].sName, MAX_STR_LENGTH, (uint8_t *)strChannelName);
+            if (ret != ERROR_OK)
+            {
+                return ret;
+            }
+
+            _rtt_info_names[i] = std::string(strChannelName, strnlen(strChannelName, MAX_STR_LENGTH));
+            LOG_INFO("%d. Channel name: %s\tsize: %d\tmode: %d", (int)i, _rtt_info_names[i].c_str(),
                      this->_rtt_info.pRttDescription->buffDesc[i].SizeOfBuffer,
                      this->_rtt_info.pRttDescription->buffDesc[i].Flags);
         }
@@ -228,7 +640,6 @@ int StRtt::getRttDesc()
         }
     }
 
-    STOP_TS;
     return ERROR_OK;
 }
 
@@ -248,6 +659,54 @@ int StRtt::getRttBuffSize(uint32_t index, uint32_t *sizeRead, uint32_t *sizeWrit
     return ERROR_OK;
 }
 
+/**
+ * @brief Up-channel registered under the given name, valid after getRttDesc().
+ *
+ * @param name e.g. "Terminal", "SysView"
+ * @return int channel index or -1
+ */
+int StRtt::findUpChannel(const std::string &name) const
+{
+    if (!this->_rtt_info.pRttDescription)
+        return -1;
+
+    uint32_t count = std::min((uint32_t)this->_rtt_info_names.size(), this->_rtt_info.pRttDescription->MaxNumUpBuffers);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (this->_rtt_info_names[i] == name)
+            return (int)i;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Name of an up-channel, valid after getRttDesc().
+ *
+ * @param index
+ * @return std::string empty if there is no such channel or it has no name
+ */
+std::string StRtt::getUpChannelName(int index) const
+{
+    if (!this->_rtt_info.pRttDescription || (index < 0) || ((uint32_t)index >= this->_rtt_info.pRttDescription->MaxNumUpBuffers) ||
+        ((size_t)index >= this->_rtt_info_names.size()))
+        return std::string();
+
+    return this->_rtt_info_names[index];
+}
+
+/**
+ * @brief Up and down buffers in the control block, valid after getRttDesc().
+ *
+ * @param up
+ * @param down
+ */
+void StRtt::getChannelCount(uint32_t *up, uint32_t *down) const
+{
+    *up = this->_rtt_info.pRttDescription ? this->_rtt_info.pRttDescription->MaxNumUpBuffers : 0;
+    *down = this->_rtt_info.pRttDescription ? this->_rtt_info.pRttDescription->MaxNumDownBuffers : 0;
+}
+
 /**
  * @brief Checks that a buffer descriptor's address actually falls inside the
  * RAM window we downloaded into this->_memory (starting at ramStart). The
@@ -274,19 +733,55 @@ bool StRtt::isBufferAddressValid(const SEGGER_RTT_BUFFER &bufferDesc) const
  */
 int StRtt::readRtt()
 {
-    START_TS;
+    PROBE_LOCK;
+
+    // 0. halted core can't produce anything, just check if it runs again
+    if (this->_halted)
+    {
+        int ret = this->sampleHalt();
+        if ((ret != ERROR_OK) || this->_halted)
+        {
+            return ret;
+        }
+    }
 
     // 1. read rtt desc
     uint32_t start = this->_rtt_info.offset;
     unsigned int buffersCnt = this->_rtt_info.pRttDescription->MaxNumUpBuffers + this->_rtt_info.pRttDescription->MaxNumDownBuffers;
     uint32_t size = sizeof(SEGGER_RTT_CB) + sizeof(SEGGER_RTT_BUFFER) * buffersCnt;
+    uint32_t descSize = size;
+
+    // a deferred bulk read is waiting, poll again only when there are
+    // tokens for all of it, otherwise the descriptor reads would eat them up
+    bool saved = this->_budget.pendingBytes != 0;
+    bool allowed = saved ? this->budgetAllows(this->_budget.pendingBytes, this->_budget.pendingTransactions)
+                         : this->budgetAllows(descSize, 1);
+    if (!allowed)
+    {
+        return ERROR_OK;
+    }
+
+    auto descStart = std::chrono::steady_clock::now();
     int ret = stlink_usb_layout_api.read_mem(this->_handle, start + ramStart, -1, size, &this->_memory[start]);
+    this->_pollStats.add(POLLSTAT_DESC, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - descStart).count());
+    this->budgetCharge(size, 1);
+    this->_budget.pendingBytes = 0;
+    this->_budget.pendingTransactions = 0;
     if (ret < 0)
     {
-        STOP_TS;
         return ret;
     }
 
+    // what we hand out below is as of now
+    this->_pollSeq++;
+    this->_pollTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    // profile, right after the descriptor read
+    if (this->_pcSampler)
+    {
+        this->samplePc();
+    }
+
     // establish memory range which we have to read
     // start address and size
     std::list<std::pair<uint32_t, uint32_t>> blocks;
@@ -312,12 +807,22 @@ int StRtt::readRtt()
     }
 
     // 3. If nothing to be read return
+    // the descriptor read can't carry DHCSR along (no scatter read in the ST-LINK
+    // command set), so the core state is sampled only every few idle cycles,
+    // a core that produces data is running anyway
     if (blocks.empty())
     {
-        STOP_TS;
-        return ERROR_OK;
+        int ret = ERROR_OK;
+        if (++this->_idleCycles >= HALT_SAMPLE_IDLE_CYCLES)
+        {
+            ret = this->sampleHalt();
+        }
+
+        return ret;
     }
 
+    this->_idleCycles = 0;
+
     // 4. Find Min/Max range that we need to read
     blocks.sort();
     start = blocks.front().first;
@@ -327,16 +832,29 @@ int StRtt::readRtt()
     if (size > SANE_SIZE_MAX)
     {
         LOG_ERROR("Read rtt memory size is insane: %d", size);
-        STOP_TS;
         return ERROR_OK;
     }
 
     // 5. Read memory
+    // with a tight budget keep doing descriptor-only polls until the tokens
+    // for the bulk read (and the RdOff write-backs) have been saved up
+    uint32_t bulk = ((size / 4) * 4) + 4;
+    uint32_t xfers = (bulk + BUDGET_XFER_BYTES - 1) / BUDGET_XFER_BYTES;
+    if (!saved && !this->budgetAllows(bulk, xfers + (uint32_t)blocks.size()))
+    {
+        this->_budget.pendingBytes = descSize + bulk;
+        this->_budget.pendingTransactions = 1 + xfers + (uint32_t)blocks.size();
+        this->_budget.deferred++;
+        return ERROR_OK;
+    }
+
     // ret = stlink_usb_layout_api.read_mem(this->_handle, start + RAM_START, -1, size, &this->_memory[start]);
-    ret = stlink_usb_layout_api.read_mem(this->_handle, start + ramStart, -1, ((size / 4) * 4) + 4, &this->_memory[start]);
+    auto dataStart = std::chrono::steady_clock::now();
+    ret = stlink_usb_layout_api.read_mem(this->_handle, start + ramStart, -1, bulk, &this->_memory[start]);
+    this->_pollStats.add(POLLSTAT_DATA, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - dataStart).count());
+    this->budgetCharge(bulk, xfers);
     if (ret < 0)
     {
-        STOP_TS;
         return ret;
     }
 
@@ -362,7 +880,6 @@ int StRtt::readRtt()
         }
     }
 
-    STOP_TS;
     return ERROR_OK;
 }
 
@@ -379,6 +896,7 @@ int StRtt::readRtt()
  */
 int StRtt::readRttFromBuff(int index, std::vector<uint8_t> *buffer)
 {
+    PROBE_LOCK;
     SEGGER_RTT_BUFFER *pRing = &this->_rtt_info.pRttDescription->buffDesc[index];
     unsigned int WrOff = pRing->WrOff; // Position of next item to be written by either target.
     unsigned int RdOff = pRing->RdOff; // Position of next item to be read by host. Must be volatile since it may be modified by host.
@@ -410,6 +928,7 @@ int StRtt::readRttFromBuff(int index, std::vector<uint8_t> *buffer)
         // we read up to read value of data - we can use it (WrOff)
         // other way we should do some maths with wrap-around logic
         int ret = stlink_usb_layout_api.write_mem(this->_handle, addrRdOff, -1, 4, (uint8_t *)&WrOff);
+        this->budgetCharge(4, 1);
         if (ret < 0)
         {
             return ret;
@@ -419,6 +938,271 @@ int StRtt::readRttFromBuff(int index, std::vector<uint8_t> *buffer)
     return buffer->size();
 }
 
+/**
+ * @brief Gets a wedged probe working again and picks RTT up where we left
+ * it, all without touching the target or closing the handle. Meant to be
+ * called after readRtt()/writeRtt() failed.
+ *
+ * @return int
+ */
+int StRtt::recover()
+{
+    PROBE_LOCK;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // can't tell what happened to the target while the probe was gone
+    this->_cache.invalidate();
+
+    int ret = stlink_usb_layout_api.recover(this->_handle);
+    if (ret == ERROR_OK)
+    {
+        ret = this->reattachRtt();
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    this->_recoveryStats.downtimeMs += ms;
+
+    if (ret == ERROR_OK)
+    {
+        this->_recoveryStats.count++;
+        this->_recoveryStats.lastMs = ms;
+        LOG_USER("Probe recovered in %.1f ms (%u so far)", ms, this->_recoveryStats.count);
+    }
+    else
+    {
+        this->_recoveryStats.failed++;
+        LOG_ERROR("Probe recovery failed (%d) after %.1f ms", ret, ms);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Tells a probe that stopped answering, which needs recover(), from
+ * an ordinary failed transfer, which is better just retried.
+ *
+ * @return true if the probe keeps timing out
+ */
+bool StRtt::isWedged()
+{
+    PROBE_LOCK;
+
+    return stlink_usb_layout_api.wedged(this->_handle);
+}
+
+/**
+ * @brief Re-reads the control block at the address findRtt() found it.
+ * Only if it's not there anymore (target was reflashed/reset meanwhile)
+ * the whole RAM window is scanned again.
+ *
+ * @return int
+ */
+int StRtt::reattachRtt()
+{
+    uint32_t start = this->_rtt_info.offset;
+    uint32_t maxUp = this->_rtt_info.pRttDescription->MaxNumUpBuffers;
+    uint32_t maxDown = this->_rtt_info.pRttDescription->MaxNumDownBuffers;
+    uint32_t size = sizeof(SEGGER_RTT_CB) + sizeof(SEGGER_RTT_BUFFER) * (maxUp + maxDown);
+
+    std::vector<uint8_t> cb(size);
+    int ret = stlink_usb_layout_api.read_mem(this->_handle, start + ramStart, -1, size, cb.data());
+    if (ret != ERROR_OK)
+    {
+        return ret;
+    }
+
+    // down-buffer may have changed under us, take a fresh snapshot on next write
+    this->_wrMemory.clear();
+    this->_halted = false;
+
+    const SEGGER_RTT_CB *pCb = (const SEGGER_RTT_CB *)cb.data();
+    if ((strncmp(pCb->acID, "SEGGER RTT", 16) != 0) || (pCb->MaxNumUpBuffers != maxUp) || (pCb->MaxNumDownBuffers != maxDown))
+    {
+        LOG_WARNING("RTT control block moved, scanning RAM again");
+        this->_rtt_info.offset = 0;
+        return this->findRtt((uint32_t)this->_memory.size() / 1024);
+    }
+
+    memcpy(&this->_memory[start], cb.data(), size);
+    return ERROR_OK;
+}
+
+/**
+ * @brief Reads DHCSR and updates the halted flag, which switches
+ * getPollDelayMs() between full rate and the heartbeat.
+ *
+ * @return int
+ */
+int StRtt::sampleHalt()
+{
+    this->_idleCycles = 0;
+
+    uint32_t dhcsr;
+    int ret = stlink_usb_layout_api.read_debug_reg(this->_handle, DHCSR_ADDR, &dhcsr);
+    this->budgetCharge(4, 1);
+    if (ret != ERROR_OK)
+    {
+        return ret;
+    }
+
+    bool halted = (dhcsr & DHCSR_S_HALT) != 0;
+    if (halted != this->_halted)
+    {
+        if (halted)
+            LOG_INFO("Target halted, polling every %d ms", HALT_HEARTBEAT_MS);
+        else
+            LOG_INFO("Target running, polling at full rate");
+    }
+
+    this->_halted = halted;
+    return ERROR_OK;
+}
+
+/**
+ * @brief Reads DWT_PCSR for the profiler. It's one more probe transaction
+ * per poll: the ST-LINK command set has no scatter read to fetch it along
+ * with the descriptors. A core without PCSR (it's optional on ARMv6-M)
+ * turns the sampler off instead of failing readRtt().
+ */
+void StRtt::samplePc()
+{
+    uint32_t pc;
+    int ret = stlink_usb_layout_api.read_debug_reg(this->_handle, DWT_PCSR_ADDR, &pc);
+    this->budgetCharge(4, 1);
+    if (ret != ERROR_OK)
+    {
+        LOG_WARNING("Reading DWT_PCSR failed (%d), PC sampling stopped", ret);
+        this->_pcSampler = nullptr;
+        return;
+    }
+
+    if (pc != PCSR_NO_SAMPLE)
+    {
+        this->_pcSampler(pc);
+    }
+}
+
+/**
+ * @brief How long the caller should wait before the next readRtt(): the
+ * heartbeat while the core is halted, or until the budget has saved up
+ * enough tokens for the next poll.
+ *
+ * @return int
+ */
+int StRtt::getPollDelayMs()
+{
+    double delay = this->_halted ? HALT_HEARTBEAT_MS : 0;
+
+    if (this->hasBudget() && this->_rtt_info.pRttDescription)
+    {
+        this->budgetRefill();
+
+        uint32_t bytes = this->_budget.pendingBytes;
+        uint32_t transactions = this->_budget.pendingTransactions;
+        if (!bytes)
+        {
+            unsigned int buffersCnt = this->_rtt_info.pRttDescription->MaxNumUpBuffers + this->_rtt_info.pRttDescription->MaxNumDownBuffers;
+            bytes = sizeof(SEGGER_RTT_CB) + sizeof(SEGGER_RTT_BUFFER) * buffersCnt;
+            transactions = 1;
+        }
+
+        if (this->_budget.bytesPerSec)
+        {
+            double missing = std::min((double)bytes, (double)this->_budget.bytesPerSec) - this->_budget.bytes;
+            delay = std::max(delay, missing * 1000 / this->_budget.bytesPerSec);
+        }
+
+        if (this->_budget.tps)
+        {
+            double missing = std::min((double)transactions, (double)this->_budget.tps) - this->_budget.transactions;
+            delay = std::max(delay, missing * 1000 / this->_budget.tps);
+        }
+    }
+
+    return (int)std::ceil(delay);
+}
+
+/**
+ * @brief Limits the probe traffic generated by readRtt()/writeRtt(), so a
+ * debugger sharing the probe (-tcp) stays responsive.
+ *
+ * @param bytesPerSec 0 = unlimited
+ * @param tps USB transactions per second, 0 = unlimited
+ */
+void StRtt::setBudget(uint32_t bytesPerSec, uint32_t tps)
+{
+    this->_budget = {};
+    this->_budget.bytesPerSec = bytesPerSec;
+    this->_budget.tps = tps;
+    this->_budget.bytes = bytesPerSec;
+    this->_budget.transactions = tps;
+    this->_budget.refill = this->_budget.usage = std::chrono::steady_clock::now();
+}
+
+/**
+ * @brief Share of the budget used since the previous call, in percent.
+ *
+ * @param bytesPct
+ * @param tpsPct
+ * @param deferred bulk reads postponed for lack of tokens meanwhile
+ */
+void StRtt::getBudgetUsage(double *bytesPct, double *tpsPct, uint32_t *deferred)
+{
+    auto now = std::chrono::steady_clock::now();
+    double sec = std::chrono::duration<double>(now - this->_budget.usage).count();
+
+    *bytesPct = (sec > 0 && this->_budget.bytesPerSec) ? 100.0 * this->_budget.usedBytes / (sec * this->_budget.bytesPerSec) : 0;
+    *tpsPct = (sec > 0 && this->_budget.tps) ? 100.0 * this->_budget.usedTransactions / (sec * this->_budget.tps) : 0;
+    *deferred = this->_budget.deferred;
+
+    this->_budget.usedBytes = 0;
+    this->_budget.usedTransactions = 0;
+    this->_budget.deferred = 0;
+    this->_budget.usage = now;
+}
+
+void StRtt::budgetRefill()
+{
+    auto now = std::chrono::steady_clock::now();
+    double sec = std::chrono::duration<double>(now - this->_budget.refill).count();
+    this->_budget.refill = now;
+
+    this->_budget.bytes = std::min(this->_budget.bytes + sec * this->_budget.bytesPerSec, (double)this->_budget.bytesPerSec);
+    this->_budget.transactions = std::min(this->_budget.transactions + sec * this->_budget.tps, (double)this->_budget.tps);
+}
+
+// a request bigger than the bucket goes through once the bucket is full,
+// leaving it in debt
+bool StRtt::budgetAllows(uint32_t bytes, uint32_t transactions)
+{
+    if (!this->hasBudget())
+        return true;
+
+    this->budgetRefill();
+
+    if (this->_budget.bytesPerSec && (this->_budget.bytes < std::min((double)bytes, (double)this->_budget.bytesPerSec)))
+        return false;
+
+    if (this->_budget.tps && (this->_budget.transactions < std::min((double)transactions, (double)this->_budget.tps)))
+        return false;
+
+    return true;
+}
+
+void StRtt::budgetCharge(uint32_t bytes, uint32_t transactions)
+{
+    this->_budget.usedBytes += bytes;
+    this->_budget.usedTransactions += transactions;
+    this->_pollStats.addTransactions(transactions);
+
+    if (this->hasBudget())
+    {
+        this->_budget.bytes -= bytes;
+        this->_budget.transactions -= transactions;
+    }
+}
+
 /**
  * @brief
  *
@@ -441,7 +1225,13 @@ void StRtt::addChannelHandler(CallbackFunction callback)
  */
 int StRtt::writeRtt(int buffIndex, std::vector<uint8_t> *buffer)
 {
-    START_TS;
+    PROBE_LOCK;
+    PollTimer timer(&this->_pollStats, POLLSTAT_WRITE);
+
+    if ((buffIndex < 0) || ((uint32_t)buffIndex >= this->_rtt_info.pRttDescription->MaxNumDownBuffers))
+    {
+        return ERROR_FAIL;
+    }
 
     SEGGER_RTT_BUFFER *pRing = &this->_rtt_info.pRttDescription->buffDesc[buffIndex + this->_rtt_info.pRttDescription->MaxNumUpBuffers];
     unsigned int WrOff = pRing->WrOff; // Position of next item to be written by host. Must be volatile since it may be modified by host.
@@ -483,35 +1273,38 @@ int StRtt::writeRtt(int buffIndex, std::vector<uint8_t> *buffer)
     // every future call -- silently writing a zero-filled shadow buffer
     // over real (and possibly still-unread) device memory from then on,
     // until the process is restarted. See test_write_stall_after_transient_error.cpp.
-    if (!_wrMemory.size())
+    //
+    // One shadow per down-buffer, console and -sysview/-rttport write different ones.
+    if (this->_wrMemory.size() <= (size_t)buffIndex)
+    {
+        this->_wrMemory.resize(buffIndex + 1);
+    }
+    std::vector<uint8_t> &shadow = this->_wrMemory[buffIndex];
+    if (!shadow.size())
     {
         std::vector<uint8_t> snapshot(pRing->SizeOfBuffer);
 
         int ret = stlink_usb_layout_api.read_mem(this->_handle, pRing->pBuffer, -1, pRing->SizeOfBuffer, snapshot.data());
+        this->budgetCharge(pRing->SizeOfBuffer, (pRing->SizeOfBuffer + BUDGET_XFER_BYTES - 1) / BUDGET_XFER_BYTES);
         if (ret != ERROR_OK)
         {
-            STOP_TS;
             return ret;
         }
 
-        this->_wrMemory = std::move(snapshot);
+        shadow = std::move(snapshot);
     }
 
-    for (size_t i = 0; i < numWritten; i++)
-    {
-        this->_wrMemory[WrOff++] = buffer->at(0);
-        buffer->erase(buffer->begin());
-
-        if (WrOff >= pRing->SizeOfBuffer)
-        {
-            WrOff = 0;
-        }
-    }
+    // at most two copies, before and after the wrap
+    unsigned first = std::min(numWritten, pRing->SizeOfBuffer - WrOff);
+    memcpy(&shadow[WrOff], buffer->data(), first);
+    memcpy(&shadow[0], buffer->data() + first, numWritten - first);
+    WrOff = (WrOff + numWritten) % pRing->SizeOfBuffer;
+    buffer->erase(buffer->begin(), buffer->begin() + numWritten);
 
-    int ret = stlink_usb_layout_api.write_mem(this->_handle, pRing->pBuffer, -1, pRing->SizeOfBuffer, this->_wrMemory.data());
+    int ret = stlink_usb_layout_api.write_mem(this->_handle, pRing->pBuffer, -1, pRing->SizeOfBuffer, shadow.data());
+    this->budgetCharge(pRing->SizeOfBuffer + 4, (pRing->SizeOfBuffer + BUDGET_XFER_BYTES - 1) / BUDGET_XFER_BYTES + 1);
     if (ret != ERROR_OK)
     {
-        STOP_TS;
         return ret;
     }
 
@@ -520,11 +1313,9 @@ int StRtt::writeRtt(int buffIndex, std::vector<uint8_t> *buffer)
     ret = stlink_usb_layout_api.write_mem(this->_handle, addrWrOff, -1, 4, (uint8_t *)&WrOff);
     if (ret < 0)
     {
-        STOP_TS;
         return ret;
     }
 
-    STOP_TS;
     return numWritten;
 }
 
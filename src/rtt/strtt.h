@@ -21,9 +21,13 @@
 #include <vector>
 #include <string>
 #include <functional>
+#include <chrono>
+#include <mutex>
 
 #include "stlink.h"
 #include "stlink_errors.h"
+#include "memcache.h"
+#include "pollstats.h"
 
 #define RAM_START (0x20000000)
 #define SANE_SIZE_MAX (512 * 1e10)
@@ -36,6 +40,28 @@
 
 #define STLINK_SPEED (24 * 1000)
 
+#define CPUID_ADDR (0xE000ED00)
+#define DHCSR_ADDR (0xE000EDF0)
+#define DHCSR_S_HALT (1 << 17)
+
+// idle readRtt() cycles between two DHCSR samples
+#define HALT_SAMPLE_IDLE_CYCLES (8)
+// poll period while the core is halted
+#define HALT_HEARTBEAT_MS (250)
+// bytes per USB transaction assumed by the bandwidth budget
+#define BUDGET_XFER_BYTES (1024)
+
+// DWT_PCSR reads this while the core is halted or can't be sampled
+#define PCSR_NO_SAMPLE (0xFFFFFFFF)
+
+// channel index SWO stimulus port 0 is reported with, up-channels come first
+#define SWO_CHANNEL_BASE (32)
+
+// write/read-back rounds -autospeed runs at every clock
+#define AUTOSPEED_ROUNDS (4)
+// more than any ST-LINK speed map
+#define AUTOSPEED_MAX_STEPS (16)
+
 /* MSVC doesn't support __attribute__ - use #pragma pack instead */
 #ifdef _MSC_VER
 #pragma pack(push, 1)
@@ -87,10 +113,42 @@ typedef struct
     uint32_t offset;
 } SEGGER_RTT_INFO;
 
+//
+// probe recovery bookkeeping, see StRtt::recover()
+//
+typedef struct
+{
+    uint32_t count;    // successful recoveries
+    uint32_t failed;   // attempts that didn't bring the probe back
+    double downtimeMs; // total time spent recovering
+    double lastMs;     // duration of the last successful recovery
+} RTT_RECOVERY_STATS;
+
+//
+// probe bandwidth budget (-budget/-maxtps), token buckets holding up to one
+// second worth of traffic, 0 = unlimited
+//
+typedef struct
+{
+    uint32_t bytesPerSec;
+    uint32_t tps;
+    double bytes;               // tokens left
+    double transactions;        // tokens left
+    uint32_t pendingBytes;      // what the deferred poll needs
+    uint32_t pendingTransactions;
+    uint64_t usedBytes;         // since last getBudgetUsage()
+    uint64_t usedTransactions;
+    uint32_t deferred;          // bulk reads postponed for lack of tokens
+    std::chrono::steady_clock::time_point refill;
+    std::chrono::steady_clock::time_point usage;
+} RTT_BUDGET;
+
 //
 //
 //
 typedef std::function<void(const int, const std::vector<uint8_t> *)> CallbackFunction;
+// PC sampled from DWT_PCSR
+typedef std::function<void(const uint32_t)> PcSampleFunction;
 
 class StRtt
 {
@@ -100,6 +158,9 @@ private:
     // stlink handle
     void *_handle = nullptr;
 
+    // interface clock last asked for, so autoSpeed() can go back to it
+    int _speedKhz = STLINK_SPEED;
+
     // memory used to find RTT
     // we may need it later to find details about buffers, that's why we keep it all the time
     std::vector<uint8_t> _memory;
@@ -111,18 +172,47 @@ private:
     // chanels names
     std::vector<std::string> _rtt_info_names;
 
-    // timestamp
-    double _duration;
-
     // callback signature
     CallbackFunction _callback;
 
-    // write shadow memory
-    std::vector<uint8_t> _wrMemory;
+    // write shadow memory, per down-buffer
+    std::vector<std::vector<uint8_t>> _wrMemory;
+
+    // recovery counters
+    RTT_RECOVERY_STATS _recoveryStats = {0};
+
+    // core state as seen by the last DHCSR sample
+    bool _halted = false;
+    uint32_t _idleCycles = 0;
+
+    // bandwidth budget
+    RTT_BUDGET _budget = {};
+
+    // flash (channel names) read through here
+    MemCache _cache;
+
+    // DWT_PCSR sampled every readRtt(), if set
+    PcSampleFunction _pcSampler;
+
+    // serializes probe access, SWO is drained on its own thread
+    std::recursive_mutex _probeMutex;
+
+    // timings and transaction counts for -t
+    PollStats _pollStats;
+
+    // descriptor reads so far and when the last one completed (steady_clock ns)
+    uint32_t _pollSeq = 0;
+    uint64_t _pollTimeNs = 0;
 
     // private functions
     void init();
     int readRttEx(uint32_t index);
+    int reattachRtt();
+    int sampleHalt();
+    void samplePc();
+    void budgetRefill();
+    bool budgetAllows(uint32_t bytes, uint32_t transactions);
+    void budgetCharge(uint32_t bytes, uint32_t transactions);
     unsigned _GetAvailWriteSpace(SEGGER_RTT_BUFFER *pRing);
     bool isBufferAddressValid(const SEGGER_RTT_BUFFER &bufferDesc) const;
 
@@ -140,14 +230,51 @@ public:
     int findRtt(uint32_t ramKbytes);
     int getRttDesc();
     int getRttBuffSize(uint32_t buffIndex, uint32_t *sizeRead, uint32_t *sizeWrite);
+    int findUpChannel(const std::string &name) const;
+    std::string getUpChannelName(int index) const;
+    void getChannelCount(uint32_t *up, uint32_t *down) const;
 
     int readRtt();
     int readRttFromBuff(int buffIndex, std::vector<uint8_t> *buffer);
     int writeRtt(int buffIndex, std::vector<uint8_t> *buffer);
 
     int getIdCode(uint32_t *idCode);
+    int getCpuId(uint32_t *cpuId);
+
+    int setSpeed(int khz, int *actualKhz = nullptr);
+    int getScratchWindow(uint32_t *addr, uint32_t *size);
+    int autoSpeed(uint32_t scratchAddr, uint32_t scratchSize, int *khz);
+
+    int recover();
+    bool isWedged();
+    const RTT_RECOVERY_STATS &getRecoveryStats() const { return _recoveryStats; }
+
+    bool isHalted() const { return _halted; }
+    int getPollDelayMs();
+
+    void setBudget(uint32_t bytesPerSec, uint32_t tps);
+    bool hasBudget() const { return _budget.bytesPerSec || _budget.tps; }
+    void getBudgetUsage(double *bytesPct, double *tpsPct, uint32_t *deferred);
+
+    int enableSwo(uint32_t cpuHz, uint32_t *swoHz);
+    int pollSwo(uint8_t *buffer, size_t *size);
+    int enablePcSampling(uint32_t cpuHz, uint32_t swoHz, uint32_t *sampleHz);
+    int disableSwo();
+
+    int readMem(uint32_t addr, uint32_t count, uint8_t *buffer);
+    void addCacheable(uint32_t addr, uint32_t size) { _cache.addCacheable(addr, size); }
+    void invalidateCache() { _cache.invalidate(); }
+    const MEMCACHE_STATS &getCacheStats() const { return _cache.getStats(); }
+
+    // the poll the chunks handed to the channel handler came from
+    uint32_t getPollSeq() const { return _pollSeq; }
+    uint64_t getPollTimeNs() const { return _pollTimeNs; }
+
+    // -t instrumentation, the main loop adds cycle times and channel bytes
+    PollStats &getPollStats() { return _pollStats; }
 
     void addChannelHandler(CallbackFunction callback);
+    void setPcSampler(PcSampleFunction sampler) { _pcSampler = sampler; }
 };
 
 #endif
\ No newline at end of file
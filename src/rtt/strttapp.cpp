@@ -2,38 +2,70 @@
 #include <vector>
 #include <chrono>
 #include <memory>
+#include <thread>
 
 #include <signal.h>
 
 #include "strtt.h"
+#include "attachcache.h"
+#include "swo.h"
+#include "elfsymbols.h"
+#include "profiler.h"
+#include "capture.h"
+#include "linestamp.h"
+#include "outputsink.h"
+#include "framing.h"
+#include "defmt.h"
+#include "scope.h"
+#include "decimate.h"
 #include "log.h"
 #include "inputparser.h"
 #include "consoleinput.h"
 #include "adapter.h"
 
-// #define SYSVIEW
-
+// SYSVIEW is defined by the build where the bridge is available
 #ifdef SYSVIEW
 #include "sysview.h"
 #endif
 
+// FANOUT likewise, Unix domain sockets and epoll
+#ifdef FANOUT
+#include "fanout.h"
+#endif
+
 #ifdef __linux__
 #include <sys/resource.h>
 #endif
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 
 // CONST //////////////////////////////////////////////////
 
 const int SYSVIEW_COMM_SERVER_PORT = 19111; // the port users will be connecting to
+const int SYSVIEW_CHANNEL_AUTO = -1;        // pick the channel named "SysView"
+const int RECOVERY_ATTEMPTS = 3;            // in a row, before we give up on the probe
+const int READ_RETRIES = 5;                 // failed readRtt() in a row on a probe that isn't wedged, before we give up
+const int PROFILE_REPORT_MS = 5000;         // live profile period
+const int SVLOAD_REPORT_S = 10;             // SystemView CPU load period
+const int REPLAY_NAP_MS = 100;              // -replay checks ctrl-c this often
+const int RTTPORT_REPLAY_CHANNELS = 3;      // -rttport ports without a target, SEGGER's default up-buffer count
+const int DEFMT_CHANNEL_AUTO = -1;          // pick the channel named "defmt"
+const int SCOPE_CHANNEL_AUTO = -1;          // pick the first channel named "JScope_..."
+const int POLLSTATS_REPORT_S = 10;          // -t summary period
 
 // GLOBAL VARIABLES ///////////////////////////////////////
 
 std::atomic_bool stopApp;
+std::atomic_bool dumpProfile;
 
 // DEFINES ////////////////////////////////////////////////
 
 #define START_TS auto __start_ts = std::chrono::high_resolution_clock::now()
-#define STOP_TS _duration = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - __start_ts).count()
+#define STOP_TS _duration = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - __start_ts).count()
 
 //
 //
@@ -47,6 +79,13 @@ void signalHandler(int signum)
     stopApp = true;
 }
 
+#ifdef SIGUSR1
+static void profileSignalHandler(int)
+{
+    dumpProfile = true;
+}
+#endif
+
 static void showArgs(const std::string& progName)
 {
     std::cout << "usage: " << progName << " [OPTIONS]" << std::endl;
@@ -54,10 +93,41 @@ static void showArgs(const std::string& progName)
     std::cout << "  -ramsize size\t ... size of RAM, e.g. 0x2000" << std::endl;
     std::cout << "  -ramstart address ... start address of RAM, e.g. 0x08000000" << std::endl;
     std::cout << "  -port number\t ... port number for TCP connection" << std::endl;
-    std::cout << "  -t\t\t ... show cycle time " << std::endl;
+    std::cout << "  -record file ... write every channel chunk with host time stamp and poll number to a capture file" << std::endl;
+    std::cout << "  -replay file ... no probe, feed a -record capture through the same channel handling" << std::endl;
+    std::cout << "  -replayspeed x ... 1 as recorded (default), 2 twice as fast, 0 as fast as possible" << std::endl;
+#ifdef SYSVIEW
+    std::cout << "  -sysview [port][:channel] ... SystemView bridge (default port 19111, channel named \"SysView\")" << std::endl;
+    std::cout << "  -svrec file.SVDat[:MB] ... record the SystemView channel too, new file every MB if given" << std::endl;
+    std::cout << "  -svload [seconds] ... decode the SystemView channel, per task and ISR CPU load every 10 s" << std::endl;
+#endif
+#ifdef FANOUT
+    std::cout << "  -fanout path[:channel,...] ... serve channels (default 0) to any number of readers on Unix sockets path.N" << std::endl;
+    std::cout << "  -rttport base ... serve every RTT channel N on TCP port base+N, what clients send goes to down-buffer N" << std::endl;
+#endif
+    std::cout << "  -t [seconds]\t ... cycle, read and write time percentiles, transactions per cycle and bytes/s per channel every 10 s and on exit" << std::endl;
+    std::cout << "  -ts\t\t ... prefix terminal lines with host time and channel" << std::endl;
+    std::cout << "  -flushms ms\t ... collect terminal output up to ms before writing it (default 0, every chunk)" << std::endl;
+    std::cout << "  -framed\t ... every channel on stdout as binary frames, down-buffer data taken the same way from stdin" << std::endl;
     std::cout << "  -tcp\t\t ... use TCP connection " << std::endl;
     std::cout << "  -ap number\t ... accessport number" << std::endl;
     std::cout << "  -serial string\t ... ST-LINK serial number to connect to" << std::endl;
+    std::cout << "  -autospeed\t ... find the fastest reliable SWD clock and remember it for this board" << std::endl;
+    std::cout << "  -scratch address[:size] ... RAM -autospeed may overwrite (default: free part of down-buffer 0)" << std::endl;
+    std::cout << "  -cache file\t ... attach cache file (default: ~/.strtt_attach)" << std::endl;
+    std::cout << "  -budget KB/s\t ... limit probe traffic, e.g. when sharing it with a debugger (-tcp)" << std::endl;
+    std::cout << "  -maxtps number ... limit probe USB transactions per second" << std::endl;
+    std::cout << "  -swo cpu_hz[:swo_hz] ... capture ITM stimulus ports over SWO too (channels 32..63)" << std::endl;
+    std::cout << "  -profile file.elf ... statistical profile, DWT PC samples over SWO with -swo, DWT_PCSR reads otherwise" << std::endl;
+    std::cout << "  -defmt file.elf[:channel] ... format deferred log messages (channel named \"defmt\") with the strings of the ELF" << std::endl;
+    std::cout << "  -scope file[:channel[:types]] ... J-Scope samples as columns, CSV for file.csv (channel named \"JScope_t4i4...\")" << std::endl;
+    std::cout << "  -decimate samples[:file] ... -scope min, max and mean per window of samples as CSV to file or stdout" << std::endl;
+}
+
+// value maybe hex or dec
+static uint32_t parseU32(const std::string& opt)
+{
+    return (uint32_t)std::stoul(opt, nullptr, 0);
 }
 
 // INFO:
@@ -88,10 +158,41 @@ int main(int argc, char **argv)
     uint32_t    _ramStart     = RAM_START;
     uint8_t     apNum         = 0;
     bool        useTCP        = false;
-    bool        showCycleTime = false;
+    uint32_t    statsSecs     = 0;
     std::string serial;
+    bool        autoSpeed     = false;
+    uint32_t    scratchAddr   = 0;
+    uint32_t    scratchSize   = 0;
+    std::string cachePath     = AttachCache::defaultPath();
+    uint32_t    budgetKBps    = 0;
+    uint32_t    maxTps        = 0;
+    uint32_t    swoCpuHz      = 0;
+    uint32_t    swoHz         = 0;
+    std::string profileElf;
+    bool        sysView       = false;
+    int         sysViewChannel = SYSVIEW_CHANNEL_AUTO;
+    std::string svRecPath;
+    uint32_t    svRecRotateMB = 0;
+    uint32_t    svLoadSecs    = 0;
+    std::string recordPath;
+    std::string replayPath;
+    double      replaySpeed   = 1.0;
+    bool        stampLines    = false;
+    uint32_t    flushMs       = 0;
+    std::string fanoutPath;
+    std::vector<int> fanoutChannels;
+    int         rttPort       = 0;
+    bool        framed        = false;
+    std::string defmtElf;
+    int         defmtChannel  = DEFMT_CHANNEL_AUTO;
+    std::string scopePath;
+    int         scopeChannel  = SCOPE_CHANNEL_AUTO;
+    std::string scopeTypes;
+    uint32_t    decimateWindow = 0;
+    std::string decimatePath;
 
-    auto handleOptions = [&argc, argv, &_ramKB, &port, &_ramStart, &apNum, &useTCP, &showCycleTime, &serial]() {
+    auto handleOptions = [&argc, argv, &_ramKB, &port, &_ramStart, &apNum, &useTCP, &statsSecs, &serial,
+                          &autoSpeed, &scratchAddr, &scratchSize, &cachePath, &budgetKBps, &maxTps, &swoCpuHz, &swoHz, &profileElf, &sysView, &sysViewChannel, &svRecPath, &svRecRotateMB, &svLoadSecs, &recordPath, &replayPath, &replaySpeed, &stampLines, &flushMs, &fanoutPath, &fanoutChannels, &rttPort, &framed, &defmtElf, &defmtChannel, &scopePath, &scopeChannel, &scopeTypes, &decimateWindow, &decimatePath]() {
         InputParser input(argc, argv);
 
         if( input.cmdOptionExists("-v") ) {
@@ -124,7 +225,20 @@ int main(int argc, char **argv)
         }
 
         if( input.cmdOptionExists("-t") ) {
-            showCycleTime = true;
+            // [seconds] between summaries
+            statsSecs = POLLSTATS_REPORT_S;
+            std::string opt = input.getCmdOption("-t");
+            if( !opt.empty() && opt[0] != '-' ) {
+                statsSecs = parseU32(opt);
+            }
+        }
+
+        if( input.cmdOptionExists("-ts") ) {
+            stampLines = true;
+        }
+
+        if( input.cmdOptionExists("-flushms") ) {
+            flushMs = parseU32(input.getCmdOption("-flushms"));
         }
 
         if( input.cmdOptionExists("-tcp") ) {
@@ -138,6 +252,156 @@ int main(int argc, char **argv)
         if( input.cmdOptionExists("-serial") ) {
             serial = input.getCmdOption("-serial");
         }
+
+        if( input.cmdOptionExists("-autospeed") ) {
+            autoSpeed = true;
+        }
+
+        if( input.cmdOptionExists("-scratch") ) {
+            // address[:size], size defaults to 1KB
+            std::string opt = input.getCmdOption("-scratch");
+            size_t colon = opt.find(':');
+            scratchAddr = parseU32(opt.substr(0, colon));
+            scratchSize = (colon == std::string::npos) ? 1024 : parseU32(opt.substr(colon + 1));
+        }
+
+        if( input.cmdOptionExists("-cache") ) {
+            cachePath = input.getCmdOption("-cache");
+        }
+
+        if( input.cmdOptionExists("-budget") ) {
+            budgetKBps = parseU32(input.getCmdOption("-budget"));
+        }
+
+        if( input.cmdOptionExists("-maxtps") ) {
+            maxTps = parseU32(input.getCmdOption("-maxtps"));
+        }
+
+        if( input.cmdOptionExists("-swo") ) {
+            // cpu_hz[:swo_hz], swo_hz defaults to the fastest the probe can do
+            std::string opt = input.getCmdOption("-swo");
+            size_t colon = opt.find(':');
+            swoCpuHz = parseU32(opt.substr(0, colon));
+            swoHz = (colon == std::string::npos) ? 0 : parseU32(opt.substr(colon + 1));
+        }
+
+        if( input.cmdOptionExists("-profile") ) {
+            profileElf = input.getCmdOption("-profile");
+        }
+
+        if( input.cmdOptionExists("-defmt") ) {
+            // file[:channel]
+            defmtElf = input.getCmdOption("-defmt");
+            size_t colon = defmtElf.find_last_of(':');
+            // not the colon of a drive letter
+            if( colon != std::string::npos && colon > 1 ) {
+                defmtChannel = std::stoi(defmtElf.substr(colon + 1));
+                defmtElf = defmtElf.substr(0, colon);
+            }
+        }
+
+        if( input.cmdOptionExists("-scope") ) {
+            // file[:channel[:types]], types for channels not named by J-Scope rules
+            scopePath = input.getCmdOption("-scope");
+            // not the colon of a drive letter
+            size_t colon = scopePath.find(':', 2);
+            if( colon != std::string::npos ) {
+                std::string opt = scopePath.substr(colon + 1);
+                scopePath = scopePath.substr(0, colon);
+                colon = opt.find(':');
+                scopeChannel = std::stoi(opt.substr(0, colon));
+                if( colon != std::string::npos ) {
+                    scopeTypes = opt.substr(colon + 1);
+                }
+            }
+        }
+
+        if( input.cmdOptionExists("-decimate") ) {
+            // samples[:file]
+            std::string opt = input.getCmdOption("-decimate");
+            size_t colon = opt.find(':');
+            decimateWindow = parseU32(opt.substr(0, colon));
+            if( colon != std::string::npos ) {
+                decimatePath = opt.substr(colon + 1);
+            }
+        }
+
+        if( input.cmdOptionExists("-sysview") ) {
+            // [port][:channel], both optional
+            sysView = true;
+            std::string opt = input.getCmdOption("-sysview");
+            if( !opt.empty() && opt[0] != '-' ) {
+                size_t colon = opt.find(':');
+                if( colon != 0 ) {
+                    port = std::stoi(opt.substr(0, colon));
+                }
+                if( colon != std::string::npos ) {
+                    sysViewChannel = std::stoi(opt.substr(colon + 1));
+                }
+            }
+        }
+
+        if( input.cmdOptionExists("-svrec") ) {
+            // file[:MB], recording needs the bridge
+            sysView = true;
+            std::string opt = input.getCmdOption("-svrec");
+            size_t colon = opt.find_last_of(':');
+            // not the colon of a drive letter
+            if( colon != std::string::npos && colon > 1 ) {
+                svRecRotateMB = parseU32(opt.substr(colon + 1));
+                opt = opt.substr(0, colon);
+            }
+            svRecPath = opt;
+        }
+
+        if( input.cmdOptionExists("-record") ) {
+            recordPath = input.getCmdOption("-record");
+        }
+
+        if( input.cmdOptionExists("-replay") ) {
+            replayPath = input.getCmdOption("-replay");
+        }
+
+        if( input.cmdOptionExists("-replayspeed") ) {
+            // 1 as recorded, 2 twice as fast, 0 as fast as possible
+            replaySpeed = std::stod(input.getCmdOption("-replayspeed"));
+        }
+
+        if( input.cmdOptionExists("-fanout") ) {
+            // path[:channel,channel,...], channel 0 if none given
+            std::string opt = input.getCmdOption("-fanout");
+            size_t colon = opt.find_last_of(':');
+            fanoutPath = opt.substr(0, colon);
+            if( colon != std::string::npos ) {
+                size_t start = colon + 1;
+                while( start <= opt.size() ) {
+                    size_t comma = opt.find(',', start);
+                    fanoutChannels.push_back(std::stoi(opt.substr(start, comma - start)));
+                    start = (comma == std::string::npos) ? opt.size() + 1 : comma + 1;
+                }
+            }
+            else {
+                fanoutChannels.push_back(0);
+            }
+        }
+
+        if( input.cmdOptionExists("-rttport") ) {
+            rttPort = std::stoi(input.getCmdOption("-rttport"));
+        }
+
+        if( input.cmdOptionExists("-framed") ) {
+            framed = true;
+        }
+
+        if( input.cmdOptionExists("-svload") ) {
+            // [seconds], decoding needs the bridge
+            sysView = true;
+            svLoadSecs = SVLOAD_REPORT_S;
+            std::string opt = input.getCmdOption("-svload");
+            if( !opt.empty() && opt[0] != '-' ) {
+                svLoadSecs = parseU32(opt);
+            }
+        }
     };
 
     try {
@@ -153,62 +417,535 @@ int main(int argc, char **argv)
 
     auto strtt = std::make_unique<StRtt>(_ramStart, apNum);
 
-    // open stLink
-    int res = strtt->open(useTCP);
-    if (res != ERROR_OK)
+    // -replay needs no probe, the capture stands in for readRtt()
+    const bool live = replayPath.empty();
+    int res = ERROR_OK;
+
+    if (live)
     {
-        LOG_ERROR("failed to open STLINK (%d)", res);
-        exit(-1);
+        // open stLink
+        res = strtt->open(useTCP);
+        if (res != ERROR_OK)
+        {
+            LOG_ERROR("failed to open STLINK (%d)", res);
+            exit(-1);
+        }
+
+        // identify the board, things we learned about it last time are in the attach cache
+        AttachCache cache(cachePath);
+        cache.load();
+
+        std::string board;
+        uint32_t idCode, cpuId;
+        if ((strtt->getIdCode(&idCode) == ERROR_OK) && (strtt->getCpuId(&cpuId) == ERROR_OK))
+        {
+            board = AttachCache::boardKey(serial, idCode, cpuId);
+            LOG_DEBUG("Board: %s", board.c_str());
+        }
+
+        // with -tcp the clock belongs to the gdb server, leave it alone
+        if (autoSpeed && useTCP)
+        {
+            LOG_WARNING("-autospeed is ignored with -tcp");
+            autoSpeed = false;
+        }
+
+        auto tuneSpeed = [&]() {
+            int khz;
+            if (strtt->autoSpeed(scratchAddr, scratchSize, &khz) != ERROR_OK)
+            {
+                LOG_ERROR("autospeed failed, keeping the current clock");
+                return;
+            }
+
+            LOG_USER("autospeed: using %d kHz", khz);
+            if (!board.empty())
+            {
+                cache.setValue(board, "speed_khz", khz);
+                cache.save();
+            }
+        };
+
+        uint32_t cachedKhz;
+        if (autoSpeed && scratchSize)
+        {
+            // explicit scratch window, we can tune before touching RTT
+            tuneSpeed();
+        }
+        else if (!autoSpeed && !useTCP && !board.empty() && cache.getValue(board, "speed_khz", &cachedKhz))
+        {
+            LOG_INFO("Using cached interface clock %d kHz", (int)cachedKhz);
+            strtt->setSpeed((int)cachedKhz);
+        }
+
+        // find rtt
+        res = strtt->findRtt(_ramKB);
+        if (res != ERROR_OK)
+        {
+            LOG_ERROR("failed to find RTT (%d)", res);
+            exit(-1);
+        }
+
+        if (autoSpeed && !scratchSize)
+        {
+            if (strtt->getScratchWindow(&scratchAddr, &scratchSize) != ERROR_OK)
+            {
+                LOG_ERROR("No free space in down-buffer 0 for -autospeed, use -scratch");
+            }
+            else
+            {
+                tuneSpeed();
+            }
+        }
+
+        // autospeed and the RAM scan are done, from now on stay within the budget
+        if (budgetKBps || maxTps)
+        {
+            strtt->setBudget(budgetKBps * 1024, maxTps);
+        }
+
+        // get channels description
+        strtt->getRttDesc();
+
+        // get buff size
+        uint32_t sizeR, sizeW;
+        res = strtt->getRttBuffSize(0, &sizeR, &sizeW);
     }
 
-    // get idCode
-    // uint32_t idCode;
-    // res = strtt->getIdCode(&idCode);
+#ifdef SYSVIEW
+    std::unique_ptr<SysView> _sv;
+    std::unique_ptr<SysViewDecoder> svDecoder;
+    std::vector<uint8_t> svPending;
+    if (sysView)
+    {
+        if (sysViewChannel == SYSVIEW_CHANNEL_AUTO)
+        {
+            sysViewChannel = strtt->findUpChannel(SYSVIEW_CHANNEL_NAME);
+        }
 
-    // find rtt
-    res = strtt->findRtt(_ramKB);
-    if (res != ERROR_OK)
+        if (sysViewChannel < 0)
+        {
+            LOG_ERROR("No \"%s\" RTT channel, use -sysview port:channel", SYSVIEW_CHANNEL_NAME);
+        }
+        else
+        {
+            LOG_USER("SystemView on RTT channel %d", sysViewChannel);
+            _sv = std::make_unique<SysView>(port);
+
+            if (!svRecPath.empty() && (_sv->record(svRecPath, (uint64_t)svRecRotateMB * 1024 * 1024) != ERROR_OK))
+            {
+                LOG_ERROR("can't record SystemView to %s", svRecPath.c_str());
+            }
+
+            if (svLoadSecs)
+            {
+                svDecoder = std::make_unique<SysViewDecoder>();
+                _sv->setDecoder(svDecoder.get());
+            }
+        }
+    }
+#else
+    if (sysView)
     {
-        LOG_ERROR("failed to find RTT (%d)", res);
-        exit(-1);
+        LOG_WARNING("-sysview is not available on this platform");
     }
+#endif
 
-    // get channels description
-    strtt->getRttDesc();
+    // formatting happens on the worker, the channel handler only queues
+    DefmtDecoder defmtDecoder;
+    std::unique_ptr<DefmtLog> defmt;
+    if (!defmtElf.empty())
+    {
+        if (defmtChannel == DEFMT_CHANNEL_AUTO)
+        {
+            defmtChannel = strtt->findUpChannel(DEFMT_CHANNEL_NAME);
+        }
 
-    // get buff size
-    uint32_t sizeR, sizeW;
-    res = strtt->getRttBuffSize(0, &sizeR, &sizeW);
+        if (defmtChannel < 0)
+        {
+            LOG_ERROR("No \"%s\" RTT channel, use -defmt file.elf:channel", DEFMT_CHANNEL_NAME);
+        }
+        else if (defmtDecoder.load(defmtElf) != ERROR_OK)
+        {
+            LOG_ERROR("can't load format strings from %s", defmtElf.c_str());
+        }
+        else
+        {
+            LOG_USER("defmt on RTT channel %d, %d format strings", defmtChannel, (int)defmtDecoder.getFormatCount());
+            defmt = std::make_unique<DefmtLog>(&defmtDecoder);
+        }
+    }
 
-#ifdef SYSVIEW
-    SysView *_sv;
-    _sv = new SysView(port);
+    std::unique_ptr<ScopeDecoder> scope;
+    if (!scopePath.empty())
+    {
+        uint32_t up = 0, down;
+        strtt->getChannelCount(&up, &down);
+        for (uint32_t i = 0; (scopeChannel == SCOPE_CHANNEL_AUTO) && (i < up); i++)
+        {
+            if (ScopeDecoder::isScopeName(strtt->getUpChannelName((int)i)))
+            {
+                scopeChannel = (int)i;
+            }
+        }
+
+        if (scopeTypes.empty() && (scopeChannel >= 0))
+        {
+            scopeTypes = strtt->getUpChannelName(scopeChannel);
+        }
+
+        if (scopeChannel < 0)
+        {
+            LOG_ERROR("No J-Scope RTT channel, use -scope file:channel:types");
+        }
+        else
+        {
+            scope = std::make_unique<ScopeDecoder>();
+            if (scope->open(scopePath, scopeTypes) != ERROR_OK)
+            {
+                LOG_ERROR("can't write RTT channel %d samples to %s", scopeChannel, scopePath.c_str());
+                scope.reset();
+            }
+            else
+            {
+                LOG_USER("J-Scope samples of RTT channel %d to %s", scopeChannel, scopePath.c_str());
+            }
+        }
+    }
+
+    std::unique_ptr<CaptureWriter> capture;
+    if (!recordPath.empty())
+    {
+        capture = std::make_unique<CaptureWriter>();
+        if (capture->open(recordPath) != ERROR_OK)
+        {
+            LOG_ERROR("can't record to %s", recordPath.c_str());
+            capture.reset();
+        }
+    }
+
+#ifdef FANOUT
+    // -fanout and -rttport share one server thread
+    std::unique_ptr<FanOut> fanout;
+    std::vector<int> rttPortChannels;
+    if (!fanoutPath.empty() || rttPort)
+    {
+        uint32_t up = RTTPORT_REPLAY_CHANNELS, down = 0;
+        if (live)
+        {
+            strtt->getChannelCount(&up, &down);
+        }
+        for (int i = 0; i < (int)up; i++)
+        {
+            rttPortChannels.push_back(i);
+        }
+
+        fanout = std::make_unique<FanOut>();
+        if (!fanoutPath.empty() && (fanout->serveUnix(fanoutPath, fanoutChannels) != ERROR_OK))
+        {
+            LOG_ERROR("can't serve channels on %s", fanoutPath.c_str());
+            fanout.reset();
+        }
+        else if (rttPort && (fanout->serveTcp(rttPort, rttPortChannels) != ERROR_OK))
+        {
+            LOG_ERROR("can't serve channels on TCP port %d and up", rttPort);
+            fanout.reset();
+        }
+        else
+        {
+            fanout->start();
+        }
+    }
+
+    // what -rttport clients sent and the down-buffers didn't take yet
+    std::vector<std::vector<uint8_t>> rttPending(rttPortChannels.size());
+#else
+    if (!fanoutPath.empty() || rttPort)
+    {
+        LOG_WARNING("-fanout and -rttport are not available on this platform");
+    }
+#endif
+
+#ifdef _WIN32
+    // frames are binary, no CR LF translation and no ^Z as end of file
+    if (framed)
+    {
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+    }
 #endif
 
-    strtt->addChannelHandler([&](const int index, const std::vector<uint8_t> *buffer)
+    // terminal output, whole chunks instead of a character at a time
+    OutputSink output(fileno(stdout), flushMs);
+
+    // frames carry their own time stamp
+    std::unique_ptr<LineStamper> stamper;
+    if (stampLines && !framed)
+    {
+        stamper = std::make_unique<LineStamper>(&output);
+    }
+
+    // -decimate lines to their own file, or to stdout with the terminal
+    FILE *decimateFile = nullptr;
+    std::unique_ptr<OutputSink> decimateSink;
+    std::unique_ptr<Decimator> decimator;
+    if (decimateWindow && !scope)
+    {
+        LOG_ERROR("-decimate needs a -scope channel");
+    }
+    else if (decimateWindow)
+    {
+        OutputSink *sink = &output;
+        if (!decimatePath.empty())
+        {
+            decimateFile = fopen(decimatePath.c_str(), "wb");
+            decimateSink = decimateFile ? std::make_unique<OutputSink>(fileno(decimateFile), flushMs) : nullptr;
+            sink = decimateSink.get();
+        }
+        else if (framed)
+        {
+            // stdout is frames only
+            sink = nullptr;
+        }
+
+        if (!sink)
+        {
+            LOG_ERROR("can't write -decimate output to %s", decimatePath.empty() ? "stdout with -framed" : decimatePath.c_str());
+        }
+        else
+        {
+            decimator = std::make_unique<Decimator>(sink, decimateWindow);
+            decimator->setColumns(scope->getColumns());
+            scope->setBlockHandler([&](uint32_t rows)
+                                   { decimator->feed(*scope, rows); });
+        }
+    }
+
+    // the record being replayed, while the handler runs for it
+    const CAPTURE_RECORD *replayed = nullptr;
+
+    CallbackFunction channelHandler = [&](const int index, const std::vector<uint8_t> *buffer)
                              {
-                                 if (index == 0)
+                                 // a replay keeps the original stamps, SWO chunks are decoded on their own thread
+                                 // and get the time we see them
+                                 uint64_t timeNs = replayed ? replayed->timeNs
+                                                            : (index < SWO_CHANNEL_BASE) ? strtt->getPollTimeNs() : captureNowNs();
+
+                                 strtt->getPollStats().addBytes(index, buffer->size());
+
+                                 if (capture)
+                                 {
+                                     capture->add(index, buffer->data(), buffer->size(), timeNs, replayed ? replayed->seq : strtt->getPollSeq());
+                                 }
+
+#ifdef FANOUT
+                                 if (fanout)
+                                 {
+                                     fanout->publish(index, buffer->data(), buffer->size());
+                                 }
+#endif
+
+                                 if (scope && (index == scopeChannel))
+                                 {
+                                     scope->feed(buffer->data(), buffer->size());
+                                 }
+
+                                 // RTT terminal and ITM port 0 (printf over SWO), with -framed every channel;
+                                 // deferred log messages come back from the worker as text
+                                 bool terminal = (index == 0) || (index == SWO_CHANNEL_BASE);
+                                 if (defmt && (index == defmtChannel))
+                                 {
+                                     defmt->push(buffer->data(), buffer->size());
+                                 }
+                                 else if (framed)
+                                 {
+                                     frameWrite(&output, index, buffer->data(), buffer->size(), timeNs);
+                                 }
+                                 else if (stamper && terminal)
+                                 {
+                                     stamper->feed(index, buffer->data(), buffer->size(), timeNs);
+                                 }
+                                 else if (terminal)
                                  {
                                      // TERMINAL, print to console
-                                     for (uint8_t ch : *buffer)
-                                     {
-                                         fputc(ch, stdout);
-                                     }
-                                     fflush(stdout);
+                                     output.write(buffer->data(), buffer->size());
                                  }
 
 #ifdef SYSVIEW
-                                 else if (index == 1)
+                                 if (_sv && (index == sysViewChannel) && (framed || !terminal))
                                  {
-                                     LOG_OUTPUT("SysView size: %d ", (int)buffer->size());
+                                     LOG_DEBUG("SysView size: %d ", (int)buffer->size());
                                      _sv->saveFromSTM(buffer);
                                  }
 #endif
-                             });
+                             };
+
+    strtt->addChannelHandler(channelHandler);
+
+    // formatted log messages, the same way the terminal goes
+    auto defmtOutput = [&]()
+    {
+        std::string text;
+        while (defmt && defmt->getText(&text))
+        {
+            if (framed)
+            {
+                frameWrite(&output, defmtChannel, (const uint8_t *)text.data(), text.size(), captureNowNs());
+            }
+            else if (stamper)
+            {
+                stamper->feed(defmtChannel, (const uint8_t *)text.data(), text.size(), captureNowNs());
+            }
+            else
+            {
+                output.write((const uint8_t *)text.data(), text.size());
+            }
+        }
+    };
+
+    ElfSymbols symbols;
+    std::unique_ptr<Profiler> profiler;
+    if (!profileElf.empty())
+    {
+        if (symbols.load(profileElf) == ERROR_OK)
+        {
+            profiler = std::make_unique<Profiler>(symbols);
+
+#ifdef SIGUSR1
+            signal(SIGUSR1, profileSignalHandler);
+#endif
+        }
+    }
+
+    std::unique_ptr<SwoTrace> swo;
+    if (swoCpuHz && live)
+    {
+        if (strtt->enableSwo(swoCpuHz, &swoHz) != ERROR_OK)
+        {
+            LOG_ERROR("failed to enable SWO, continuing with RTT only");
+        }
+        else
+        {
+            LOG_USER("SWO: capturing ITM at %u Hz", swoHz);
 
-    ConsoleInput console;
+            uint32_t sampleHz;
+            if (profiler && (strtt->enablePcSampling(swoCpuHz, swoHz, &sampleHz) != ERROR_OK))
+            {
+                LOG_ERROR("failed to enable DWT PC sampling, no profile");
+                profiler.reset();
+            }
+
+            swo = std::make_unique<SwoTrace>(strtt.get(), profiler.get());
+        }
+    }
+
+    // no SWO on this board, sample DWT_PCSR every poll
+    if (profiler && !swo && live)
+    {
+        Profiler *p = profiler.get();
+        strtt->setPcSampler([p](const uint32_t pc)
+                            { p->addSample(pc); });
+    }
+
+    // -framed owns stdin, no keyboard then
+    std::unique_ptr<ConsoleInput> console;
     std::vector<uint8_t> str;
+    FramedInput framedInput;
+    std::vector<std::vector<uint8_t>> framedPending;
+    if (framed)
+    {
+        framedInput.start(fileno(stdin));
+    }
+    else
+    {
+        console = std::make_unique<ConsoleInput>();
+    }
     double _duration;
+    auto lastReport = std::chrono::steady_clock::now();
+    auto lastSvLoad = lastReport;
+    auto lastStats = lastReport;
+
+    // -t summary, budget use since the last one too
+    auto reportStats = [&]()
+    {
+        strtt->getPollStats().report();
+        if (strtt->hasBudget())
+        {
+            double bytesPct, tpsPct;
+            uint32_t deferred;
+            strtt->getBudgetUsage(&bytesPct, &tpsPct, &deferred);
+            LOG_USER("  budget %3.0f%% KB/s %3.0f%% tps %u deferred", bytesPct, tpsPct, deferred);
+        }
+    };
+
+    if (!live)
+    {
+        CaptureReader reader;
+        if (reader.open(replayPath) != ERROR_OK)
+        {
+            stopApp = true;
+            return EXIT_FAILURE;
+        }
+
+        CAPTURE_RECORD rec;
+        std::vector<uint8_t> chunk;
+        uint64_t firstNs = 0;
+        uint64_t chunks = 0, bytes = 0;
+        auto start = std::chrono::steady_clock::now();
+
+        while (!stopApp && reader.next(&rec, &chunk))
+        {
+            if (!chunks)
+            {
+                firstNs = rec.timeNs;
+            }
+
+            // original or scaled timing, in short naps so ctrl-c still works over long gaps
+            if (replaySpeed > 0)
+            {
+                auto due = start + std::chrono::nanoseconds((uint64_t)((rec.timeNs - firstNs) / replaySpeed));
+                while (!stopApp && (std::chrono::steady_clock::now() < due))
+                {
+                    std::this_thread::sleep_until(std::min(due, std::chrono::steady_clock::now() + std::chrono::milliseconds(REPLAY_NAP_MS)));
+                }
+            }
+
+            replayed = &rec;
+            channelHandler(rec.channel, &chunk);
+            replayed = nullptr;
+
+            chunks++;
+            bytes += chunk.size();
+
+            if (capture)
+            {
+                capture->tick(captureNowNs());
+            }
+            defmtOutput();
+            output.tick(captureNowNs());
+            if (decimateSink)
+            {
+                decimateSink->tick(captureNowNs());
+            }
+
+#ifdef SYSVIEW
+            if (svDecoder && (std::chrono::steady_clock::now() - lastSvLoad > std::chrono::seconds(svLoadSecs)))
+            {
+                svDecoder->report();
+                lastSvLoad = std::chrono::steady_clock::now();
+            }
+#endif
+        }
+
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        LOG_USER("Replayed %llu chunks, %llu bytes in %.3f s (%.1f MB/s)", (unsigned long long)chunks, (unsigned long long)bytes,
+                 secs, secs > 0 ? bytes / secs / 1e6 : 0.0);
+
+        // threads (SysView) wait for this
+        stopApp = true;
+    }
+
+    int readErrors = 0;
     while (!stopApp)
     {
         START_TS;
@@ -216,16 +953,73 @@ int main(int argc, char **argv)
         // read rtt
         res = strtt->readRtt();
 
-        if (res != ERROR_OK)
+        if (res == ERROR_OK)
         {
-            LOG_ERROR("readRtt returned error %d, program is exiting", res);
+            readErrors = 0;
+        }
+        else if (strtt->isWedged())
+        {
+            // only a probe that keeps timing out gets the full USB reset
+            LOG_WARNING("readRtt returned error %d, recovering the probe", res);
+
+            int attempt = 0;
+            do
+            {
+                res = strtt->recover();
+            } while ((res != ERROR_OK) && (++attempt < RECOVERY_ATTEMPTS) && !stopApp);
+
+            if (res != ERROR_OK)
+            {
+                LOG_ERROR("probe recovery failed (%d), program is exiting", res);
+                stopApp = true;
+            }
+            readErrors = 0;
+        }
+        else if (++readErrors < READ_RETRIES)
+        {
+            LOG_WARNING("readRtt returned error %d, retrying", res);
+        }
+        else
+        {
+            LOG_ERROR("readRtt failed %d times in a row (%d), program is exiting", readErrors, res);
             stopApp = true;
         }
 
+        // SWO data decoded meanwhile
+        if (swo)
+        {
+            int index;
+            std::vector<uint8_t> chunk;
+            while (swo->getChunk(&index, &chunk))
+            {
+                channelHandler(index, &chunk);
+            }
+        }
+
+        // partly filled capture block and collected terminal output go out after a while
+        if (capture)
+        {
+            capture->tick(captureNowNs());
+        }
+        defmtOutput();
+        output.tick(captureNowNs());
+        if (decimateSink)
+        {
+            decimateSink->tick(captureNowNs());
+        }
+
+        // SWO samples fast enough for a live view, PCSR sampling needs longer, dump it on request
+        if (profiler && ((swo && (std::chrono::steady_clock::now() - lastReport > std::chrono::milliseconds(PROFILE_REPORT_MS))) || dumpProfile))
+        {
+            profiler->report();
+            lastReport = std::chrono::steady_clock::now();
+            dumpProfile = false;
+        }
+
         // read console
-        while (console.isChar())
+        while (console && console->isChar())
         {
-            uint8_t ch = console.getChar();
+            uint8_t ch = console->getChar();
             str.push_back(ch);
         }
 
@@ -235,21 +1029,154 @@ int main(int argc, char **argv)
             strtt->writeRtt(0, &str);
         }
 
+        // write -framed input per down-buffer
+        // what a down-buffer didn't take stays pending, and holds its stdin back
+        framedInput.take(&framedPending);
+        for (size_t i = 0; i < framedPending.size(); i++)
+        {
+            if (framedPending[i].size() && (strtt->writeRtt((int)i, &framedPending[i]) < 0))
+            {
+                uint32_t up, down;
+                strtt->getChannelCount(&up, &down);
+                if (i >= down)
+                {
+                    LOG_WARNING("framed input for channel %d dropped, no such down-buffer", (int)i);
+                    framedPending[i].clear();
+                }
+            }
+        }
+
+#ifdef FANOUT
+        // write -rttport input, channel 0 shares the down-buffer with the console
+        for (size_t i = 0; fanout && (i < rttPending.size()); i++)
+        {
+            // refill only once the down-buffer took everything, the rest waits in the input ring
+            if (rttPending[i].empty())
+            {
+                fanout->getInput((int)i, &rttPending[i]);
+            }
+            // no down-buffer with that number, nowhere to go
+            if (rttPending[i].size() && (strtt->writeRtt((int)i, &rttPending[i]) < 0))
+            {
+                rttPending[i].clear();
+            }
+        }
+#endif
+
 #ifdef SYSVIEW
         // write SysView
-        if (_sv->dataToSTM())
+        // what the down buffer didn't take stays in svPending for the next cycle
+        if (_sv && (svPending.size() || _sv->dataToSTM()))
         {
-            auto data = _sv->getDataToSTM();
-            strtt->writeRtt(1, &data);
+            _sv->getDataToSTM(&svPending);
+            strtt->writeRtt(sysViewChannel, &svPending);
+        }
+
+        if (svDecoder && (std::chrono::steady_clock::now() - lastSvLoad > std::chrono::seconds(svLoadSecs)))
+        {
+            svDecoder->report();
+            lastSvLoad = std::chrono::steady_clock::now();
         }
 #endif
 
-        if (showCycleTime)
+        STOP_TS;
+        strtt->getPollStats().endCycle((uint64_t)_duration);
+
+        if (statsSecs && (std::chrono::steady_clock::now() - lastStats > std::chrono::seconds(statsSecs)))
+        {
+            reportStats();
+            lastStats = std::chrono::steady_clock::now();
+        }
+
+        // core stopped at a breakpoint or budget used up, don't steal the probe from the debugger
+        int delay = strtt->getPollDelayMs();
+        if (delay)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+        }
+    }
+
+    if (statsSecs)
+    {
+        reportStats();
+    }
+
+    if (swo)
+    {
+        swo->stop();
+        strtt->disableSwo();
+        LOG_INFO("SWO: %llu bytes, %u overflows", (unsigned long long)swo->getBytes(), swo->getOverflows());
+    }
+
+    if (defmt)
+    {
+        defmt->stop();
+        defmtOutput();
+        const DEFMT_STATS &stats = defmtDecoder.getStats();
+        LOG_USER("defmt: %llu messages, %llu bytes for %llu bytes of text, %llu bad, %llu unknown ids", (unsigned long long)stats.messages,
+                 (unsigned long long)stats.bytesIn, (unsigned long long)stats.bytesOut, (unsigned long long)stats.bad,
+                 (unsigned long long)stats.unknown);
+    }
+
+    if (decimator)
+    {
+        decimator->finish();
+        LOG_USER("Decimated to %llu windows of %u samples", (unsigned long long)decimator->getWindows(), decimateWindow);
+    }
+    if (decimateSink)
+    {
+        decimateSink->flush();
+        decimateSink.reset();
+        fclose(decimateFile);
+    }
+
+    if (stamper)
+    {
+        stamper->finish();
+    }
+    output.flush();
+
+#ifdef FANOUT
+    if (fanout)
+    {
+        fanout->close();
+        for (const FANOUT_STATS &stats : fanout->getStats())
         {
-            STOP_TS;
-            LOG_USER("Cycle time: %dms", (int)_duration);
+            LOG_USER("Fanout channel %d: %llu bytes, %u subscribers, %u dropped, %llu bytes in, %llu lost", stats.channel,
+                     (unsigned long long)stats.bytes, stats.subscribers, stats.dropped, (unsigned long long)stats.input,
+                     (unsigned long long)stats.inputLost);
         }
     }
+#endif
+
+    if (scope)
+    {
+        scope->close();
+        LOG_USER("J-Scope: %llu samples, %llu bytes written to %s, %llu bytes dropped", (unsigned long long)scope->getSamples(),
+                 (unsigned long long)scope->getWritten(), scopePath.c_str(), (unsigned long long)scope->getDropped());
+    }
+
+    if (capture)
+    {
+        capture->close();
+        LOG_USER("Recorded %llu bytes in %llu records to %s, %llu bytes dropped", (unsigned long long)capture->getBytes(),
+                 (unsigned long long)capture->getRecords(), recordPath.c_str(), (unsigned long long)capture->getDropped());
+    }
+
+    if (profiler)
+    {
+        profiler->report();
+    }
+
+    const MEMCACHE_STATS &cacheStats = strtt->getCacheStats();
+    LOG_DEBUG("Memory cache: %llu hits, %llu misses, %llu bypassed", (unsigned long long)cacheStats.hits,
+              (unsigned long long)cacheStats.misses, (unsigned long long)cacheStats.bypassed);
+
+    const RTT_RECOVERY_STATS &recovery = strtt->getRecoveryStats();
+    if (recovery.count || recovery.failed)
+    {
+        LOG_USER("Probe recoveries: %u (%u failed), downtime %.1f ms", recovery.count, recovery.failed, recovery.downtimeMs);
+    }
 
     return 0;
 }
@@ -0,0 +1,237 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// strtt-query: looks things up in a -record capture without reading all of
+// it. The capture is mapped, its index narrows a time range down to a few
+// spans and skips spans that have nothing on the wanted channel.
+//
+
+// cpp
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// c
+#include <stdio.h>
+#include <string.h>
+
+// local
+#include "capturequery.h"
+#include "stlink_errors.h"
+#include "log.h"
+#include "inputparser.h"
+
+// CONST //////////////////////////////////////////////////
+
+const size_t QUERY_MAX_LINE = 4096; // a longer "line" (binary channel) is searched as it is
+
+static void showArgs(const std::string& progName)
+{
+    std::cout << "usage: " << progName << " capture [OPTIONS]" << std::endl;
+    std::cout << "  -v number\t ... verbosity (debug level) 0..4" << std::endl;
+    std::cout << "  -from seconds\t ... skip what was recorded earlier, counted from the capture start" << std::endl;
+    std::cout << "  -to seconds\t ... skip what was recorded later" << std::endl;
+    std::cout << "  -channel number ... only this channel (SWO stimulus port n is 32 + n)" << std::endl;
+    std::cout << "  -grep text\t ... print the lines holding text, with time and channel" << std::endl;
+    std::cout << "  -count\t ... only count chunks and bytes, or lines with -grep" << std::endl;
+    std::cout << "  -stats\t ... bytes per channel from the index alone, whole spans" << std::endl;
+    std::cout << "  without -grep, -count or -stats the chunks are written to stdout as they are" << std::endl;
+}
+
+//
+// Feeds a channel's chunks through line by line, lines can be split over chunks.
+//
+class LineGrep
+{
+private:
+    std::string _pattern;
+    std::vector<std::vector<uint8_t>> _carry;
+    bool _print;
+
+public:
+    uint64_t matches;
+
+    LineGrep(const std::string &pattern, bool print)
+    {
+        this->_pattern = pattern;
+        this->_carry.resize(CAPTURE_INDEX_CHANNELS + 1);
+        this->_print = print;
+        this->matches = 0;
+    }
+
+    void feed(double seconds, int channel, const uint8_t *data, size_t size)
+    {
+        std::vector<uint8_t> &buf = this->_carry[std::min(channel, CAPTURE_INDEX_CHANNELS)];
+        buf.insert(buf.end(), data, data + size);
+
+        // lines are complete up to the last new line
+        size_t done = buf.size();
+        while (done && (buf[done - 1] != '\n'))
+            done--;
+        if (!done && (buf.size() > QUERY_MAX_LINE))
+            done = buf.size();
+
+        const uint8_t *pos = buf.data();
+        const uint8_t *end = buf.data() + done;
+        const uint8_t *hit;
+        while ((hit = captureFind(pos, end - pos, (const uint8_t *)this->_pattern.data(), this->_pattern.size())))
+        {
+            const uint8_t *start = hit;
+            while ((start > pos) && (start[-1] != '\n'))
+                start--;
+            const uint8_t *stop = (const uint8_t *)memchr(hit, '\n', end - hit);
+            if (!stop)
+                stop = end;
+            pos = (stop < end) ? stop + 1 : end;
+
+            int len = (int)(stop - start);
+            if (len && (start[len - 1] == '\r'))
+                len--;
+            this->matches++;
+            if (this->_print)
+                printf("%12.6f %2d: %.*s\n", seconds, channel, len, (const char *)start);
+        }
+
+        buf.erase(buf.begin(), buf.begin() + done);
+    }
+};
+
+int main(int argc, char **argv)
+{
+    log_init();
+
+    for( int i = 1; i < argc; ++i ) {
+        if( strcmp(argv[i], "--help") == 0 ) {
+            showArgs(argv[0]);
+            return EXIT_SUCCESS;
+        }
+    }
+
+    if( argc < 2 || argv[1][0] == '-' ) {
+        showArgs(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    debug_level        = LOG_LVL_WARNING;
+    double      from   = -1;
+    double      to     = -1;
+    int         channel = -1;
+    std::string pattern;
+    bool        count  = false;
+    bool        stats  = false;
+
+    try {
+        InputParser input(argc, argv);
+
+        if( input.cmdOptionExists("-v") ) {
+            debug_level = std::stoi(input.getCmdOption("-v"));
+        }
+
+        if( input.cmdOptionExists("-from") ) {
+            from = std::stod(input.getCmdOption("-from"));
+        }
+
+        if( input.cmdOptionExists("-to") ) {
+            to = std::stod(input.getCmdOption("-to"));
+        }
+
+        if( input.cmdOptionExists("-channel") ) {
+            channel = std::stoi(input.getCmdOption("-channel"));
+        }
+
+        if( input.cmdOptionExists("-grep") ) {
+            pattern = input.getCmdOption("-grep");
+            if( pattern.empty() ) {
+                throw std::invalid_argument("-grep needs a text");
+            }
+        }
+
+        count = input.cmdOptionExists("-count");
+        stats = input.cmdOptionExists("-stats");
+    } catch( const std::exception& e ) {
+        std::cerr << "ERROR parsing command-line args:" << e.what() << std::endl;
+        showArgs(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    CaptureFile capture;
+    if (capture.open(argv[1]) != ERROR_OK)
+    {
+        return EXIT_FAILURE;
+    }
+
+    const CAPTURE_FILE_HEADER *hdr = capture.getHeader();
+    uint64_t fromNs = (from < 0) ? 0 : hdr->startNs + (uint64_t)(from * 1e9);
+    uint64_t toNs = (to < 0) ? UINT64_MAX : hdr->startNs + (uint64_t)(to * 1e9);
+
+    if (stats)
+    {
+        // every span that overlaps the range counts whole
+        const std::vector<CAPTURE_INDEX_ENTRY> &index = capture.getIndex();
+        uint64_t bytes[CAPTURE_INDEX_CHANNELS] = {};
+        size_t spans = 0;
+        for (size_t i = 0; i < index.size(); i++)
+        {
+            if ((index[i].firstNs > toNs) || ((i + 1 < index.size()) && (index[i + 1].firstNs < fromNs)))
+                continue;
+            spans++;
+            for (int ch = 0; ch < CAPTURE_INDEX_CHANNELS; ch++)
+                bytes[ch] += index[i].channelBytes[ch];
+        }
+
+        printf("%lu bytes, %lu index spans of %u records, %s\n", (unsigned long)capture.getSize(),
+               (unsigned long)index.size(), hdr->indexEvery, capture.isComplete() ? "closed" : "not closed, last span not counted");
+        printf("%lu spans in range\n", (unsigned long)spans);
+        for (int ch = 0; ch < CAPTURE_INDEX_CHANNELS; ch++)
+        {
+            if (bytes[ch] && ((channel < 0) || (channel == ch)))
+                printf("channel %2d: %lu bytes\n", ch, (unsigned long)bytes[ch]);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    uint64_t chunks = 0;
+    uint64_t bytes = 0;
+    LineGrep grep(pattern, !count);
+
+    capture.query(fromNs, toNs, channel, [&](const CAPTURE_RECORD &rec, const uint8_t *data) {
+        chunks++;
+        bytes += rec.length;
+        if (!pattern.empty())
+        {
+            grep.feed((rec.timeNs - hdr->startNs) / 1e9, rec.channel, data, rec.length);
+        }
+        else if (!count)
+        {
+            fwrite(data, 1, rec.length, stdout);
+        }
+        return true;
+    });
+
+    if (count)
+    {
+        if (pattern.empty())
+            printf("%lu chunks, %lu bytes\n", (unsigned long)chunks, (unsigned long)bytes);
+        else
+            printf("%lu lines\n", (unsigned long)grep.matches);
+    }
+
+    return EXIT_SUCCESS;
+}
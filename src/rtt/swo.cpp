@@ -0,0 +1,132 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+
+#include "log.h"
+#include "swo.h"
+
+/**
+ * @brief Construct a new Swo Trace:: Swo Trace object, starts draining
+ * right away. Trace has to be enabled with StRtt::enableSwo() before.
+ *
+ * @param rtt
+ * @param profiler gets the DWT PC samples (optional)
+ */
+SwoTrace::SwoTrace(StRtt *rtt, Profiler *profiler)
+    : _rtt(rtt), _profiler(profiler), _sleeps(0), _stop(false), _bytes(0)
+{
+    this->_decoder.setHandler([this](const int port, const std::vector<uint8_t> *data)
+                              { this->_queue.enqueue(std::make_pair(SWO_CHANNEL_BASE + port, *data)); });
+
+    this->_decoder.setHardwareHandler([this](const int id, const uint32_t value, const int size)
+                                      {
+                                          if (id != ITM_DWT_PC_SAMPLE)
+                                              return;
+
+                                          // 1 byte sample means the core was sleeping
+                                          if (size == 4)
+                                              this->_pcs.push_back(value);
+                                          else
+                                              this->_sleeps++;
+                                      });
+
+    this->_th = std::thread(&SwoTrace::run, this);
+}
+
+/**
+ * @brief Destroy the Swo Trace:: Swo Trace object
+ */
+SwoTrace::~SwoTrace()
+{
+    this->stop();
+}
+
+/**
+ * @brief
+ */
+void SwoTrace::stop()
+{
+    this->_stop = true;
+    if (this->_th.joinable())
+    {
+        this->_th.join();
+    }
+}
+
+/**
+ * @brief Next decoded chunk, to be called from the main thread.
+ *
+ * @param index channel index, SWO_CHANNEL_BASE + stimulus port
+ * @param data
+ * @return true if there was one
+ */
+bool SwoTrace::getChunk(int *index, std::vector<uint8_t> *data)
+{
+    std::pair<int, std::vector<uint8_t>> chunk;
+    if (!this->_queue.try_dequeue(chunk))
+    {
+        return false;
+    }
+
+    *index = chunk.first;
+    *data = std::move(chunk.second);
+    return true;
+}
+
+/**
+ * @brief
+ */
+void SwoTrace::run()
+{
+    std::vector<uint8_t> buffer(SWO_POLL_SIZE);
+    bool failing = false;
+
+    while (!this->_stop)
+    {
+        size_t size = buffer.size();
+        int ret = this->_rtt->pollSwo(buffer.data(), &size);
+        if (ret != ERROR_OK)
+        {
+            if (!failing)
+            {
+                LOG_WARNING("SWO poll failed (%d)", ret);
+                failing = true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(SWO_ERROR_MS));
+            continue;
+        }
+
+        failing = false;
+
+        if (!size)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(SWO_IDLE_MS));
+            continue;
+        }
+
+        this->_bytes += size;
+        this->_decoder.feed(buffer.data(), size);
+
+        if (this->_profiler && (this->_pcs.size() || this->_sleeps))
+        {
+            this->_profiler->addSamples(this->_pcs, this->_sleeps);
+        }
+        this->_pcs.clear();
+        this->_sleeps = 0;
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_SWO_H
+#define _PH_SWO_H
+
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "concurrentqueue.h"
+#include "strtt.h"
+#include "itm.h"
+#include "profiler.h"
+
+// probe side buffer is 4KB (STLINK_TRACE_SIZE)
+#define SWO_POLL_SIZE (4096)
+// wait between polls that returned nothing
+#define SWO_IDLE_MS (2)
+// wait after a failed poll, the main loop is recovering the probe
+#define SWO_ERROR_MS (100)
+
+//
+// Drains the probe's trace endpoint on its own thread, so SWO keeps up
+// independent of the RTT poll rate. ITM stimulus port data is handed to the
+// main thread through a queue, as channel SWO_CHANNEL_BASE + port. DWT PC
+// samples go straight to the profiler, if there is one.
+//
+class SwoTrace
+{
+private:
+    StRtt *_rtt;
+    ItmDecoder _decoder;
+    Profiler *_profiler;
+
+    // PC samples of the current chunk
+    std::vector<uint32_t> _pcs;
+    uint64_t _sleeps;
+
+    // channel index, data
+    moodycamel::ConcurrentQueue<std::pair<int, std::vector<uint8_t>>> _queue;
+
+    std::thread _th;
+    std::atomic_bool _stop;
+    std::atomic<uint64_t> _bytes;
+
+    void run();
+
+public:
+    SwoTrace(StRtt *rtt, Profiler *profiler = nullptr);
+    ~SwoTrace();
+
+    void stop();
+    bool getChunk(int *index, std::vector<uint8_t> *data);
+
+    uint64_t getBytes() const { return _bytes; }
+    uint32_t getOverflows() const { return _decoder.getOverflows(); }
+};
+
+#endif
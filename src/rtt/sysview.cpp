@@ -15,17 +15,53 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <chrono>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include <errno.h>
+#include <string.h>
+#ifdef _WIN32
+#include <BaseTsd.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SSIZE_T ssize_t;
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
 #include "log.h"
+#include "stlink_errors.h"
 #include "sysview.h"
 
-using namespace moodycamel;
-using namespace std::chrono_literals;
-
 extern std::atomic_bool stopApp;
 
-#define DEQ_SIZE 1400
+// how often the accept and socket loops look at stopApp
+#define ACCEPT_POLL_MS 100
+// throughput line while connected, shown with -v 3
+#define SYSVIEW_REPORT_MS 10000
+// socket loop nap where the ring has no fd to wait on (Windows)
+#define RING_NAP_MS 1
+
+// SIGPIPE is asked away per send() on Linux, per socket on macOS, Windows has none
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+// host -> target commands, SEGGER_SYSVIEW.c
+#define SYSVIEW_COMMAND_ID_START 1
+#define SYSVIEW_COMMAND_ID_STOP 2
 
 #define SYSVIEW_COMM_TARGET_HELLO_SIZE 32
 #define SYSVIEW_COMM_APP_HELLO_SIZE 32
@@ -37,56 +73,499 @@ static const char _abHelloMsg[SYSVIEW_COMM_TARGET_HELLO_SIZE] = {'S', 'E', 'G',
                                                                  'V', '0' + SEGGER_SYSVIEW_MAJOR, '.', '0' + (SEGGER_SYSVIEW_MINOR / 10), '0' + (SEGGER_SYSVIEW_MINOR % 10), '.',
                                                                  '0' + (SEGGER_SYSVIEW_REV / 10), '0' + (SEGGER_SYSVIEW_REV % 10), '\0', 0, 0, 0, 0, 0};
 
+// sockets, Winsock spells a few things differently
+
+static int sock_error()
+{
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+static bool sock_again(int err)
+{
+#ifdef _WIN32
+    return err == WSAEWOULDBLOCK;
+#else
+    return (err == EAGAIN) || (err == EWOULDBLOCK);
+#endif
+}
+
+static bool sock_intr(int err)
+{
+#ifdef _WIN32
+    return err == WSAEINTR;
+#else
+    return err == EINTR;
+#endif
+}
+
+static std::string sock_strerror(int err)
+{
+#ifdef _WIN32
+    return "WSA error " + std::to_string(err);
+#else
+    return strerror(err);
+#endif
+}
+
+static void sock_close(int sock)
+{
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+}
+
+static void sock_nonblock(int sock)
+{
+#ifdef _WIN32
+    u_long on = 1;
+    ioctlsocket(sock, FIONBIO, &on);
+#else
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+static ssize_t sock_send(int sock, const void *buf, size_t n)
+{
+    return send(sock, (const char *)buf, (int)n, SEND_FLAGS);
+}
+
+static ssize_t sock_recv(int sock, void *buf, size_t n)
+{
+    return recv(sock, (char *)buf, (int)n, 0);
+}
+
+/**
+ * @brief poll() on up to two fds, WSAPoll() on Windows.
+ *
+ * @param fds
+ * @param events asked for, POLLIN / POLLOUT
+ * @param revents
+ * @param n
+ * @param timeoutMs
+ * @return int as poll()
+ */
+static int sock_poll(const int *fds, const short *events, short *revents, int n, int timeoutMs)
+{
+    struct pollfd pfd[2] = {};
+    for (int i = 0; i < n; i++)
+    {
+#ifdef _WIN32
+        pfd[i].fd = (SOCKET)fds[i];
+#else
+        pfd[i].fd = fds[i];
+#endif
+        pfd[i].events = events[i];
+    }
+
+#ifdef _WIN32
+    int ret = WSAPoll(pfd, n, timeoutMs);
+#else
+    int ret = poll(pfd, n, timeoutMs);
+#endif
+
+    for (int i = 0; i < n; i++)
+    {
+        revents[i] = pfd[i].revents;
+    }
+    return ret;
+}
+
+/**
+ * @brief What run_socket() sleeps on: the socket and the wake-up fd of the
+ * ring with target data. epoll on Linux, poll() elsewhere. Where the ring
+ * has no fd (Windows) only the socket is polled, for RING_NAP_MS at most.
+ */
+class SocketWait
+{
+public:
+    SocketWait(int sock, int ringFd);
+    ~SocketWait();
+    bool ok() const;
+    void want(bool out, bool in);
+    int wait(int timeoutMs, bool *ring, bool *readable, bool *hangup);
+
+private:
+    int _sock;
+    int _ringFd;
+    bool _out;
+    bool _in;
+#ifdef __linux__
+    int _ep;
+#endif
+};
+
+SocketWait::SocketWait(int sock, int ringFd)
+    : _sock(sock), _ringFd(ringFd), _out(false), _in(true)
+{
+#ifdef __linux__
+    this->_ep = epoll_create1(EPOLL_CLOEXEC);
+    if (this->_ep < 0)
+    {
+        return;
+    }
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = ringFd;
+    epoll_ctl(this->_ep, EPOLL_CTL_ADD, ringFd, &ev);
+
+    ev.events = EPOLLIN;
+    ev.data.fd = sock;
+    epoll_ctl(this->_ep, EPOLL_CTL_ADD, sock, &ev);
+#endif
+}
+
+SocketWait::~SocketWait()
+{
+#ifdef __linux__
+    if (this->_ep >= 0)
+    {
+        close(this->_ep);
+    }
+#endif
+}
+
+bool SocketWait::ok() const
+{
+#ifdef __linux__
+    return this->_ep >= 0;
+#else
+    return true;
+#endif
+}
+
+/**
+ * @brief Writable only while the socket is full, readable only while the
+ * ring for the target has room.
+ *
+ * @param out
+ * @param in
+ */
+void SocketWait::want(bool out, bool in)
+{
+    if ((out == this->_out) && (in == this->_in))
+    {
+        return;
+    }
+
+    this->_out = out;
+    this->_in = in;
+
+#ifdef __linux__
+    struct epoll_event ev = {};
+    ev.events = (out ? (uint32_t)EPOLLOUT : 0u) | (in ? (uint32_t)EPOLLIN : 0u);
+    ev.data.fd = this->_sock;
+    epoll_ctl(this->_ep, EPOLL_CTL_MOD, this->_sock, &ev);
+#endif
+}
+
+/**
+ * @brief
+ *
+ * @param timeoutMs
+ * @param ring ring's fd fired
+ * @param readable SystemView sent something
+ * @param hangup socket closed or failed
+ * @return int events, 0 on timeout, -1 on error (errno)
+ */
+int SocketWait::wait(int timeoutMs, bool *ring, bool *readable, bool *hangup)
+{
+    *ring = *readable = *hangup = false;
+
+#ifdef __linux__
+    struct epoll_event events[2];
+    int nev = epoll_wait(this->_ep, events, 2, timeoutMs);
+
+    for (int i = 0; i < nev; i++)
+    {
+        if (events[i].data.fd == this->_ringFd)
+        {
+            *ring = true;
+        }
+        else if (events[i].events & (EPOLLHUP | EPOLLERR))
+        {
+            // reported even while EPOLLIN is masked, level triggered it would fire forever
+            *hangup = true;
+        }
+        else if (events[i].events & EPOLLIN)
+        {
+            *readable = true;
+        }
+    }
+    return nev;
+#else
+    int fds[2] = {this->_sock, this->_ringFd};
+    short events[2] = {(short)((this->_out ? POLLOUT : 0) | (this->_in ? POLLIN : 0)), POLLIN};
+    short revents[2];
+    int n = (this->_ringFd >= 0) ? 2 : 1;
+
+    int nev = sock_poll(fds, events, revents, n, (n == 2) ? timeoutMs : RING_NAP_MS);
+    if (nev > 0)
+    {
+        *ring = (n == 2) && (revents[1] & POLLIN);
+        *hangup = revents[0] & (POLLHUP | POLLERR);
+        *readable = !*hangup && (revents[0] & POLLIN);
+    }
+    return nev;
+#endif
+}
+
 /**
  * @brief Construct a new Sys View:: Sys View object
  * 
  * @param port 
  */
 SysView::SysView(int port)
+    : _from_uc(SYSVIEW_FROM_UC_SIZE), _to_uc(SYSVIEW_TO_UC_SIZE)
 {
+    this->_dropped = 0;
     this->_connected = false;
+    this->_recording = false;
+    this->_recState = SYSVIEW_REC_SYNC;
+    this->_rotateBytes = 0;
+    this->_fileBytes = 0;
+    this->_decoder = nullptr;
+    this->_restart = false;
     this->_port = port;
     this->_th = std::thread(&SysView::run_server, this);
 }
 
 /**
- * @brief 
+ * @brief Destroy the Sys View:: Sys View object, stopApp has to be set
+ * already, the server thread checks it
+ */
+SysView::~SysView()
+{
+    if (this->_th.joinable())
+    {
+        this->_th.join();
+    }
+
+    if (this->_recording)
+    {
+        this->_rec.close();
+        LOG_USER("SysView: recorded %llu bytes, %llu dropped", (unsigned long long)this->_rec.getWritten(),
+                 (unsigned long long)this->_rec.getDropped());
+    }
+}
+
+/**
+ * @brief Writes the channel to path whether a client is connected or not.
+ * The stream is written as is, like J-Link RTT Logger does, SystemView
+ * loads it with File / Load Data when named *.SVDat.
+ *
+ * Every file has to start with the sync info SystemView needs, and only a
+ * started recorder sends it. So the target recorder is restarted (STOP,
+ * START) for the first file and for each rotation, and a file begins
+ * where the restarted stream does, see recordChunk(). While SystemView is
+ * connected the restart, and with it the rotation, waits until it
+ * disconnects.
+ *
+ * @param path
+ * @param rotateBytes continue in path.1.SVDat ... above this size, 0 = never
+ * @return int ERROR_OK or ERROR_FAIL
+ */
+int SysView::record(const std::string &path, uint64_t rotateBytes)
+{
+    int ret = this->_rec.open(path);
+    if (ret != ERROR_OK)
+    {
+        return ret;
+    }
+
+    LOG_USER("SysView: recording to %s", path.c_str());
+    this->_recState = SYSVIEW_REC_SYNC;
+    this->_rotateBytes = rotateBytes;
+    this->_fileBytes = 0;
+    this->_recording = true;
+
+    // nobody else will send START if no client connects
+    this->_restart = true;
+    return ERROR_OK;
+}
+
+/**
+ * @brief Writes all of it to a non blocking socket.
+ *
+ * @return ssize_t n, or -1 on error
+ */
+static ssize_t write_n(int sock, const void *buf, size_t n)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    size_t done = 0;
+
+    while (done < n)
+    {
+        ssize_t nn = sock_send(sock, p + done, n - done);
+        if (nn < 0)
+        {
+            int err = sock_error();
+            if (sock_again(err))
+            {
+                short events = POLLOUT, revents;
+                sock_poll(&sock, &events, &revents, 1, ACCEPT_POLL_MS);
+                continue;
+            }
+            if (sock_intr(err))
+            {
+                continue;
+            }
+            return -1;
+        }
+        done += nn;
+    }
+
+    return (ssize_t)done;
+}
+
+/**
+ * @brief Decodes the channel on the main thread, for the CPU load report.
+ *
+ * @param decoder
+ */
+void SysView::setDecoder(SysViewDecoder *decoder)
+{
+    this->_decoder = decoder;
+
+    // like recording, it needs the target recorder running without a client
+    this->_restart = true;
+}
+
+/**
+ * @brief Queues a chunk read from the target, the socket thread wakes up
+ * on the ring's eventfd.
  * 
  * @param buffer 
- * @return true 
+ * @return true if all of it fit
  * @return false 
  */
 bool SysView::saveFromSTM(const std::vector<uint8_t> *buffer)
 {
-    if (this->_connected)
+    if (this->_recording)
     {
-        return this->_q_from_uc.enqueue_bulk(buffer->data(), buffer->size());
+        this->recordChunk(buffer->data(), buffer->size());
+    }
+
+    if (this->_decoder)
+    {
+        this->_decoder->feed(buffer->data(), buffer->size());
+    }
+
+    if (!this->_connected)
+    {
+        return this->_recording || this->_decoder;
+    }
+
+    size_t n = this->_from_uc.write(buffer->data(), buffer->size());
+    if (n != buffer->size())
+    {
+        // SystemView can't resync in the middle of a stream, tell the user once in a while
+        if ((this->_dropped++ % 1000) == 0)
+        {
+            LOG_WARNING("SysView client too slow, dropped %d bytes", (int)(buffer->size() - n));
+        }
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Appends a chunk to the recording. Before the first start of the
+ * recorder nothing is written, SystemView couldn't load it. Once the file
+ * is full a restart is queued and the file keeps growing until the
+ * restarted stream arrives; the next file begins there, with the sync
+ * zeros and TRACE_START.
+ *
+ * @param data
+ * @param size
+ */
+void SysView::recordChunk(const uint8_t *data, size_t size)
+{
+    static const uint8_t sync[SYSVIEW_SYNC_SIZE] = {0};
+
+    this->_recFraming.feed(data, size);
+    const SYSVIEW_RESTART &restart = this->_recFraming.getRestart();
+
+    size_t at = 0;
+    if (restart.found && ((this->_recState == SYSVIEW_REC_SYNC) || (this->_recState == SYSVIEW_REC_SWITCH)))
+    {
+        if (this->_recState == SYSVIEW_REC_SWITCH)
+        {
+            // the old stream, up to the restart, stays in the old file
+            this->_rec.write(data, restart.offset);
+            std::string name = this->_rec.rotate();
+            LOG_USER("SysView: recording to %s", name.c_str());
+        }
+
+        this->_rec.write(sync, sizeof(sync));
+        this->_rec.write(restart.head, restart.headSize);
+        this->_fileBytes = sizeof(sync) + restart.headSize;
+        this->_recState = SYSVIEW_REC_WRITE;
+        at = restart.offset;
+    }
+
+    if (this->_recState == SYSVIEW_REC_SYNC)
+    {
+        return;
+    }
+
+    this->_rec.write(data + at, size - at);
+    this->_fileBytes += size - at;
+
+    if ((this->_recState == SYSVIEW_REC_WRITE) && this->_rotateBytes && (this->_fileBytes >= this->_rotateBytes))
+    {
+        this->_recState = SYSVIEW_REC_ROTATE;
+        this->_restart = true;
     }
-    return false;
 }
 
 /**
  * @brief 
  * 
- * @return size_t 
+ * @return size_t bytes waiting for the target
  */
 size_t SysView::dataToSTM()
 {
-    return this->_q_to_uc.size_approx();
+    return this->_to_uc.size() + ((this->_restart && !this->_connected) ? 2 : 0);
 }
 
 /**
- * @brief 
+ * @brief Appends everything waiting for the target to data.
  * 
- * @return std::vector<unsigned char> 
+ * @param data 
+ * @return size_t bytes appended
  */
-std::vector<unsigned char> SysView::getDataToSTM()
+size_t SysView::getDataToSTM(std::vector<unsigned char> *data)
 {
-    size_t n = this->_q_to_uc.size_approx();
-    std::vector<unsigned char> data;
-    data.resize(n);
-    this->_q_to_uc.try_dequeue_bulk(data.data(), data.size());
-    return data;
+    size_t start = data->size();
+
+    // our own STOP/START first, the ring belongs to the socket thread. Never
+    // while SystemView is connected, it runs the recorder then; the restart
+    // waits until it disconnects
+    if (!this->_connected && this->_restart.exchange(false))
+    {
+        data->push_back(SYSVIEW_COMMAND_ID_STOP);
+        data->push_back(SYSVIEW_COMMAND_ID_START);
+
+        // from now on the restarted stream may arrive
+        if (this->_recState == SYSVIEW_REC_ROTATE)
+        {
+            this->_recState = SYSVIEW_REC_SWITCH;
+        }
+    }
+
+    size_t old = data->size();
+    size_t n = this->_to_uc.size();
+    data->resize(old + n);
+    n = this->_to_uc.read(data->data() + old, n);
+    data->resize(old + n);
+    return data->size() - start;
 }
 
 /**
@@ -95,34 +574,194 @@ std::vector<unsigned char> SysView::getDataToSTM()
  */
 void SysView::run_server()
 {
-    sockpp::socket_initializer sockInit;
-    sockpp::tcp_acceptor acc(this->_port);
+#ifdef _WIN32
+    WSADATA wsaData;
+    int wsa = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (wsa != 0)
+    {
+        LOG_ERROR("Error initializing sockets (WSAStartup failed: %d)", wsa);
+        return;
+    }
+#endif
 
-    if (!acc)
+    int acc = (int)socket(AF_INET, SOCK_STREAM, 0);
+    if (acc < 0)
     {
-        LOG_ERROR("Error creating the acceptor: %s", acc.last_error_str().c_str());
-        exit(EXIT_FAILURE);
+        LOG_ERROR("Error creating the acceptor: %s", sock_strerror(sock_error()).c_str());
+        return;
     }
 
-    LOG_USER("Acceptor bound to address: %s", acc.address().to_string().c_str());
+    int reuse = 1;
+    setsockopt(acc, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(this->_port);
+
+    if ((bind(acc, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(acc, 1) < 0))
+    {
+        LOG_ERROR("Error binding the acceptor to port %d: %s", this->_port, sock_strerror(sock_error()).c_str());
+        sock_close(acc);
+        return;
+    }
+
+    LOG_USER("Acceptor bound to address: 0.0.0.0:%d", this->_port);
     LOG_USER("Awaiting connections on port %d ...", this->_port);
 
     while (!stopApp)
     {
-        sockpp::inet_address peer;
+        // don't block in accept(), we have to notice stopApp
+        short events = POLLIN, revents;
+        if (sock_poll(&acc, &events, &revents, 1, ACCEPT_POLL_MS) <= 0)
+        {
+            continue;
+        }
 
         // Accept a new sysview connection
-        sockpp::tcp_socket sock = acc.accept(&peer);
-        LOG_USER("Received a connection request from %s", peer.to_string().c_str());
+        struct sockaddr_in peerAddr;
+        socklen_t peerLen = sizeof(peerAddr);
+        int sock = (int)accept(acc, (struct sockaddr *)&peerAddr, &peerLen);
+
+        if (sock < 0)
+        {
+            LOG_ERROR("Error accepting incoming connection: %s", sock_strerror(sock_error()).c_str());
+            continue;
+        }
+
+#ifdef SO_NOSIGPIPE
+        int noSigPipe = 1;
+        setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+
+        char ip[INET_ADDRSTRLEN] = "?";
+        inet_ntop(AF_INET, &peerAddr.sin_addr, ip, sizeof(ip));
+        std::string peer = std::string(ip) + ":" + std::to_string(ntohs(peerAddr.sin_port));
+        LOG_USER("Received a connection request from %s", peer.c_str());
+
+        this->run_socket(sock, peer);
+        sock_close(sock);
+    }
+
+    sock_close(acc);
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+/**
+ * @brief Sends what the ring has without blocking, a partial send leaves
+ * the rest in the ring until the socket is writable again.
+ *
+ * @param sock
+ * @return int 1 all sent, 0 socket full, -1 error
+ */
+int SysView::flush(int sock)
+{
+    const uint8_t *span;
+    size_t n;
+
+    while ((n = this->_from_uc.readSpan(&span)) > 0)
+    {
+        ssize_t nn = sock_send(sock, span, n);
+        if (nn < 0)
+        {
+            int err = sock_error();
+            if (sock_again(err))
+            {
+                this->_stats.blocked++;
+                return 0;
+            }
+            if (sock_intr(err))
+            {
+                continue;
+            }
+            LOG_ERROR("Socket send error: %s", sock_strerror(err).c_str());
+            return -1;
+        }
+
+        this->_from_uc.consume(nn);
+        this->_stats.sends++;
+        this->_stats.toHost += nn;
+
+        if ((size_t)nn < n)
+        {
+            this->_stats.partial++;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Moves what SystemView sent into the ring for the target.
+ *
+ * @param sock
+ * @return int 1 ok, 0 ring full, -1 closed or error
+ */
+int SysView::receive(int sock)
+{
+    while (true)
+    {
+        // no more than the ring takes, the rest stays in the socket
+        uint8_t *dst;
+        size_t room = this->_to_uc.writeSpan(&dst);
+        if (!room)
+        {
+            return 0;
+        }
 
-        if (!sock)
+        ssize_t n = sock_recv(sock, dst, room);
+        if (n < 0)
         {
-            LOG_ERROR("Error accepting incoming connection: %s", acc.last_error_str().c_str());
+            int err = sock_error();
+            if (sock_again(err))
+            {
+                return 1;
+            }
+            if (sock_intr(err))
+            {
+                continue;
+            }
+            LOG_ERROR("Socket received error: %s", sock_strerror(err).c_str());
+            return -1;
         }
-        else
+        if (n == 0)
         {
-            this->run_socket(std::move(sock));
+            return -1;
         }
+
+        this->_to_uc.commit(n);
+        this->_stats.toTarget += n;
+    }
+}
+
+/**
+ * @brief Throughput of the current connection, instead of a line per packet.
+ * 
+ * @param since connection start
+ * @param final at close, shown without -d
+ */
+void SysView::report(std::chrono::steady_clock::time_point since, bool final)
+{
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+    if (secs <= 0)
+        secs = 1;
+
+    char line[256];
+    snprintf(line, sizeof(line), "SysView: to SystemView %llu B (%.1f KB/s) in %u sends, %u partial, %u blocked, from SystemView %llu B, %u chunks dropped",
+             (unsigned long long)this->_stats.toHost, this->_stats.toHost / secs / 1024, this->_stats.sends,
+             this->_stats.partial, this->_stats.blocked, (unsigned long long)this->_stats.toTarget, (unsigned)this->_dropped);
+
+    if (final)
+    {
+        LOG_USER("%s", line);
+    }
+    else
+    {
+        LOG_DEBUG("%s", line);
     }
 }
 
@@ -130,16 +769,15 @@ void SysView::run_server()
  * @brief 
  * 
  * @param sock 
+ * @param peer 
  */
-void SysView::run_socket(sockpp::tcp_socket sock)
+void SysView::run_socket(int sock, const std::string &peer)
 {
-    sock.set_non_blocking();
-
     ssize_t n;
-    char buf[1024 * 2];
+    char buf[SYSVIEW_COMM_APP_HELLO_SIZE * 2];
 
     // first we should get HELLO message
-    n = sock.read(buf, sizeof(buf));
+    n = sock_recv(sock, buf, sizeof(buf));
 
     if (n != SYSVIEW_COMM_APP_HELLO_SIZE)
     {
@@ -150,7 +788,7 @@ void SysView::run_socket(sockpp::tcp_socket sock)
     LOG_USER("Received HELLO message");
 
     // answer to HELLO message
-    n = sock.write_n(_abHelloMsg, sizeof(_abHelloMsg));
+    n = write_n(sock, _abHelloMsg, sizeof(_abHelloMsg));
     if (n != SYSVIEW_COMM_TARGET_HELLO_SIZE)
     {
         LOG_ERROR("Failed to send Hello message to SystemView App");
@@ -159,71 +797,73 @@ void SysView::run_socket(sockpp::tcp_socket sock)
 
     LOG_USER("Answered HELLO message");
 
+    // from now on non blocking
+    sock_nonblock(sock);
+
+    // wake on target data (ring eventfd) and on SystemView commands
+    SocketWait waiter(sock, this->_from_uc.eventFd());
+    if (!waiter.ok())
+    {
+        LOG_ERROR("Error creating epoll: %s", strerror(errno));
+        return;
+    }
+
     // purge all data from uc
-    n = this->_q_from_uc.size_approx();
-    std::vector<unsigned char> data;
-    data.resize(n);
-    this->_q_from_uc.try_dequeue_bulk(data.data(), data.size());
+    this->_from_uc.clear();
+    this->_stats = {};
+    this->_dropped = 0;
 
     // no looks like we are connected
     this->_connected = true;
 
-    int errnum;
-    unsigned char deq_buff[DEQ_SIZE];
+    auto start = std::chrono::steady_clock::now();
+    auto lastReport = start;
 
     while (!stopApp)
     {
-        // write to socket if we get data from uc
-        n = this->_q_from_uc.wait_dequeue_bulk_timed(deq_buff, sizeof(deq_buff), 10ms);
-        if (n)
+        bool ring, readable, closed;
+        if (waiter.wait(ACCEPT_POLL_MS, &ring, &readable, &closed) < 0)
         {
-            ssize_t nn = sock.write_n(deq_buff, n);
-            LOG_USER("Socket send %d from %d", (int)nn, (int)n);
+            int err = sock_error();
+            if (sock_intr(err))
+                continue;
+            LOG_ERROR("Socket poll error: %s", sock_strerror(err).c_str());
+            break;
         }
 
-        // read socket
-        n = sock.read(buf, sizeof(buf));
-
-        // returned error
-        if (n == -1)
+        if (ring)
         {
-            errnum = errno;
-
-            // if no data received
-            if (errnum == EWOULDBLOCK)
-            {
-                continue;
-            }
-
-            // if error return
-            LOG_ERROR("Socket received error: %s", std::strerror(errnum));
-            return;
+            this->_from_uc.drainEvent();
         }
-        else if (n == 0)
+        if (readable)
         {
-            goto closed;
+            closed |= this->receive(sock) < 0;
         }
-        else
+
+        // always try, the eventfd only fires when the ring was empty
+        int sent = this->flush(sock);
+        if (closed || (sent < 0))
         {
-            // received data
-            if (n > 1)
-            {
-                LOG_USER("Socket received: %d, 0x%02x 0x%02x", (int)n, buf[0], buf[1]);
-            }
-            else
-            {
-                LOG_USER("Socket received: %d, 0x%02x", (int)n, buf[0]);
-            }
+            break;
+        }
 
-            // write to que and later to uc
-            if (!this->_q_to_uc.enqueue_bulk(buf, n))
-            {
-                LOG_ERROR("Can't enqueue data from SystemView");
-            }
+        waiter.want(!sent, this->_to_uc.size() < this->_to_uc.capacity());
+
+        if (std::chrono::steady_clock::now() - lastReport > std::chrono::milliseconds(SYSVIEW_REPORT_MS))
+        {
+            lastReport = std::chrono::steady_clock::now();
+            this->report(start, false);
         }
     }
 
-closed:
     this->_connected = false;
-    LOG_USER("Connection closed from %s", sock.peer_address().to_string().c_str());
-}
\ No newline at end of file
+
+    // SystemView stops the target when it disconnects, keep recording / decoding
+    if (this->_recording || this->_decoder)
+    {
+        this->_restart = true;
+    }
+
+    LOG_USER("Connection closed from %s", peer.c_str());
+    this->report(start, true);
+}
@@ -18,27 +18,78 @@
 #ifndef _SYSVIEW_H
 #define _SYSVIEW_H
 
-#include <sockpp/tcp_acceptor.h>
+#include <stdint.h>
 
-#include "blockingconcurrentqueue.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bytering.h"
+#include "filewriter.h"
+#include "sysviewdecoder.h"
+
+// RTT channel name SEGGER_SYSVIEW_Init() registers
+#define SYSVIEW_CHANNEL_NAME "SysView"
+
+// target -> SystemView, a few seconds of a busy target
+#define SYSVIEW_FROM_UC_SIZE (1024 * 1024)
+// SystemView -> target, only commands
+#define SYSVIEW_TO_UC_SIZE (16 * 1024)
+
+typedef struct
+{
+    uint64_t toHost;   // bytes sent to SystemView
+    uint64_t toTarget; // bytes received from SystemView
+    uint32_t sends;    // send() calls
+    uint32_t partial;  // send() took less than offered
+    uint32_t blocked;  // send() would block, waiting until writable
+} SYSVIEW_STATS;
+
+// -svrec, main thread only
+typedef enum
+{
+    SYSVIEW_REC_SYNC,   // nothing written yet, waiting for the recorder to start
+    SYSVIEW_REC_WRITE,  // appending to the current file
+    SYSVIEW_REC_ROTATE, // file is full, STOP/START queued
+    SYSVIEW_REC_SWITCH, // STOP/START sent, the next file begins where the recorder restarts
+} SYSVIEW_REC_STATE;
 
 class SysView
 {
 public:
     SysView(int port);
+    ~SysView();
+    int record(const std::string &path, uint64_t rotateBytes);
+    void setDecoder(SysViewDecoder *decoder);
     bool saveFromSTM(const std::vector<uint8_t> *buffer);
     size_t dataToSTM();
-    std::vector<unsigned char> getDataToSTM();
+    size_t getDataToSTM(std::vector<unsigned char> *data);
 
 private:
-    moodycamel::BlockingConcurrentQueue<unsigned char> _q_from_uc;
-    moodycamel::BlockingConcurrentQueue<unsigned char> _q_to_uc;
+    ByteRing _from_uc;
+    ByteRing _to_uc;
+    std::atomic<uint32_t> _dropped;
+    SYSVIEW_STATS _stats;
+    FileWriter _rec;
+    std::atomic_bool _recording;
+    SYSVIEW_REC_STATE _recState;
+    SysViewDecoder _recFraming;
+    uint64_t _rotateBytes;
+    uint64_t _fileBytes;
+    SysViewDecoder *_decoder;
+    std::atomic_bool _restart;
     int _port;
     std::thread _th;
-    bool _connected;
+    std::atomic_bool _connected;
 
+    void recordChunk(const uint8_t *data, size_t size);
     void run_server();
-    void run_socket(sockpp::tcp_socket sock);
+    void run_socket(int sock, const std::string &peer);
+    int flush(int sock);
+    int receive(int sock);
+    void report(std::chrono::steady_clock::time_point since, bool final);
 };
 
 #endif
@@ -0,0 +1,595 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// cpp
+#include <algorithm>
+
+// c
+#include <stdio.h>
+#include <string.h>
+
+// local
+#include "sysviewdecoder.h"
+#include "log.h"
+
+// payload of the events without a length field: LEB128 U32s, then maybe a string
+typedef struct
+{
+    uint8_t args;
+    uint8_t str;
+} SYSVIEW_FIXED;
+
+#define SYSVIEW_NO_LENGTH 24
+#define SYSVIEW_ARGS_MAX 4
+#define SYSVIEW_UNKNOWN 0xFF
+
+static const SYSVIEW_FIXED _fixed[SYSVIEW_NO_LENGTH] = {
+    {0, 0},               // NOP, sync
+    {1, 0},               // OVERFLOW drop count
+    {1, 0},               // ISR_ENTER isr
+    {0, 0},               // ISR_EXIT
+    {1, 0},               // TASK_START_EXEC task
+    {0, 0},               // TASK_STOP_EXEC
+    {1, 0},               // TASK_START_READY task
+    {2, 0},               // TASK_STOP_READY task, cause
+    {1, 0},               // TASK_CREATE task
+    {2, 1},               // TASK_INFO task, prio, name
+    {0, 0},               // TRACE_START
+    {0, 0},               // TRACE_STOP
+    {1, 0},               // SYSTIME_CYCLES
+    {2, 0},               // SYSTIME_US low, high
+    {0, 1},               // SYSDESC
+    {1, 0},               // MARK_START
+    {1, 0},               // MARK_STOP
+    {0, 0},               // IDLE
+    {0, 0},               // ISR_TO_SCHEDULER
+    {1, 0},               // TIMER_ENTER
+    {0, 0},               // TIMER_EXIT
+    {4, 0},               // STACK_INFO task, base, size, end
+    {2, 1},               // MODULEDESC offset, count, description
+    {SYSVIEW_UNKNOWN, 0}, //
+};
+
+/**
+ * @brief LEB128, 7 bits per byte, low first
+ *
+ * @return int 1 ok, 0 need more data, -1 not a U32
+ */
+static int getU32(const uint8_t *p, size_t n, size_t *pos, uint32_t *value)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 5; i++)
+    {
+        if (*pos >= n)
+            return 0;
+
+        uint8_t b = p[(*pos)++];
+        v |= (uint32_t)(b & 0x7F) << (7 * i);
+        if (!(b & 0x80))
+        {
+            *value = v;
+            return 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Construct a new Sys View Decoder:: Sys View Decoder object
+ */
+SysViewDecoder::SysViewDecoder()
+{
+    this->_used = 0;
+    this->_now = 0;
+    this->_last = 0;
+    this->_sysFreq = 0;
+    // started before we attached
+    this->_tracing = true;
+    this->_numTasks = 0;
+    this->_numIsrs = 0;
+    this->_running = -1;
+    this->_isrDepth = 0;
+    memset(&this->_load, 0, sizeof(this->_load));
+    memset(&this->_restart, 0, sizeof(this->_restart));
+    this->_zeros = 0;
+}
+
+/**
+ * @brief Decodes what it can, a packet split between calls is kept for the next one.
+ *
+ * @param data
+ * @param size
+ */
+void SysViewDecoder::feed(const uint8_t *data, size_t size)
+{
+    this->_restart.found = false;
+    size_t base = 0;
+
+    while (size)
+    {
+        // _packet[i] is data[base - carried + i], negative for an earlier feed()
+        size_t carried = this->_used;
+        size_t n = std::min(size, sizeof(this->_packet) - this->_used);
+        memcpy(this->_packet + this->_used, data, n);
+        this->_used += n;
+        data += n;
+        size -= n;
+
+        size_t pos = 0;
+        while (pos < this->_used)
+        {
+            int ret = this->parse(this->_packet + pos, this->_used - pos);
+            if (ret == 0)
+            {
+                break;
+            }
+            if (ret < 0)
+            {
+                // not a packet we know, resync on the next byte
+                this->_load.unknown++;
+                this->_zeros = 0;
+                pos++;
+                continue;
+            }
+
+            // a restart is TRACE_START right behind the whole sync, not just any 0x0A
+            if (this->_packet[pos] == SYSVIEW_EVTID_NOP)
+            {
+                this->_zeros++;
+            }
+            else
+            {
+                if ((this->_packet[pos] == SYSVIEW_EVTID_TRACE_START) && (this->_zeros >= SYSVIEW_SYNC_SIZE) && !this->_restart.found)
+                {
+                    this->restartAt(base, carried, pos, ret);
+                }
+                this->_zeros = 0;
+            }
+            pos += ret;
+        }
+
+        // can't happen with well formed packets, don't get stuck on a full buffer
+        if (!pos && (this->_used == sizeof(this->_packet)))
+        {
+            this->_load.unknown++;
+            this->_zeros = 0;
+            pos = 1;
+        }
+
+        memmove(this->_packet, this->_packet + pos, this->_used - pos);
+        this->_used -= pos;
+        base += n;
+    }
+}
+
+/**
+ * @brief Notes where the TRACE_START packet at _packet[pos] is in the data
+ * passed to feed(). A started recorder sends it right after its
+ * SYSVIEW_SYNC_SIZE sync zeros, followed by INIT and the system description.
+ *
+ * @param base offset in that data of the piece being parsed
+ * @param carried bytes in _packet before that piece
+ * @param pos
+ * @param size packet size
+ */
+void SysViewDecoder::restartAt(size_t base, size_t carried, size_t pos, int size)
+{
+    this->_restart.found = true;
+
+    if (base + pos >= carried)
+    {
+        this->_restart.offset = base + pos - carried;
+        this->_restart.headSize = 0;
+        return;
+    }
+
+    // the packet began in an earlier feed()
+    this->_restart.offset = 0;
+    this->_restart.headSize = std::min(carried - base - pos, std::min((size_t)size, sizeof(this->_restart.head)));
+    memcpy(this->_restart.head, this->_packet + pos, this->_restart.headSize);
+}
+
+/**
+ * @brief One packet from the start of p.
+ *
+ * @param p
+ * @param n
+ * @return int bytes used, 0 incomplete, -1 garbage
+ */
+int SysViewDecoder::parse(const uint8_t *p, size_t n)
+{
+    uint32_t args[SYSVIEW_ARGS_MAX] = {0};
+    const uint8_t *str = nullptr;
+    size_t strLen = 0;
+    size_t pos = 0;
+    uint32_t id, delta;
+    int ret;
+
+    // sync and NOP are a bare 0, no time stamp
+    if (p[0] == SYSVIEW_EVTID_NOP)
+    {
+        return 1;
+    }
+
+    if ((ret = getU32(p, n, &pos, &id)) <= 0)
+        return ret;
+
+    if (id < SYSVIEW_NO_LENGTH)
+    {
+        const SYSVIEW_FIXED *fixed = &_fixed[id];
+        if (fixed->args == SYSVIEW_UNKNOWN)
+            return -1;
+
+        for (int i = 0; i < fixed->args; i++)
+        {
+            if ((ret = getU32(p, n, &pos, &args[i])) <= 0)
+                return ret;
+        }
+
+        if (fixed->str)
+        {
+            if (pos >= n)
+                return 0;
+
+            strLen = p[pos++];
+            if (strLen == 255)
+            {
+                if (pos + 2 > n)
+                    return 0;
+                strLen = p[pos] | (p[pos + 1] << 8);
+                pos += 2;
+            }
+
+            if (pos + strLen > n)
+                return (pos + strLen > SYSVIEW_MAX_PACKET) ? -1 : 0;
+
+            str = p + pos;
+            pos += strLen;
+        }
+    }
+    else
+    {
+        uint32_t len;
+        if ((ret = getU32(p, n, &pos, &len)) <= 0)
+            return ret;
+
+        if (pos + len + 5 > SYSVIEW_MAX_PACKET)
+            return -1;
+        if (pos + len > n)
+            return 0;
+
+        // the U32s at the start of the payload, where there are any
+        size_t argPos = 0;
+        for (int i = 0; i < SYSVIEW_ARGS_MAX; i++)
+        {
+            if (getU32(p + pos, len, &argPos, &args[i]) <= 0)
+                break;
+        }
+        pos += len;
+    }
+
+    if ((ret = getU32(p, n, &pos, &delta)) <= 0)
+        return ret;
+
+    this->_now += delta;
+    this->account();
+    this->event(id, args, str, strLen);
+    return (int)pos;
+}
+
+/**
+ * @brief Time since the last event goes to whoever had the CPU.
+ */
+void SysViewDecoder::account()
+{
+    uint64_t dt = this->_now - this->_last;
+    this->_last = this->_now;
+
+    if (!this->_tracing)
+        return;
+
+    this->_load.time += dt;
+    if (this->_isrDepth)
+    {
+        this->_isrs[this->_isrStack[this->_isrDepth - 1]].time += dt;
+    }
+    else if (this->_running >= 0)
+    {
+        this->_tasks[this->_running].time += dt;
+    }
+    else
+    {
+        this->_load.idle += dt;
+    }
+}
+
+/**
+ * @brief
+ *
+ * @param table
+ * @param num
+ * @param max
+ * @param id
+ * @param add
+ * @return SYSVIEW_CONTEXT* nullptr if not there (or no room)
+ */
+SYSVIEW_CONTEXT *SysViewDecoder::find(SYSVIEW_CONTEXT *table, int *num, int max, uint32_t id, bool add)
+{
+    for (int i = 0; i < *num; i++)
+    {
+        if (table[i].id == id)
+            return &table[i];
+    }
+
+    if (!add || (*num >= max))
+        return nullptr;
+
+    SYSVIEW_CONTEXT *ctx = &table[(*num)++];
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->id = id;
+    snprintf(ctx->name, sizeof(ctx->name), (table == this->_isrs) ? "#%u" : "0x%x", id);
+    return ctx;
+}
+
+/**
+ * @brief "N=App,D=Device,O=OS,I#15=SysTick,I#37=USART1", we want the ISR names
+ *
+ * @param str
+ * @param len
+ */
+void SysViewDecoder::parseSysDesc(const uint8_t *str, size_t len)
+{
+    size_t i = 0;
+    while (i < len)
+    {
+        size_t end = i;
+        while ((end < len) && (str[end] != ','))
+            end++;
+
+        if ((end - i > 3) && (str[i] == 'I') && (str[i + 1] == '#'))
+        {
+            uint32_t irq = 0;
+            size_t j = i + 2;
+            while ((j < end) && (str[j] >= '0') && (str[j] <= '9'))
+                irq = irq * 10 + (str[j++] - '0');
+
+            SYSVIEW_CONTEXT *ctx;
+            if ((j < end) && (str[j] == '=') && (ctx = this->find(this->_isrs, &this->_numIsrs, SYSVIEW_MAX_ISRS, irq, true)))
+            {
+                size_t n = std::min(end - j - 1, sizeof(ctx->name) - 1);
+                memcpy(ctx->name, str + j + 1, n);
+                ctx->name[n] = 0;
+            }
+        }
+
+        i = end + 1;
+    }
+}
+
+/**
+ * @brief Context switches and bookkeeping, called at the event's time stamp.
+ *
+ * @param id
+ * @param args
+ * @param str
+ * @param strLen
+ */
+void SysViewDecoder::event(unsigned id, const uint32_t *args, const uint8_t *str, size_t strLen)
+{
+    SYSVIEW_CONTEXT *ctx;
+    this->_load.events++;
+
+    switch (id)
+    {
+    case SYSVIEW_EVTID_OVERFLOW:
+        this->_load.overflows += args[0];
+        break;
+
+    case SYSVIEW_EVTID_ISR_ENTER:
+        ctx = this->find(this->_isrs, &this->_numIsrs, SYSVIEW_MAX_ISRS, args[0], true);
+        if (ctx && (this->_isrDepth < SYSVIEW_MAX_NESTING))
+        {
+            ctx->count++;
+            this->_isrStack[this->_isrDepth] = (int)(ctx - this->_isrs);
+            this->_isrEnter[this->_isrDepth++] = this->_now;
+        }
+        break;
+
+    case SYSVIEW_EVTID_ISR_EXIT:
+    case SYSVIEW_EVTID_ISR_TO_SCHEDULER:
+        if (this->_isrDepth)
+        {
+            this->_isrDepth--;
+            ctx = &this->_isrs[this->_isrStack[this->_isrDepth]];
+            ctx->maxLatency = std::max(ctx->maxLatency, this->_now - this->_isrEnter[this->_isrDepth]);
+        }
+        break;
+
+    case SYSVIEW_EVTID_TASK_START_EXEC:
+        ctx = this->find(this->_tasks, &this->_numTasks, SYSVIEW_MAX_TASKS, args[0], true);
+        this->_running = ctx ? (int)(ctx - this->_tasks) : -1;
+        if (ctx)
+        {
+            ctx->count++;
+            if (ctx->ready)
+            {
+                ctx->maxLatency = std::max(ctx->maxLatency, this->_now - ctx->readyAt);
+                ctx->ready = false;
+            }
+        }
+        break;
+
+    case SYSVIEW_EVTID_TASK_STOP_EXEC:
+    case SYSVIEW_EVTID_IDLE:
+        this->_running = -1;
+        break;
+
+    case SYSVIEW_EVTID_TASK_START_READY:
+        ctx = this->find(this->_tasks, &this->_numTasks, SYSVIEW_MAX_TASKS, args[0], true);
+        if (ctx && !ctx->ready)
+        {
+            ctx->ready = true;
+            ctx->readyAt = this->_now;
+        }
+        break;
+
+    case SYSVIEW_EVTID_TASK_STOP_READY:
+        ctx = this->find(this->_tasks, &this->_numTasks, SYSVIEW_MAX_TASKS, args[0], false);
+        if (ctx)
+        {
+            ctx->ready = false;
+        }
+        break;
+
+    case SYSVIEW_EVTID_TASK_CREATE:
+        this->find(this->_tasks, &this->_numTasks, SYSVIEW_MAX_TASKS, args[0], true);
+        break;
+
+    case SYSVIEW_EVTID_TASK_INFO:
+        ctx = this->find(this->_tasks, &this->_numTasks, SYSVIEW_MAX_TASKS, args[0], true);
+        if (ctx)
+        {
+            size_t n = std::min(strLen, sizeof(ctx->name) - 1);
+            memcpy(ctx->name, str, n);
+            ctx->name[n] = 0;
+        }
+        break;
+
+    case SYSVIEW_EVTID_TASK_TERMINATE:
+        ctx = this->find(this->_tasks, &this->_numTasks, SYSVIEW_MAX_TASKS, args[0], false);
+        if (ctx && (this->_running == (int)(ctx - this->_tasks)))
+        {
+            this->_running = -1;
+        }
+        break;
+
+    case SYSVIEW_EVTID_TRACE_START:
+        // we don't know what runs until the next switch
+        this->_tracing = true;
+        this->_running = -1;
+        this->_isrDepth = 0;
+        break;
+
+    case SYSVIEW_EVTID_TRACE_STOP:
+        this->_tracing = false;
+        break;
+
+    case SYSVIEW_EVTID_SYSDESC:
+        this->parseSysDesc(str, strLen);
+        break;
+
+    case SYSVIEW_EVTID_INIT:
+        // SysFreq, CPUFreq, RAMBaseAddress, SysIdShift
+        this->_sysFreq = args[0];
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Starts a new window, names and who is ready stay.
+ */
+void SysViewDecoder::resetWindow()
+{
+    for (int i = 0; i < this->_numTasks; i++)
+    {
+        this->_tasks[i].time = 0;
+        this->_tasks[i].maxLatency = 0;
+        this->_tasks[i].count = 0;
+    }
+
+    for (int i = 0; i < this->_numIsrs; i++)
+    {
+        this->_isrs[i].time = 0;
+        this->_isrs[i].maxLatency = 0;
+        this->_isrs[i].count = 0;
+    }
+
+    memset(&this->_load, 0, sizeof(this->_load));
+}
+
+/**
+ * @brief
+ *
+ * @param num
+ * @return const SYSVIEW_CONTEXT*
+ */
+const SYSVIEW_CONTEXT *SysViewDecoder::getTasks(int *num) const
+{
+    *num = this->_numTasks;
+    return this->_tasks;
+}
+
+/**
+ * @brief
+ *
+ * @param num
+ * @return const SYSVIEW_CONTEXT*
+ */
+const SYSVIEW_CONTEXT *SysViewDecoder::getIsrs(int *num) const
+{
+    *num = this->_numIsrs;
+    return this->_isrs;
+}
+
+/**
+ * @brief CPU load of the window so far, then starts a new one.
+ */
+void SysViewDecoder::report()
+{
+    const SYSVIEW_LOAD &load = this->_load;
+    if (!load.time)
+    {
+        LOG_USER("SysView load: no events");
+        this->resetWindow();
+        return;
+    }
+
+    double secs = this->_sysFreq ? (double)load.time / this->_sysFreq : 0;
+    // latencies in us when we know the timer frequency
+    double scale = this->_sysFreq ? 1e6 / this->_sysFreq : 1;
+    const char *unit = this->_sysFreq ? "us" : "ticks";
+
+    if (secs > 0)
+    {
+        LOG_USER("SysView load: CPU %.1f%%, %.0f events/s, %u overflows, %u unknown", 100.0 - 100.0 * load.idle / load.time,
+                 load.events / secs, load.overflows, load.unknown);
+    }
+    else
+    {
+        LOG_USER("SysView load: CPU %.1f%%, %llu events, %u overflows, %u unknown", 100.0 - 100.0 * load.idle / load.time,
+                 (unsigned long long)load.events, load.overflows, load.unknown);
+    }
+
+    for (int i = 0; i < this->_numTasks; i++)
+    {
+        const SYSVIEW_CONTEXT *t = &this->_tasks[i];
+        LOG_USER("  task %-*s %6.2f%% %8u runs  max latency %.1f %s", SYSVIEW_NAME_LEN, t->name, 100.0 * t->time / load.time,
+                 t->count, t->maxLatency * scale, unit);
+    }
+
+    for (int i = 0; i < this->_numIsrs; i++)
+    {
+        const SYSVIEW_CONTEXT *isr = &this->_isrs[i];
+        LOG_USER("  isr  %-*s %6.2f%% %8u runs  max %.1f %s", SYSVIEW_NAME_LEN, isr->name, 100.0 * isr->time / load.time,
+                 isr->count, isr->maxLatency * scale, unit);
+    }
+
+    this->resetWindow();
+}
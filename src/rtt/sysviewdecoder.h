@@ -0,0 +1,148 @@
+/*
+ * Author(s): Pawel Hryniszak <phryniszak@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PH_SYSVIEWDECODER_H
+#define _PH_SYSVIEWDECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// event ids, SEGGER_SYSVIEW.h
+#define SYSVIEW_EVTID_NOP 0
+#define SYSVIEW_EVTID_OVERFLOW 1
+#define SYSVIEW_EVTID_ISR_ENTER 2
+#define SYSVIEW_EVTID_ISR_EXIT 3
+#define SYSVIEW_EVTID_TASK_START_EXEC 4
+#define SYSVIEW_EVTID_TASK_STOP_EXEC 5
+#define SYSVIEW_EVTID_TASK_START_READY 6
+#define SYSVIEW_EVTID_TASK_STOP_READY 7
+#define SYSVIEW_EVTID_TASK_CREATE 8
+#define SYSVIEW_EVTID_TASK_INFO 9
+#define SYSVIEW_EVTID_TRACE_START 10
+#define SYSVIEW_EVTID_TRACE_STOP 11
+#define SYSVIEW_EVTID_SYSTIME_CYCLES 12
+#define SYSVIEW_EVTID_SYSTIME_US 13
+#define SYSVIEW_EVTID_SYSDESC 14
+#define SYSVIEW_EVTID_MARK_START 15
+#define SYSVIEW_EVTID_MARK_STOP 16
+#define SYSVIEW_EVTID_IDLE 17
+#define SYSVIEW_EVTID_ISR_TO_SCHEDULER 18
+#define SYSVIEW_EVTID_TIMER_ENTER 19
+#define SYSVIEW_EVTID_TIMER_EXIT 20
+#define SYSVIEW_EVTID_STACK_INFO 21
+#define SYSVIEW_EVTID_MODULEDESC 22
+// from here on the packet carries its length
+#define SYSVIEW_EVTID_INIT 24
+#define SYSVIEW_EVTID_TASK_TERMINATE 29
+
+// fixed tables, nothing is allocated while decoding
+#define SYSVIEW_MAX_TASKS (32)
+#define SYSVIEW_MAX_ISRS (32)
+#define SYSVIEW_MAX_NESTING (8)
+#define SYSVIEW_NAME_LEN (24)
+// longest packet: 2 byte id, 2 byte length (so up to 16383 payload) and a 5 byte delta
+#define SYSVIEW_MAX_PACKET (16 * 1024 + 16)
+// zeros a started recorder sends ahead of TRACE_START
+#define SYSVIEW_SYNC_SIZE (10)
+// TRACE_START: id and a LEB128 delta
+#define SYSVIEW_TRACE_START_MAX (6)
+
+typedef struct
+{
+    uint32_t id;
+    char name[SYSVIEW_NAME_LEN];
+    uint64_t time;       // ticks in this context, this window
+    uint64_t maxLatency; // ticks, ready -> running for tasks, enter -> exit for ISRs
+    uint32_t count;      // activations, this window
+    uint64_t readyAt;
+    bool ready;
+} SYSVIEW_CONTEXT;
+
+typedef struct
+{
+    uint64_t events;   // this window
+    uint64_t time;     // ticks covered by this window
+    uint64_t idle;     // ticks with no task and no ISR running
+    uint32_t overflows; // events the target dropped
+    uint32_t unknown;  // packets we could not parse
+} SYSVIEW_LOAD;
+
+// where a (re)started recorder begins in the data of the last feed()
+typedef struct
+{
+    bool found;
+    size_t offset;                         // TRACE_START packet, or the rest of it
+    uint8_t head[SYSVIEW_TRACE_START_MAX]; // its first bytes if an earlier feed() brought them
+    size_t headSize;
+} SYSVIEW_RESTART;
+
+//
+// Decodes the SystemView event stream (SEGGER_SYSVIEW.c) as it comes from
+// the target: 1 byte event id, for ids below 24 a fixed payload of LEB128
+// encoded U32s and strings, for the others a length and the payload, and
+// always a LEB128 time stamp delta. From task switches and ISR enter/exit
+// it keeps per-task and per-ISR CPU load, worst latency and activation
+// counts for the current window. It also tells where the recorder was
+// (re)started, -svrec begins every file there.
+//
+class SysViewDecoder
+{
+private:
+    uint8_t _packet[SYSVIEW_MAX_PACKET];
+    size_t _used;
+
+    uint64_t _now;
+    uint64_t _last;
+    uint32_t _sysFreq;
+    bool _tracing;
+
+    SYSVIEW_CONTEXT _tasks[SYSVIEW_MAX_TASKS];
+    int _numTasks;
+    SYSVIEW_CONTEXT _isrs[SYSVIEW_MAX_ISRS];
+    int _numIsrs;
+
+    int _running; // task index, -1 idle
+    int _isrStack[SYSVIEW_MAX_NESTING];
+    uint64_t _isrEnter[SYSVIEW_MAX_NESTING];
+    int _isrDepth;
+
+    SYSVIEW_LOAD _load;
+    SYSVIEW_RESTART _restart;
+    size_t _zeros; // NOP bytes right before the packet being parsed
+
+    int parse(const uint8_t *p, size_t n);
+    void event(unsigned id, const uint32_t *args, const uint8_t *str, size_t strLen);
+    void account();
+    SYSVIEW_CONTEXT *find(SYSVIEW_CONTEXT *table, int *num, int max, uint32_t id, bool add);
+    void parseSysDesc(const uint8_t *str, size_t len);
+    void restartAt(size_t base, size_t carried, size_t pos, int size);
+
+public:
+    SysViewDecoder();
+
+    void feed(const uint8_t *data, size_t size);
+    void resetWindow();
+    void report();
+
+    const SYSVIEW_LOAD &getLoad() const { return _load; }
+    const SYSVIEW_RESTART &getRestart() const { return _restart; }
+    const SYSVIEW_CONTEXT *getTasks(int *num) const;
+    const SYSVIEW_CONTEXT *getIsrs(int *num) const;
+    uint32_t getSysFreq() const { return _sysFreq; }
+};
+
+#endif
@@ -0,0 +1,101 @@
+// Benchmark, not run by ctest: the SystemView data path before and after
+// ByteRing. A producer pushes RTT sized chunks, a consumer drains them the
+// way SysView::run_socket() does, once through the old per byte
+// BlockingConcurrentQueue<unsigned char> (1400 byte timed bulk dequeue) and
+// once through the ring with the eventfd wake-up.
+//
+//   bench_bytering [MB] [chunk]
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "blockingconcurrentqueue.h"
+#include "bytering.h"
+
+using namespace std::chrono_literals;
+
+static double cpuSeconds()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+template <typename F>
+static void run(const char *name, size_t total, F body)
+{
+    double cpu = cpuSeconds();
+    auto start = std::chrono::steady_clock::now();
+    uint64_t sum = body();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    cpu = cpuSeconds() - cpu;
+
+    printf("%-28s %8.1f MB/s  cpu %6.3f s  (sum %llu)\n", name, total / secs / 1e6, cpu, (unsigned long long)sum);
+}
+
+int main(int argc, char **argv)
+{
+    size_t total = (argc > 1 ? atoi(argv[1]) : 64) * 1024 * 1024;
+    size_t chunkSize = argc > 2 ? atoi(argv[2]) : 1024;
+
+    std::vector<uint8_t> chunk(chunkSize);
+    for (size_t i = 0; i < chunk.size(); i++)
+        chunk[i] = (uint8_t)i;
+
+    run("BlockingConcurrentQueue", total, [&]() {
+        moodycamel::BlockingConcurrentQueue<unsigned char> q;
+        uint64_t sum = 0;
+        std::thread consumer([&]() {
+            unsigned char buf[1400];
+            size_t got = 0;
+            while (got < total)
+            {
+                size_t n = q.wait_dequeue_bulk_timed(buf, sizeof(buf), 10ms);
+                for (size_t i = 0; i < n; i++)
+                    sum += buf[i];
+                got += n;
+            }
+        });
+        for (size_t sent = 0; sent < total; sent += chunkSize)
+            q.enqueue_bulk(chunk.data(), std::min(chunkSize, total - sent));
+        consumer.join();
+        return sum;
+    });
+
+    run("ByteRing + eventfd", total, [&]() {
+        ByteRing ring(1024 * 1024);
+        uint64_t sum = 0;
+        std::thread consumer([&]() {
+            size_t got = 0;
+            const uint8_t *span;
+            while (got < total)
+            {
+                ring.wait(10);
+                size_t n;
+                while ((n = ring.readSpan(&span)) > 0)
+                {
+                    for (size_t i = 0; i < n; i++)
+                        sum += span[i];
+                    ring.consume(n);
+                    got += n;
+                }
+            }
+        });
+        for (size_t sent = 0; sent < total;)
+        {
+            size_t n = ring.write(chunk.data(), std::min(chunkSize, total - sent));
+            if (!n)
+                std::this_thread::yield();
+            sent += n;
+        }
+        consumer.join();
+        return sum;
+    });
+
+    return 0;
+}
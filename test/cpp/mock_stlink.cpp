@@ -14,6 +14,16 @@ uint32_t g_failReadMemAtAddr = 0;
 int g_failReadMemAtAddrRemaining = 0;
 uint32_t g_failWriteMemAtAddr = 0;
 int g_failWriteMemAtAddrRemaining = 0;
+std::vector<int> g_mockSpeedMapKhz;
+int g_mockSpeedKhz = 0;
+int g_mockCorruptAboveKhz = 0;
+int g_mockRecoverCalls = 0;
+int g_mockRecoverFailRemaining = 0;
+bool g_mockWedged = false;
+uint32_t g_mockDhcsr = 0;
+uint32_t g_mockPcsr = 0;
+int g_mockReadDebugRegCalls = 0;
+int g_mockReadMemCalls = 0;
 
 static int mock_open(struct hl_interface_param_s *, void **handle)
 {
@@ -34,6 +44,8 @@ static int mock_close(void *)
 // would when writing received USB data into the same bad pointer.
 static int mock_read_mem(void *, uint32_t addr, uint32_t /*size*/, uint32_t count, uint8_t *buffer)
 {
+    ++g_mockReadMemCalls;
+
     if (g_failReadMemAtAddr != 0 && addr == g_failReadMemAtAddr && g_failReadMemAtAddrRemaining > 0)
     {
         --g_failReadMemAtAddrRemaining;
@@ -46,6 +58,9 @@ static int mock_read_mem(void *, uint32_t addr, uint32_t /*size*/, uint32_t coun
     else
         memset(buffer, 0, count);
 
+    if (g_mockCorruptAboveKhz != 0 && g_mockSpeedKhz > g_mockCorruptAboveKhz && count > 0)
+        buffer[count / 2] ^= 0x10;
+
     return ERROR_OK;
 }
 
@@ -67,12 +82,60 @@ static int mock_write_mem(void *, uint32_t addr, uint32_t /*size*/, uint32_t cou
     return ERROR_OK;
 }
 
+static int mock_read_debug_reg(void *, uint32_t addr, uint32_t *val)
+{
+    ++g_mockReadDebugRegCalls;
+    if (addr == 0xE000EDF0)
+        *val = g_mockDhcsr;
+    else if (addr == 0xE000101C)
+        *val = g_mockPcsr;
+    else
+        *val = 0;
+    return ERROR_OK;
+}
+
 static int mock_idcode(void *, uint32_t *idcode)
 {
     *idcode = 0;
     return ERROR_OK;
 }
 
+static int mock_speed(void *, int khz, bool query)
+{
+    if (!query)
+        g_mockSpeedKhz = khz;
+    return khz;
+}
+
+static int mock_speed_map(void *, int *khz, unsigned int *count)
+{
+    unsigned int n = 0;
+    for (int speed : g_mockSpeedMapKhz)
+    {
+        if (n == *count)
+            break;
+        khz[n++] = speed;
+    }
+    *count = n;
+    return ERROR_OK;
+}
+
+static int mock_recover(void *)
+{
+    ++g_mockRecoverCalls;
+    if (g_mockRecoverFailRemaining > 0)
+    {
+        --g_mockRecoverFailRemaining;
+        return ERROR_FAIL;
+    }
+    return ERROR_OK;
+}
+
+static bool mock_wedged(void *)
+{
+    return g_mockWedged;
+}
+
 struct hl_layout_api_s stlink_usb_layout_api = {};
 
 namespace
@@ -85,7 +148,12 @@ struct MockRegistration
         stlink_usb_layout_api.close = mock_close;
         stlink_usb_layout_api.read_mem = mock_read_mem;
         stlink_usb_layout_api.write_mem = mock_write_mem;
+        stlink_usb_layout_api.read_debug_reg = mock_read_debug_reg;
         stlink_usb_layout_api.idcode = mock_idcode;
+        stlink_usb_layout_api.speed = mock_speed;
+        stlink_usb_layout_api.speed_map = mock_speed_map;
+        stlink_usb_layout_api.recover = mock_recover;
+        stlink_usb_layout_api.wedged = mock_wedged;
     }
 } registration;
 } // namespace
@@ -23,4 +23,28 @@ extern int g_failReadMemAtAddrRemaining;
 extern uint32_t g_failWriteMemAtAddr;
 extern int g_failWriteMemAtAddrRemaining;
 
+// Simulated interface clock. speed_map() reports g_mockSpeedMapKhz, speed()
+// switches g_mockSpeedKhz to the requested entry. While the clock is above
+// g_mockCorruptAboveKhz (0 = never) every read_mem() returns one flipped
+// byte, like a marginal SWD line would.
+extern std::vector<int> g_mockSpeedMapKhz;
+extern int g_mockSpeedKhz;
+extern int g_mockCorruptAboveKhz;
+
+// recover() is counted in g_mockRecoverCalls and fails while
+// g_mockRecoverFailRemaining > 0 (decremented on every failing call).
+extern int g_mockRecoverCalls;
+extern int g_mockRecoverFailRemaining;
+
+// wedged() reports g_mockWedged.
+extern bool g_mockWedged;
+
+// read_debug_reg() returns g_mockDhcsr for DHCSR, g_mockPcsr for DWT_PCSR
+// (0 for anything else) and counts calls in g_mockReadDebugRegCalls.
+// read_mem() calls are counted in g_mockReadMemCalls.
+extern uint32_t g_mockDhcsr;
+extern uint32_t g_mockPcsr;
+extern int g_mockReadDebugRegCalls;
+extern int g_mockReadMemCalls;
+
 #endif
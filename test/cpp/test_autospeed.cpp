@@ -0,0 +1,131 @@
+// Test for -autospeed (StRtt::autoSpeed()).
+//
+// The mocked probe offers four SWD clocks, and every read above 4 MHz comes
+// back with a flipped byte, as a board with long or noisy SWD wiring would.
+// autoSpeed() walks the clocks from the top down and must settle on
+// 4000 kHz: the fastest clock whose write/read-back pattern test is clean.
+//
+// The pattern test runs in the default scratch window, the free part of
+// down-buffer 0 (StRtt::getScratchWindow()). The target only reads a
+// down-buffer between RdOff and WrOff, so that space is ours to use, but
+// its content must still be put back afterwards.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "mock_stlink.h"
+#include "strtt.h"
+#include "stlink_errors.h"
+
+namespace
+{
+constexpr uint32_t kRamStart = 0x20000000;
+constexpr uint32_t kRamKBytes = 2;
+constexpr uint32_t kRttCbOffset = 16; // keep nonzero, offset 0 is ambiguous with "not found" in findRtt()
+
+constexpr uint32_t kUpBufferOffset = 200;
+constexpr uint32_t kUpBufferSize = 64;
+
+constexpr uint32_t kDownBufferOffset = 400;
+constexpr uint32_t kDownBufferSize = 256;
+constexpr uint8_t kCanary = 0xAA;
+
+void writeU32(std::vector<uint8_t> &mem, size_t offset, uint32_t value)
+{
+    memcpy(mem.data() + offset, &value, sizeof(value));
+}
+} // namespace
+
+int main()
+{
+    g_fakeMemoryBase = kRamStart;
+    g_fakeMemory.assign(kRamKBytes * 1024, 0);
+
+    memcpy(g_fakeMemory.data() + kRttCbOffset, "SEGGER RTT", 11);
+    writeU32(g_fakeMemory, kRttCbOffset + 16, 1); // MaxNumUpBuffers
+    writeU32(g_fakeMemory, kRttCbOffset + 20, 1); // MaxNumDownBuffers
+
+    size_t up = kRttCbOffset + 24;
+    writeU32(g_fakeMemory, up + 4, kRamStart + kUpBufferOffset);
+    writeU32(g_fakeMemory, up + 8, kUpBufferSize);
+
+    // down-buffer with 10 unread bytes at 0..9, free space from 10 on
+    size_t down = up + 24;
+    writeU32(g_fakeMemory, down + 4, kRamStart + kDownBufferOffset);
+    writeU32(g_fakeMemory, down + 8, kDownBufferSize);
+    writeU32(g_fakeMemory, down + 12, 10); // WrOff
+    writeU32(g_fakeMemory, down + 16, 0);  // RdOff
+    memset(g_fakeMemory.data() + kDownBufferOffset, kCanary, kDownBufferSize);
+
+    g_mockSpeedMapKhz = {24000, 8000, 4000, 1000};
+    g_mockCorruptAboveKhz = 4000;
+
+    StRtt rtt(kRamStart, 0);
+
+    if (rtt.open(false) != ERROR_OK || rtt.findRtt(kRamKBytes) != ERROR_OK)
+    {
+        printf("FAIL: open()/findRtt()\n");
+        return 1;
+    }
+
+    uint32_t scratchAddr, scratchSize;
+    int res = rtt.getScratchWindow(&scratchAddr, &scratchSize);
+    if (res != ERROR_OK)
+    {
+        printf("FAIL: getScratchWindow() returned %d\n", res);
+        return 1;
+    }
+
+    // WrOff = 10 rounded up to a word, up to the end of the buffer (RdOff == 0 keeps the last byte free)
+    if (scratchAddr != kRamStart + kDownBufferOffset + 12 || scratchSize != kDownBufferSize - 12 - 4)
+    {
+        printf("FAIL: unexpected scratch window 0x%x size %u\n", scratchAddr, scratchSize);
+        return 1;
+    }
+
+    int khz = 0;
+    res = rtt.autoSpeed(scratchAddr, scratchSize, &khz);
+    if (res != ERROR_OK)
+    {
+        printf("FAIL: autoSpeed() returned %d\n", res);
+        return 1;
+    }
+
+    if (khz != 4000 || g_mockSpeedKhz != 4000)
+    {
+        printf("FAIL: expected 4000 kHz, got %d (probe at %d)\n", khz, g_mockSpeedKhz);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < kDownBufferSize; i++)
+    {
+        if (g_fakeMemory[kDownBufferOffset + i] != kCanary)
+        {
+            printf("FAIL: scratch window not restored at offset %u\n", i);
+            return 1;
+        }
+    }
+
+    // only the marginal clocks on offer -> error, clock back at the 4000 kHz
+    // this run started at, and the window restored there
+    g_mockSpeedMapKhz = {24000, 8000};
+    res = rtt.autoSpeed(scratchAddr, scratchSize, &khz);
+    if (res == ERROR_OK || g_mockSpeedKhz != 4000)
+    {
+        printf("FAIL: autoSpeed() should fail and return to 4000 kHz (%d, %d kHz)\n", res, g_mockSpeedKhz);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < kDownBufferSize; i++)
+    {
+        if (g_fakeMemory[kDownBufferOffset + i] != kCanary)
+        {
+            printf("FAIL: scratch window not restored after a failed run at offset %u\n", i);
+            return 1;
+        }
+    }
+
+    printf("PASS: autoSpeed() picked %d kHz and restored the scratch window\n", khz);
+    return 0;
+}
@@ -0,0 +1,117 @@
+// Test for the probe bandwidth budget (-budget/-maxtps).
+//
+// With a budget too small for the descriptor and the buffer read in one go,
+// readRtt() does a descriptor-only poll and defers the bulk read. The poll
+// delay then covers the time needed to save up for the whole read, and the
+// next readRtt() after that delay delivers the data.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mock_stlink.h"
+#include "strtt.h"
+#include "stlink_errors.h"
+
+namespace
+{
+constexpr uint32_t kRamStart = 0x20000000;
+constexpr uint32_t kRamKBytes = 1;
+constexpr uint32_t kRttCbOffset = 16;
+constexpr uint32_t kUpBufferOffset = 200;
+constexpr uint32_t kUpBufferSize = 64;
+constexpr uint32_t kUpDesc = kRttCbOffset + 24;
+
+// descriptor (72 bytes) + buffer (68 bytes) don't fit at once
+constexpr uint32_t kBudgetBytesPerSec = 1000;
+
+void writeU32(size_t offset, uint32_t value)
+{
+    memcpy(g_fakeMemory.data() + offset, &value, sizeof(value));
+}
+} // namespace
+
+int main()
+{
+    g_fakeMemoryBase = kRamStart;
+    g_fakeMemory.assign(kRamKBytes * 1024, 0);
+
+    memcpy(g_fakeMemory.data() + kRttCbOffset, "SEGGER RTT", 11);
+    writeU32(kRttCbOffset + 16, 1); // MaxNumUpBuffers
+    writeU32(kRttCbOffset + 20, 1); // MaxNumDownBuffers
+    writeU32(kUpDesc + 4, kRamStart + kUpBufferOffset);
+    writeU32(kUpDesc + 8, kUpBufferSize);
+
+    StRtt rtt(kRamStart, 0);
+
+    std::string received;
+    rtt.addChannelHandler([&](const int index, const std::vector<uint8_t> *buffer)
+                          {
+                              if (index == 0)
+                                  received.append(buffer->begin(), buffer->end());
+                          });
+
+    if (rtt.open(false) != ERROR_OK || rtt.findRtt(kRamKBytes) != ERROR_OK)
+    {
+        printf("FAIL: open()/findRtt()\n");
+        return 1;
+    }
+
+    // bucket holds a second worth of traffic, use most of it up first
+    rtt.setBudget(kBudgetBytesPerSec, 0);
+    for (int i = 0; i < 13; i++)
+        rtt.readRtt();
+
+    memcpy(g_fakeMemory.data() + kUpBufferOffset, "budget", 6);
+    writeU32(kUpDesc + 12, 6); // WrOff
+
+    int delay = rtt.getPollDelayMs();
+    if (delay <= 0)
+    {
+        printf("FAIL: expected a poll delay with the bucket almost empty\n");
+        return 1;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+    int readMem = g_mockReadMemCalls;
+    rtt.readRtt();
+
+    if (g_mockReadMemCalls != readMem + 1 || !received.empty())
+    {
+        printf("FAIL: expected a descriptor-only poll, got %d reads, '%s'\n", g_mockReadMemCalls - readMem, received.c_str());
+        return 1;
+    }
+
+    // skipped polls don't touch the probe
+    readMem = g_mockReadMemCalls;
+    rtt.readRtt();
+    if (g_mockReadMemCalls != readMem)
+    {
+        printf("FAIL: poll not skipped while saving up for the deferred read\n");
+        return 1;
+    }
+
+    delay = rtt.getPollDelayMs();
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+    rtt.readRtt();
+
+    if (received != "budget")
+    {
+        printf("FAIL: deferred read not done after %d ms, got '%s'\n", delay, received.c_str());
+        return 1;
+    }
+
+    double bytesPct, tpsPct;
+    uint32_t deferred;
+    rtt.getBudgetUsage(&bytesPct, &tpsPct, &deferred);
+    if (deferred != 1 || bytesPct <= 0 || tpsPct != 0)
+    {
+        printf("FAIL: usage %.1f%% bytes %.1f%% tps, %u deferred\n", bytesPct, tpsPct, deferred);
+        return 1;
+    }
+
+    printf("PASS: %.1f%% of the budget used\n", bytesPct);
+    return 0;
+}
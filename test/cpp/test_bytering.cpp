@@ -0,0 +1,144 @@
+// Test for the SPSC byte ring behind the SystemView bridge.
+//
+// Single threaded: wrap around with partial writes and reads, zero copy
+// spans, clear() and the eventfd wake-up. Then a producer and a consumer
+// thread move a few MB of a known pattern in odd sized chunks and the
+// consumer checks every byte.
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "bytering.h"
+
+static uint8_t pattern(size_t i)
+{
+    return (uint8_t)((i * 7) ^ (i >> 8));
+}
+
+int main()
+{
+    ByteRing ring(1000);
+    if (ring.capacity() != 1024)
+    {
+        printf("FAIL: capacity %d, expected 1024\n", (int)ring.capacity());
+        return 1;
+    }
+
+    // empty ring, wait() times out
+    if (ring.wait(1))
+    {
+        printf("FAIL: wait() on an empty ring\n");
+        return 1;
+    }
+
+    // fill up, the last write is cut short
+    std::vector<uint8_t> in(600), out(1024);
+    for (size_t i = 0; i < in.size(); i++)
+        in[i] = pattern(i);
+
+    if (ring.write(in.data(), 600) != 600 || ring.write(in.data(), 600) != 424)
+    {
+        printf("FAIL: write past capacity\n");
+        return 1;
+    }
+
+    if (!ring.wait(0) || ring.size() != 1024)
+    {
+        printf("FAIL: full ring size %d\n", (int)ring.size());
+        return 1;
+    }
+
+    // take some out, the next write wraps
+    if (ring.read(out.data(), 700) != 700)
+    {
+        printf("FAIL: read 700\n");
+        return 1;
+    }
+    ring.write(in.data(), 300);
+
+    // 324 old bytes (in[100..423]) then 300 new ones, spans split at the wrap
+    std::vector<uint8_t> got;
+    const uint8_t *span;
+    size_t n;
+    int spans = 0;
+    while ((n = ring.readSpan(&span)) > 0)
+    {
+        got.insert(got.end(), span, span + n);
+        ring.consume(n);
+        spans++;
+    }
+
+    if (got.size() != 624 || spans != 2)
+    {
+        printf("FAIL: got %d bytes in %d spans\n", (int)got.size(), spans);
+        return 1;
+    }
+    for (size_t i = 0; i < got.size(); i++)
+    {
+        uint8_t expected = (i < 324) ? in[100 + i] : in[i - 324];
+        if (got[i] != expected)
+        {
+            printf("FAIL: byte %d\n", (int)i);
+            return 1;
+        }
+    }
+
+    ring.write(in.data(), 10);
+    ring.clear();
+    if (!ring.empty() || ring.wait(1))
+    {
+        printf("FAIL: clear()\n");
+        return 1;
+    }
+
+    // two threads
+    const size_t total = 8 * 1024 * 1024;
+    ByteRing big(64 * 1024);
+    bool ok = true;
+
+    std::thread consumer([&]() {
+        std::vector<uint8_t> buf(3000);
+        size_t pos = 0;
+        while (pos < total)
+        {
+            if (!big.wait(1000))
+            {
+                printf("FAIL: consumer stalled at %d\n", (int)pos);
+                ok = false;
+                return;
+            }
+            size_t n = big.read(buf.data(), 1 + (pos % buf.size()));
+            for (size_t i = 0; i < n; i++, pos++)
+            {
+                if (buf[i] != pattern(pos))
+                {
+                    printf("FAIL: byte %d\n", (int)pos);
+                    ok = false;
+                    return;
+                }
+            }
+        }
+    });
+
+    std::vector<uint8_t> chunk(1500);
+    size_t pos = 0;
+    while (ok && (pos < total))
+    {
+        size_t want = std::min(total - pos, (size_t)(1 + (pos * 13) % chunk.size()));
+        for (size_t i = 0; i < want; i++)
+            chunk[i] = pattern(pos + i);
+
+        size_t n = big.write(chunk.data(), want);
+        if (!n)
+            std::this_thread::yield();
+        pos += n;
+    }
+
+    consumer.join();
+    if (!ok)
+        return 1;
+
+    printf("PASS\n");
+    return 0;
+}
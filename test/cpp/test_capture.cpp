@@ -0,0 +1,207 @@
+// Test for the -record capture file writer and the -replay reader.
+//
+// Writes small chunks on a few channels and one chunk bigger than a block,
+// then walks the file by hand the way an external reader would: header,
+// blocks at aligned offsets, records inside them. Every chunk has to come
+// back whole (joining CAPTURE_RECORD_CONTINUED parts) with its channel, time
+// and sequence, and CaptureReader has to return the same chunks. The index
+// blocks have to chain back from the file header and count every byte.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "capture.h"
+
+typedef struct
+{
+    int channel;
+    uint64_t timeNs;
+    uint32_t seq;
+    std::vector<uint8_t> data;
+} CHUNK;
+
+// where an index span has to start
+typedef struct
+{
+    uint64_t offset;
+    uint32_t position;
+    uint64_t firstNs;
+    uint64_t record;
+} SPAN;
+
+int main()
+{
+    const char *path = "test_capture.cap";
+    std::vector<CHUNK> chunks;
+
+    for (uint32_t i = 0; i < 5000; i++)
+    {
+        CHUNK c = {(int)(i % 3), 1000000ull * i, i / 2, std::vector<uint8_t>(1 + (i * 37) % 200)};
+        if (i == 2500)
+            c.data.resize(150 * 1024); // spans three blocks
+        for (size_t j = 0; j < c.data.size(); j++)
+            c.data[j] = (uint8_t)(i + j);
+        chunks.push_back(c);
+    }
+
+    {
+        CaptureWriter writer;
+        if (writer.open(path) != 0)
+        {
+            printf("FAIL: open\n");
+            return 1;
+        }
+        for (const CHUNK &c : chunks)
+            writer.add(c.channel, c.data.data(), c.data.size(), c.timeNs, c.seq);
+        writer.close();
+    }
+
+    FILE *f = fopen(path, "rb");
+    std::vector<uint8_t> file;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        file.insert(file.end(), buf, buf + n);
+    fclose(f);
+
+    const CAPTURE_FILE_HEADER *hdr = (const CAPTURE_FILE_HEADER *)file.data();
+    if ((file.size() % CAPTURE_ALIGN) || memcmp(hdr->magic, CAPTURE_MAGIC, 8) || (hdr->version != CAPTURE_VERSION) ||
+        (hdr->align != CAPTURE_ALIGN))
+    {
+        printf("FAIL: file header, size %d\n", (int)file.size());
+        return 1;
+    }
+
+    size_t next = 0;
+    std::vector<uint8_t> joined;
+    int blocks = 0;
+    uint64_t records = 0;
+    uint64_t lastIndex = 0;
+    std::vector<CAPTURE_INDEX_ENTRY> index;
+    uint64_t channelBytes[CAPTURE_INDEX_CHANNELS] = {};
+    std::vector<SPAN> spans;
+    bool chunkPart = false;
+    for (size_t off = hdr->align; off < file.size();)
+    {
+        const CAPTURE_BLOCK_HEADER *blk = (const CAPTURE_BLOCK_HEADER *)&file[off];
+        if ((blk->magic != CAPTURE_BLOCK_MAGIC) || (blk->size % CAPTURE_ALIGN) || (blk->size > CAPTURE_BLOCK_SIZE) ||
+            (blk->used > blk->size))
+        {
+            printf("FAIL: block at %d\n", (int)off);
+            return 1;
+        }
+
+        if (blk->type == CAPTURE_BLOCK_INDEX)
+        {
+            const CAPTURE_INDEX_HEADER *idx = (const CAPTURE_INDEX_HEADER *)(blk + 1);
+            const CAPTURE_INDEX_ENTRY *entries = (const CAPTURE_INDEX_ENTRY *)(idx + 1);
+            if ((idx->prevIndex != lastIndex) || (idx->entries != blk->records))
+            {
+                printf("FAIL: index block at %d\n", (int)off);
+                return 1;
+            }
+            index.insert(index.end(), entries, entries + idx->entries);
+            lastIndex = off;
+            off += blk->size;
+            continue;
+        }
+
+        size_t pos = sizeof(CAPTURE_BLOCK_HEADER);
+        for (uint32_t r = 0; r < blk->records; r++)
+        {
+            const CAPTURE_RECORD *rec = (const CAPTURE_RECORD *)&file[off + pos];
+            const uint8_t *payload = (const uint8_t *)(rec + 1);
+            channelBytes[rec->channel] += rec->length;
+            if (!chunkPart && (spans.empty() || (records - spans.back().record >= CAPTURE_INDEX_EVERY)))
+                spans.push_back({off, (uint32_t)pos, rec->timeNs, records});
+            records++;
+            chunkPart = rec->flags & CAPTURE_RECORD_CONTINUED;
+            joined.insert(joined.end(), payload, payload + rec->length);
+            pos += sizeof(CAPTURE_RECORD) + captureAlign(rec->length, 8);
+
+            if (rec->flags & CAPTURE_RECORD_CONTINUED)
+                continue;
+
+            const CHUNK &c = chunks[next++];
+            if ((rec->channel != c.channel) || (rec->timeNs != c.timeNs) || (rec->seq != c.seq) || (joined != c.data))
+            {
+                printf("FAIL: chunk %d\n", (int)next - 1);
+                return 1;
+            }
+            joined.clear();
+        }
+
+        if (pos != blk->used)
+        {
+            printf("FAIL: block at %d uses %d, records end at %d\n", (int)off, (int)blk->used, (int)pos);
+            return 1;
+        }
+
+        off += blk->size;
+        blocks++;
+    }
+
+    if (next != chunks.size())
+    {
+        printf("FAIL: %d of %d chunks\n", (int)next, (int)chunks.size());
+        return 1;
+    }
+
+    if ((hdr->indexOffset != lastIndex) || (hdr->indexEvery != CAPTURE_INDEX_EVERY) || (index.size() != spans.size()))
+    {
+        printf("FAIL: index at %d, %d entries for %d spans\n", (int)hdr->indexOffset, (int)index.size(), (int)spans.size());
+        return 1;
+    }
+    for (size_t i = 0; i < index.size(); i++)
+    {
+        if ((index[i].offset != spans[i].offset) || (index[i].position != spans[i].position) ||
+            (index[i].firstNs != spans[i].firstNs) || (index[i].record != spans[i].record))
+        {
+            printf("FAIL: index entry %d\n", (int)i);
+            return 1;
+        }
+        for (int ch = 0; ch < CAPTURE_INDEX_CHANNELS; ch++)
+            channelBytes[ch] -= index[i].channelBytes[ch];
+    }
+    for (int ch = 0; ch < CAPTURE_INDEX_CHANNELS; ch++)
+    {
+        if (channelBytes[ch])
+        {
+            printf("FAIL: index bytes on channel %d\n", ch);
+            return 1;
+        }
+    }
+
+    CaptureReader reader;
+    if (reader.open(path) != 0)
+    {
+        printf("FAIL: reader open\n");
+        return 1;
+    }
+
+    CAPTURE_RECORD rec;
+    std::vector<uint8_t> data;
+    next = 0;
+    while (reader.next(&rec, &data))
+    {
+        const CHUNK &c = chunks[next++];
+        if ((rec.channel != c.channel) || (rec.timeNs != c.timeNs) || (rec.seq != c.seq) || (rec.length != c.data.size()) ||
+            (data != c.data))
+        {
+            printf("FAIL: reader chunk %d\n", (int)next - 1);
+            return 1;
+        }
+    }
+    reader.close();
+    remove(path);
+
+    if (next != chunks.size())
+    {
+        printf("FAIL: reader returned %d of %d chunks\n", (int)next, (int)chunks.size());
+        return 1;
+    }
+
+    printf("PASS (%d blocks, %d index entries)\n", blocks, (int)index.size());
+    return 0;
+}
@@ -0,0 +1,166 @@
+// Test for the capture index and strtt-query's lookups.
+//
+// Writes a capture spanning many index blocks, then every query (time range,
+// channel, both) has to return exactly the chunks a brute force pass over
+// what was written picks, with the index from the closed file and again with
+// indexOffset cleared as if strtt was killed. captureFind has to agree with
+// std::search on every length and position.
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "capturequery.h"
+
+typedef struct
+{
+    int channel;
+    uint64_t timeNs;
+    std::vector<uint8_t> data;
+} CHUNK;
+
+static int check(CaptureFile &file, const std::vector<CHUNK> &chunks, uint64_t fromNs, uint64_t toNs, int channel)
+{
+    std::vector<size_t> expect;
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        if ((chunks[i].timeNs >= fromNs) && (chunks[i].timeNs <= toNs) && ((channel < 0) || (chunks[i].channel == channel)))
+            expect.push_back(i);
+    }
+
+    size_t next = 0;
+    bool ok = true;
+    uint64_t spans = file.query(fromNs, toNs, channel, [&](const CAPTURE_RECORD &rec, const uint8_t *data) {
+        if (next >= expect.size())
+        {
+            ok = false;
+            return false;
+        }
+        const CHUNK &c = chunks[expect[next++]];
+        ok = (rec.channel == c.channel) && (rec.timeNs == c.timeNs) && (rec.length == c.data.size()) &&
+             !memcmp(data, c.data.data(), rec.length);
+        return ok;
+    });
+
+    if (!ok || (next != expect.size()))
+    {
+        printf("FAIL: query %lu..%lu channel %d, %d of %d chunks\n", (unsigned long)fromNs, (unsigned long)toNs, channel,
+               (int)next, (int)expect.size());
+        return -1;
+    }
+    return (int)spans;
+}
+
+static int queries(CaptureFile &file, const std::vector<CHUNK> &chunks)
+{
+    const uint64_t ranges[][2] = {{0, UINT64_MAX}, {0, 0}, {5000000000ull, 5000000000ull},
+                                  {12345678901ull, 15000000000ull}, {69000000000ull, UINT64_MAX}};
+    for (const auto &r : ranges)
+    {
+        for (int channel : {-1, 0, 1, 2, 33, 40})
+        {
+            if (check(file, chunks, r[0], r[1], channel) < 0)
+                return 1;
+        }
+    }
+
+    // the rare channel sits in a few spans, the rest are skipped
+    int all = check(file, chunks, 0, UINT64_MAX, -1);
+    int rare = check(file, chunks, 0, UINT64_MAX, 33);
+    if (file.isComplete() && (rare * 4 > all))
+    {
+        printf("FAIL: channel 33 walked %d of %d spans\n", rare, all);
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    const char *path = "test_capturequery.cap";
+    std::vector<CHUNK> chunks;
+
+    // 70 s at 10 kHz, two index blocks, channel 33 only around 20 s
+    for (uint32_t i = 0; i < 700000; i++)
+    {
+        CHUNK c = {(int)(i % 3), 100000ull * i, std::vector<uint8_t>(1 + (i * 13) % 40)};
+        if ((i >= 200000) && (i < 200100))
+            c.channel = 33;
+        if (i == 300000)
+            c.data.resize(100 * 1024); // split over blocks
+        for (size_t j = 0; j < c.data.size(); j++)
+            c.data[j] = (uint8_t)(i * 7 + j);
+        chunks.push_back(c);
+    }
+
+    {
+        CaptureWriter writer;
+        if (writer.open(path) != 0)
+        {
+            printf("FAIL: open\n");
+            return 1;
+        }
+        for (const CHUNK &c : chunks)
+            writer.add(c.channel, c.data.data(), c.data.size(), c.timeNs, 0);
+        writer.close();
+    }
+
+    CaptureFile file;
+    if ((file.open(path) != 0) || !file.isComplete() || (file.getIndex().size() <= CAPTURE_INDEX_PER_BLOCK))
+    {
+        printf("FAIL: index of the closed capture\n");
+        return 1;
+    }
+    size_t entries = file.getIndex().size();
+    if (queries(file, chunks))
+        return 1;
+    file.close();
+
+    // as if strtt was killed: no index offset, the blocks are walked
+    FILE *f = fopen(path, "r+b");
+    uint64_t zero = 0;
+    fseek(f, offsetof(CAPTURE_FILE_HEADER, indexOffset), SEEK_SET);
+    fwrite(&zero, sizeof(zero), 1, f);
+    fclose(f);
+
+    if ((file.open(path) != 0) || file.isComplete() || (file.getIndex().size() != entries))
+    {
+        printf("FAIL: index of the unclosed capture\n");
+        return 1;
+    }
+    if (queries(file, chunks))
+        return 1;
+    file.close();
+    remove(path);
+
+    // captureFind
+    std::vector<uint8_t> hay(1000);
+    for (size_t i = 0; i < hay.size(); i++)
+        hay[i] = (uint8_t)("abcab"[i % 5]);
+    for (size_t len = 1; len < 40; len++)
+    {
+        for (size_t at = 0; at + len <= hay.size(); at += 7)
+        {
+            std::vector<uint8_t> pattern(hay.begin() + at, hay.begin() + at + len);
+            pattern.back() = 'z';
+            for (size_t size : {hay.size(), at + len, at + len - 1})
+            {
+                std::vector<uint8_t> data(hay.begin(), hay.begin() + size);
+                if (size >= at + len)
+                    data[at + len - 1] = 'z';
+                const uint8_t *found = captureFind(data.data(), data.size(), pattern.data(), pattern.size());
+                auto it = std::search(data.begin(), data.end(), pattern.begin(), pattern.end());
+                const uint8_t *expect = (it == data.end()) ? nullptr : data.data() + (it - data.begin());
+                if (found != expect)
+                {
+                    printf("FAIL: captureFind length %d at %d in %d\n", (int)len, (int)at, (int)size);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    printf("PASS (%d index entries)\n", (int)entries);
+    return 0;
+}
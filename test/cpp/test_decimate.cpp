@@ -0,0 +1,167 @@
+// Test for the -decimate stage behind -scope.
+//
+// Samples of a t4 i2 f4 u4 channel go through the J-Scope decoder in odd
+// sized chunks, so windows span chunks and blocks, and every block is
+// decimated into a file. Each line has to hold the first time stamp and
+// the min, max and mean of its window, the last window may be short. The
+// full rate file still has to get every sample, and decimation has to
+// keep up with far more than a probe delivers.
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "decimate.h"
+#include "scope.h"
+#include "stlink_errors.h"
+
+namespace
+{
+#pragma pack(push, 1)
+typedef struct
+{
+    uint32_t t;
+    int16_t i;
+    float f;
+    uint32_t u;
+} SAMPLE;
+#pragma pack(pop)
+
+std::string readFile(const std::string &name)
+{
+    std::string data;
+    FILE *f = fopen(name.c_str(), "rb");
+    if (!f)
+        return data;
+
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.append(buf, n);
+    fclose(f);
+    return data;
+}
+
+bool near(double a, double b)
+{
+    return std::fabs(a - b) <= 1e-6 * std::max(1.0, std::fabs(b));
+}
+} // namespace
+
+int main()
+{
+    const uint32_t window = 1000;
+    std::vector<SAMPLE> samples(1234567);
+    for (size_t n = 0; n < samples.size(); n++)
+    {
+        samples[n].t = (uint32_t)(4000000000u + n * 50);
+        samples[n].i = (int16_t)((n * 7919) % 65536 - 32768);
+        samples[n].f = std::sin(n * 0.001f) * 100.0f;
+        samples[n].u = (uint32_t)(n * 2654435761u);
+    }
+
+    uint64_t full;
+    double secs;
+    {
+        FILE *out = fopen("test_decimate.csv", "wb");
+        OutputSink sink(fileno(out), 1000);
+        Decimator decimator(&sink, window);
+        ScopeDecoder scope;
+        if (!out || (scope.open("test_decimate.bin", "JScope_t4i2f4u4") != ERROR_OK))
+        {
+            printf("FAIL: open\n");
+            return 1;
+        }
+        decimator.setColumns(scope.getColumns());
+        scope.setBlockHandler([&](uint32_t rows) { decimator.feed(scope, rows); });
+
+        const uint8_t *p = (const uint8_t *)samples.data();
+        size_t size = samples.size() * sizeof(SAMPLE);
+        size_t at = 0;
+        uint32_t i = 1;
+        auto start = std::chrono::steady_clock::now();
+        while (at < size)
+        {
+            size_t n = std::min((size_t)(i++ * 7919 % 70000 + 1), size - at);
+            scope.feed(p + at, n);
+            at += n;
+        }
+        decimator.finish();
+        secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        sink.flush();
+        scope.close();
+        full = scope.getSamples();
+        fclose(out);
+    }
+    remove("test_decimate.bin");
+
+    if (full != samples.size())
+    {
+        printf("FAIL: %d samples in the full rate file\n", (int)full);
+        return 1;
+    }
+
+    std::string csv = readFile("test_decimate.csv");
+    remove("test_decimate.csv");
+    char *line = strtok(&csv[0], "\n");
+    if (!line || strcmp(line, "t4_0,i2_1_min,i2_1_max,i2_1_mean,f4_2_min,f4_2_max,f4_2_mean,u4_3_min,u4_3_max,u4_3_mean"))
+    {
+        printf("FAIL: header %s\n", line ? line : "");
+        return 1;
+    }
+
+    size_t lines = 0;
+    while ((line = strtok(nullptr, "\n")))
+    {
+        unsigned long long t;
+        double got[9];
+        if (sscanf(line, "%llu,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf", &t, &got[0], &got[1], &got[2], &got[3], &got[4], &got[5], &got[6],
+                   &got[7], &got[8]) != 10)
+        {
+            printf("FAIL: line %d: %s\n", (int)lines, line);
+            return 1;
+        }
+
+        size_t first = lines * window;
+        size_t last = std::min(first + window, samples.size());
+        double want[9] = {1e300, -1e300, 0, 1e300, -1e300, 0, 1e300, -1e300, 0};
+        for (size_t n = first; n < last; n++)
+        {
+            double v[3] = {(double)samples[n].i, (double)samples[n].f, (double)samples[n].u};
+            for (int c = 0; c < 3; c++)
+            {
+                want[c * 3] = std::min(want[c * 3], v[c]);
+                want[c * 3 + 1] = std::max(want[c * 3 + 1], v[c]);
+                want[c * 3 + 2] += v[c] / (last - first);
+            }
+        }
+        bool ok = (t == samples[first].t);
+        for (int k = 0; k < 9; k++)
+            ok = ok && near(got[k], want[k]);
+        if (!ok)
+        {
+            printf("FAIL: window %d: %s\n", (int)lines, line);
+            return 1;
+        }
+        lines++;
+    }
+
+    if (lines != (samples.size() + window - 1) / window)
+    {
+        printf("FAIL: %d windows\n", (int)lines);
+        return 1;
+    }
+
+    double mbps = samples.size() * sizeof(SAMPLE) / secs / 1e6;
+    if (mbps < 5)
+    {
+        printf("FAIL: %.1f MB/s of samples\n", mbps);
+        return 1;
+    }
+
+    printf("PASS (%d windows, decoded and decimated at %.0f MB/s of samples)\n", (int)lines, mbps);
+    return 0;
+}
@@ -0,0 +1,205 @@
+// Test for the deferred formatting decoder (-defmt).
+//
+// A format table like the one in a firmware's .strtt_fmt section is loaded,
+// then messages are COBS encoded the way the target does it and fed in
+// pieces of every size. Every conversion has to come out as printf would
+// have made it on the target. Messages with lost bytes, unknown ids and a
+// stream joined in the middle must only cost the messages they hit. The
+// worker thread has to deliver the same text.
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "defmt.h"
+#include "stlink_errors.h"
+
+namespace
+{
+// the section: strings at their offsets, 0 padded to 4 like the linker does
+std::vector<uint8_t> table;
+
+uint16_t addFormat(const char *format)
+{
+    uint16_t id = (uint16_t)table.size();
+    table.insert(table.end(), format, format + strlen(format) + 1);
+    while (table.size() % 4)
+        table.push_back(0);
+    return id;
+}
+
+template <typename T>
+void put(std::vector<uint8_t> &out, T value)
+{
+    const uint8_t *p = (const uint8_t *)&value;
+    out.insert(out.end(), p, p + sizeof(value));
+}
+
+void putString(std::vector<uint8_t> &out, const char *s)
+{
+    out.push_back((uint8_t)strlen(s));
+    out.insert(out.end(), s, s + strlen(s));
+}
+
+// COBS and the 0 that ends the message
+void encode(std::vector<uint8_t> &out, uint16_t id, const std::vector<uint8_t> &args)
+{
+    std::vector<uint8_t> msg;
+    put(msg, id);
+    msg.insert(msg.end(), args.begin(), args.end());
+
+    size_t code = out.size();
+    out.push_back(1);
+    for (uint8_t b : msg)
+    {
+        if (b)
+        {
+            out.push_back(b);
+            out[code]++;
+        }
+        if (!b || (out[code] == 0xff))
+        {
+            code = out.size();
+            out.push_back(1);
+        }
+    }
+    out.push_back(0);
+}
+
+std::string decode(DefmtDecoder &decoder, const std::vector<uint8_t> &stream, size_t piece)
+{
+    std::string text;
+    size_t at = 0;
+    uint32_t i = 1;
+    while (at < stream.size())
+    {
+        size_t n = std::min(piece ? piece : (size_t)(i++ * 7919 % 300 + 1), stream.size() - at);
+        decoder.feed(stream.data() + at, n, &text);
+        at += n;
+    }
+    return text;
+}
+} // namespace
+
+int main()
+{
+    uint16_t hello = addFormat("hello");
+    uint16_t ints = addFormat("a=%d b=%u c=%08x d=%hhd e=%hu f=%lld g=%llu%%");
+    uint16_t misc = addFormat("%c %s|%-6s|%.2f %e %lf %p\n");
+    uint16_t widths = addFormat("[%5d] [%-4u] [%+d] %*d");
+
+    std::vector<uint8_t> stream;
+    std::string expect;
+
+    encode(stream, hello, {});
+    expect += "hello\n";
+
+    std::vector<uint8_t> args;
+    put<int32_t>(args, -42);
+    put<uint32_t>(args, 4000000000u);
+    put<uint32_t>(args, 0xbeef);
+    put<int8_t>(args, -5);
+    put<uint16_t>(args, 65000);
+    put<int64_t>(args, -1234567890123LL);
+    put<uint64_t>(args, 18000000000000000000ULL);
+    encode(stream, ints, args);
+    expect += "a=-42 b=4000000000 c=0000beef d=-5 e=65000 f=-1234567890123 g=18000000000000000000%\n";
+
+    args.clear();
+    put<uint8_t>(args, 'Z');
+    putString(args, "zero\0ok");
+    putString(args, "ab");
+    put<float>(args, 3.14159f);
+    put<float>(args, 1e6f);
+    put<double>(args, 0.5);
+    put<uint32_t>(args, 0x20000400);
+    encode(stream, misc, args);
+    char buf[128];
+    snprintf(buf, sizeof(buf), "Z zero|ab    |3.14 %e 0.500000 0x20000400\n", (double)1e6f);
+    expect += buf;
+
+    // * widths can't come from the wire and stay as they are
+    args.clear();
+    put<int32_t>(args, 7);
+    put<uint32_t>(args, 3);
+    put<int32_t>(args, 9);
+    encode(stream, widths, args);
+    expect += "[    7] [3   ] [+9] %*d\n";
+
+    // long enough for COBS blocks over 254 bytes
+    std::string longText(240, 'x');
+    uint16_t longId = addFormat("%s%s");
+    args.clear();
+    putString(args, longText.c_str());
+    putString(args, longText.c_str());
+    encode(stream, longId, args);
+    expect += longText + longText + "\n";
+
+    DefmtDecoder decoder;
+    if ((decoder.loadTable(table.data(), (uint32_t)table.size()) != ERROR_OK) || (decoder.getFormatCount() != 5))
+    {
+        printf("FAIL: %d formats loaded\n", (int)decoder.getFormatCount());
+        return 1;
+    }
+
+    for (size_t piece : {(size_t)0, (size_t)1, (size_t)7, stream.size()})
+    {
+        std::string text = decode(decoder, stream, piece);
+        if (text != expect)
+        {
+            printf("FAIL: piece %d\n%s\nexpected\n%s\n", (int)piece, text.c_str(), expect.c_str());
+            return 1;
+        }
+    }
+
+    // joined in the middle (of the first message, nothing left of it), a message with bytes lost, an unknown id,
+    // one with an argument too many, one too long
+    std::vector<uint8_t> dirty(stream.begin() + 3, stream.end());
+    std::vector<uint8_t> one;
+    encode(one, ints, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27});
+    one.erase(one.begin() + 10, one.begin() + 14);
+    dirty.insert(dirty.end(), one.begin(), one.end());
+    encode(dirty, 2, {});
+    encode(dirty, hello, {1});
+    dirty.insert(dirty.end(), 5000, 0x55);
+    dirty.push_back(0);
+    encode(dirty, hello, {});
+
+    DefmtDecoder fresh;
+    fresh.loadTable(table.data(), (uint32_t)table.size());
+    std::string text = decode(fresh, dirty, 0);
+    std::string want = expect.substr(expect.find('\n') + 1) + "hello\n";
+    const DEFMT_STATS &stats = fresh.getStats();
+    if ((text != want) || (stats.messages != 5) || (stats.bad != 3) || (stats.unknown != 1))
+    {
+        printf("FAIL: resync, %d messages, %d bad, %d unknown\n%s\n", (int)stats.messages, (int)stats.bad, (int)stats.unknown, text.c_str());
+        return 1;
+    }
+
+    // worker thread, stop() decodes what was pushed
+    DefmtDecoder threaded;
+    threaded.loadTable(table.data(), (uint32_t)table.size());
+    std::string got;
+    {
+        DefmtLog log(&threaded);
+        for (int i = 0; i < 1000; i++)
+            log.push(stream.data(), stream.size());
+        log.stop();
+        std::string piece;
+        while (log.getText(&piece))
+            got += piece;
+    }
+    if ((got.size() != expect.size() * 1000) || (got.compare(0, expect.size(), expect) != 0))
+    {
+        printf("FAIL: worker, %d bytes of text\n", (int)got.size());
+        return 1;
+    }
+
+    // bandwidth, the point of it all
+    const DEFMT_STATS &total = threaded.getStats();
+    printf("PASS (%llu bytes sent for %llu bytes of text)\n", (unsigned long long)total.bytesIn, (unsigned long long)total.bytesOut);
+    return 0;
+}
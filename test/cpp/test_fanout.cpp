@@ -0,0 +1,206 @@
+// Test for -fanout and -rttport, channels served on Unix sockets and TCP.
+//
+// A live subscriber and a history subscriber read a channel while a third
+// one never reads. The two readers have to get every byte in order (the
+// history one also what was published before it connected), the silent
+// one has to be dropped once it fell a ring behind, and the publisher must
+// never wait for it. A TCP client on another channel gets that channel's
+// data and what it sends comes out of getInput().
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "fanout.h"
+
+static int connectTo(const std::string &path)
+{
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int connectTcp(int port)
+{
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static uint8_t pattern(uint64_t i)
+{
+    return (uint8_t)(i * 31 + (i >> 10));
+}
+
+int main()
+{
+    const std::string path = "/tmp/test_fanout_" + std::to_string(getpid());
+    const uint64_t early = 1000;
+    const uint64_t total = 16 * 1024 * 1024;
+
+    FanOut fanout;
+    if (fanout.serveUnix(path, {0, 5}) != 0)
+    {
+        printf("FAIL: open\n");
+        return 1;
+    }
+
+    // a free pair of ports, channel 1 is on base + 1
+    int base = 0;
+    for (int port = 20000 + getpid() % 20000; !base && (port < 60000); port += 97)
+    {
+        if (fanout.serveTcp(port, {1}) == 0)
+            base = port;
+    }
+    if (!base)
+    {
+        printf("FAIL: no TCP port\n");
+        return 1;
+    }
+    fanout.start();
+
+    // before anybody listens, only the history subscriber sees it
+    std::vector<uint8_t> chunk(early);
+    for (uint64_t i = 0; i < early; i++)
+        chunk[i] = pattern(i);
+    fanout.publish(0, chunk.data(), chunk.size());
+
+    int live = connectTo(path + ".0");
+    int history = connectTo(path + ".0.history");
+    int silent = connectTo(path + ".0");
+    if ((live < 0) || (history < 0) || (silent < 0))
+    {
+        printf("FAIL: connect\n");
+        return 1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::atomic<uint64_t> got[2] = {{0}, {0}};
+    std::atomic_bool bad[2] = {{false}, {false}};
+    auto reader = [&](int k, int fd, uint64_t first, uint64_t want) {
+        std::vector<uint8_t> buf(65536);
+        uint64_t at = first;
+        while (at < first + want)
+        {
+            ssize_t n = read(fd, buf.data(), buf.size());
+            if (n <= 0)
+                break;
+            for (ssize_t j = 0; j < n; j++)
+            {
+                if (buf[j] != pattern(at + j))
+                    bad[k] = true;
+            }
+            at += n;
+            got[k] = at - first;
+        }
+    };
+    std::thread t0(reader, 0, live, early, total);
+    std::thread t1(reader, 1, history, 0, early + total);
+
+    // publish in chunks, paced by the readers only, never by the silent one
+    uint64_t at = early;
+    auto start = std::chrono::steady_clock::now();
+    while (at < early + total)
+    {
+        chunk.resize(std::min<uint64_t>(4096 + at % 3000, early + total - at));
+        for (size_t j = 0; j < chunk.size(); j++)
+            chunk[j] = pattern(at + j);
+        fanout.publish(0, chunk.data(), chunk.size());
+        fanout.publish(7, chunk.data(), chunk.size()); // not served
+        at += chunk.size();
+
+        while (((at - early - got[0] > FANOUT_RING_SIZE / 2) || (at - got[1] > FANOUT_RING_SIZE / 2)) &&
+               (std::chrono::steady_clock::now() - start < std::chrono::seconds(20)))
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    t0.join();
+    t1.join();
+
+    // TCP, both ways
+    int tcp = connectTcp(base + 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    const char hello[] = "hello target\n";
+    if ((tcp < 0) || (write(tcp, hello, sizeof(hello) - 1) != sizeof(hello) - 1))
+    {
+        printf("FAIL: TCP connect\n");
+        return 1;
+    }
+    fanout.publish(1, (const uint8_t *)"hello host\n", 11);
+
+    char reply[32] = {};
+    size_t replied = 0;
+    while (replied < 11)
+    {
+        ssize_t n = read(tcp, reply + replied, sizeof(reply) - 1 - replied);
+        if (n <= 0)
+            break;
+        replied += n;
+    }
+
+    std::vector<uint8_t> input;
+    for (int i = 0; (i < 100) && (input.size() < sizeof(hello) - 1); i++)
+    {
+        fanout.getInput(1, &input);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    close(tcp);
+
+    if (std::string(reply) != "hello host\n" || std::string(input.begin(), input.end()) != hello || fanout.hasInput(0))
+    {
+        printf("FAIL: TCP got \"%s\", sent \"%s\"\n", reply, std::string(input.begin(), input.end()).c_str());
+        return 1;
+    }
+
+    fanout.close();
+    close(live);
+    close(history);
+    close(silent);
+
+    if (bad[0] || bad[1] || (got[0] != total) || (got[1] != early + total))
+    {
+        printf("FAIL: live %llu of %llu, history %llu of %llu bytes\n", (unsigned long long)got[0], (unsigned long long)total,
+               (unsigned long long)got[1], (unsigned long long)(early + total));
+        return 1;
+    }
+
+    std::vector<FANOUT_STATS> stats = fanout.getStats();
+    if ((stats.size() != 3) || (stats[0].channel != 0) || (stats[0].bytes != early + total) || (stats[0].subscribers != 3) ||
+        (stats[0].dropped != 1) || (stats[1].bytes != 0) || (stats[2].channel != 1) || (stats[2].input != sizeof(hello) - 1))
+    {
+        printf("FAIL: stats %d subscribers, %d dropped\n", (int)stats[0].subscribers, (int)stats[0].dropped);
+        return 1;
+    }
+
+    if (!access((path + ".0").c_str(), F_OK))
+    {
+        printf("FAIL: socket left behind\n");
+        return 1;
+    }
+
+    printf("PASS\n");
+    return 0;
+}
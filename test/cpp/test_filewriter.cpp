@@ -0,0 +1,102 @@
+// Test for the background file writer behind -svrec.
+//
+// Writes a known pattern in odd sized pieces and calls rotate() every 1 MB,
+// in the middle of a piece where needed. Checks that the files are split at
+// exactly those points, named name.N.ext, and that nothing was lost.
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "filewriter.h"
+
+static std::vector<uint8_t> readFile(const std::string &name)
+{
+    std::vector<uint8_t> data;
+    FILE *f = fopen(name.c_str(), "rb");
+    if (!f)
+        return data;
+
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(f);
+    return data;
+}
+
+int main()
+{
+    const size_t total = 3 * 1024 * 1024 + 12345;
+    const uint64_t rotate = 1024 * 1024;
+    std::vector<std::string> rotated;
+
+    {
+        FileWriter writer;
+        if (writer.open("test_filewriter.SVDat") != 0)
+        {
+            printf("FAIL: open\n");
+            return 1;
+        }
+
+        std::vector<uint8_t> piece;
+        size_t pos = 0;
+        while (pos < total)
+        {
+            piece.resize(std::min(total - pos, (size_t)(1 + (pos * 7) % 3000)));
+            for (size_t i = 0; i < piece.size(); i++)
+                piece[i] = (uint8_t)((pos + i) * 13);
+
+            // the caller decides where a file ends
+            size_t first = piece.size();
+            if ((pos / rotate) != ((pos + piece.size()) / rotate))
+                first = rotate - pos % rotate;
+
+            writer.write(piece.data(), first);
+            if ((pos + first) % rotate == 0)
+                rotated.push_back(writer.rotate());
+            writer.write(piece.data() + first, piece.size() - first);
+            pos += piece.size();
+        }
+
+        writer.close();
+        if (writer.getWritten() != total || writer.getDropped() || writer.hasFailed())
+        {
+            printf("FAIL: written %llu, dropped %llu\n", (unsigned long long)writer.getWritten(),
+                   (unsigned long long)writer.getDropped());
+            return 1;
+        }
+    }
+
+    const char *names[] = {"test_filewriter.SVDat", "test_filewriter.1.SVDat", "test_filewriter.2.SVDat", "test_filewriter.3.SVDat"};
+    if ((rotated.size() != 3) || (rotated[0] != names[1]) || (rotated[2] != names[3]))
+    {
+        printf("FAIL: %d rotations\n", (int)rotated.size());
+        return 1;
+    }
+
+    size_t pos = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        std::vector<uint8_t> data = readFile(names[i]);
+        size_t expected = (i < 3) ? rotate : total - 3 * rotate;
+        if (data.size() != expected)
+        {
+            printf("FAIL: %s has %d bytes, expected %d\n", names[i], (int)data.size(), (int)expected);
+            return 1;
+        }
+
+        for (size_t j = 0; j < data.size(); j++, pos++)
+        {
+            if (data[j] != (uint8_t)(pos * 13))
+            {
+                printf("FAIL: byte %d\n", (int)pos);
+                return 1;
+            }
+        }
+        remove(names[i]);
+    }
+
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,83 @@
+// Test for the channel lookup by name (StRtt::findUpChannel()).
+//
+// -sysview, -defmt and -scope find their up-channel by the name the target
+// gave it. Only up-channels count: a down-channel with the same name is
+// not a match, and nothing is found before getRttDesc() read the names.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "mock_stlink.h"
+#include "strtt.h"
+#include "stlink_errors.h"
+
+namespace
+{
+constexpr uint32_t kRamStart = 0x20000000;
+constexpr uint32_t kRamKBytes = 1;
+constexpr uint32_t kRttCbOffset = 16;
+
+constexpr uint32_t kTerminalName = 0x200;
+constexpr uint32_t kSysViewName = 0x210;
+constexpr uint32_t kDownName = 0x220;
+
+void writeU32(size_t offset, uint32_t value)
+{
+    memcpy(g_fakeMemory.data() + offset, &value, sizeof(value));
+}
+} // namespace
+
+int main()
+{
+    g_fakeMemoryBase = kRamStart;
+    g_fakeMemory.assign(kRamKBytes * 1024, 0);
+
+    memcpy(g_fakeMemory.data() + kTerminalName, "Terminal", 9);
+    memcpy(g_fakeMemory.data() + kSysViewName, "SysView", 8);
+    memcpy(g_fakeMemory.data() + kDownName, "Down", 5);
+
+    size_t cb = kRttCbOffset;
+    memcpy(g_fakeMemory.data() + cb, "SEGGER RTT", 11);
+    writeU32(cb + 16, 2);                             // MaxNumUpBuffers
+    writeU32(cb + 20, 1);                             // MaxNumDownBuffers
+    writeU32(cb + 24, kRamStart + kTerminalName);     // up 0 sName
+    writeU32(cb + 48, kRamStart + kSysViewName);      // up 1 sName
+    writeU32(cb + 72, kRamStart + kDownName);         // down 0 sName
+
+    StRtt rtt(kRamStart, 0);
+    rtt.addChannelHandler([](const int, const std::vector<uint8_t> *) {});
+
+    if (rtt.open(false) != ERROR_OK || rtt.findRtt(kRamKBytes) != ERROR_OK)
+    {
+        printf("FAIL: open()/findRtt()\n");
+        return 1;
+    }
+
+    if (rtt.findUpChannel("Terminal") != -1)
+    {
+        printf("FAIL: findUpChannel() before getRttDesc()\n");
+        return 1;
+    }
+
+    if (rtt.getRttDesc() != ERROR_OK)
+    {
+        printf("FAIL: getRttDesc()\n");
+        return 1;
+    }
+
+    if (rtt.findUpChannel("Terminal") != 0 || rtt.findUpChannel("SysView") != 1)
+    {
+        printf("FAIL: up-channels not found (%d, %d)\n", rtt.findUpChannel("Terminal"), rtt.findUpChannel("SysView"));
+        return 1;
+    }
+
+    if (rtt.findUpChannel("Down") != -1 || rtt.findUpChannel("Missing") != -1)
+    {
+        printf("FAIL: down-channel or unknown name matched\n");
+        return 1;
+    }
+
+    printf("PASS: findUpChannel()\n");
+    return 0;
+}
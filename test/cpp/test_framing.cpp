@@ -0,0 +1,228 @@
+// Test for the -framed protocol.
+//
+// Frames of several channels and sizes are written through an OutputSink
+// into a pipe and parsed back on the other side, the stream cut into pieces
+// of every size including single bytes. Garbage in front of and between
+// frames has to be skipped. FramedInput has to sort a framed stream into
+// its channels, and parsing has to keep up with far more than a probe
+// delivers.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "framing.h"
+
+typedef struct
+{
+    int channel;
+    uint64_t timeNs;
+    std::vector<uint8_t> data;
+} FRAME;
+
+static std::vector<FRAME> makeFrames(int count)
+{
+    std::vector<FRAME> frames(count);
+    for (int i = 0; i < count; i++)
+    {
+        frames[i].channel = (i * 7) % 40;
+        frames[i].timeNs = 1000000000ULL + (uint64_t)i * 12345;
+        // empty frames too
+        frames[i].data.resize((i * 7919) % 3000);
+        for (size_t j = 0; j < frames[i].data.size(); j++)
+            frames[i].data[j] = (uint8_t)(i + j * 31);
+    }
+    return frames;
+}
+
+static std::vector<uint8_t> encode(const std::vector<FRAME> &frames)
+{
+    int fds[2];
+    if (pipe(fds))
+        return {};
+
+    std::vector<uint8_t> got;
+    std::thread reader([&]() {
+        uint8_t buf[65536];
+        ssize_t n;
+        while ((n = read(fds[0], buf, sizeof(buf))) > 0)
+            got.insert(got.end(), buf, buf + n);
+    });
+
+    {
+        OutputSink sink(fds[1]);
+        for (const FRAME &f : frames)
+            frameWrite(&sink, f.channel, f.data.data(), f.data.size(), f.timeNs);
+    }
+    close(fds[1]);
+    reader.join();
+    close(fds[0]);
+    return got;
+}
+
+// feeds stream in pieces of piece bytes, 0 for varying sizes
+static int decode(const std::vector<uint8_t> &stream, size_t piece, const std::vector<FRAME> &frames, uint64_t *skipped)
+{
+    FrameParser parser;
+    size_t next = 0;
+    bool bad = false;
+    auto check = [&](const FRAME_HEADER &header, const uint8_t *payload) {
+        if (next >= frames.size())
+        {
+            bad = true;
+            return;
+        }
+        const FRAME &f = frames[next++];
+        if ((header.channel != f.channel) || (header.timeNs != f.timeNs) || (header.flags != 0) ||
+            (header.length != f.data.size()) || !std::equal(f.data.begin(), f.data.end(), payload))
+            bad = true;
+    };
+
+    size_t at = 0;
+    uint32_t i = 1;
+    while (at < stream.size())
+    {
+        size_t n = std::min(piece ? piece : (size_t)(i++ * 7919 % 5000 + 1), stream.size() - at);
+        parser.feed(stream.data() + at, n, check);
+        at += n;
+    }
+
+    if (bad || (next != frames.size()))
+    {
+        printf("FAIL: piece %d, %d of %d frames, %s\n", (int)piece, (int)next, (int)frames.size(), bad ? "mismatch" : "missing");
+        return 1;
+    }
+    *skipped = parser.getSkipped();
+    return 0;
+}
+
+int main()
+{
+    std::vector<FRAME> frames = makeFrames(2000);
+    std::vector<uint8_t> stream = encode(frames);
+    if (stream.empty())
+    {
+        printf("FAIL: nothing written\n");
+        return 1;
+    }
+
+    uint64_t skipped;
+    for (size_t piece : {(size_t)0, (size_t)1, (size_t)3, (size_t)16, (size_t)17, (size_t)4096, stream.size()})
+    {
+        if (decode(stream, piece, frames, &skipped))
+            return 1;
+        if (skipped)
+        {
+            printf("FAIL: %d bytes skipped in a clean stream\n", (int)skipped);
+            return 1;
+        }
+    }
+
+    // garbage in front and between frames, including half a magic and a frame start too long to be one
+    std::vector<uint8_t> dirty = {0x00, 0x52, 0x01, 0x52, 0x54, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff};
+    std::vector<uint8_t> one = encode({frames[1]});
+    dirty.insert(dirty.end(), one.begin(), one.end());
+    dirty.insert(dirty.end(), {0x52, 0x52});
+    one = encode({frames[2]});
+    dirty.insert(dirty.end(), one.begin(), one.end());
+    std::vector<FRAME> expect = {frames[1], frames[2]};
+    for (size_t piece : {(size_t)0, (size_t)1, (size_t)5, dirty.size()})
+    {
+        if (decode(dirty, piece, expect, &skipped))
+            return 1;
+        if (skipped != 13)
+        {
+            printf("FAIL: piece %d, %d bytes skipped, 13 expected\n", (int)piece, (int)skipped);
+            return 1;
+        }
+    }
+
+    // stdin side, collected per channel
+    int fds[2];
+    if (pipe(fds))
+    {
+        printf("FAIL: pipe\n");
+        return 1;
+    }
+    FramedInput input;
+    input.start(fds[0]);
+    // FramedInput stops reading past FRAMED_INPUT_MAX per channel, so write and take side by side
+    bool written = false;
+    std::thread writer([&]() {
+        written = (write(fds[1], stream.data(), stream.size()) == (ssize_t)stream.size());
+        close(fds[1]);
+    });
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    std::vector<std::vector<uint8_t>> pending, taken;
+    bool bounded = true;
+    for (bool last = false; !last;)
+    {
+        last = input.atEnd() || (std::chrono::steady_clock::now() >= deadline);
+        input.take(&taken);
+        if (pending.size() < taken.size())
+            pending.resize(taken.size());
+        for (size_t i = 0; i < taken.size(); i++)
+        {
+            // one 64K read may land on top of a full channel
+            bounded = bounded && (taken[i].size() <= FRAMED_INPUT_MAX + 64 * 1024);
+            pending[i].insert(pending[i].end(), taken[i].begin(), taken[i].end());
+            taken[i].clear();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    writer.join();
+    close(fds[0]);
+    if (!written)
+    {
+        printf("FAIL: write\n");
+        return 1;
+    }
+    if (!bounded)
+    {
+        printf("FAIL: framed input not held back\n");
+        return 1;
+    }
+
+    std::vector<std::vector<uint8_t>> want;
+    for (const FRAME &f : frames)
+    {
+        if (want.size() <= (size_t)f.channel)
+            want.resize(f.channel + 1);
+        want[f.channel].insert(want[f.channel].end(), f.data.begin(), f.data.end());
+    }
+    if (pending != want)
+    {
+        printf("FAIL: framed input, %d channels\n", (int)pending.size());
+        return 1;
+    }
+
+    // 1 KB frames as a probe would deliver them, in 64K reads
+    std::vector<FRAME> small(1);
+    small[0].data.resize(1024, 0x55);
+    std::vector<uint8_t> block;
+    while (block.size() < 64 * 1024)
+    {
+        one = encode(small);
+        block.insert(block.end(), one.begin(), one.end());
+    }
+    FrameParser parser;
+    uint64_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 4000; i++)
+        parser.feed(block.data(), block.size(), [&](const FRAME_HEADER &header, const uint8_t *) { bytes += header.length; });
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double mbps = bytes / secs / 1e6;
+    // a probe delivers a few MB/s
+    if (mbps < 50)
+    {
+        printf("FAIL: parsing at %.0f MB/s\n", mbps);
+        return 1;
+    }
+
+    printf("PASS (parsing at %.0f MB/s)\n", mbps);
+    return 0;
+}
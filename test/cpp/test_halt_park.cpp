@@ -0,0 +1,106 @@
+// Test for halt-aware polling.
+//
+// readRtt() samples DHCSR every HALT_SAMPLE_IDLE_CYCLES idle cycles. Once it
+// sees S_HALT it stops reading the control block altogether, only DHCSR is
+// read (one probe transaction) and getPollDelayMs() asks the caller to slow
+// down to HALT_HEARTBEAT_MS. The first sample that shows the core running
+// again resumes normal reads in the same cycle.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "mock_stlink.h"
+#include "strtt.h"
+#include "stlink_errors.h"
+
+namespace
+{
+constexpr uint32_t kRamStart = 0x20000000;
+constexpr uint32_t kRamKBytes = 1;
+constexpr uint32_t kRttCbOffset = 16;
+constexpr uint32_t kUpBufferOffset = 200;
+constexpr uint32_t kUpBufferSize = 64;
+constexpr uint32_t kUpDesc = kRttCbOffset + 24;
+
+void writeU32(size_t offset, uint32_t value)
+{
+    memcpy(g_fakeMemory.data() + offset, &value, sizeof(value));
+}
+} // namespace
+
+int main()
+{
+    g_fakeMemoryBase = kRamStart;
+    g_fakeMemory.assign(kRamKBytes * 1024, 0);
+
+    memcpy(g_fakeMemory.data() + kRttCbOffset, "SEGGER RTT", 11);
+    writeU32(kRttCbOffset + 16, 1); // MaxNumUpBuffers
+    writeU32(kRttCbOffset + 20, 1); // MaxNumDownBuffers
+    writeU32(kUpDesc + 4, kRamStart + kUpBufferOffset);
+    writeU32(kUpDesc + 8, kUpBufferSize);
+
+    StRtt rtt(kRamStart, 0);
+
+    std::string received;
+    rtt.addChannelHandler([&](const int index, const std::vector<uint8_t> *buffer)
+                          {
+                              if (index == 0)
+                                  received.append(buffer->begin(), buffer->end());
+                          });
+
+    if (rtt.open(false) != ERROR_OK || rtt.findRtt(kRamKBytes) != ERROR_OK)
+    {
+        printf("FAIL: open()/findRtt()\n");
+        return 1;
+    }
+
+    // running and idle: DHCSR is sampled once per HALT_SAMPLE_IDLE_CYCLES
+    for (int i = 0; i < HALT_SAMPLE_IDLE_CYCLES * 2; i++)
+        rtt.readRtt();
+
+    if (g_mockReadDebugRegCalls != 2 || rtt.isHalted() || rtt.getPollDelayMs() != 0)
+    {
+        printf("FAIL: expected 2 DHCSR samples while running, got %d\n", g_mockReadDebugRegCalls);
+        return 1;
+    }
+
+    // core hits a breakpoint
+    g_mockDhcsr = DHCSR_S_HALT;
+    for (int i = 0; i < HALT_SAMPLE_IDLE_CYCLES; i++)
+        rtt.readRtt();
+
+    if (!rtt.isHalted() || rtt.getPollDelayMs() != HALT_HEARTBEAT_MS)
+    {
+        printf("FAIL: halt not detected\n");
+        return 1;
+    }
+
+    // parked: nothing but DHCSR goes over the wire
+    int readMem = g_mockReadMemCalls;
+    int readReg = g_mockReadDebugRegCalls;
+    for (int i = 0; i < 5; i++)
+        rtt.readRtt();
+
+    if (g_mockReadMemCalls != readMem || g_mockReadDebugRegCalls != readReg + 5)
+    {
+        printf("FAIL: parked readRtt() did %d memory reads and %d DHCSR reads\n",
+               g_mockReadMemCalls - readMem, g_mockReadDebugRegCalls - readReg);
+        return 1;
+    }
+
+    // resumed with data waiting, it comes in on the very same cycle
+    memcpy(g_fakeMemory.data() + kUpBufferOffset, "run", 3);
+    writeU32(kUpDesc + 12, 3); // WrOff
+    g_mockDhcsr = 0;
+
+    if (rtt.readRtt() != ERROR_OK || rtt.isHalted() || rtt.getPollDelayMs() != 0 || received != "run")
+    {
+        printf("FAIL: no full rate after resume, got '%s'\n", received.c_str());
+        return 1;
+    }
+
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,57 @@
+// Test for the ITM packet decoder used for SWO capture.
+//
+// Feeds a stream mixing stimulus port packets of all sizes with sync,
+// overflow, timestamp and hardware (DWT) packets, split at awkward places,
+// and checks that only the stimulus port payload comes out, per port.
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "itm.h"
+
+int main()
+{
+    const std::vector<uint8_t> stream = {
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x80, // sync
+        0x01, 'H',                          // port 0, 1 byte
+        0x01, 'i',                          //
+        0xC0, 0x81, 0x02,                   // local timestamp with 2 continuation bytes
+        0x0A, 'a', 'b',                     // port 1, 2 bytes
+        0x70,                               // overflow
+        0x47, 0x11, 0x22, 0x33, 0x44,       // hardware source packet (DWT id 8), 4 bytes
+        0x03, '!', '\n', 'x', 'y',          // port 0, 4 bytes
+        0x94, 0x85, 0x86, 0x07,             // global timestamp 1
+        0xFB, 'e', 'n', 'd', '.',           // port 31, 4 bytes
+    };
+
+    ItmDecoder decoder;
+    std::map<int, std::string> ports;
+    decoder.setHandler([&](const int port, const std::vector<uint8_t> *data)
+                       { ports[port].append(data->begin(), data->end()); });
+
+    // every possible split point between two feed() calls
+    for (size_t split = 0; split <= stream.size(); split++)
+    {
+        ports.clear();
+        decoder.feed(stream.data(), split);
+        decoder.feed(stream.data() + split, stream.size() - split);
+
+        if (ports.size() != 3 || ports[0] != "Hi!\nxy" || ports[1] != "ab" || ports[31] != "end.")
+        {
+            printf("FAIL: split at %d: port 0 '%s', port 1 '%s', port 31 '%s'\n", (int)split,
+                   ports[0].c_str(), ports[1].c_str(), ports[31].c_str());
+            return 1;
+        }
+    }
+
+    if (decoder.getOverflows() != stream.size() + 1)
+    {
+        printf("FAIL: expected %d overflows, got %u\n", (int)stream.size() + 1, decoder.getOverflows());
+        return 1;
+    }
+
+    printf("PASS\n");
+    return 0;
+}
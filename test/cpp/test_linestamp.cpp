@@ -0,0 +1,146 @@
+// Test for -ts line time stamps.
+//
+// Two channels send numbered lines cut into random fragments and
+// interleaved, one line is longer than LINESTAMP_MAX_LINE and one has no
+// end. Every line has to come out whole, once, with its channel and the
+// time of the fragment it started in. Then a big stream of short lines is
+// pushed through to see it keeps up with several MB/s.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "linestamp.h"
+
+static std::string readAll(FILE *f)
+{
+    std::string text;
+    char buf[4096];
+    size_t n;
+    rewind(f);
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        text.append(buf, n);
+    return text;
+}
+
+typedef struct
+{
+    std::string text;
+    uint64_t timeNs;
+} LINE;
+
+int main()
+{
+    FILE *f = tmpfile();
+    std::vector<LINE> expect[2];
+    {
+        OutputSink sink(fileno(f));
+        LineStamper stamper(&sink);
+
+        std::string text[2];
+        for (int ch = 0; ch < 2; ch++)
+        {
+            for (int i = 0; i < 2000; i++)
+            {
+                std::string line = "ch" + std::to_string(ch) + " line " + std::to_string(i);
+                if ((ch == 1) && (i == 1000))
+                    line += std::string(LINESTAMP_MAX_LINE + 100, 'x');
+                text[ch] += line + "\n";
+            }
+            text[ch] += "no end";
+        }
+
+        // fragment start of every byte, a line is stamped with the fragment it starts in
+        std::vector<uint64_t> stamp[2];
+        size_t pos[2] = {0, 0};
+        srand(1);
+        while ((pos[0] < text[0].size()) || (pos[1] < text[1].size()))
+        {
+            int ch = rand() % 2;
+            size_t n = std::min((size_t)(1 + rand() % 50), text[ch].size() - pos[ch]);
+            uint64_t timeNs = (pos[ch] + 1) * 1000000ull;
+            stamper.feed(ch, (const uint8_t *)text[ch].data() + pos[ch], n, timeNs);
+            stamp[ch].insert(stamp[ch].end(), n, timeNs);
+            pos[ch] += n;
+        }
+        stamper.finish();
+
+        // the long line comes out cut at LINESTAMP_MAX_LINE
+        for (int ch = 0; ch < 2; ch++)
+        {
+            size_t at = 0;
+            while (at < text[ch].size())
+            {
+                size_t nl = std::min(text[ch].find('\n', at), text[ch].size());
+                size_t len = std::min(nl - at, (size_t)LINESTAMP_MAX_LINE);
+                expect[ch].push_back({text[ch].substr(at, len), stamp[ch][at] - 1000000ull});
+                at += (len == LINESTAMP_MAX_LINE) ? len : len + 1;
+            }
+        }
+
+        if (stamper.getLines() != expect[0].size() + expect[1].size())
+        {
+            printf("FAIL: %d lines\n", (int)stamper.getLines());
+            return 1;
+        }
+    }
+
+    std::string out = readAll(f);
+    fclose(f);
+
+    // "[    s.micros ch] text"
+    size_t lines[2] = {0, 0};
+    size_t at = 0;
+    while (at < out.size())
+    {
+        size_t nl = out.find('\n', at);
+        std::string line = out.substr(at, nl - at);
+        at = nl + 1;
+
+        unsigned long long s;
+        unsigned us;
+        int ch, n;
+        if ((sscanf(line.c_str(), "[%llu.%u %d] %n", &s, &us, &ch, &n) != 3) || (ch < 0) || (ch > 1) ||
+            (lines[ch] >= expect[ch].size()))
+        {
+            printf("FAIL: prefix of \"%s\"\n", line.c_str());
+            return 1;
+        }
+
+        const LINE &want = expect[ch][lines[ch]++];
+        if ((line.substr(n) != want.text) || (s * 1000000000ull + us * 1000ull != want.timeNs))
+        {
+            printf("FAIL: channel %d line %d is \"%s\"\n", ch, (int)lines[ch] - 1, line.c_str());
+            return 1;
+        }
+    }
+
+    if ((lines[0] != expect[0].size()) || (lines[1] != expect[1].size()))
+    {
+        printf("FAIL: %d and %d lines\n", (int)lines[0], (int)lines[1]);
+        return 1;
+    }
+
+    // throughput, 64 byte lines in 4 KB fragments
+    f = tmpfile();
+    std::string chunk;
+    while (chunk.size() < 4096)
+        chunk += "0123456789 abcdefghijklmnopqrstuvwxyz 0123456789 abcdefghijkl\n";
+    const size_t total = 256 * 1024 * 1024;
+    auto start = std::chrono::steady_clock::now();
+    {
+        OutputSink sink(fileno(f), 1000);
+        LineStamper stamper(&sink);
+        for (size_t done = 0; done < total; done += chunk.size())
+            stamper.feed(0, (const uint8_t *)chunk.data(), chunk.size(), done + 1);
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fclose(f);
+
+    printf("PASS (%.0f MB/s)\n", total / secs / 1e6);
+    return 0;
+}
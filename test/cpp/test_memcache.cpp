@@ -0,0 +1,99 @@
+// Test for the host-side page cache (MemCache) StRtt reads flash through.
+//
+// Channel names live in flash: the first getRttDesc() fetches their page
+// once, every later lookup is served from host memory until recover()
+// invalidates the cache. RAM reads always go to the probe.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "mock_stlink.h"
+#include "strtt.h"
+#include "stlink_errors.h"
+
+namespace
+{
+// simulated memory starts in flash (code region) and continues into RAM
+constexpr uint32_t kFlashStart = 0x1FFFF000;
+constexpr uint32_t kRamStart = 0x20000000;
+constexpr uint32_t kRamKBytes = 1;
+constexpr uint32_t kRamOffset = kRamStart - kFlashStart;
+
+constexpr uint32_t kUpName = kFlashStart + 0x100;
+constexpr uint32_t kDownName = kFlashStart + 0x10A;
+constexpr uint32_t kRttCbOffset = 16;
+
+void writeU32(size_t offset, uint32_t value)
+{
+    memcpy(g_fakeMemory.data() + offset, &value, sizeof(value));
+}
+} // namespace
+
+int main()
+{
+    g_fakeMemoryBase = kFlashStart;
+    g_fakeMemory.assign(kRamOffset + kRamKBytes * 1024, 0);
+
+    memcpy(g_fakeMemory.data() + (kUpName - kFlashStart), "Terminal", 9);
+    memcpy(g_fakeMemory.data() + (kDownName - kFlashStart), "Down", 5);
+
+    size_t cb = kRamOffset + kRttCbOffset;
+    memcpy(g_fakeMemory.data() + cb, "SEGGER RTT", 11);
+    writeU32(cb + 16, 1);       // MaxNumUpBuffers
+    writeU32(cb + 20, 1);       // MaxNumDownBuffers
+    writeU32(cb + 24, kUpName); // up sName
+    writeU32(cb + 48, kDownName); // down sName
+
+    StRtt rtt(kRamStart, 0);
+    rtt.addChannelHandler([](const int, const std::vector<uint8_t> *) {});
+
+    if (rtt.open(false) != ERROR_OK || rtt.findRtt(kRamKBytes) != ERROR_OK)
+    {
+        printf("FAIL: open()/findRtt()\n");
+        return 1;
+    }
+
+    // both names share one page
+    int readMem = g_mockReadMemCalls;
+    rtt.getRttDesc();
+    rtt.getRttDesc();
+
+    const MEMCACHE_STATS &stats = rtt.getCacheStats();
+    if (g_mockReadMemCalls != readMem + 1 || stats.misses != 1 || stats.hits != 3)
+    {
+        printf("FAIL: expected 1 probe read, 1 miss, 3 hits, got %d, %llu, %llu\n", g_mockReadMemCalls - readMem,
+               (unsigned long long)stats.misses, (unsigned long long)stats.hits);
+        return 1;
+    }
+
+    // volatile memory is never cached
+    uint8_t cbCopy[24];
+    readMem = g_mockReadMemCalls;
+    rtt.readMem(kRamStart + kRttCbOffset, sizeof(cbCopy), cbCopy);
+    rtt.readMem(kRamStart + kRttCbOffset, sizeof(cbCopy), cbCopy);
+    if (g_mockReadMemCalls != readMem + 2 || stats.bypassed != 2 || memcmp(cbCopy, "SEGGER RTT", 11) != 0)
+    {
+        printf("FAIL: RAM reads must go to the probe\n");
+        return 1;
+    }
+
+    // target may have been reflashed meanwhile
+    memcpy(g_fakeMemory.data() + (kUpName - kFlashStart), "Console", 8);
+    if (rtt.recover() != ERROR_OK)
+    {
+        printf("FAIL: recover()\n");
+        return 1;
+    }
+
+    char name[8];
+    if (rtt.readMem(kUpName, sizeof(name), (uint8_t *)name) != ERROR_OK || strcmp(name, "Console") != 0 || stats.misses != 2)
+    {
+        printf("FAIL: stale flash content after recover()\n");
+        return 1;
+    }
+
+    printf("PASS: %llu hits, %llu misses, %llu bypassed\n", (unsigned long long)stats.hits,
+           (unsigned long long)stats.misses, (unsigned long long)stats.bypassed);
+    return 0;
+}
@@ -0,0 +1,103 @@
+// Test for the buffered terminal output (-flushms).
+//
+// Chunks of odd sizes go through a pipe to a reader thread and have to
+// arrive complete and in order. Without a deadline every chunk is one
+// write, with one the chunks are collected into few large writes, and
+// tick() has to push out what is left once the deadline passed.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "outputsink.h"
+
+static uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int run(uint32_t flushMs, const std::vector<uint8_t> &data, uint64_t *writes)
+{
+    int fds[2];
+    if (pipe(fds))
+    {
+        printf("FAIL: pipe\n");
+        return 1;
+    }
+
+    std::vector<uint8_t> got;
+    std::thread reader([&]() {
+        uint8_t buf[65536];
+        ssize_t n;
+        while ((n = read(fds[0], buf, sizeof(buf))) > 0)
+            got.insert(got.end(), buf, buf + n);
+    });
+
+    bool ticked = true;
+    {
+        OutputSink sink(fds[1], flushMs);
+        size_t at = 0;
+        uint32_t chunk = 1;
+        while (at < data.size())
+        {
+            size_t n = std::min((size_t)(chunk * 7919 % 70000 + 1), data.size() - at);
+            sink.write(data.data() + at, n);
+            at += n;
+            chunk++;
+        }
+
+        // the tail waits for the deadline
+        if (flushMs)
+        {
+            uint8_t tail[10] = {};
+            sink.write(tail, sizeof(tail));
+            sink.tick(nowNs());
+            uint64_t before = sink.getBytes();
+            sink.tick(nowNs() + (uint64_t)flushMs * 1000000);
+            ticked = sink.getBytes() > before;
+        }
+        *writes = sink.getWrites();
+    }
+    close(fds[1]);
+    reader.join();
+    close(fds[0]);
+
+    if (!ticked)
+    {
+        printf("FAIL: tick after %u ms wrote nothing\n", flushMs);
+        return 1;
+    }
+    if (flushMs)
+        got.resize(got.size() - 10);
+    if (got != data)
+    {
+        printf("FAIL: %d bytes out, %d in\n", (int)got.size(), (int)data.size());
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    std::vector<uint8_t> data(8 * 1024 * 1024);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 131 + (i >> 12));
+
+    uint64_t direct, batched;
+    if (run(0, data, &direct) || run(1000, data, &batched))
+        return 1;
+
+    // writev of the buffer and the chunk that didn't fit, pipe permitting
+    if (batched * 8 > direct)
+    {
+        printf("FAIL: %d writes batched, %d direct\n", (int)batched, (int)direct);
+        return 1;
+    }
+
+    printf("PASS (%d writes direct, %d batched)\n", (int)direct, (int)batched);
+    return 0;
+}
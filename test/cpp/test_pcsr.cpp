@@ -0,0 +1,80 @@
+// Test for DWT_PCSR sampling (-profile without -swo).
+//
+// With a PC sampler set, every readRtt() that gets past the descriptor read
+// samples DWT_PCSR once. PCSR_NO_SAMPLE (core halted/sleeping) is dropped,
+// and a parked (halted) poll samples nothing.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "mock_stlink.h"
+#include "strtt.h"
+#include "stlink_errors.h"
+
+namespace
+{
+constexpr uint32_t kRamStart = 0x20000000;
+constexpr uint32_t kRamKBytes = 1;
+constexpr uint32_t kRttCbOffset = 16;
+
+void writeU32(size_t offset, uint32_t value)
+{
+    memcpy(g_fakeMemory.data() + offset, &value, sizeof(value));
+}
+} // namespace
+
+int main()
+{
+    g_fakeMemoryBase = kRamStart;
+    g_fakeMemory.assign(kRamKBytes * 1024, 0);
+
+    memcpy(g_fakeMemory.data() + kRttCbOffset, "SEGGER RTT", 11);
+    writeU32(kRttCbOffset + 16, 1); // MaxNumUpBuffers
+    writeU32(kRttCbOffset + 20, 1); // MaxNumDownBuffers
+
+    StRtt rtt(kRamStart, 0);
+    rtt.addChannelHandler([](const int, const std::vector<uint8_t> *) {});
+
+    std::vector<uint32_t> pcs;
+    rtt.setPcSampler([&](const uint32_t pc)
+                     { pcs.push_back(pc); });
+
+    if (rtt.open(false) != ERROR_OK || rtt.findRtt(kRamKBytes) != ERROR_OK)
+    {
+        printf("FAIL: open()/findRtt()\n");
+        return 1;
+    }
+
+    g_mockPcsr = 0x08000124;
+    rtt.readRtt();
+    g_mockPcsr = 0x08000200;
+    rtt.readRtt();
+    g_mockPcsr = PCSR_NO_SAMPLE;
+    rtt.readRtt();
+
+    if (pcs.size() != 2 || pcs[0] != 0x08000124 || pcs[1] != 0x08000200)
+    {
+        printf("FAIL: expected 2 samples, got %d\n", (int)pcs.size());
+        return 1;
+    }
+
+    // park the poll loop, no PC reads while halted
+    g_mockDhcsr = DHCSR_S_HALT;
+    g_mockPcsr = 0x08000300;
+    for (int i = 0; i < HALT_SAMPLE_IDLE_CYCLES * 2; i++)
+        rtt.readRtt();
+
+    size_t beforeHalt = pcs.size();
+    for (int i = 0; i < 4; i++)
+        rtt.readRtt();
+
+    if (!rtt.isHalted() || pcs.size() != beforeHalt)
+    {
+        printf("FAIL: PC sampled while parked\n");
+        return 1;
+    }
+
+    printf("PASS\n");
+    return 0;
+}
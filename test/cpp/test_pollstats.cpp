@@ -0,0 +1,94 @@
+// Test for the -t instrumentation.
+//
+// Every value has to land in a bucket whose range holds it and is no
+// wider than 1/8 of the value. Percentiles of a skewed sample have to be
+// within a bucket of the exact ones, the maximum exact. PollStats has to
+// count transactions per cycle and bytes per channel, and start over after
+// a report.
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "pollstats.h"
+
+int main()
+{
+    // bucket bounds
+    std::mt19937_64 rng(42);
+    for (int i = 0; i < 1000000; i++)
+    {
+        uint64_t v = (i < 1000) ? (uint64_t)i : rng() >> (rng() % 64);
+        int b = Histogram::bucket(v);
+        uint64_t upper = Histogram::upperBound(b);
+        uint64_t lower = b ? Histogram::upperBound(b - 1) + 1 : 0;
+        if ((b < 0) || (b >= HISTOGRAM_BUCKETS) || (v < lower) || (v > upper) || ((upper - lower) * 8 > std::max(lower, (uint64_t)8)))
+        {
+            printf("FAIL: %llu in bucket %d [%llu, %llu]\n", (unsigned long long)v, b, (unsigned long long)lower, (unsigned long long)upper);
+            return 1;
+        }
+    }
+    if (Histogram::bucket(UINT64_MAX) != HISTOGRAM_BUCKETS - 1)
+    {
+        printf("FAIL: top bucket %d\n", Histogram::bucket(UINT64_MAX));
+        return 1;
+    }
+
+    // cycle times: mostly ~100 us, a tail up to 20 ms
+    Histogram h;
+    std::vector<uint64_t> values;
+    std::lognormal_distribution<double> dist(11.5, 0.6);
+    for (int i = 0; i < 200000; i++)
+    {
+        uint64_t v = (uint64_t)dist(rng);
+        if (i % 1000 == 0)
+            v = 20000000;
+        values.push_back(v);
+        h.add(v);
+    }
+    std::sort(values.begin(), values.end());
+    for (double p : {50.0, 90.0, 99.0, 99.9})
+    {
+        uint64_t exact = values[(size_t)(p / 100.0 * values.size()) - 1];
+        uint64_t got = h.percentile(p);
+        if ((got < exact) || (got > exact + exact / 8 + 1))
+        {
+            printf("FAIL: p%.1f %llu, exact %llu\n", p, (unsigned long long)got, (unsigned long long)exact);
+            return 1;
+        }
+    }
+    if ((h.getMax() != 20000000) || (h.percentile(100) != 20000000) || (h.getCount() != values.size()))
+    {
+        printf("FAIL: max %llu\n", (unsigned long long)h.getMax());
+        return 1;
+    }
+
+    PollStats stats;
+    for (int i = 0; i < 100; i++)
+    {
+        stats.addTransactions(1);
+        stats.addTransactions(i % 3);
+        stats.addBytes(i % 2 ? 1 : 33, 100);
+        stats.endCycle(1000 + i);
+    }
+    stats.addBytes(64, 1);
+    stats.addBytes(-1, 1);
+    const Histogram &usb = stats.getHistogram(POLLSTAT_USB);
+    if ((usb.getCount() != 100) || (usb.getMax() != 3) || (usb.percentile(50) != 2) || (stats.getChannelBytes(1) != 5000) ||
+        (stats.getChannelBytes(33) != 5000) || (stats.getHistogram(POLLSTAT_CYCLE).getMax() != 1099))
+    {
+        printf("FAIL: poll stats, %llu cycles, max %llu transactions\n", (unsigned long long)usb.getCount(), (unsigned long long)usb.getMax());
+        return 1;
+    }
+
+    stats.report();
+    if (stats.getHistogram(POLLSTAT_CYCLE).getCount() || stats.getChannelBytes(1))
+    {
+        printf("FAIL: report didn't start over\n");
+        return 1;
+    }
+
+    printf("PASS\n");
+    return 0;
+}
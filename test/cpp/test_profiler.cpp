@@ -0,0 +1,190 @@
+// Test for the SWO PC sampling profiler chain:
+// ITM stream -> ItmDecoder (DWT PC sample packets) -> Profiler -> ElfSymbols.
+//
+// A minimal ELF with three function symbols is written to a temporary file,
+// then a stream of periodic PC sample packets (with some sleep samples,
+// stimulus port data and a hardware packet of another kind mixed in) is
+// decoded and the profile is checked per function.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "elfsymbols.h"
+#include "itm.h"
+#include "profiler.h"
+#include "stlink_errors.h"
+
+namespace
+{
+template <typename T>
+void put(std::vector<uint8_t> &out, T value)
+{
+    const uint8_t *p = (const uint8_t *)&value;
+    out.insert(out.end(), p, p + sizeof(value));
+}
+
+void putSection(std::vector<uint8_t> &out, uint32_t name, uint32_t type, uint32_t offset, uint32_t size, uint32_t link, uint32_t entsize)
+{
+    put<uint32_t>(out, name);
+    put<uint32_t>(out, type);
+    put<uint32_t>(out, 0); // flags
+    put<uint32_t>(out, 0); // addr
+    put<uint32_t>(out, offset);
+    put<uint32_t>(out, size);
+    put<uint32_t>(out, link);
+    put<uint32_t>(out, 0); // info
+    put<uint32_t>(out, 4); // addralign
+    put<uint32_t>(out, entsize);
+}
+
+void putSymbol(std::vector<uint8_t> &out, uint32_t name, uint32_t value, uint32_t size, uint8_t info = 0x12 /* GLOBAL FUNC */)
+{
+    put<uint32_t>(out, name);
+    put<uint32_t>(out, value);
+    put<uint32_t>(out, size);
+    put<uint8_t>(out, info);
+    put<uint8_t>(out, 0);
+    put<uint16_t>(out, 1);
+}
+
+// .symtab, .strtab, .shstrtab; thumb addresses like a real Cortex-M build
+std::vector<uint8_t> makeElf()
+{
+    const char strtab[] = "\0main\0busy_loop\0isr\0";
+    const char shstrtab[] = "\0.symtab\0.strtab\0.shstrtab\0";
+
+    std::vector<uint8_t> symtab;
+    putSymbol(symtab, 0, 0, 0, 0);
+    putSymbol(symtab, 1, 0x08000101, 0x40);  // main
+    putSymbol(symtab, 6, 0x08000201, 0x100); // busy_loop
+    putSymbol(symtab, 16, 0x08000401, 0x20); // isr
+
+    std::vector<uint8_t> elf;
+    const uint32_t symtabOff = 52;
+    const uint32_t strtabOff = symtabOff + (uint32_t)symtab.size();
+    const uint32_t shstrtabOff = strtabOff + sizeof(strtab);
+    const uint32_t shOff = (shstrtabOff + sizeof(shstrtab) + 3) & ~3u;
+
+    const uint8_t ident[16] = {0x7f, 'E', 'L', 'F', 1, 1, 1};
+    elf.insert(elf.end(), ident, ident + 16);
+    put<uint16_t>(elf, 2);  // EXEC
+    put<uint16_t>(elf, 40); // ARM
+    put<uint32_t>(elf, 1);
+    put<uint32_t>(elf, 0x08000101);
+    put<uint32_t>(elf, 0);
+    put<uint32_t>(elf, shOff);
+    put<uint32_t>(elf, 0x05000000);
+    put<uint16_t>(elf, 52);
+    put<uint16_t>(elf, 0);
+    put<uint16_t>(elf, 0);
+    put<uint16_t>(elf, 40);
+    put<uint16_t>(elf, 4);
+    put<uint16_t>(elf, 3);
+
+    elf.insert(elf.end(), symtab.begin(), symtab.end());
+    elf.insert(elf.end(), strtab, strtab + sizeof(strtab));
+    elf.insert(elf.end(), shstrtab, shstrtab + sizeof(shstrtab));
+    elf.resize(shOff, 0);
+
+    putSection(elf, 0, 0, 0, 0, 0, 0);
+    putSection(elf, 1, 2, symtabOff, (uint32_t)symtab.size(), 2, 16);
+    putSection(elf, 9, 3, strtabOff, sizeof(strtab), 0, 0);
+    putSection(elf, 17, 3, shstrtabOff, sizeof(shstrtab), 0, 0);
+    return elf;
+}
+
+void putPcSample(std::vector<uint8_t> &stream, uint32_t pc)
+{
+    stream.push_back(0x17); // DWT id 2, 4 bytes
+    put<uint32_t>(stream, pc);
+}
+} // namespace
+
+int main()
+{
+    std::string path = "strtt_test_profiler.elf";
+    std::vector<uint8_t> elf = makeElf();
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f || fwrite(elf.data(), 1, elf.size(), f) != elf.size())
+    {
+        printf("FAIL: can't write %s\n", path.c_str());
+        return 1;
+    }
+    fclose(f);
+
+    ElfSymbols symbols;
+    if (symbols.load(path) != ERROR_OK || symbols.getSymbols().size() != 3)
+    {
+        printf("FAIL: load()\n");
+        return 1;
+    }
+    remove(path.c_str());
+
+    std::vector<uint8_t> stream;
+    for (int i = 0; i < 60; i++)
+        putPcSample(stream, 0x08000200 + (i % 0x80) * 2); // busy_loop
+    for (int i = 0; i < 30; i++)
+        putPcSample(stream, 0x08000110); // main
+    for (int i = 0; i < 5; i++)
+        putPcSample(stream, 0x08000402); // isr
+    for (int i = 0; i < 4; i++)
+    {
+        stream.push_back(0x15); // sleeping
+        stream.push_back(0x00);
+    }
+    putPcSample(stream, 0x08000800);                                 // no function
+    stream.insert(stream.end(), {0x01, 'x', 0x0F, 1, 2, 3, 4, 0x01, 'y'}); // port 0, DWT id 1 (event counter), port 0
+
+    Profiler profiler(symbols);
+    ItmDecoder decoder;
+    std::vector<uint32_t> pcs;
+    uint64_t sleeps = 0;
+    std::string port0;
+    decoder.setHandler([&](const int port, const std::vector<uint8_t> *data)
+                       {
+                           if (port == 0)
+                               port0.append(data->begin(), data->end());
+                       });
+    decoder.setHardwareHandler([&](const int id, const uint32_t value, const int size)
+                               {
+                                   if (id != ITM_DWT_PC_SAMPLE)
+                                       return;
+                                   if (size == 4)
+                                       pcs.push_back(value);
+                                   else
+                                       sleeps++;
+                               });
+
+    // odd chunk size, packets get split
+    for (size_t pos = 0; pos < stream.size(); pos += 7)
+    {
+        decoder.feed(stream.data() + pos, std::min<size_t>(7, stream.size() - pos));
+        profiler.addSamples(pcs, sleeps);
+        pcs.clear();
+        sleeps = 0;
+    }
+
+    uint64_t samples, sleeping;
+    auto top = profiler.getTop(10, &samples, &sleeping);
+
+    if (samples != 100 || sleeping != 4 || top.size() != 4 || port0 != "xy")
+    {
+        printf("FAIL: %llu samples, %llu sleeping, %d functions, port 0 '%s'\n", (unsigned long long)samples,
+               (unsigned long long)sleeping, (int)top.size(), port0.c_str());
+        return 1;
+    }
+
+    if (top[0].first != "busy_loop" || top[0].second != 60 || top[1].first != "main" || top[1].second != 30 ||
+        top[2].first != "isr" || top[2].second != 5 || top[3].first != "0x08000800")
+    {
+        printf("FAIL: wrong attribution\n");
+        profiler.report();
+        return 1;
+    }
+
+    profiler.report();
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,146 @@
+// Test for in-process probe recovery (StRtt::recover()).
+//
+// A wedged ST-LINK shows up as a failing read_mem() in readRtt(). Once the
+// stlink layer reports it wedged (isWedged()), strttapp.cpp calls recover()
+// instead of exiting, which has the stlink layer reset the transport and
+// then re-reads the RTT control block at the address findRtt() found it
+// earlier, so no full RAM scan is needed. This test drives that with a
+// mocked backend:
+//
+//  1. a transient read failure -> recover() -> data still delivered,
+//  2. a failing recovery is counted as failed, not as a recovery,
+//  3. the control block moved meanwhile (target reflashed) -> recover()
+//     falls back to scanning RAM and finds it at the new place.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "mock_stlink.h"
+#include "strtt.h"
+#include "stlink_errors.h"
+
+namespace
+{
+constexpr uint32_t kRamStart = 0x20000000;
+constexpr uint32_t kRamKBytes = 2;
+constexpr uint32_t kRttCbOffset = 16;
+constexpr uint32_t kMovedCbOffset = 1024;
+
+constexpr uint32_t kUpBufferOffset = 200;
+constexpr uint32_t kUpBufferSize = 64;
+
+void writeU32(std::vector<uint8_t> &mem, size_t offset, uint32_t value)
+{
+    memcpy(mem.data() + offset, &value, sizeof(value));
+}
+
+void placeControlBlock(uint32_t cbOffset, const char *text)
+{
+    memcpy(g_fakeMemory.data() + cbOffset, "SEGGER RTT", 11);
+    writeU32(g_fakeMemory, cbOffset + 16, 1); // MaxNumUpBuffers
+    writeU32(g_fakeMemory, cbOffset + 20, 1); // MaxNumDownBuffers
+
+    size_t up = cbOffset + 24;
+    size_t len = strlen(text);
+    memcpy(g_fakeMemory.data() + kUpBufferOffset, text, len);
+    writeU32(g_fakeMemory, up + 4, kRamStart + kUpBufferOffset);
+    writeU32(g_fakeMemory, up + 8, kUpBufferSize);
+    writeU32(g_fakeMemory, up + 12, (uint32_t)len); // WrOff
+    writeU32(g_fakeMemory, up + 16, 0);             // RdOff
+}
+} // namespace
+
+int main()
+{
+    g_fakeMemoryBase = kRamStart;
+    g_fakeMemory.assign(kRamKBytes * 1024, 0);
+    placeControlBlock(kRttCbOffset, "hello");
+
+    StRtt rtt(kRamStart, 0);
+
+    std::string received;
+    rtt.addChannelHandler([&](const int index, const std::vector<uint8_t> *buffer)
+                          {
+                              if (index == 0)
+                                  received.append(buffer->begin(), buffer->end());
+                          });
+
+    if (rtt.open(false) != ERROR_OK || rtt.findRtt(kRamKBytes) != ERROR_OK)
+    {
+        printf("FAIL: open()/findRtt()\n");
+        return 1;
+    }
+
+    // 1. wedge on the descriptor read
+    g_failReadMemAtAddr = kRamStart + kRttCbOffset;
+    g_failReadMemAtAddrRemaining = 1;
+
+    if (rtt.readRtt() == ERROR_OK)
+    {
+        printf("FAIL: readRtt() should have failed (injected error)\n");
+        return 1;
+    }
+
+    if (rtt.isWedged())
+    {
+        printf("FAIL: a single failed read shouldn't look wedged\n");
+        return 1;
+    }
+
+    g_mockWedged = true;
+    if (!rtt.isWedged())
+    {
+        printf("FAIL: isWedged() doesn't follow the stlink layer\n");
+        return 1;
+    }
+    g_mockWedged = false;
+
+    if (rtt.recover() != ERROR_OK || g_mockRecoverCalls != 1)
+    {
+        printf("FAIL: recover() after a transient error\n");
+        return 1;
+    }
+
+    if (rtt.readRtt() != ERROR_OK || received != "hello")
+    {
+        printf("FAIL: data not delivered after recovery, got '%s'\n", received.c_str());
+        return 1;
+    }
+
+    // 2. probe doesn't come back
+    g_mockRecoverFailRemaining = 1;
+    if (rtt.recover() == ERROR_OK)
+    {
+        printf("FAIL: recover() should have failed\n");
+        return 1;
+    }
+
+    // 3. control block is somewhere else now
+    memset(g_fakeMemory.data() + kRttCbOffset, 0, 48);
+    placeControlBlock(kMovedCbOffset, "moved");
+    received.clear();
+
+    if (rtt.recover() != ERROR_OK)
+    {
+        printf("FAIL: recover() didn't find the moved control block\n");
+        return 1;
+    }
+
+    if (rtt.readRtt() != ERROR_OK || received != "moved")
+    {
+        printf("FAIL: data not delivered from the moved control block, got '%s'\n", received.c_str());
+        return 1;
+    }
+
+    const RTT_RECOVERY_STATS &stats = rtt.getRecoveryStats();
+    if (stats.count != 2 || stats.failed != 1)
+    {
+        printf("FAIL: expected 2 recoveries and 1 failure, got %u and %u\n", stats.count, stats.failed);
+        return 1;
+    }
+
+    printf("PASS: %u recoveries, %u failed, %.3f ms downtime\n", stats.count, stats.failed, stats.downtimeMs);
+    return 0;
+}
@@ -0,0 +1,191 @@
+// Test for J-Scope sample channel decoding (-scope).
+//
+// Channel names are parsed into sample layouts. Samples of a t4 i2 f4 u1 b
+// channel are fed in pieces of every size, so samples are split between
+// chunks, and written once as CSV and once in the binary columnar layout.
+// Both files are read back and compared value by value, and the CSV has to
+// keep up with far more than a probe delivers.
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "scope.h"
+#include "stlink_errors.h"
+
+namespace
+{
+#pragma pack(push, 1)
+typedef struct
+{
+    uint32_t t;
+    int16_t i;
+    float f;
+    uint8_t u;
+    uint8_t b;
+} SAMPLE;
+#pragma pack(pop)
+
+std::vector<uint8_t> readFile(const std::string &name)
+{
+    std::vector<uint8_t> data;
+    FILE *f = fopen(name.c_str(), "rb");
+    if (!f)
+        return data;
+
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(f);
+    return data;
+}
+
+bool write(const std::string &path, const std::vector<SAMPLE> &samples, size_t piece, double *secs)
+{
+    ScopeDecoder scope;
+    if (scope.open(path, "JScope_t4i2f4u1b") != ERROR_OK)
+        return false;
+
+    const uint8_t *p = (const uint8_t *)samples.data();
+    size_t size = samples.size() * sizeof(SAMPLE);
+    auto start = std::chrono::steady_clock::now();
+    size_t at = 0;
+    uint32_t i = 1;
+    while (at < size)
+    {
+        size_t n = std::min(piece ? piece : (size_t)(i++ * 7919 % 5000 + 1), size - at);
+        scope.feed(p + at, n);
+        at += n;
+    }
+    *secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    scope.close();
+    return scope.getSamples() == samples.size();
+}
+} // namespace
+
+int main()
+{
+    std::vector<SCOPE_COLUMN> columns;
+    if (!ScopeDecoder::parseTypes("J-Scope_t4i4", &columns) || (columns.size() != 2) || (columns[1].offset != 4) ||
+        !ScopeDecoder::parseTypes("JScope_T4F4U2I1B", &columns) || (columns.size() != 5) || (columns[4].size != 1) ||
+        ScopeDecoder::parseTypes("JScope_i3", &columns) || ScopeDecoder::parseTypes("JScope_", &columns) ||
+        ScopeDecoder::parseTypes("JScope_f8", &columns) || !ScopeDecoder::isScopeName("jscope_t4") || ScopeDecoder::isScopeName("Terminal"))
+    {
+        printf("FAIL: channel names\n");
+        return 1;
+    }
+
+    std::vector<SAMPLE> samples(300000);
+    for (size_t n = 0; n < samples.size(); n++)
+    {
+        samples[n].t = (uint32_t)(n * 25);
+        samples[n].i = (int16_t)(n * 37);
+        samples[n].f = (float)n / 7.0f - 1000.0f;
+        samples[n].u = (uint8_t)n;
+        samples[n].b = n & 1;
+    }
+
+    double secs;
+    for (size_t piece : {(size_t)0, (size_t)1, (size_t)13})
+    {
+        std::vector<SAMPLE> part(samples.begin(), samples.begin() + (piece == 1 ? 5000 : samples.size()));
+        if (!write("test_scope.csv", part, piece, &secs))
+        {
+            printf("FAIL: csv, piece %d\n", (int)piece);
+            return 1;
+        }
+
+        std::vector<uint8_t> csv = readFile("test_scope.csv");
+        csv.push_back(0);
+        char *line = strtok((char *)csv.data(), "\n");
+        if (!line || strcmp(line, "t4_0,i2_1,f4_2,u1_3,b1_4"))
+        {
+            printf("FAIL: csv header %s\n", line ? line : "");
+            return 1;
+        }
+        size_t n = 0;
+        while ((line = strtok(nullptr, "\n")))
+        {
+            unsigned t, u, b;
+            int i;
+            float f;
+            if ((n >= part.size()) || (sscanf(line, "%u,%d,%f,%u,%u", &t, &i, &f, &u, &b) != 5) || (t != part[n].t) || (i != part[n].i) ||
+                (f != part[n].f) || (u != part[n].u) || (b != part[n].b))
+            {
+                printf("FAIL: csv line %d: %s\n", (int)n, line);
+                return 1;
+            }
+            n++;
+        }
+        if (n != part.size())
+        {
+            printf("FAIL: %d csv lines\n", (int)n);
+            return 1;
+        }
+    }
+    remove("test_scope.csv");
+
+    // the full rate of a probe is a few MB/s
+    write("test_scope.csv", samples, 4096, &secs);
+    remove("test_scope.csv");
+    double mbps = samples.size() * sizeof(SAMPLE) / secs / 1e6;
+    if (mbps < 5)
+    {
+        printf("FAIL: csv at %.1f MB/s of samples\n", mbps);
+        return 1;
+    }
+
+    if (!write("test_scope.bin", samples, 0, &secs))
+    {
+        printf("FAIL: binary\n");
+        return 1;
+    }
+    std::vector<uint8_t> bin = readFile("test_scope.bin");
+    remove("test_scope.bin");
+
+    SCOPE_FILE_HEADER header;
+    if ((bin.size() < sizeof(header)) || (memcpy(&header, bin.data(), sizeof(header)), memcmp(header.magic, SCOPE_MAGIC, 8)) ||
+        (header.columns != 5) || strcmp(header.types, "t4i2f4u1b"))
+    {
+        printf("FAIL: binary header\n");
+        return 1;
+    }
+    size_t at = sizeof(header);
+    size_t n = 0;
+    while (at + sizeof(SCOPE_BLOCK_HEADER) <= bin.size())
+    {
+        SCOPE_BLOCK_HEADER block;
+        memcpy(&block, bin.data() + at, sizeof(block));
+        at += sizeof(block);
+        const uint8_t *cols = bin.data() + at;
+        at += (size_t)block.rows * sizeof(SAMPLE);
+        if ((at > bin.size()) || (n + block.rows > samples.size()) || (block.rows > SCOPE_BLOCK_ROWS))
+            break;
+
+        for (uint32_t r = 0; r < block.rows; r++, n++)
+        {
+            SAMPLE s;
+            memcpy(&s.t, cols + r * 4, 4);
+            memcpy(&s.i, cols + block.rows * 4 + r * 2, 2);
+            memcpy(&s.f, cols + block.rows * 6 + r * 4, 4);
+            s.u = cols[block.rows * 10 + r];
+            s.b = cols[block.rows * 11 + r];
+            if (memcmp(&s, &samples[n], sizeof(s)))
+            {
+                printf("FAIL: binary sample %d\n", (int)n);
+                return 1;
+            }
+        }
+    }
+    if ((n != samples.size()) || (at != bin.size()))
+    {
+        printf("FAIL: %d binary samples\n", (int)n);
+        return 1;
+    }
+
+    printf("PASS (csv at %.0f MB/s of samples)\n", mbps);
+    return 0;
+}
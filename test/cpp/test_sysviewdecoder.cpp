@@ -0,0 +1,180 @@
+// Test for the SystemView event decoder behind -svload.
+//
+// Builds a short trace the way SEGGER_SYSVIEW.c sends it (sync, INIT,
+// SYSDESC, TASK_INFO, then task switches and an ISR, with multi-byte time
+// stamp deltas and a user event with a length field) and feeds it split at
+// every possible point. The CPU time, latencies and names per task and ISR
+// have to come out the same every time. A restarted recorder (sync zeros,
+// TRACE_START) has to be found at the same place however the stream is
+// split, that is where -svrec begins the next file. A stray 0x0A without
+// the whole sync in front is no restart.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "sysviewdecoder.h"
+
+static void u32(std::vector<uint8_t> *out, uint32_t v)
+{
+    while (v > 0x7F)
+    {
+        out->push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out->push_back((uint8_t)v);
+}
+
+static void str(std::vector<uint8_t> *out, const char *s)
+{
+    out->push_back((uint8_t)strlen(s));
+    out->insert(out->end(), s, s + strlen(s));
+}
+
+// event below 24: id, payload, delta
+static void fixed(std::vector<uint8_t> *out, uint8_t id, std::vector<uint32_t> args, uint32_t delta, const char *s = nullptr)
+{
+    out->push_back(id);
+    for (uint32_t a : args)
+        u32(out, a);
+    if (s)
+        str(out, s);
+    u32(out, delta);
+}
+
+// event from 24 on: id, length, payload, delta
+static void sized(std::vector<uint8_t> *out, uint8_t id, const std::vector<uint8_t> &payload, uint32_t delta)
+{
+    out->push_back(id);
+    u32(out, (uint32_t)payload.size());
+    out->insert(out->end(), payload.begin(), payload.end());
+    u32(out, delta);
+}
+
+static bool check(const SysViewDecoder &dec, const char *what)
+{
+    int numTasks, numIsrs;
+    const SYSVIEW_CONTEXT *tasks = dec.getTasks(&numTasks);
+    const SYSVIEW_CONTEXT *isrs = dec.getIsrs(&numIsrs);
+    const SYSVIEW_LOAD &load = dec.getLoad();
+
+    bool ok = (numTasks == 2) && (numIsrs == 1) && (dec.getSysFreq() == 1000000) &&
+              !strcmp(tasks[0].name, "Main") && (tasks[0].time == 190) && (tasks[0].count == 1) &&
+              !strcmp(tasks[1].name, "Worker") && (tasks[1].time == 300) && (tasks[1].maxLatency == 100) &&
+              !strcmp(isrs[0].name, "SysTick") && (isrs[0].time == 10) && (isrs[0].maxLatency == 10) && (isrs[0].count == 1) &&
+              (load.time == 1000) && (load.idle == 500) && (load.unknown == 0) && (load.overflows == 3);
+
+    if (!ok)
+    {
+        printf("FAIL: %s: %d tasks, %d isrs, freq %u, time %llu, idle %llu, unknown %u\n", what, numTasks, numIsrs,
+               dec.getSysFreq(), (unsigned long long)load.time, (unsigned long long)load.idle, load.unknown);
+        for (int i = 0; i < numTasks; i++)
+            printf("  task %s %llu %u %llu\n", tasks[i].name, (unsigned long long)tasks[i].time, tasks[i].count,
+                   (unsigned long long)tasks[i].maxLatency);
+        for (int i = 0; i < numIsrs; i++)
+            printf("  isr %s %llu %u %llu\n", isrs[i].name, (unsigned long long)isrs[i].time, isrs[i].count,
+                   (unsigned long long)isrs[i].maxLatency);
+    }
+    return ok;
+}
+
+int main()
+{
+    std::vector<uint8_t> s(10, 0); // sync
+
+    std::vector<uint8_t> init;
+    u32(&init, 1000000); // SysFreq
+    u32(&init, 64000000);
+    u32(&init, 0x20000000);
+    u32(&init, 2);
+    sized(&s, SYSVIEW_EVTID_INIT, init, 0);
+
+    fixed(&s, SYSVIEW_EVTID_SYSDESC, {}, 0, "N=Test,O=FreeRTOS,I#15=SysTick");
+    fixed(&s, SYSVIEW_EVTID_TASK_INFO, {1, 3}, 0, "Main");
+    fixed(&s, SYSVIEW_EVTID_TASK_INFO, {2, 1}, 0, "Worker");
+    fixed(&s, SYSVIEW_EVTID_STACK_INFO, {1, 0x20001000, 512, 0}, 0);
+    fixed(&s, SYSVIEW_EVTID_TRACE_START, {}, 0);
+
+    fixed(&s, SYSVIEW_EVTID_TASK_START_EXEC, {1}, 0);   // t=0    Main
+    fixed(&s, SYSVIEW_EVTID_TASK_START_READY, {2}, 100); // t=100  Worker ready
+    fixed(&s, SYSVIEW_EVTID_ISR_ENTER, {15}, 50);        // t=150
+    fixed(&s, SYSVIEW_EVTID_ISR_EXIT, {}, 10);           // t=160
+    fixed(&s, SYSVIEW_EVTID_TASK_STOP_EXEC, {}, 40);     // t=200
+    fixed(&s, SYSVIEW_EVTID_TASK_START_EXEC, {2}, 0);    // t=200  Worker, 100 latency
+    fixed(&s, SYSVIEW_EVTID_OVERFLOW, {3}, 0);           //
+    fixed(&s, SYSVIEW_EVTID_TASK_STOP_EXEC, {}, 300);    // t=500
+    sized(&s, 40, {1, 2, 3}, 0);                         // user event
+    fixed(&s, SYSVIEW_EVTID_IDLE, {}, 500);              // t=1000
+
+    for (size_t split = 0; split <= s.size(); split++)
+    {
+        SysViewDecoder dec;
+        dec.feed(s.data(), split);
+        dec.feed(s.data() + split, s.size() - split);
+
+        char what[32];
+        snprintf(what, sizeof(what), "split at %d", (int)split);
+        if (!check(dec, what))
+            return 1;
+    }
+
+    SysViewDecoder dec;
+    for (uint8_t b : s)
+        dec.feed(&b, 1);
+    if (!check(dec, "byte by byte"))
+        return 1;
+
+    // a new window keeps the names
+    dec.resetWindow();
+    int num;
+    if (dec.getLoad().time || strcmp(dec.getTasks(&num)[1].name, "Worker") || dec.getTasks(&num)[1].time)
+    {
+        printf("FAIL: resetWindow\n");
+        return 1;
+    }
+
+    // old stream, TRACE_STOP, then the recorder restarts
+    std::vector<uint8_t> r;
+    // TRACE_START ids with no sync and with one zero short of it
+    fixed(&r, SYSVIEW_EVTID_TRACE_START, {}, 7);
+    fixed(&r, SYSVIEW_EVTID_TASK_START_EXEC, {1}, 20);
+    r.insert(r.end(), SYSVIEW_SYNC_SIZE - 1, 0);
+    fixed(&r, SYSVIEW_EVTID_TRACE_START, {}, 7);
+    fixed(&r, SYSVIEW_EVTID_TASK_START_EXEC, {1}, 20);
+    fixed(&r, SYSVIEW_EVTID_TRACE_STOP, {}, 5);
+    r.insert(r.end(), SYSVIEW_SYNC_SIZE, 0);
+    size_t traceStart = r.size();
+    fixed(&r, SYSVIEW_EVTID_TRACE_START, {}, 300);
+    sized(&r, SYSVIEW_EVTID_INIT, {0xC0, 0x84, 0x3D, 0}, 0);
+    std::vector<uint8_t> restarted(r.begin() + traceStart, r.end());
+
+    for (size_t split = 0; split <= r.size(); split++)
+    {
+        SysViewDecoder rdec;
+        std::vector<uint8_t> from;
+
+        rdec.feed(r.data(), split);
+        if (rdec.getRestart().found)
+        {
+            from.assign(r.begin() + rdec.getRestart().offset, r.end());
+        }
+
+        rdec.feed(r.data() + split, r.size() - split);
+        const SYSVIEW_RESTART &restart = rdec.getRestart();
+        if (restart.found)
+        {
+            from.assign(restart.head, restart.head + restart.headSize);
+            from.insert(from.end(), r.begin() + split + restart.offset, r.end());
+        }
+
+        if (from != restarted)
+        {
+            printf("FAIL: restart not found at %d, split at %d\n", (int)traceStart, (int)split);
+            return 1;
+        }
+    }
+
+    printf("PASS\n");
+    return 0;
+}